@@ -24,6 +24,7 @@
 #include "lvm.c"
 #include "lzio.c"
 
+#include "larraylib.c"
 #include "lauxlib.c"
 #include "lbaselib.c"
 #include "ldblib.c"
@@ -32,7 +33,9 @@
 #include "lmathlib.c"
 #include "loadlib.c"
 #include "loslib.c"
+#include "lproflib.c"
 #include "lstrlib.c"
 #include "ltablib.c"
+#include "lworklib.c"
 
 #include "lua.c"
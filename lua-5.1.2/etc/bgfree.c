@@ -0,0 +1,94 @@
+/*
+* bgfree.c
+* Runs test/bgfree.lua with an allocator that holds the background
+* freeing thread until the script ends, so that thread falls behind;
+* checks that the collector then frees by itself (memory waiting for the
+* thread stays bounded by LUAI_BGFREEMAX) and that lua_close frees
+* everything still queued.
+*/
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "lua.h"
+#include "lauxlib.h"
+#include "lualib.h"
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t resume = PTHREAD_COND_INITIALIZER;
+static pthread_t mainthread;
+static int stalled = 1;		/* background frees must wait */
+static size_t total = 0;	/* bytes held by Lua, freed or not */
+static size_t blocks = 0;	/* blocks held by Lua */
+static size_t maxblock = 0;	/* biggest block allocated */
+static size_t behind = 0;	/* most bytes seen waiting to be freed */
+static int bgfrees = 0;		/* frees done by another thread */
+
+static void *alloc(void *ud, void *ptr, size_t osize, size_t nsize)
+{
+ void *p;
+ int bg = !pthread_equal(pthread_self(), mainthread);
+ (void)ud;
+ if (bg)
+ {
+  pthread_mutex_lock(&lock);
+  while (stalled) pthread_cond_wait(&resume, &lock);
+  pthread_mutex_unlock(&lock);
+ }
+ p = (nsize == 0) ? (free(ptr), NULL) : realloc(ptr, nsize);
+ if (nsize > 0 && p == NULL) return NULL;
+ pthread_mutex_lock(&lock);
+ total = total - osize + nsize;
+ blocks = blocks - (ptr != NULL) + (p != NULL);
+ if (nsize > maxblock) maxblock = nsize;
+ if (bg) bgfrees++;
+ pthread_mutex_unlock(&lock);
+ return p;
+}
+
+/* bytes Lua counts as freed but not yet given back to `alloc' */
+static void sample(lua_State *L, lua_Debug *ar)
+{
+ size_t counted = (size_t)lua_gc(L, LUA_GCCOUNT, 0) * 1024 +
+                  (size_t)lua_gc(L, LUA_GCCOUNTB, 0);
+ size_t held;
+ (void)ar;
+ pthread_mutex_lock(&lock);
+ held = total;
+ pthread_mutex_unlock(&lock);
+ if (held > counted && held - counted > behind) behind = held - counted;
+}
+
+int main(int argc, char *argv[])
+{
+ lua_State *L;
+ size_t limit;
+ int status;
+ mainthread = pthread_self();
+ L = lua_newstate(alloc, NULL);
+ luaL_openlibs(L);
+ lua_sethook(L, sample, LUA_MASKCOUNT, 1000);
+ lua_newtable(L);
+ lua_pushstring(L, "24");  /* rounds (stopping the thread would hang) */
+ lua_rawseti(L, -2, 1);
+ lua_setglobal(L, "arg");
+ status = luaL_dofile(L, argc > 1 ? argv[1] : "bgfree.lua");
+ if (status != 0) fprintf(stderr, "%s\n", lua_tostring(L, -1));
+ pthread_mutex_lock(&lock);
+ stalled = 0;
+ pthread_cond_signal(&resume);
+ pthread_mutex_unlock(&lock);
+ lua_close(L);
+ /* pending list plus the batch being filled (and their headers) */
+ limit = LUAI_BGFREEMAX + 2 * (LUAI_BGFREEMAX/4 + maxblock) + 64*1024;
+ printf("%d background frees; at most %lu KB behind (limit %lu KB)\n",
+        bgfrees, (unsigned long)(behind / 1024), (unsigned long)(limit / 1024));
+ if (status != 0 || total != 0 || blocks != 0 || bgfrees == 0 ||
+     behind > limit) {
+  fprintf(stderr, "bgfree: FAILED (%lu bytes in %lu blocks left)\n",
+          (unsigned long)total, (unsigned long)blocks);
+  return 1;
+ }
+ return 0;
+}
@@ -0,0 +1,78 @@
+/*
+* light.c
+* Checks the errors raised inside light C functions: they must be about
+* the function's own values, never named after locals of its caller.
+*/
+
+#include <stdio.h>
+
+#include "lua.h"
+#include "lauxlib.h"
+#include "lualib.h"
+
+static int cat(lua_State *L)
+{
+ lua_concat(L, lua_gettop(L));
+ return 1;
+}
+
+static int get(lua_State *L)
+{
+ lua_gettable(L, 1);
+ return 1;
+}
+
+static int less(lua_State *L)
+{
+ lua_pushboolean(L, lua_lessthan(L, 1, 2));
+ return 1;
+}
+
+static const luaL_Reg lm[] =
+{
+ {"cat", cat},
+ {"get", get},
+ {"less", less},
+ {NULL, NULL}
+};
+
+static const char *test =
+ /* each light function is called from Lua code with locals */
+ "local function check(expected, f)\n"
+ " local ok, msg = pcall(f)\n"
+ " assert(not ok and msg == expected, msg)\n"
+ "end\n"
+ "check('attempt to concatenate a table value', function ()\n"
+ " local zzz, aaa = 1, {} return lm.cat(aaa, 6) end)\n"
+ "check('attempt to concatenate a table value', function ()\n"
+ " local zzz, aaa = 'x', {} return lm.cat(zzz, aaa) end)\n"
+ "check('attempt to concatenate a nil value', function ()\n"
+ " local zzz, aaa = 'x', nil return lm.cat(zzz, aaa) end)\n"
+ "check('attempt to index a number value', function ()\n"
+ " local zzz, aaa = 1, 2 return lm.get(zzz, aaa) end)\n"
+ "check('attempt to compare number with table', function ()\n"
+ " local zzz, aaa = 1, {} return lm.less(zzz, aaa) end)\n"
+ "check('attempt to compare two table values', function ()\n"
+ " local zzz, aaa = {}, {} return lm.less(zzz, aaa) end)\n"
+ "assert(lm.cat('a', 1, 'b') == 'a1b' and lm.get({5}, 1) == 5)\n"
+ "assert(lm.less(1, 2) and not lm.less('b', 'a'))\n"
+ /* errors in Lua code still name the culprit */
+ "local aaa = {}\n"
+ "local ok, msg = pcall(function () return aaa .. 6 end)\n"
+ "assert(string.find(msg, \"upvalue 'aaa'\"), msg)\n";
+
+int main(void)
+{
+ lua_State *L=luaL_newstate();
+ luaL_openlibs(L);
+ luaL_registerlight(L,"lm",lm);
+ if (luaL_dostring(L,test)!=0)
+ {
+  fprintf(stderr,"light: FAILED: %s\n",lua_tostring(L,-1));
+  lua_close(L);
+  return 1;
+ }
+ printf("light: ok\n");
+ lua_close(L);
+ return 0;
+}
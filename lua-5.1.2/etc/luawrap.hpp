@@ -0,0 +1,392 @@
+// luawrap.hpp
+// Compile-time generated bindings of C++ functions and classes for Lua
+//
+// The wrapper of each function is a distinct lua_CFunction instantiated
+// from the function's signature, with the function itself as a template
+// argument: a call converts and checks all arguments into locals, calls
+// the function directly and pushes its result. Nothing is allocated per
+// call.
+//
+//   double add(double a, double b);
+//   struct Vec { Vec(); double len() const; void scale(double s); };
+//
+//   luawrap::reg(L, "add", LUAWRAP_FUNCTION(add));
+//   static const luaL_Reg vecmethods[] = {
+//     {"len", LUAWRAP_METHOD(Vec::len)},
+//     {"scale", LUAWRAP_METHOD(Vec::scale)},
+//     {NULL, NULL}
+//   };
+//   luawrap::Class<Vec>::define(L, "Vec", vecmethods);
+//   luawrap::reg(L, "newvec", luawrap::Class<Vec>::construct);
+//
+// Bound functions must have external linkage (they are template arguments)
+// and overloaded ones need a cast to pick one of them. Functions take up
+// to 6 arguments; supported types are bool, the integral and floating
+// types, const char * and pointers to defined classes (and const
+// references to any of those); results may also be std::string. A bad
+// argument raises its Lua error before the call starts, when no C++
+// object is alive yet. A C++ exception escaping a bound function or a
+// constructor becomes a Lua error. When Lua is compiled as C++ its
+// errors are exceptions themselves: define LUAWRAP_LUA_CXX then, and
+// exceptions not derived from std::exception pass through wrappers
+// untouched (to be caught by Lua as an error without a message). Bound functions and methods are registered as
+// light C functions, which are called without a CallInfo of their own.
+
+#ifndef luawrap_hpp
+#define luawrap_hpp
+
+#include <exception>
+#include <new>
+#include <string>
+#include <string.h>
+
+#include "lua.hpp"
+
+
+namespace luawrap {
+
+
+// type with references and top-level const removed
+template <typename T> struct Plain { typedef T type; };
+template <typename T> struct Plain<const T> { typedef T type; };
+template <typename T> struct Plain<T &> { typedef T type; };
+template <typename T> struct Plain<const T &> { typedef T type; };
+
+
+// runs `stmt' and turns a C++ exception into a Lua error; the message is
+// copied because the error cannot be raised (by longjmp or by a Lua
+// exception) from inside the catch block
+#if defined(LUAWRAP_LUA_CXX)
+#define LUAWRAP_CATCHALL
+#else
+#define LUAWRAP_CATCHALL \
+  catch (...) { \
+    strcpy(what, "unknown C++ exception"); \
+    failed = true; \
+  }
+#endif
+
+#define LUAWRAP_TRY(stmt) \
+  char what[256]; \
+  bool failed = false; \
+  try { stmt; } \
+  catch (const std::exception &e) { \
+    strncpy(what, e.what(), sizeof(what) - 1); \
+    what[sizeof(what) - 1] = '\0'; \
+    failed = true; \
+  } \
+  LUAWRAP_CATCHALL \
+  if (failed) return luaL_error(L, "%s", what);
+
+
+// ------------------------------------------------------------------
+// classes: userdata boxes holding either an object or a pointer to one
+// ------------------------------------------------------------------
+
+template <typename T> class Class {
+  struct Box {
+    T *p;
+    bool owned;  // object lives in the box (and dies with it)
+  };
+
+  static int gc (lua_State *L) {
+    Box *b = static_cast<Box *>(luaL_checkudata(L, 1, name));
+    if (b->owned) {
+      b->p->~T();
+      b->owned = false;
+    }
+    return 0;
+  }
+
+  static int tostring (lua_State *L) {
+    lua_pushfstring(L, "%s (%p)", name, static_cast<void *>(check(L, 1)));
+    return 1;
+  }
+
+public:
+  static const char *name;  // metatable name (NULL until defined)
+
+  // creates the metatable of T; methods become its __index table
+  static void define (lua_State *L, const char *tname,
+                      const luaL_Reg *methods) {
+    name = tname;
+    luaL_newmetatable(L, tname);
+    lua_pushvalue(L, -1);
+    lua_setfield(L, -2, "__index");
+    lua_pushcfunction(L, gc);
+    lua_setfield(L, -2, "__gc");
+    lua_pushcfunction(L, tostring);
+    lua_setfield(L, -2, "__tostring");
+    if (methods != NULL)
+      luaL_registerlight(L, NULL, methods);
+    lua_pop(L, 1);
+  }
+
+  static T *check (lua_State *L, int idx) {
+    if (name == NULL)
+      luaL_error(L, "class used before being defined");
+    Box *b = static_cast<Box *>(luaL_checkudata(L, idx, name));
+    if (b->p == NULL)
+      luaL_argerror(L, idx, "object already destroyed");
+    return b->p;
+  }
+
+  // pushes a reference to an object owned by C++
+  static void push (lua_State *L, T *p) {
+    if (p == NULL) {
+      lua_pushnil(L);
+      return;
+    }
+    Box *b = static_cast<Box *>(lua_newuserdata(L, sizeof(Box)));
+    b->p = p;
+    b->owned = false;
+    luaL_getmetatable(L, name);
+    lua_setmetatable(L, -2);
+  }
+
+  // pushes a new default-constructed object owned by Lua; the object is
+  // stored in the userdata itself
+  static int construct (lua_State *L) {
+    union Space { Box b; double d; void *p; long l; };
+    Box *b = static_cast<Box *>(lua_newuserdata(L, sizeof(Space) + sizeof(T)));
+    b->p = NULL;
+    b->owned = false;
+    luaL_getmetatable(L, name);
+    lua_setmetatable(L, -2);
+    LUAWRAP_TRY(b->p = new (reinterpret_cast<char *>(b) + sizeof(Space)) T())
+    b->owned = true;
+    return 1;
+  }
+};
+
+template <typename T> const char *Class<T>::name = NULL;
+
+
+// ------------------------------------------------------------------
+// conversions between Lua values and C++ values
+// ------------------------------------------------------------------
+
+template <typename T> struct Stack;  // only the types below convert
+
+template <> struct Stack<bool> {
+  static bool get (lua_State *L, int i) {
+    luaL_checkany(L, i);
+    return lua_toboolean(L, i) != 0;
+  }
+  static void push (lua_State *L, bool v) { lua_pushboolean(L, v); }
+};
+
+#define LUAWRAP_INTEGER(T) \
+  template <> struct Stack<T> { \
+    static T get (lua_State *L, int i) { \
+      return static_cast<T>(luaL_checkinteger(L, i)); \
+    } \
+    static void push (lua_State *L, T v) { \
+      lua_pushinteger(L, static_cast<lua_Integer>(v)); \
+    } \
+  };
+
+LUAWRAP_INTEGER(char)
+LUAWRAP_INTEGER(signed char)
+LUAWRAP_INTEGER(unsigned char)
+LUAWRAP_INTEGER(short)
+LUAWRAP_INTEGER(unsigned short)
+LUAWRAP_INTEGER(int)
+LUAWRAP_INTEGER(unsigned int)
+LUAWRAP_INTEGER(long)
+LUAWRAP_INTEGER(unsigned long)
+
+#undef LUAWRAP_INTEGER
+
+#define LUAWRAP_NUMBER(T) \
+  template <> struct Stack<T> { \
+    static T get (lua_State *L, int i) { \
+      return static_cast<T>(luaL_checknumber(L, i)); \
+    } \
+    static void push (lua_State *L, T v) { \
+      lua_pushnumber(L, static_cast<lua_Number>(v)); \
+    } \
+  };
+
+LUAWRAP_NUMBER(float)
+LUAWRAP_NUMBER(double)
+
+#undef LUAWRAP_NUMBER
+
+template <> struct Stack<const char *> {
+  static const char *get (lua_State *L, int i) {
+    return luaL_checkstring(L, i);
+  }
+  static void push (lua_State *L, const char *v) { lua_pushstring(L, v); }
+};
+
+// results only: an argument would allocate on every call
+template <> struct Stack<std::string> {
+  static void push (lua_State *L, const std::string &v) {
+    lua_pushlstring(L, v.data(), v.size());
+  }
+};
+
+template <typename T> struct Stack<T *> {
+  static T *get (lua_State *L, int i) { return Class<T>::check(L, i); }
+  static void push (lua_State *L, T *v) { Class<T>::push(L, v); }
+};
+
+template <typename T> struct Stack<const T *> {
+  static const T *get (lua_State *L, int i) { return Class<T>::check(L, i); }
+  static void push (lua_State *L, const T *v) {
+    Class<T>::push(L, const_cast<T *>(v));
+  }
+};
+
+
+// ------------------------------------------------------------------
+// calls
+// ------------------------------------------------------------------
+
+// `(f(...), r)' pushes the result of `f', unless `f' returns void (the
+// built-in comma operator is used then)
+struct Result {
+  lua_State *L;
+  int n;
+  explicit Result (lua_State *L_) : L(L_), n(0) {}
+};
+
+template <typename T> inline Result &operator , (const T &v, Result &r) {
+  Stack<typename Plain<T>::type>::push(r.L, v);
+  r.n = 1;
+  return r;
+}
+
+#define LUAWRAP_CALL(call) \
+  int n = 0; \
+  Result r(L); \
+  LUAWRAP_TRY(n = (call, r).n) \
+  return n;
+
+// converts argument i of a function into local `ai' (methods get `self'
+// as argument 1)
+#define LUAWRAP_ARG(i) \
+  typename Plain<A##i>::type a##i = \
+    Stack<typename Plain<A##i>::type>::get(L, B + i);
+
+
+// one set of callers for each number of arguments
+#define LUAWRAP_CALLERS(N, TPARAMS, TYPES, LOCALS, ARGS) \
+  template <typename R TPARAMS> struct Function##N { \
+    typedef R (*Type) (TYPES); \
+    template <Type F> static int call (lua_State *L) { \
+      const int B = 0; (void)B; \
+      LOCALS \
+      LUAWRAP_CALL(F(ARGS)) \
+    } \
+    template <Type F> lua_CFunction thunk () const { return &call<F>; } \
+  }; \
+  template <typename C, typename R TPARAMS> struct Method##N { \
+    typedef R (C::*Type) (TYPES); \
+    template <Type F> static int call (lua_State *L) { \
+      const int B = 1; (void)B; \
+      C *self = Class<C>::check(L, 1); \
+      LOCALS \
+      LUAWRAP_CALL((self->*F)(ARGS)) \
+    } \
+    template <Type F> lua_CFunction thunk () const { return &call<F>; } \
+  }; \
+  template <typename C, typename R TPARAMS> struct ConstMethod##N { \
+    typedef R (C::*Type) (TYPES) const; \
+    template <Type F> static int call (lua_State *L) { \
+      const int B = 1; (void)B; \
+      const C *self = Class<C>::check(L, 1); \
+      LOCALS \
+      LUAWRAP_CALL((self->*F)(ARGS)) \
+    } \
+    template <Type F> lua_CFunction thunk () const { return &call<F>; } \
+  }; \
+  template <typename R TPARAMS> \
+  inline Function##N<R TYPEARGS##N> signature (R (*) (TYPES)) { \
+    return Function##N<R TYPEARGS##N>(); \
+  } \
+  template <typename C, typename R TPARAMS> \
+  inline Method##N<C, R TYPEARGS##N> signature (R (C::*) (TYPES)) { \
+    return Method##N<C, R TYPEARGS##N>(); \
+  } \
+  template <typename C, typename R TPARAMS> \
+  inline ConstMethod##N<C, R TYPEARGS##N> \
+  signature (R (C::*) (TYPES) const) { \
+    return ConstMethod##N<C, R TYPEARGS##N>(); \
+  }
+
+#define LUAWRAP_COMMA	,
+
+#define TYPEARGS0
+#define TYPEARGS1	, A1
+#define TYPEARGS2	, A1, A2
+#define TYPEARGS3	, A1, A2, A3
+#define TYPEARGS4	, A1, A2, A3, A4
+#define TYPEARGS5	, A1, A2, A3, A4, A5
+#define TYPEARGS6	, A1, A2, A3, A4, A5, A6
+
+LUAWRAP_CALLERS(0, , , , )
+LUAWRAP_CALLERS(1, LUAWRAP_COMMA typename A1, A1, LUAWRAP_ARG(1), a1)
+LUAWRAP_CALLERS(2, LUAWRAP_COMMA typename A1 LUAWRAP_COMMA typename A2,
+                A1 LUAWRAP_COMMA A2,
+                LUAWRAP_ARG(1) LUAWRAP_ARG(2),
+                a1 LUAWRAP_COMMA a2)
+LUAWRAP_CALLERS(3, LUAWRAP_COMMA typename A1 LUAWRAP_COMMA typename A2
+                   LUAWRAP_COMMA typename A3,
+                A1 LUAWRAP_COMMA A2 LUAWRAP_COMMA A3,
+                LUAWRAP_ARG(1) LUAWRAP_ARG(2) LUAWRAP_ARG(3),
+                a1 LUAWRAP_COMMA a2 LUAWRAP_COMMA a3)
+LUAWRAP_CALLERS(4, LUAWRAP_COMMA typename A1 LUAWRAP_COMMA typename A2
+                   LUAWRAP_COMMA typename A3 LUAWRAP_COMMA typename A4,
+                A1 LUAWRAP_COMMA A2 LUAWRAP_COMMA A3 LUAWRAP_COMMA A4,
+                LUAWRAP_ARG(1) LUAWRAP_ARG(2) LUAWRAP_ARG(3) LUAWRAP_ARG(4),
+                a1 LUAWRAP_COMMA a2 LUAWRAP_COMMA a3 LUAWRAP_COMMA a4)
+LUAWRAP_CALLERS(5, LUAWRAP_COMMA typename A1 LUAWRAP_COMMA typename A2
+                   LUAWRAP_COMMA typename A3 LUAWRAP_COMMA typename A4
+                   LUAWRAP_COMMA typename A5,
+                A1 LUAWRAP_COMMA A2 LUAWRAP_COMMA A3 LUAWRAP_COMMA A4
+                LUAWRAP_COMMA A5,
+                LUAWRAP_ARG(1) LUAWRAP_ARG(2) LUAWRAP_ARG(3) LUAWRAP_ARG(4)
+                LUAWRAP_ARG(5),
+                a1 LUAWRAP_COMMA a2 LUAWRAP_COMMA a3 LUAWRAP_COMMA a4
+                LUAWRAP_COMMA a5)
+LUAWRAP_CALLERS(6, LUAWRAP_COMMA typename A1 LUAWRAP_COMMA typename A2
+                   LUAWRAP_COMMA typename A3 LUAWRAP_COMMA typename A4
+                   LUAWRAP_COMMA typename A5 LUAWRAP_COMMA typename A6,
+                A1 LUAWRAP_COMMA A2 LUAWRAP_COMMA A3 LUAWRAP_COMMA A4
+                LUAWRAP_COMMA A5 LUAWRAP_COMMA A6,
+                LUAWRAP_ARG(1) LUAWRAP_ARG(2) LUAWRAP_ARG(3) LUAWRAP_ARG(4)
+                LUAWRAP_ARG(5) LUAWRAP_ARG(6),
+                a1 LUAWRAP_COMMA a2 LUAWRAP_COMMA a3 LUAWRAP_COMMA a4
+                LUAWRAP_COMMA a5 LUAWRAP_COMMA a6)
+
+#undef TYPEARGS0
+#undef TYPEARGS1
+#undef TYPEARGS2
+#undef TYPEARGS3
+#undef TYPEARGS4
+#undef TYPEARGS5
+#undef TYPEARGS6
+#undef LUAWRAP_COMMA
+#undef LUAWRAP_CALLERS
+#undef LUAWRAP_ARG
+#undef LUAWRAP_CALL
+#undef LUAWRAP_TRY
+#undef LUAWRAP_CATCHALL
+
+
+// sets global `name' to a C function (a light one, see lua_pushlightfunction)
+inline void reg (lua_State *L, const char *name, lua_CFunction f) {
+  lua_pushlightfunction(L, f);
+  lua_setglobal(L, name);
+}
+
+}  // namespace luawrap
+
+
+// wrapper of a function or method (give its full name, as in `A::f')
+#define LUAWRAP_FUNCTION(f)	(luawrap::signature(&f).thunk<&f>())
+#define LUAWRAP_METHOD(m)	(luawrap::signature(&m).thunk<&m>())
+
+#endif
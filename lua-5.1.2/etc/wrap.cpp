@@ -0,0 +1,93 @@
+// wrap.cpp
+// Compares bindings generated by luawrap.hpp with hand-written ones
+
+#include <stdexcept>
+#include <stdio.h>
+#include <time.h>
+
+#include "luawrap.hpp"
+
+double add (double a, double b) {  // bound functions need external linkage
+  return a + b;
+}
+
+static int l_add (lua_State *L) {
+  lua_pushnumber(L, luaL_checknumber(L, 1) + luaL_checknumber(L, 2));
+  return 1;
+}
+
+
+struct Counter {
+  int n;
+  Counter () : n(0) {}
+  int get () const { return n; }
+  void add (int k) { n += k; }
+};
+
+static int l_counter_add (lua_State *L) {
+  Counter *c = luawrap::Class<Counter>::check(L, 1);
+  c->add(static_cast<int>(luaL_checkinteger(L, 2)));
+  return 0;
+}
+
+
+int nonnegative (int k) {  // errors must not escape into the C VM
+  if (k < 0) throw std::invalid_argument("negative argument");
+  if (k == 0) throw k;
+  return k;
+}
+
+struct Faulty {
+  Faulty () { throw std::runtime_error("cannot construct"); }
+};
+
+
+static double run (lua_State *L, const char *code) {
+  clock_t t = clock();
+  if (luaL_dostring(L, code) != 0) {
+    fprintf(stderr, "%s\n", lua_tostring(L, -1));
+    return -1;
+  }
+  return static_cast<double>(clock() - t) / CLOCKS_PER_SEC;
+}
+
+
+int main (void) {
+  lua_State *L = luaL_newstate();
+  luaL_openlibs(L);
+  luawrap::reg(L, "add", LUAWRAP_FUNCTION(add));
+  luawrap::reg(L, "l_add", l_add);
+  static const luaL_Reg methods[] = {
+    {"add", LUAWRAP_METHOD(Counter::add)},
+    {"get", LUAWRAP_METHOD(Counter::get)},
+    {"l_add", l_counter_add},
+    {NULL, NULL}
+  };
+  luawrap::Class<Counter>::define(L, "Counter", methods);
+  luawrap::reg(L, "Counter", luawrap::Class<Counter>::construct);
+  luawrap::reg(L, "nonnegative", LUAWRAP_FUNCTION(nonnegative));
+  luawrap::Class<Faulty>::define(L, "Faulty", NULL);
+  luawrap::reg(L, "Faulty", luawrap::Class<Faulty>::construct);
+  printf("function, hand-written: %.2fs\n",
+         run(L, "local f, s = l_add, 0 for i = 1, 1e7 do s = f(s, 1) end"));
+  printf("function, luawrap:      %.2fs\n",
+         run(L, "local f, s = add, 0 for i = 1, 1e7 do s = f(s, 1) end"));
+  printf("method, hand-written:   %.2fs\n",
+         run(L, "local c = Counter() for i = 1, 1e7 do c:l_add(1) end"));
+  printf("method, luawrap:        %.2fs\n",
+         run(L, "local c = Counter() for i = 1, 1e7 do c:add(1) end"
+                " assert(c:get() == 1e7)"));
+  run(L, "local ok, e = pcall(add, 1, 'x')"
+         " assert(not ok and e:find('bad argument #2')) assert(add(2, 3) == 5)"
+         " assert(not pcall(Counter().add, 1, 1))");
+  run(L, "assert(nonnegative(2) == 2)"
+         " local ok, e = pcall(nonnegative, -1)"
+         " assert(not ok and e:find('negative argument'))"
+         " ok, e = pcall(nonnegative, 0)"
+         " assert(not ok and e:find('unknown C%+%+ exception'))"
+         " ok, e = pcall(Faulty)"
+         " assert(not ok and e:find('cannot construct'))"
+         " collectgarbage()");
+  lua_close(L);
+  return 0;
+}
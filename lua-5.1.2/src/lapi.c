@@ -22,6 +22,7 @@
 #include "lgc.h"
 #include "lmem.h"
 #include "lobject.h"
+#include "lopcodes.h"
 #include "lstate.h"
 #include "lstring.h"
 #include "ltable.h"
@@ -60,13 +61,17 @@ static TValue *index2adr (lua_State *L, int idx) {
   else switch (idx) {  /* pseudo-indices */
     case LUA_REGISTRYINDEX: return registry(L);
     case LUA_ENVIRONINDEX: {
-      Closure *func = curr_func(L);
+      Closure *func;
+      luaD_checklight(L);
+      func = curr_func(L);
       sethvalue(L, &L->env, func->c.env);
       return &L->env;
     }
     case LUA_GLOBALSINDEX: return gt(L);
     default: {
-      Closure *func = curr_func(L);
+      Closure *func;
+      luaD_checklight(L);
+      func = curr_func(L);
       idx = LUA_GLOBALSINDEX - idx;
       return (idx <= func->c.nupvalues)
                 ? &func->c.upvalue[idx-1]
@@ -77,6 +82,7 @@ static TValue *index2adr (lua_State *L, int idx) {
 
 
 static Table *getcurrenv (lua_State *L) {
+  luaD_checklight(L);
   if (L->ci == L->base_ci)  /* no enclosing function? */
     return hvalue(gt(L));  /* use global table as environment */
   else {
@@ -260,6 +266,17 @@ LUA_API int lua_isnumber (lua_State *L, int idx) {
 }
 
 
+/*
+** like `lua_isnumber', but only for numbers of the integer subtype (see
+** LUA_INTNUMBER) and strings that convert to one
+*/
+LUA_API int lua_isinteger (lua_State *L, int idx) {
+  TValue n;
+  const TValue *o = index2adr(L, idx);
+  return tonumber(o, &n) && ttisint(o);
+}
+
+
 LUA_API int lua_isstring (lua_State *L, int idx) {
   int t = lua_type(L, idx);
   return (t == LUA_TSTRING || t == LUA_TNUMBER);
@@ -321,7 +338,10 @@ LUA_API lua_Integer lua_tointeger (lua_State *L, int idx) {
   const TValue *o = index2adr(L, idx);
   if (tonumber(o, &n)) {
     lua_Integer res;
-    lua_Number num = nvalue(o);
+    lua_Number num;
+    if (ttisint(o))
+      return cast(lua_Integer, ivalue(o));
+    num = fltvalue(o);
     lua_number2integer(res, num);
     return res;
   }
@@ -432,7 +452,7 @@ LUA_API void lua_pushnumber (lua_State *L, lua_Number n) {
 
 LUA_API void lua_pushinteger (lua_State *L, lua_Integer n) {
   lua_lock(L);
-  setnvalue(L->top, cast_num(n));
+  setivalue(L->top, n);
   api_incr_top(L);
   lua_unlock(L);
 }
@@ -496,6 +516,20 @@ LUA_API void lua_pushcclosure (lua_State *L, lua_CFunction fn, int n) {
 }
 
 
+/*
+** a light C function is called without a CallInfo of its own while no
+** hooks are set; it gets one only when it calls back into Lua, yields,
+** raises an error or inspects the stack, so it behaves just like any
+** other C function, only cheaper for short accessors
+*/
+LUA_API void lua_pushlightfunction (lua_State *L, lua_CFunction fn) {
+  lua_pushcclosure(L, fn, 0);
+  lua_lock(L);
+  clvalue(L->top - 1)->c.islight = 1;
+  lua_unlock(L);
+}
+
+
 LUA_API void lua_pushboolean (lua_State *L, int b) {
   lua_lock(L);
   setbvalue(L->top, (b != 0));  /* ensure that true is 1 */
@@ -883,6 +917,53 @@ LUA_API int lua_dump (lua_State *L, lua_Writer writer, void *data) {
 }
 
 
+/*
+** the header of binary chunks (format, byte order and sizes) plus what
+** it does not show: the opcode set and the size of integer numbers
+*/
+LUA_API void lua_chunkid (char *id) {
+  luaU_header(id);
+  id[LUAC_HEADERSIZE] = cast(char, NUM_OPCODES);
+  id[LUAC_HEADERSIZE+1] = cast(char, FIRST_FUSEDOP);
+  id[LUAC_HEADERSIZE+2] = cast(char, sizeof(lua_Int));
+  id[LUAC_HEADERSIZE+3] = 0;
+}
+
+
+LUA_API lua_Chunk *lua_sharechunk (lua_State *L, int idx) {
+  lua_Chunk *c = NULL;
+  StkId o;
+  lua_lock(L);
+  o = index2adr(L, idx);
+  if (isLfunction(o))
+    c = luaF_freeze(L, clvalue(o)->l.p);
+  lua_unlock(L);
+  return c;
+}
+
+
+LUA_API void lua_pushchunk (lua_State *L, lua_Chunk *c) {
+  Proto *f;
+  Closure *cl;
+  int i;
+  lua_lock(L);
+  luaC_checkGC(L);
+  f = luaF_instance(L, c);
+  cl = luaF_newLclosure(L, f->nups, hvalue(gt(L)));
+  cl->l.p = f;
+  for (i = 0; i < f->nups; i++)  /* initialize eventual upvalues */
+    cl->l.upvals[i] = luaF_newupval(L);
+  setclvalue(L, L->top, cl);
+  api_incr_top(L);
+  lua_unlock(L);
+}
+
+
+LUA_API void lua_releasechunk (lua_Chunk *c) {
+  luaF_releasechunk(c);
+}
+
+
 LUA_API int  lua_status (lua_State *L) {
   return L->status;
 }
@@ -941,6 +1022,22 @@ LUA_API int lua_gc (lua_State *L, int what, int data) {
       g->gcstepmul = data;
       break;
     }
+    case LUA_GCBACKGROUND: {
+      res = luaM_bgfree(L, data);
+      break;
+    }
+    case LUA_GCPEAK: {
+      res = cast_int(g->peakbytes >> 10);
+      break;
+    }
+    case LUA_GCPEAKB: {
+      res = cast_int(g->peakbytes & 0x3ff);
+      break;
+    }
+    case LUA_GCRESETPEAK: {
+      g->peakbytes = g->totalbytes;
+      break;
+    }
     default: res = -1;  /* invalid option */
   }
   lua_unlock(L);
@@ -948,6 +1045,25 @@ LUA_API int lua_gc (lua_State *L, int what, int data) {
 }
 
 
+/*
+** Fills `ms' with the statistics of `type' (a basic type or one of the
+** LUA_MEM* categories); returns 0 if Lua was built without them.
+*/
+LUA_API int lua_memstat (lua_State *L, int type, lua_MemStat *ms) {
+#if defined(LUA_USE_GCSTATS)
+  if (type < 0 || type >= LUA_NUMMEMSTAT)
+    return 0;
+  lua_lock(L);
+  *ms = G(L)->memstat[type];
+  lua_unlock(L);
+  return 1;
+#else
+  UNUSED(L); UNUSED(type); UNUSED(ms);
+  return 0;
+#endif
+}
+
+
 
 /*
 ** miscellaneous functions
@@ -1040,9 +1156,9 @@ static const char *aux_upvalue (StkId fi, int n, TValue **val) {
   }
   else {
     Proto *p = f->l.p;
-    if (!(1 <= n && n <= p->sizeupvalues)) return NULL;
+    if (!(1 <= n && n <= luaF_sizeupvalues(p))) return NULL;
     *val = f->l.upvals[n-1]->v;
-    return getstr(p->upvalues[n-1]);
+    return luaF_upvalname(p, n-1);
   }
 }
 
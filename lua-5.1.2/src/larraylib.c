@@ -0,0 +1,615 @@
+/*
+** $Id: larraylib.c $
+** Typed numeric arrays with bulk operations
+** See Copyright Notice in lua.h
+*/
+
+
+#include <limits.h>
+#include <string.h>
+
+#define larraylib_c
+#define LUA_LIB
+
+#include "lua.h"
+
+#include "lauxlib.h"
+#include "lualib.h"
+
+
+/*
+** An array is a full userdata holding a header and `n' contiguous
+** elements of one kind. Element access goes through __index/__newindex
+** (1-based, like tables); the bulk operations run native loops over the
+** whole array. The float kernels use SSE2 when the compiler targets it;
+** the other loops are unrolled with independent accumulators so they
+** pipeline (and vectorize) well. Reductions may therefore add elements
+** in a different order than a sequential loop would.
+*/
+
+
+#define ARRAY_HANDLE	"NumArray"
+
+
+/* elements of kind "int32" are exactly 32 bits wide */
+#if INT_MAX == 2147483647
+typedef int Int32;
+#elif LONG_MAX == 2147483647L
+typedef long Int32;
+#else
+#error "no 32-bit integer type for arrays"
+#endif
+
+
+enum ArrayKind { AK_FLOAT32, AK_FLOAT64, AK_INT32 };
+
+static const char *const kindnames[] = {"float32", "float64", "int32", NULL};
+static const size_t kindsizes[] = {sizeof(float), sizeof(double),
+                                   sizeof(Int32)};
+
+
+typedef struct NumArray {
+  union {
+    struct {
+      int kind;
+      size_t n;
+    } h;
+    LUAI_USER_ALIGNMENT_T dummy;  /* keep data aligned */
+  } u;
+} NumArray;
+
+#define arrdata(a)	((void *)((a) + 1))
+#define arrf(a)		((float *)arrdata(a))
+#define arrd(a)		((double *)arrdata(a))
+#define arri(a)		((Int32 *)arrdata(a))
+
+
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define ARRAY_SSE2
+#include <emmintrin.h>
+#endif
+
+
+
+static NumArray *checkarray (lua_State *L, int narg) {
+  return (NumArray *)luaL_checkudata(L, narg, ARRAY_HANDLE);
+}
+
+
+static NumArray *checksame (lua_State *L, NumArray *a, int narg) {
+  NumArray *b = checkarray(L, narg);
+  luaL_argcheck(L, b->u.h.kind == a->u.h.kind, narg, "array kinds differ");
+  luaL_argcheck(L, b->u.h.n == a->u.h.n, narg, "array sizes differ");
+  return b;
+}
+
+
+static NumArray *newarray (lua_State *L, int kind, size_t n) {
+  NumArray *a;
+  if (n > ((size_t)~0 - sizeof(NumArray)) / kindsizes[kind])
+    luaL_error(L, "array too large");
+  a = (NumArray *)lua_newuserdata(L, sizeof(NumArray) + n*kindsizes[kind]);
+  a->u.h.kind = kind;
+  a->u.h.n = n;
+  luaL_getmetatable(L, ARRAY_HANDLE);
+  lua_setmetatable(L, -2);
+  return a;
+}
+
+
+static lua_Number getelem (NumArray *a, size_t i) {
+  switch (a->u.h.kind) {
+    case AK_FLOAT32: return (lua_Number)arrf(a)[i];
+    case AK_FLOAT64: return (lua_Number)arrd(a)[i];
+    default: return (lua_Number)arri(a)[i];
+  }
+}
+
+
+static void setelem (NumArray *a, size_t i, lua_Number v) {
+  switch (a->u.h.kind) {
+    case AK_FLOAT32: arrf(a)[i] = (float)v; break;
+    case AK_FLOAT64: arrd(a)[i] = (double)v; break;
+    default: {
+      int k;
+      lua_number2int(k, v);
+      arri(a)[i] = (Int32)k;
+      break;
+    }
+  }
+}
+
+
+
+/*
+** {======================================================
+** Kernels
+** =======================================================
+*/
+
+
+static double sum_f (const float *x, size_t n) {
+  double s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+  size_t i = 0;
+#if defined(ARRAY_SSE2)
+  __m128d v0 = _mm_setzero_pd(), v1 = _mm_setzero_pd();
+  for (; i + 4 <= n; i += 4) {
+    __m128 f = _mm_loadu_ps(x + i);
+    v0 = _mm_add_pd(v0, _mm_cvtps_pd(f));
+    v1 = _mm_add_pd(v1, _mm_cvtps_pd(_mm_movehl_ps(f, f)));
+  }
+  v0 = _mm_add_pd(v0, v1);
+  s0 = _mm_cvtsd_f64(v0);
+  s1 = _mm_cvtsd_f64(_mm_unpackhi_pd(v0, v0));
+#endif
+  for (; i + 4 <= n; i += 4) {
+    s0 += x[i]; s1 += x[i+1]; s2 += x[i+2]; s3 += x[i+3];
+  }
+  for (; i < n; i++) s0 += x[i];
+  return (s0 + s1) + (s2 + s3);
+}
+
+
+static double sum_d (const double *x, size_t n) {
+  double s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+  size_t i = 0;
+#if defined(ARRAY_SSE2)
+  __m128d v0 = _mm_setzero_pd(), v1 = _mm_setzero_pd();
+  for (; i + 4 <= n; i += 4) {
+    v0 = _mm_add_pd(v0, _mm_loadu_pd(x + i));
+    v1 = _mm_add_pd(v1, _mm_loadu_pd(x + i + 2));
+  }
+  v0 = _mm_add_pd(v0, v1);
+  s0 = _mm_cvtsd_f64(v0);
+  s1 = _mm_cvtsd_f64(_mm_unpackhi_pd(v0, v0));
+#endif
+  for (; i + 4 <= n; i += 4) {
+    s0 += x[i]; s1 += x[i+1]; s2 += x[i+2]; s3 += x[i+3];
+  }
+  for (; i < n; i++) s0 += x[i];
+  return (s0 + s1) + (s2 + s3);
+}
+
+
+static double sum_i (const Int32 *x, size_t n) {
+  double s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    s0 += x[i]; s1 += x[i+1]; s2 += x[i+2]; s3 += x[i+3];
+  }
+  for (; i < n; i++) s0 += x[i];
+  return (s0 + s1) + (s2 + s3);
+}
+
+
+static double dot_f (const float *x, const float *y, size_t n) {
+  double s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+  size_t i = 0;
+#if defined(ARRAY_SSE2)
+  __m128d v0 = _mm_setzero_pd(), v1 = _mm_setzero_pd();
+  for (; i + 4 <= n; i += 4) {
+    __m128 a = _mm_loadu_ps(x + i);
+    __m128 b = _mm_loadu_ps(y + i);
+    v0 = _mm_add_pd(v0, _mm_mul_pd(_mm_cvtps_pd(a), _mm_cvtps_pd(b)));
+    v1 = _mm_add_pd(v1, _mm_mul_pd(_mm_cvtps_pd(_mm_movehl_ps(a, a)),
+                                   _mm_cvtps_pd(_mm_movehl_ps(b, b))));
+  }
+  v0 = _mm_add_pd(v0, v1);
+  s0 = _mm_cvtsd_f64(v0);
+  s1 = _mm_cvtsd_f64(_mm_unpackhi_pd(v0, v0));
+#endif
+  for (; i + 4 <= n; i += 4) {
+    s0 += (double)x[i]*y[i];
+    s1 += (double)x[i+1]*y[i+1];
+    s2 += (double)x[i+2]*y[i+2];
+    s3 += (double)x[i+3]*y[i+3];
+  }
+  for (; i < n; i++) s0 += (double)x[i]*y[i];
+  return (s0 + s1) + (s2 + s3);
+}
+
+
+static double dot_d (const double *x, const double *y, size_t n) {
+  double s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+  size_t i = 0;
+#if defined(ARRAY_SSE2)
+  __m128d v0 = _mm_setzero_pd(), v1 = _mm_setzero_pd();
+  for (; i + 4 <= n; i += 4) {
+    v0 = _mm_add_pd(v0, _mm_mul_pd(_mm_loadu_pd(x + i),
+                                   _mm_loadu_pd(y + i)));
+    v1 = _mm_add_pd(v1, _mm_mul_pd(_mm_loadu_pd(x + i + 2),
+                                   _mm_loadu_pd(y + i + 2)));
+  }
+  v0 = _mm_add_pd(v0, v1);
+  s0 = _mm_cvtsd_f64(v0);
+  s1 = _mm_cvtsd_f64(_mm_unpackhi_pd(v0, v0));
+#endif
+  for (; i + 4 <= n; i += 4) {
+    s0 += x[i]*y[i]; s1 += x[i+1]*y[i+1];
+    s2 += x[i+2]*y[i+2]; s3 += x[i+3]*y[i+3];
+  }
+  for (; i < n; i++) s0 += x[i]*y[i];
+  return (s0 + s1) + (s2 + s3);
+}
+
+
+static double dot_i (const Int32 *x, const Int32 *y, size_t n) {
+  double s0 = 0, s1 = 0;
+  size_t i = 0;
+  for (; i + 2 <= n; i += 2) {
+    s0 += (double)x[i]*y[i];
+    s1 += (double)x[i+1]*y[i+1];
+  }
+  for (; i < n; i++) s0 += (double)x[i]*y[i];
+  return s0 + s1;
+}
+
+
+/* y = alpha*x + y */
+static void axpy_f (float *y, float alpha, const float *x, size_t n) {
+  size_t i = 0;
+#if defined(ARRAY_SSE2)
+  __m128 va = _mm_set1_ps(alpha);
+  for (; i + 4 <= n; i += 4)
+    _mm_storeu_ps(y + i, _mm_add_ps(_mm_loadu_ps(y + i),
+                                    _mm_mul_ps(va, _mm_loadu_ps(x + i))));
+#endif
+  for (; i < n; i++) y[i] += alpha*x[i];
+}
+
+
+static void axpy_d (double *y, double alpha, const double *x, size_t n) {
+  size_t i = 0;
+#if defined(ARRAY_SSE2)
+  __m128d va = _mm_set1_pd(alpha);
+  for (; i + 2 <= n; i += 2)
+    _mm_storeu_pd(y + i, _mm_add_pd(_mm_loadu_pd(y + i),
+                                    _mm_mul_pd(va, _mm_loadu_pd(x + i))));
+#endif
+  for (; i < n; i++) y[i] += alpha*x[i];
+}
+
+
+static void axpy_i (Int32 *y, lua_Number alpha, const Int32 *x, size_t n) {
+  size_t i;
+  for (i = 0; i < n; i++) {
+    int k;
+    lua_Number v = (lua_Number)y[i] + alpha*x[i];
+    lua_number2int(k, v);
+    y[i] = (Int32)k;
+  }
+}
+
+
+static void scale_f (float *x, float s, size_t n) {
+  size_t i = 0;
+#if defined(ARRAY_SSE2)
+  __m128 vs = _mm_set1_ps(s);
+  for (; i + 4 <= n; i += 4)
+    _mm_storeu_ps(x + i, _mm_mul_ps(vs, _mm_loadu_ps(x + i)));
+#endif
+  for (; i < n; i++) x[i] *= s;
+}
+
+
+static void scale_d (double *x, double s, size_t n) {
+  size_t i = 0;
+#if defined(ARRAY_SSE2)
+  __m128d vs = _mm_set1_pd(s);
+  for (; i + 2 <= n; i += 2)
+    _mm_storeu_pd(x + i, _mm_mul_pd(vs, _mm_loadu_pd(x + i)));
+#endif
+  for (; i < n; i++) x[i] *= s;
+}
+
+
+static void scale_i (Int32 *x, lua_Number s, size_t n) {
+  size_t i;
+  for (i = 0; i < n; i++) {
+    int k;
+    lua_Number v = s*x[i];
+    lua_number2int(k, v);
+    x[i] = (Int32)k;
+  }
+}
+
+
+/* min (if `wantmax' is 0) or max of a non-empty array */
+static lua_Number extreme (NumArray *a, int wantmax) {
+  size_t n = a->u.h.n;
+  size_t i;
+  switch (a->u.h.kind) {
+    case AK_FLOAT32: {
+      const float *x = arrf(a);
+      float m = x[0];
+      if (wantmax) { for (i = 1; i < n; i++) if (x[i] > m) m = x[i]; }
+      else { for (i = 1; i < n; i++) if (x[i] < m) m = x[i]; }
+      return (lua_Number)m;
+    }
+    case AK_FLOAT64: {
+      const double *x = arrd(a);
+      double m = x[0];
+      if (wantmax) { for (i = 1; i < n; i++) if (x[i] > m) m = x[i]; }
+      else { for (i = 1; i < n; i++) if (x[i] < m) m = x[i]; }
+      return (lua_Number)m;
+    }
+    default: {
+      const Int32 *x = arri(a);
+      Int32 m = x[0];
+      if (wantmax) { for (i = 1; i < n; i++) if (x[i] > m) m = x[i]; }
+      else { for (i = 1; i < n; i++) if (x[i] < m) m = x[i]; }
+      return (lua_Number)m;
+    }
+  }
+}
+
+/* }====================================================== */
+
+
+
+static int arr_new (lua_State *L) {
+  int kind = luaL_checkoption(L, 1, NULL, kindnames);
+  lua_Integer n = luaL_checkinteger(L, 2);
+  lua_Number v = luaL_optnumber(L, 3, 0);
+  NumArray *a;
+  size_t i;
+  luaL_argcheck(L, n >= 0, 2, "negative size");
+  a = newarray(L, kind, (size_t)n);
+  if (v == 0)
+    memset(arrdata(a), 0, (size_t)n * kindsizes[kind]);
+  else
+    for (i = 0; i < (size_t)n; i++) setelem(a, i, v);
+  return 1;
+}
+
+
+static int arr_fromtable (lua_State *L) {
+  int kind = luaL_checkoption(L, 1, NULL, kindnames);
+  int n, i;
+  NumArray *a;
+  luaL_checktype(L, 2, LUA_TTABLE);
+  n = luaL_getn(L, 2);
+  a = newarray(L, kind, (size_t)n);
+  for (i = 1; i <= n; i++) {
+    lua_rawgeti(L, 2, i);
+    setelem(a, (size_t)(i - 1), lua_tonumber(L, -1));
+    lua_pop(L, 1);
+  }
+  return 1;
+}
+
+
+static int arr_totable (lua_State *L) {
+  NumArray *a = checkarray(L, 1);
+  size_t i;
+  lua_createtable(L, (int)a->u.h.n, 0);
+  for (i = 0; i < a->u.h.n; i++) {
+    lua_pushnumber(L, getelem(a, i));
+    lua_rawseti(L, -2, (int)(i + 1));
+  }
+  return 1;
+}
+
+
+static int arr_copy (lua_State *L) {
+  NumArray *a = checkarray(L, 1);
+  NumArray *b = newarray(L, a->u.h.kind, a->u.h.n);
+  memcpy(arrdata(b), arrdata(a), a->u.h.n * kindsizes[a->u.h.kind]);
+  return 1;
+}
+
+
+static int arr_kind (lua_State *L) {
+  NumArray *a = checkarray(L, 1);
+  lua_pushstring(L, kindnames[a->u.h.kind]);
+  return 1;
+}
+
+
+static int arr_fill (lua_State *L) {
+  NumArray *a = checkarray(L, 1);
+  lua_Number v = luaL_checknumber(L, 2);
+  size_t i, n = a->u.h.n;
+  switch (a->u.h.kind) {
+    case AK_FLOAT32: {
+      float *x = arrf(a);
+      float f = (float)v;
+      for (i = 0; i < n; i++) x[i] = f;
+      break;
+    }
+    case AK_FLOAT64: {
+      double *x = arrd(a);
+      for (i = 0; i < n; i++) x[i] = v;
+      break;
+    }
+    default: {
+      Int32 *x = arri(a);
+      int k;
+      lua_number2int(k, v);
+      for (i = 0; i < n; i++) x[i] = (Int32)k;
+      break;
+    }
+  }
+  lua_settop(L, 1);
+  return 1;
+}
+
+
+static int arr_scale (lua_State *L) {
+  NumArray *a = checkarray(L, 1);
+  lua_Number s = luaL_checknumber(L, 2);
+  switch (a->u.h.kind) {
+    case AK_FLOAT32: scale_f(arrf(a), (float)s, a->u.h.n); break;
+    case AK_FLOAT64: scale_d(arrd(a), (double)s, a->u.h.n); break;
+    default: scale_i(arri(a), s, a->u.h.n); break;
+  }
+  lua_settop(L, 1);
+  return 1;
+}
+
+
+/* y:axpy(alpha, x) computes y = alpha*x + y */
+static int arr_axpy (lua_State *L) {
+  NumArray *y = checkarray(L, 1);
+  lua_Number alpha = luaL_checknumber(L, 2);
+  NumArray *x = checksame(L, y, 3);
+  switch (y->u.h.kind) {
+    case AK_FLOAT32: axpy_f(arrf(y), (float)alpha, arrf(x), y->u.h.n); break;
+    case AK_FLOAT64: axpy_d(arrd(y), (double)alpha, arrd(x), y->u.h.n); break;
+    default: axpy_i(arri(y), alpha, arri(x), y->u.h.n); break;
+  }
+  lua_settop(L, 1);
+  return 1;
+}
+
+
+static int arr_dot (lua_State *L) {
+  NumArray *a = checkarray(L, 1);
+  NumArray *b = checksame(L, a, 2);
+  double r;
+  switch (a->u.h.kind) {
+    case AK_FLOAT32: r = dot_f(arrf(a), arrf(b), a->u.h.n); break;
+    case AK_FLOAT64: r = dot_d(arrd(a), arrd(b), a->u.h.n); break;
+    default: r = dot_i(arri(a), arri(b), a->u.h.n); break;
+  }
+  lua_pushnumber(L, (lua_Number)r);
+  return 1;
+}
+
+
+static int arr_sum (lua_State *L) {
+  NumArray *a = checkarray(L, 1);
+  double r;
+  switch (a->u.h.kind) {
+    case AK_FLOAT32: r = sum_f(arrf(a), a->u.h.n); break;
+    case AK_FLOAT64: r = sum_d(arrd(a), a->u.h.n); break;
+    default: r = sum_i(arri(a), a->u.h.n); break;
+  }
+  lua_pushnumber(L, (lua_Number)r);
+  return 1;
+}
+
+
+static int arr_min (lua_State *L) {
+  NumArray *a = checkarray(L, 1);
+  if (a->u.h.n == 0) return 0;
+  lua_pushnumber(L, extreme(a, 0));
+  return 1;
+}
+
+
+static int arr_max (lua_State *L) {
+  NumArray *a = checkarray(L, 1);
+  if (a->u.h.n == 0) return 0;
+  lua_pushnumber(L, extreme(a, 1));
+  return 1;
+}
+
+
+/* integral index at `narg' (not checked against the array bounds) */
+static lua_Integer checkindex (lua_State *L, int narg) {
+  lua_Number k = luaL_checknumber(L, narg);
+  lua_Integer i;
+  lua_number2integer(i, k);
+  luaL_argcheck(L, (lua_Number)i == k, narg, "integer index expected");
+  return i;
+}
+
+
+static int arr_index (lua_State *L) {
+  NumArray *a = checkarray(L, 1);
+  if (lua_type(L, 2) == LUA_TNUMBER) {
+    lua_Integer i = checkindex(L, 2);
+    if (i >= 1 && (size_t)i <= a->u.h.n)
+      lua_pushnumber(L, getelem(a, (size_t)(i - 1)));
+    else
+      lua_pushnil(L);
+  }
+  else {  /* method */
+    lua_pushvalue(L, 2);
+    lua_rawget(L, lua_upvalueindex(1));
+  }
+  return 1;
+}
+
+
+static int arr_newindex (lua_State *L) {
+  NumArray *a = checkarray(L, 1);
+  lua_Integer i = checkindex(L, 2);
+  lua_Number v = luaL_checknumber(L, 3);
+  luaL_argcheck(L, i >= 1 && (size_t)i <= a->u.h.n, 2, "index out of range");
+  setelem(a, (size_t)(i - 1), v);
+  return 0;
+}
+
+
+static int arr_len (lua_State *L) {
+  NumArray *a = checkarray(L, 1);
+  lua_pushinteger(L, (lua_Integer)a->u.h.n);
+  return 1;
+}
+
+
+static int arr_tostring (lua_State *L) {
+  NumArray *a = checkarray(L, 1);
+  lua_pushfstring(L, "array<%s>(%d): %p", kindnames[a->u.h.kind],
+                  (int)a->u.h.n, (void *)a);
+  return 1;
+}
+
+
+static const luaL_Reg arraylib[] = {
+  {"axpy", arr_axpy},
+  {"copy", arr_copy},
+  {"dot", arr_dot},
+  {"fill", arr_fill},
+  {"fromtable", arr_fromtable},
+  {"kind", arr_kind},
+  {"max", arr_max},
+  {"min", arr_min},
+  {"new", arr_new},
+  {"scale", arr_scale},
+  {"sum", arr_sum},
+  {"totable", arr_totable},
+  {NULL, NULL}
+};
+
+
+static const luaL_Reg methods[] = {
+  {"axpy", arr_axpy},
+  {"copy", arr_copy},
+  {"dot", arr_dot},
+  {"fill", arr_fill},
+  {"kind", arr_kind},
+  {"max", arr_max},
+  {"min", arr_min},
+  {"scale", arr_scale},
+  {"sum", arr_sum},
+  {"totable", arr_totable},
+  {NULL, NULL}
+};
+
+
+static void arr_createmeta (lua_State *L) {
+  luaL_newmetatable(L, ARRAY_HANDLE);  /* create metatable for arrays */
+  lua_newtable(L);  /* method table... */
+  luaL_register(L, NULL, methods);
+  lua_pushcclosure(L, arr_index, 1);  /* ...is an upvalue of __index */
+  lua_setfield(L, -2, "__index");
+  lua_pushcfunction(L, arr_newindex);
+  lua_setfield(L, -2, "__newindex");
+  lua_pushcfunction(L, arr_len);
+  lua_setfield(L, -2, "__len");
+  lua_pushcfunction(L, arr_tostring);
+  lua_setfield(L, -2, "__tostring");
+  lua_pop(L, 1);
+}
+
+
+LUALIB_API int luaopen_array (lua_State *L) {
+  arr_createmeta(L);
+  luaL_register(L, LUA_ARRAYLIBNAME, arraylib);
+  return 1;
+}
+
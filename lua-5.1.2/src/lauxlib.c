@@ -232,6 +232,16 @@ LUALIB_API void (luaL_register) (lua_State *L, const char *libname,
 }
 
 
+LUALIB_API void (luaL_registerlight) (lua_State *L, const char *libname,
+                                const luaL_Reg *l) {
+  luaI_openlib(L, libname, l, 0);
+  for (; l->name; l++) {  /* replace them by light functions */
+    lua_pushlightfunction(L, l->func);
+    lua_setfield(L, -2, l->name);
+  }
+}
+
+
 static int libsize (const luaL_Reg *l) {
   int size = 0;
   for (; l->name; l++) size++;
@@ -549,6 +559,207 @@ static int errfile (lua_State *L, const char *what, int fnameindex) {
 }
 
 
+typedef struct LoadS {
+  const char *s;
+  size_t size;
+} LoadS;
+
+
+static const char *getS (lua_State *L, void *ud, size_t *size) {
+  LoadS *ls = (LoadS *)ud;
+  (void)L;
+  if (ls->size == 0) return NULL;
+  *size = ls->size;
+  ls->size = 0;
+  return ls->s;
+}
+
+
+/*
+** {======================================================
+** Bytecode cache
+** =======================================================
+*/
+
+/*
+** When the registry field CACHEKEY names a directory, source chunks
+** read by `luaL_loadfile' (and those given to `luaL_loadbuffer' under a
+** file name, "@...") are kept there precompiled, as written by
+** `lua_dump'. Entries are named after a hash of the chunk format (see
+** `lua_chunkid'), the chunk name and the source text, so a changed file
+** or a VM that reads other bytecode simply misses. New
+** entries are written to a temporary file and renamed into place, so
+** concurrent readers see either a whole entry or none. Precompiled code
+** is not checked when loaded: the directory must be trusted.
+*/
+
+#define CACHEKEY	"_LOADCACHE"
+
+
+LUALIB_API void luaL_setloadcache (lua_State *L, const char *dir) {
+  if (dir == NULL || *dir == '\0')
+    lua_pushnil(L);  /* turn caching off */
+  else
+    lua_pushstring(L, dir);
+  lua_setfield(L, LUA_REGISTRYINDEX, CACHEKEY);
+}
+
+
+/* two independent 32-bit hashes make a 64-bit key */
+static void hashbytes (unsigned long h[2], const char *s, size_t l) {
+  size_t i;
+  for (i = 0; i < l; i++) {
+    unsigned long c = (unsigned char)s[i];
+    h[0] = ((h[0] ^ c) * 16777619UL) & 0xffffffffUL;  /* FNV-1a */
+    h[1] = ((h[1] ^ c) * 0x5bd1e995UL) & 0xffffffffUL;
+    h[1] ^= h[1] >> 15;
+  }
+}
+
+
+/*
+** Pushes the name of the cache entry for a chunk; returns 0 (pushing
+** nothing) if caching is off.
+*/
+static int cachename (lua_State *L, const char *buff, size_t size,
+                      const char *name) {
+  unsigned long h[2];
+  char id[LUA_CHUNKIDSIZE];
+  char key[2*8 + 1];
+  lua_getfield(L, LUA_REGISTRYINDEX, CACHEKEY);
+  if (!lua_isstring(L, -1)) {
+    lua_pop(L, 1);
+    return 0;
+  }
+  h[0] = 2166136261UL;
+  h[1] = (unsigned long)size & 0xffffffffUL;
+  lua_chunkid(id);
+  hashbytes(h, id, sizeof(id));
+  hashbytes(h, LUAL_BUILDID, sizeof(LUAL_BUILDID));  /* with its '\0' */
+  hashbytes(h, name, strlen(name) + 1);
+  hashbytes(h, buff, size);
+  sprintf(key, "%08lx%08lx", h[0], h[1]);
+  lua_pushfstring(L, "%s" LUA_DIRSEP "%s.luac", lua_tostring(L, -1), key);
+  lua_remove(L, -2);  /* remove directory */
+  return 1;
+}
+
+
+static int aux_writer (lua_State *L, const void *p, size_t size, void *u) {
+  (void)L;
+  return (fwrite(p, size, 1, (FILE *)u) != 1) && (size != 0);
+}
+
+
+/* dumps the function on the top into cache entry `path'; errors are ignored */
+static void storecache (lua_State *L, const char *path) {
+  size_t l = strlen(path);
+  char *tmp = (char *)lua_newuserdata(L, l + sizeof(".XXXXXX"));
+  FILE *f;
+  memcpy(tmp, path, l);
+  memcpy(tmp + l, ".XXXXXX", sizeof(".XXXXXX"));
+  lua_opentemp(tmp, f);
+  if (f != NULL) {
+    int status;
+    lua_pushvalue(L, -2);  /* function to be dumped */
+    status = lua_dump(L, aux_writer, f);
+    lua_pop(L, 1);
+    if (ferror(f)) status = 1;
+    if (fclose(f) != 0) status = 1;
+    if (status != 0 || rename(tmp, path) != 0)
+      remove(tmp);  /* never leave a partial entry behind */
+  }
+  lua_pop(L, 1);  /* remove name buffer */
+}
+
+
+/*
+** Loads a source chunk through the cache entry on the top of the stack
+** (which is removed).
+*/
+static int loadcached (lua_State *L, const char *buff, size_t size,
+                       const char *name) {
+  int path = lua_gettop(L);
+  LoadS ls;
+  int status;
+  FILE *f = fopen(lua_tostring(L, path), "rb");
+  if (f != NULL) {
+    int c = getc(f);
+    if (c == LUA_SIGNATURE[0]) {
+      LoadF lf;
+      lf.extraline = 0;
+      lf.f = f;
+      ungetc(c, f);
+      if (lua_load(L, getF, &lf, name) == 0 && !ferror(f)) {
+        fclose(f);
+        lua_remove(L, path);
+        return 0;  /* hit */
+      }
+    }
+    fclose(f);
+    lua_settop(L, path);  /* damaged or foreign entry: compile again */
+  }
+  ls.s = buff;
+  ls.size = size;
+  status = lua_load(L, getS, &ls, name);
+  if (status == 0)
+    storecache(L, lua_tostring(L, path));
+  lua_remove(L, path);
+  return status;
+}
+
+
+/*
+** Reads a whole file into memory and loads it through the cache; the
+** file name is at `fnameindex'.
+*/
+static int loadfilecached (lua_State *L, const char *filename,
+                           int fnameindex) {
+  luaL_Buffer b;
+  const char *s;
+  size_t l, n;
+  int readstatus, status;
+  FILE *f = fopen(filename, "rb");
+  if (f == NULL) return errfile(L, "open", fnameindex);
+  luaL_buffinit(L, &b);
+  do {
+    n = fread(luaL_prepbuffer(&b), 1, LUAL_BUFFERSIZE, f);
+    luaL_addsize(&b, n);
+  } while (n == LUAL_BUFFERSIZE);
+  readstatus = ferror(f);
+  fclose(f);
+  luaL_pushresult(&b);
+  if (readstatus) {
+    lua_settop(L, fnameindex);
+    return errfile(L, "read", fnameindex);
+  }
+  s = lua_tolstring(L, -1, &l);
+  if (l > 0 && *s == '#') {  /* Unix exec. file? */
+    const char *nl = (const char *)memchr(s, '\n', l);
+    /* skip first line, but keep its newline to preserve line numbers */
+    l = (nl == NULL) ? 0 : l - (nl - s);
+    s = nl;
+    if (l > 1 && s[1] == LUA_SIGNATURE[0]) {  /* binary file? */
+      s++; l--;
+    }
+  }
+  if ((l == 0 || *s != LUA_SIGNATURE[0]) &&
+      cachename(L, s, l, lua_tostring(L, fnameindex)))
+    status = loadcached(L, s, l, lua_tostring(L, fnameindex));
+  else {  /* binary file */
+    LoadS ls;
+    ls.s = s;
+    ls.size = l;
+    status = lua_load(L, getS, &ls, lua_tostring(L, fnameindex));
+  }
+  lua_remove(L, -2);  /* remove file contents */
+  lua_remove(L, fnameindex);
+  return status;
+}
+
+/* }====================================================== */
+
+
 LUALIB_API int luaL_loadfile (lua_State *L, const char *filename) {
   LoadF lf;
   int status, readstatus;
@@ -561,6 +772,12 @@ LUALIB_API int luaL_loadfile (lua_State *L, const char *filename) {
   }
   else {
     lua_pushfstring(L, "@%s", filename);
+    lua_getfield(L, LUA_REGISTRYINDEX, CACHEKEY);
+    if (lua_isstring(L, -1)) {  /* cache on? */
+      lua_pop(L, 1);
+      return loadfilecached(L, filename, fnameindex);
+    }
+    lua_pop(L, 1);
     lf.f = fopen(filename, "r");
     if (lf.f == NULL) return errfile(L, "open", fnameindex);
   }
@@ -591,25 +808,12 @@ LUALIB_API int luaL_loadfile (lua_State *L, const char *filename) {
 }
 
 
-typedef struct LoadS {
-  const char *s;
-  size_t size;
-} LoadS;
-
-
-static const char *getS (lua_State *L, void *ud, size_t *size) {
-  LoadS *ls = (LoadS *)ud;
-  (void)L;
-  if (ls->size == 0) return NULL;
-  *size = ls->size;
-  ls->size = 0;
-  return ls->s;
-}
-
-
 LUALIB_API int luaL_loadbuffer (lua_State *L, const char *buff, size_t size,
                                 const char *name) {
   LoadS ls;
+  if (name != NULL && *name == '@' && size > 0 && *buff != LUA_SIGNATURE[0] &&
+      cachename(L, buff, size, name))
+    return loadcached(L, buff, size, name);
   ls.s = buff;
   ls.size = size;
   return lua_load(L, getS, &ls, name);
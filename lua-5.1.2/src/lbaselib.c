@@ -54,7 +54,11 @@ static int luaB_tonumber (lua_State *L) {
   int base = luaL_optint(L, 2, 10);
   if (base == 10) {  /* standard conversion */
     luaL_checkany(L, 1);
-    if (lua_isnumber(L, 1)) {
+    if (lua_isinteger(L, 1)) {  /* keep its subtype (and all its digits) */
+      lua_pushinteger(L, lua_tointeger(L, 1));
+      return 1;
+    }
+    else if (lua_isnumber(L, 1)) {
       lua_pushnumber(L, lua_tonumber(L, 1));
       return 1;
     }
@@ -190,21 +194,62 @@ static int luaB_gcinfo (lua_State *L) {
 }
 
 
+/*
+** collectgarbage("stats"): {type = {bytes=, objects=, allocs=}, ...},
+** or nil if Lua was built without LUA_USE_GCSTATS
+*/
+static int auxmemstats (lua_State *L) {
+  static const char *const names[LUA_NUMMEMSTAT] = {"other", NULL, NULL,
+    NULL, "string", "table", "function", "userdata", "thread", "proto",
+    "upvalue"};
+  lua_MemStat ms;
+  int i;
+  if (!lua_memstat(L, LUA_MEMOTHER, &ms)) {
+    lua_pushnil(L);
+    return 1;
+  }
+  lua_createtable(L, 0, LUA_NUMMEMSTAT);
+  for (i = 0; i < LUA_NUMMEMSTAT; i++) {
+    if (names[i] == NULL) continue;  /* types without own memory */
+    lua_memstat(L, i, &ms);
+    lua_createtable(L, 0, 3);
+    lua_pushnumber(L, (lua_Number)ms.bytes);
+    lua_setfield(L, -2, "bytes");
+    lua_pushnumber(L, (lua_Number)ms.objects);
+    lua_setfield(L, -2, "objects");
+    lua_pushnumber(L, (lua_Number)ms.allocs);
+    lua_setfield(L, -2, "allocs");
+    lua_setfield(L, -2, names[i]);
+  }
+  return 1;
+}
+
+
 static int luaB_collectgarbage (lua_State *L) {
   static const char *const opts[] = {"stop", "restart", "collect",
-    "count", "step", "setpause", "setstepmul", NULL};
+    "count", "step", "setpause", "setstepmul", "background", "peak",
+    "resetpeak", "stats", NULL};
   static const int optsnum[] = {LUA_GCSTOP, LUA_GCRESTART, LUA_GCCOLLECT,
-    LUA_GCCOUNT, LUA_GCSTEP, LUA_GCSETPAUSE, LUA_GCSETSTEPMUL};
+    LUA_GCCOUNT, LUA_GCSTEP, LUA_GCSETPAUSE, LUA_GCSETSTEPMUL,
+    LUA_GCBACKGROUND, LUA_GCPEAK, LUA_GCRESETPEAK, -1};
   int o = luaL_checkoption(L, 1, "collect", opts);
   int ex = luaL_optint(L, 2, 0);
-  int res = lua_gc(L, optsnum[o], ex);
+  int res;
+  if (optsnum[o] == -1)  /* "stats"? */
+    return auxmemstats(L);
+  res = lua_gc(L, optsnum[o], ex);
   switch (optsnum[o]) {
     case LUA_GCCOUNT: {
       int b = lua_gc(L, LUA_GCCOUNTB, 0);
       lua_pushnumber(L, res + ((lua_Number)b/1024));
       return 1;
     }
-    case LUA_GCSTEP: {
+    case LUA_GCPEAK: {
+      int b = lua_gc(L, LUA_GCPEAKB, 0);
+      lua_pushnumber(L, res + ((lua_Number)b/1024));
+      return 1;
+    }
+    case LUA_GCSTEP: case LUA_GCBACKGROUND: {
       lua_pushboolean(L, res);
       return 1;
     }
@@ -453,20 +498,26 @@ static const luaL_Reg base_funcs[] = {
   {"loadfile", luaB_loadfile},
   {"load", luaB_load},
   {"loadstring", luaB_loadstring},
-  {"next", luaB_next},
   {"pcall", luaB_pcall},
   {"print", luaB_print},
+  {"setfenv", luaB_setfenv},
+  {"setmetatable", luaB_setmetatable},
+  {"tostring", luaB_tostring},
+  {"unpack", luaB_unpack},
+  {"xpcall", luaB_xpcall},
+  {NULL, NULL}
+};
+
+
+/* short functions, called as light C functions */
+static const luaL_Reg base_light[] = {
+  {"next", luaB_next},
   {"rawequal", luaB_rawequal},
   {"rawget", luaB_rawget},
   {"rawset", luaB_rawset},
   {"select", luaB_select},
-  {"setfenv", luaB_setfenv},
-  {"setmetatable", luaB_setmetatable},
   {"tonumber", luaB_tonumber},
-  {"tostring", luaB_tostring},
   {"type", luaB_type},
-  {"unpack", luaB_unpack},
-  {"xpcall", luaB_xpcall},
   {NULL, NULL}
 };
 
@@ -607,7 +658,7 @@ static const luaL_Reg co_funcs[] = {
 
 static void auxopen (lua_State *L, const char *name,
                      lua_CFunction f, lua_CFunction u) {
-  lua_pushcfunction(L, u);
+  lua_pushlightfunction(L, u);
   lua_pushcclosure(L, f, 1);
   lua_setfield(L, -2, name);
 }
@@ -619,6 +670,7 @@ static void base_open (lua_State *L) {
   lua_setglobal(L, "_G");
   /* open lib into global table */
   luaL_register(L, "_G", base_funcs);
+  luaL_registerlight(L, NULL, base_light);
   lua_pushliteral(L, LUA_VERSION);
   lua_setglobal(L, "_VERSION");  /* set global _VERSION */
   /* `ipairs' and `pairs' need auxliliary functions as upvalues */
@@ -22,13 +22,15 @@
 #include "lopcodes.h"
 #include "lparser.h"
 #include "ltable.h"
+#include "lvm.h"
 
 
 #define hasjumps(e)	((e)->t != (e)->f)
 
 
 static int isnumeral(expdesc *e) {
-  return (e->k == VKNUM && e->t == NO_JUMP && e->f == NO_JUMP);
+  return ((e->k == VKNUM || e->k == VKINT) &&
+          e->t == NO_JUMP && e->f == NO_JUMP);
 }
 
 
@@ -231,14 +233,16 @@ static int addk (FuncState *fs, TValue *k, TValue *v) {
   TValue *idx = luaH_set(L, fs->h, k);
   Proto *f = fs->f;
   int oldsize = f->sizek;
-  if (ttisnumber(idx)) {
+  if (ttisnumber(idx) &&  /* an integer and a float with its value are */
+      rttype(&f->k[cast_int(nvalue(idx))]) == rttype(v)) {  /* one key */
     lua_assert(luaO_rawequalObj(&fs->f->k[cast_int(nvalue(idx))], v));
     return cast_int(nvalue(idx));
   }
   else {  /* constant not found; create a new entry */
-    setnvalue(idx, cast_num(fs->nk));
-    luaM_growvector(L, f->k, fs->nk, f->sizek, TValue,
-                    MAXARG_Bx, "constant table overflow");
+    setivalue(idx, fs->nk);
+    luaM_tagged(L, LUA_MEMPROTO,
+                luaM_growvector(L, f->k, fs->nk, f->sizek, TValue,
+                                MAXARG_Bx, "constant table overflow"));
     while (oldsize < f->sizek) setnilvalue(&f->k[oldsize++]);
     setobj(L, &f->k[fs->nk], v);
     luaC_barrier(L, f, v);
@@ -261,6 +265,13 @@ int luaK_numberK (FuncState *fs, lua_Number r) {
 }
 
 
+int luaK_intK (FuncState *fs, lua_Int i) {
+  TValue o;
+  setivalue(&o, i);
+  return addk(fs, &o, &o);
+}
+
+
 static int boolK (FuncState *fs, int b) {
   TValue o;
   setbvalue(&o, b);
@@ -359,6 +370,10 @@ static void discharge2reg (FuncState *fs, expdesc *e, int reg) {
       luaK_codeABx(fs, OP_LOADK, reg, luaK_numberK(fs, e->u.nval));
       break;
     }
+    case VKINT: {
+      luaK_codeABx(fs, OP_LOADK, reg, luaK_intK(fs, e->u.ival));
+      break;
+    }
     case VRELOCABLE: {
       Instruction *pc = &getcode(fs, e);
       SETARG_A(*pc, reg);
@@ -445,12 +460,14 @@ int luaK_exp2RK (FuncState *fs, expdesc *e) {
   luaK_exp2val(fs, e);
   switch (e->k) {
     case VKNUM:
+    case VKINT:
     case VTRUE:
     case VFALSE:
     case VNIL: {
       if (fs->nk <= MAXINDEXRK) {  /* constant fit in RK operand? */
         e->u.s.info = (e->k == VNIL)  ? nilK(fs) :
                       (e->k == VKNUM) ? luaK_numberK(fs, e->u.nval) :
+                      (e->k == VKINT) ? luaK_intK(fs, e->u.ival) :
                                         boolK(fs, (e->k == VTRUE));
         e->k = VK;
         return RKASK(e->u.s.info);
@@ -469,11 +486,55 @@ int luaK_exp2RK (FuncState *fs, expdesc *e) {
 }
 
 
+#if defined(LUA_FUSEOPS)
+
+/*
+** Register coalescing: when the value for local `reg' sits in a
+** temporary just written by the last instruction, and nothing jumps to
+** the MOVE that would follow, that instruction writes `reg' instead.
+*/
+static int coalesce (FuncState *fs, expdesc *e, int reg) {
+  Instruction *previous;
+  if (e->k != VNONRELOC || hasjumps(e) || e->u.s.info < fs->nactvar ||
+      fs->pc == 0 || fs->pc <= fs->lasttarget || fs->jpc != NO_JUMP)
+    return 0;
+  if (fs->pc >= 2) {
+    Instruction p = fs->f->code[fs->pc-2];
+    if (GET_OPCODE(p) == OP_SETLIST && GETARG_C(p) == 0)
+      return 0;  /* last `instruction' is a count */
+  }
+  previous = &fs->f->code[fs->pc-1];
+  if (GETARG_A(*previous) != e->u.s.info)
+    return 0;
+  switch (GET_OPCODE(*previous)) {  /* instructions that only write R(A) */
+    case OP_LOADBOOL:
+      if (GETARG_C(*previous) != 0) return 0;  /* skips next */
+      break;
+    case OP_VARARG:
+      if (GETARG_B(*previous) != 2) return 0;  /* not a single value */
+      break;
+    case OP_MOVE: case OP_LOADK: case OP_GETUPVAL: case OP_GETGLOBAL:
+    case OP_GETTABLE: case OP_NEWTABLE: case OP_ADD: case OP_SUB:
+    case OP_MUL: case OP_DIV: case OP_MOD: case OP_POW: case OP_UNM:
+    case OP_NOT: case OP_LEN: case OP_CONCAT:
+      break;
+    default: return 0;
+  }
+  SETARG_A(*previous, reg);
+  return 1;
+}
+
+#else
+#define coalesce(fs,e,reg)	0
+#endif
+
+
 void luaK_storevar (FuncState *fs, expdesc *var, expdesc *ex) {
   switch (var->k) {
     case VLOCAL: {
       freeexp(fs, ex);
-      exp2reg(fs, ex, var->u.s.info);
+      if (!coalesce(fs, ex, var->u.s.info))
+        exp2reg(fs, ex, var->u.s.info);
       return;
     }
     case VUPVAL: {
@@ -540,7 +601,7 @@ void luaK_goiftrue (FuncState *fs, expdesc *e) {
   int pc;  /* pc of last jump */
   luaK_dischargevars(fs, e);
   switch (e->k) {
-    case VK: case VKNUM: case VTRUE: {
+    case VK: case VKNUM: case VKINT: case VTRUE: {
       pc = NO_JUMP;  /* always true; do nothing */
       break;
     }
@@ -598,7 +659,7 @@ static void codenot (FuncState *fs, expdesc *e) {
       e->k = VTRUE;
       break;
     }
-    case VK: case VKNUM: case VTRUE: {
+    case VK: case VKNUM: case VKINT: case VTRUE: {
       e->k = VFALSE;
       break;
     }
@@ -632,11 +693,21 @@ void luaK_indexed (FuncState *fs, expdesc *t, expdesc *k) {
 }
 
 
+#define numeral(e)	((e)->k == VKINT ? cast_num((e)->u.ival) : (e)->u.nval)
+
+
 static int constfolding (OpCode op, expdesc *e1, expdesc *e2) {
   lua_Number v1, v2, r;
+  lua_Int i;
   if (!isnumeral(e1) || !isnumeral(e2)) return 0;
-  v1 = e1->u.nval;
-  v2 = e2->u.nval;
+  if (e1->k == VKINT && e2->k == VKINT && op != OP_LEN &&
+      luaV_intarith(cast(TMS, op - OP_ADD + TM_ADD),
+                    e1->u.ival, e2->u.ival, &i)) {
+    e1->u.ival = i;  /* same result as at run time */
+    return 1;
+  }
+  v1 = numeral(e1);
+  v2 = numeral(e2);
   switch (op) {
     case OP_ADD: r = luai_numadd(v1, v2); break;
     case OP_SUB: r = luai_numsub(v1, v2); break;
@@ -653,6 +724,7 @@ static int constfolding (OpCode op, expdesc *e1, expdesc *e2) {
     default: lua_assert(0); r = 0; break;
   }
   if (luai_numisnan(r)) return 0;  /* do not attempt to produce NaN */
+  e1->k = VKNUM;
   e1->u.nval = r;
   return 1;
 }
@@ -696,7 +768,7 @@ static void codecomp (FuncState *fs, OpCode op, int cond, expdesc *e1,
 
 void luaK_prefix (FuncState *fs, UnOpr op, expdesc *e) {
   expdesc e2;
-  e2.t = e2.f = NO_JUMP; e2.k = VKNUM; e2.u.nval = 0;
+  e2.t = e2.f = NO_JUMP; e2.k = VKINT; e2.u.ival = 0;
   switch (op) {
     case OPR_MINUS: {
       if (e->k == VK)
@@ -798,12 +870,14 @@ static int luaK_code (FuncState *fs, Instruction i, int line) {
   Proto *f = fs->f;
   dischargejpc(fs);  /* `pc' will change */
   /* put new instruction in code array */
-  luaM_growvector(fs->L, f->code, fs->pc, f->sizecode, Instruction,
-                  MAX_INT, "code size overflow");
+  luaM_tagged(fs->L, LUA_MEMPROTO,
+              luaM_growvector(fs->L, f->code, fs->pc, f->sizecode, Instruction,
+                              MAX_INT, "code size overflow"));
   f->code[fs->pc] = i;
   /* save corresponding line information */
-  luaM_growvector(fs->L, f->lineinfo, fs->pc, f->sizelineinfo, int,
-                  MAX_INT, "code size overflow");
+  luaM_tagged(fs->L, LUA_MEMPROTO,
+              luaM_growvector(fs->L, f->lineinfo, fs->pc, f->sizelineinfo, int,
+                              MAX_INT, "code size overflow"));
   f->lineinfo[fs->pc] = line;
   return fs->pc++;
 }
@@ -837,3 +911,36 @@ void luaK_setlist (FuncState *fs, int base, int nelems, int tostore) {
   fs->freereg = base + 1;  /* free registers with list values */
 }
 
+
+#if defined(LUA_FUSEOPS)
+
+/*
+** Fuses the pairs of instructions listed in lopcodes.h: the first one
+** of a pair takes the fused opcode, so the VM runs both with a single
+** dispatch. The second one stays where it is, which keeps jumps into
+** it, line information and the debug interface working.
+*/
+void luaK_fuse (FuncState *fs) {
+  Proto *f = fs->f;
+  int pc;
+  for (pc = 0; pc+1 < fs->pc; pc++) {
+    Instruction *i = &f->code[pc];
+    OpCode op = GET_OPCODE(*i);
+    if (op == OP_SETLIST && GETARG_C(*i) == 0)
+      pc++;  /* skip count */
+    else if (op == OP_CLOSURE)
+      pc += f->p[GETARG_Bx(*i)]->nups;  /* skip pseudo-instructions */
+    else {
+      int o;
+      for (o = FIRST_FUSEDOP; o < NUM_OPCODES; o++) {
+        if (firstop(o) == op && secondop(o) == GET_OPCODE(*(i+1))) {
+          SET_OPCODE(*i, o);
+          pc++;  /* a second half does not start another pair */
+          break;
+        }
+      }
+    }
+  }
+}
+
+#endif
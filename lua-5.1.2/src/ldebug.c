@@ -66,6 +66,22 @@ LUA_API int lua_sethook (lua_State *L, lua_Hook func, int mask, int count) {
 }
 
 
+/*
+** Sampling support: `lua_sample' only raises a flag, so it is safe to
+** call it asynchronously (e.g. from a signal handler). The interpreter
+** checks the flag at backward jumps and calls and then runs the sample
+** hook with event LUA_HOOKSAMPLE.
+*/
+LUA_API void lua_setsamplehook (lua_State *L, lua_Hook func) {
+  G(L)->samplehook = func;
+}
+
+
+LUA_API void lua_sample (lua_State *L) {
+  G(L)->samplepending = 1;
+}
+
+
 LUA_API lua_Hook lua_gethook (lua_State *L) {
   return L->hook;
 }
@@ -85,6 +101,7 @@ LUA_API int lua_getstack (lua_State *L, int level, lua_Debug *ar) {
   int status;
   CallInfo *ci;
   lua_lock(L);
+  luaD_checklight(L);
   for (ci = L->ci; level > 0 && ci > L->base_ci; ci--) {
     level--;
     if (f_isLua(ci))  /* Lua function? */
@@ -326,6 +343,11 @@ static Instruction symbexec (const Proto *pt, int lastpc, int reg) {
     int b = 0;
     int c = 0;
     check(op < NUM_OPCODES);
+    if (isfusedop(op)) {  /* check its second half; then it is the first */
+      check(pc+1 < pt->sizecode);
+      check(GET_OPCODE(pt->code[pc+1]) == secondop(op));
+      op = firstop(op);
+    }
     checkreg(pt, a);
     switch (getOpMode(op)) {
       case iABC: {
@@ -489,7 +511,7 @@ static const char *getobjname (lua_State *L, CallInfo *ci, int stackpos,
       return "local";
     i = symbexec(p, pc, stackpos);  /* try symbolic execution */
     lua_assert(pc != -1);
-    switch (GET_OPCODE(i)) {
+    switch (firstop(GET_OPCODE(i))) {
       case OP_GETGLOBAL: {
         int g = GETARG_Bx(i);  /* global index */
         lua_assert(ttisstring(&p->k[g]));
@@ -510,7 +532,8 @@ static const char *getobjname (lua_State *L, CallInfo *ci, int stackpos,
       }
       case OP_GETUPVAL: {
         int u = GETARG_B(i);  /* upvalue index */
-        *name = p->upvalues ? getstr(p->upvalues[u]) : "?";
+        *name = luaF_upvalname(p, u);
+        if (*name == NULL) *name = "?";
         return "upvalue";
       }
       case OP_SELF: {
@@ -551,9 +574,10 @@ static int isinstack (CallInfo *ci, const TValue *o) {
 void luaG_typeerror (lua_State *L, const TValue *o, const char *op) {
   const char *name = NULL;
   const char *t = luaT_typenames[ttype(o)];
-  const char *kind = (isinstack(L->ci, o)) ?
-                         getobjname(L, L->ci, cast_int(o - L->base), &name) :
-                         NULL;
+  const char *kind;
+  luaD_checklight(L);  /* `o' belongs to the C function, not its caller */
+  kind = (isinstack(L->ci, o)) ?
+             getobjname(L, L->ci, cast_int(o - L->base), &name) : NULL;
   if (kind)
     luaG_runerror(L, "attempt to %s %s " LUA_QS " (a %s value)",
                 op, kind, name, t);
@@ -614,6 +638,7 @@ void luaG_errormsg (lua_State *L) {
 
 void luaG_runerror (lua_State *L, const char *fmt, ...) {
   va_list argp;
+  luaD_checklight(L);  /* the error is in the C function, not its caller */
   va_start(argp, fmt);
   addinfo(L, luaO_pushvfstring(L, fmt, argp));
   va_end(argp);
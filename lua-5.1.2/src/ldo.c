@@ -92,6 +92,8 @@ static void resetstack (lua_State *L, int status) {
 
 
 void luaD_throw (lua_State *L, int errcode) {
+  L->lightfunc = NULL;  /* its caller's `ci' is unwound as well */
+  luaM_resettag(L);  /* an allocation may have failed inside `luaM_tagged' */
   if (L->errorJmp) {
     L->errorJmp->status = errcode;
     LUAI_THROW(L, L->errorJmp);
@@ -135,6 +137,8 @@ static void correctstack (lua_State *L, TValue *oldstack) {
     ci->func = (ci->func - oldstack) + L->stack;
   }
   L->base = (L->base - oldstack) + L->stack;
+  if (L->lightfunc)
+    L->lightfunc = (L->lightfunc - oldstack) + L->stack;
 }
 
 
@@ -142,7 +146,8 @@ void luaD_reallocstack (lua_State *L, int newsize) {
   TValue *oldstack = L->stack;
   int realsize = newsize + 1 + EXTRA_STACK;
   lua_assert(L->stack_last - L->stack == L->stacksize - EXTRA_STACK - 1);
-  luaM_reallocvector(L, L->stack, L->stacksize, realsize, TValue);
+  luaM_tagged(L, LUA_TTHREAD,
+              luaM_reallocvector(L, L->stack, L->stacksize, realsize, TValue));
   L->stacksize = realsize;
   L->stack_last = L->stack+newsize;
   correctstack(L, oldstack);
@@ -151,7 +156,8 @@ void luaD_reallocstack (lua_State *L, int newsize) {
 
 void luaD_reallocCI (lua_State *L, int newsize) {
   CallInfo *oldci = L->base_ci;
-  luaM_reallocvector(L, L->base_ci, L->size_ci, newsize, CallInfo);
+  luaM_tagged(L, LUA_TTHREAD,
+              luaM_reallocvector(L, L->base_ci, L->size_ci, newsize, CallInfo));
   L->size_ci = newsize;
   L->ci = (L->ci - oldci) + L->base_ci;
   L->end_ci = L->base_ci + L->size_ci - 1;
@@ -178,8 +184,7 @@ static CallInfo *growCI (lua_State *L) {
 }
 
 
-void luaD_callhook (lua_State *L, int event, int line) {
-  lua_Hook hook = L->hook;
+static void callhook (lua_State *L, lua_Hook hook, int event, int line) {
   if (hook && L->allowhook) {
     ptrdiff_t top = savestack(L, L->top);
     ptrdiff_t ci_top = savestack(L, L->ci->top);
@@ -205,6 +210,17 @@ void luaD_callhook (lua_State *L, int event, int line) {
 }
 
 
+void luaD_callhook (lua_State *L, int event, int line) {
+  callhook(L, L->hook, event, line);
+}
+
+
+void luaD_sample (lua_State *L) {
+  G(L)->samplepending = 0;
+  callhook(L, G(L)->samplehook, LUA_HOOKSAMPLE, -1);
+}
+
+
 static StkId adjust_varargs (lua_State *L, Proto *p, int actual) {
   int i;
   int nfixargs = p->numparams;
@@ -221,7 +237,7 @@ static StkId adjust_varargs (lua_State *L, Proto *p, int actual) {
     for (i=0; i<nvar; i++)  /* put extra arguments into `arg' table */
       setobj2n(L, luaH_setnum(L, htab, i+1), L->top - nvar + i);
     /* store counter in field `n' */
-    setnvalue(luaH_setstr(L, htab, luaS_newliteral(L, "n")), cast_num(nvar));
+    setivalue(luaH_setstr(L, htab, luaS_newliteral(L, "n")), nvar);
   }
 #endif
   /* move fixed parameters to final position */
@@ -306,6 +322,8 @@ int luaD_precall (lua_State *L, StkId func, int nresults) {
   else {  /* if is a C function, call it */
     CallInfo *ci;
     int n;
+    if (luaD_islight(L, func))
+      return luaD_lightcall(L, func, nresults);
     luaD_checkstack(L, LUA_MINSTACK);  /* ensure minimum stack size */
     ci = inc_ci(L);  /* now `enter' new function */
     ci->func = restorestack(L, funcr);
@@ -328,6 +346,67 @@ int luaD_precall (lua_State *L, StkId func, int nresults) {
 }
 
 
+/*
+** Call a light C function inside the caller's `ci': no CallInfo is pushed
+** and no hooks are called (there are none). The caller's `ci->top' is
+** raised to give the function its LUA_MINSTACK slots. If the function
+** does something that needs a frame of its own (a call, a yield, an
+** error message, a look at the stack, its environment or upvalues)
+** `luaD_lightframe' pushes one on the spot, and the call then returns
+** through `luaD_poscall' as usual.
+*/
+int luaD_lightcall (lua_State *L, StkId func, int nresults) {
+  CallInfo *ci = L->ci;
+  ptrdiff_t top = savestack(L, ci->top);
+  int n;
+  lua_assert(L->lightfunc == NULL);
+  ci->savedpc = L->savedpc;
+  if (ci->top < L->top + LUA_MINSTACK)
+    ci->top = L->top + LUA_MINSTACK;
+  L->base = func + 1;
+  L->lightfunc = func;
+  L->lightnres = nresults;
+  lua_unlock(L);
+  n = (*clvalue(func)->c.f)(L);  /* do the actual call */
+  lua_lock(L);
+  if (L->lightfunc == NULL) {  /* function got a `ci' after all? */
+    (L->ci - 1)->top = restorestack(L, top);
+    if (n < 0)  /* yielding? */
+      return PCRYIELD;
+    luaD_poscall(L, L->top - n);
+  }
+  else {  /* move results in place, as `luaD_poscall' would */
+    StkId res = L->lightfunc;
+    StkId firstResult = L->top - n;
+    int i;
+    lua_assert(n >= 0);
+    L->lightfunc = NULL;
+    L->ci->top = restorestack(L, top);
+    for (i = nresults; i != 0 && firstResult < L->top; i--)
+      setobjs2s(L, res++, firstResult++);
+    while (i-- > 0)
+      setnilvalue(res++);
+    L->top = res;
+    L->base = L->ci->base;
+  }
+  return PCRC;
+}
+
+
+void luaD_lightframe (lua_State *L) {
+  StkId func = L->lightfunc;
+  StkId top = L->ci->top;  /* keeps what `lua_checkstack' has granted */
+  CallInfo *ci;
+  lua_assert(func != NULL);
+  L->lightfunc = NULL;
+  ci = inc_ci(L);
+  ci->func = func;
+  ci->base = L->base;
+  ci->top = top;
+  ci->nresults = L->lightnres;
+}
+
+
 static StkId callrethooks (lua_State *L, StkId firstResult) {
   ptrdiff_t fr = savestack(L, firstResult);  /* next call may change stack */
   luaD_callhook(L, LUA_HOOKRET, -1);
@@ -367,6 +446,7 @@ int luaD_poscall (lua_State *L, StkId firstResult) {
 ** function position.
 */ 
 void luaD_call (lua_State *L, StkId func, int nResults) {
+  luaD_checklight(L);
   if (++L->nCcalls >= LUAI_MAXCCALLS) {
     if (L->nCcalls == LUAI_MAXCCALLS)
       luaG_runerror(L, "C stack overflow");
@@ -441,6 +521,7 @@ LUA_API int lua_resume (lua_State *L, int nargs) {
 LUA_API int lua_yield (lua_State *L, int nresults) {
   luai_userstateyield(L, nresults);
   lua_lock(L);
+  luaD_checklight(L);
   if (L->nCcalls > 0)
     luaG_runerror(L, "attempt to yield across metamethod/C-call boundary");
   L->base = L->top - nresults;  /* protect stack slots below */
@@ -454,9 +535,11 @@ int luaD_pcall (lua_State *L, Pfunc func, void *u,
                 ptrdiff_t old_top, ptrdiff_t ef) {
   int status;
   unsigned short oldnCcalls = L->nCcalls;
-  ptrdiff_t old_ci = saveci(L, L->ci);
+  ptrdiff_t old_ci;
   lu_byte old_allowhooks = L->allowhook;
   ptrdiff_t old_errfunc = L->errfunc;
+  luaD_checklight(L);  /* an error must not unwind the caller's frame */
+  old_ci = saveci(L, L->ci);
   L->errfunc = ef;
   status = luaD_rawrunprotected(L, func, u);
   if (status != 0) {  /* an error occurred? */
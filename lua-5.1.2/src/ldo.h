@@ -19,6 +19,15 @@
   else condhardstacktests(luaD_reallocstack(L, L->stacksize - EXTRA_STACK - 1));
 
 
+/* can C function `f' run without a `ci' of its own? */
+#define luaD_islight(L,f) \
+  (clvalue(f)->c.islight && !L->hookmask && \
+   (char *)L->stack_last - (char *)L->top > LUA_MINSTACK*(int)sizeof(TValue))
+
+/* give a running light C function its `ci' before anyone looks at it */
+#define luaD_checklight(L)	if (L->lightfunc) luaD_lightframe(L)
+
+
 #define incr_top(L) {luaD_checkstack(L,1); L->top++;}
 
 #define savestack(L,p)		((char *)(p) - (char *)L->stack)
@@ -39,7 +48,10 @@ typedef void (*Pfunc) (lua_State *L, void *ud);
 
 LUAI_FUNC int luaD_protectedparser (lua_State *L, ZIO *z, const char *name);
 LUAI_FUNC void luaD_callhook (lua_State *L, int event, int line);
+LUAI_FUNC void luaD_sample (lua_State *L);
 LUAI_FUNC int luaD_precall (lua_State *L, StkId func, int nresults);
+LUAI_FUNC int luaD_lightcall (lua_State *L, StkId func, int nresults);
+LUAI_FUNC void luaD_lightframe (lua_State *L);
 LUAI_FUNC void luaD_call (lua_State *L, StkId func, int nResults);
 LUAI_FUNC int luaD_pcall (lua_State *L, Pfunc func, void *u,
                                         ptrdiff_t oldtop, ptrdiff_t ef);
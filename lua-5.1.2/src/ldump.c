@@ -11,6 +11,7 @@
 
 #include "lua.h"
 
+#include "lfunc.h"
 #include "lobject.h"
 #include "lstate.h"
 #include "lundump.h"
@@ -52,6 +53,11 @@ static void DumpNumber(lua_Number x, DumpState* D)
  DumpVar(x,D);
 }
 
+static void DumpInteger(lua_Int x, DumpState* D)
+{
+ DumpVar(x,D);
+}
+
 static void DumpVector(const void* b, int n, size_t size, DumpState* D)
 {
  DumpInt(n,D);
@@ -73,6 +79,21 @@ static void DumpString(const TString* s, DumpState* D)
  }
 }
 
+static void DumpSharedString(const SharedStr* s, DumpState* D)
+{
+ if (s->s==NULL)
+ {
+  size_t size=0;
+  DumpVar(size,D);
+ }
+ else
+ {
+  size_t size=s->len+1;			/* include trailing '\0' */
+  DumpVar(size,D);
+  DumpBlock(s->s,size,D);
+ }
+}
+
 #define DumpCode(f,D)	 DumpVector(f->code,f->sizecode,sizeof(Instruction),D)
 
 static void DumpFunction(const Proto* f, const TString* p, DumpState* D);
@@ -84,8 +105,9 @@ static void DumpConstants(const Proto* f, DumpState* D)
  for (i=0; i<n; i++)
  {
   const TValue* o=&f->k[i];
-  DumpChar(ttype(o),D);
-  switch (ttype(o))
+  int t=ttisint(o) ? LUAC_TINT : ttype(o);
+  DumpChar(t,D);
+  switch (t)
   {
    case LUA_TNIL:
 	break;
@@ -95,6 +117,9 @@ static void DumpConstants(const Proto* f, DumpState* D)
    case LUA_TNUMBER:
 	DumpNumber(nvalue(o),D);
 	break;
+   case LUAC_TINT:
+	DumpInteger(ivalue(o),D);
+	break;
    case LUA_TSTRING:
 	DumpString(rawtsvalue(o),D);
 	break;
@@ -113,6 +138,22 @@ static void DumpDebug(const Proto* f, DumpState* D)
  int i,n;
  n= (D->strip) ? 0 : f->sizelineinfo;
  DumpVector(f->lineinfo,n,sizeof(int),D);
+ if (f->shared!=NULL)			/* debug names are in a shared chunk */
+ {
+  const SharedProto* sp=f->shared;
+  n= (D->strip) ? 0 : sp->sizelocvars;
+  DumpInt(n,D);
+  for (i=0; i<n; i++)
+  {
+   DumpSharedString(&sp->locvars[i].varname,D);
+   DumpInt(sp->locvars[i].startpc,D);
+   DumpInt(sp->locvars[i].endpc,D);
+  }
+  n= (D->strip) ? 0 : sp->sizeupvalues;
+  DumpInt(n,D);
+  for (i=0; i<n; i++) DumpSharedString(&sp->upvalues[i],D);
+  return;
+ }
  n= (D->strip) ? 0 : f->sizelocvars;
  DumpInt(n,D);
  for (i=0; i<n; i++)
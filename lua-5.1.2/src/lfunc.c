@@ -6,24 +6,30 @@
 
 
 #include <stddef.h>
+#include <string.h>
 
 #define lfunc_c
 #define LUA_CORE
 
 #include "lua.h"
 
+#include "ldo.h"
 #include "lfunc.h"
 #include "lgc.h"
 #include "lmem.h"
 #include "lobject.h"
 #include "lstate.h"
+#include "lstring.h"
 
 
 
 Closure *luaF_newCclosure (lua_State *L, int nelems, Table *e) {
-  Closure *c = cast(Closure *, luaM_malloc(L, sizeCclosure(nelems)));
+  Closure *c;
+  luaM_tagged(L, LUA_TFUNCTION,
+              c = cast(Closure *, luaM_malloc(L, sizeCclosure(nelems))));
   luaC_link(L, obj2gco(c), LUA_TFUNCTION);
   c->c.isC = 1;
+  c->c.islight = 0;
   c->c.env = e;
   c->c.nupvalues = cast_byte(nelems);
   return c;
@@ -31,9 +37,12 @@ Closure *luaF_newCclosure (lua_State *L, int nelems, Table *e) {
 
 
 Closure *luaF_newLclosure (lua_State *L, int nelems, Table *e) {
-  Closure *c = cast(Closure *, luaM_malloc(L, sizeLclosure(nelems)));
+  Closure *c;
+  luaM_tagged(L, LUA_TFUNCTION,
+              c = cast(Closure *, luaM_malloc(L, sizeLclosure(nelems))));
   luaC_link(L, obj2gco(c), LUA_TFUNCTION);
   c->l.isC = 0;
+  c->l.islight = 0;
   c->l.env = e;
   c->l.nupvalues = cast_byte(nelems);
   while (nelems--) c->l.upvals[nelems] = NULL;
@@ -42,7 +51,8 @@ Closure *luaF_newLclosure (lua_State *L, int nelems, Table *e) {
 
 
 UpVal *luaF_newupval (lua_State *L) {
-  UpVal *uv = luaM_new(L, UpVal);
+  UpVal *uv;
+  luaM_tagged(L, LUA_TUPVAL, uv = luaM_new(L, UpVal));
   luaC_link(L, obj2gco(uv), LUA_TUPVAL);
   uv->v = &uv->u.value;
   setnilvalue(uv->v);
@@ -64,8 +74,10 @@ UpVal *luaF_findupval (lua_State *L, StkId level) {
     }
     pp = &p->next;
   }
-  uv = luaM_new(L, UpVal);  /* not found: create a new one */
+  luaM_tagged(L, LUA_TUPVAL,
+              uv = luaM_new(L, UpVal));  /* not found: create a new one */
   uv->tt = LUA_TUPVAL;
+  luaM_countobj(L, LUA_TUPVAL, 1);
   uv->marked = luaC_white(g);
   uv->v = level;  /* current value lives in the stack */
   uv->next = *pp;  /* chain it in the proper position */
@@ -89,7 +101,7 @@ static void unlinkupval (UpVal *uv) {
 void luaF_freeupval (lua_State *L, UpVal *uv) {
   if (uv->v != &uv->u.value)  /* is it open? */
     unlinkupval(uv);  /* remove from open list */
-  luaM_free(L, uv);  /* free upvalue */
+  luaM_tagged(L, LUA_TUPVAL, luaM_free(L, uv));  /* free upvalue */
 }
 
 
@@ -100,8 +112,10 @@ void luaF_close (lua_State *L, StkId level) {
     GCObject *o = obj2gco(uv);
     lua_assert(!isblack(o) && uv->v != &uv->u.value);
     L->openupval = uv->next;  /* remove from `open' list */
-    if (isdead(g, o))
+    if (isdead(g, o)) {
+      luaM_countobj(L, LUA_TUPVAL, -1);
       luaF_freeupval(L, uv);  /* free upvalue */
+    }
     else {
       unlinkupval(uv);
       setobj(L, &uv->u.value, uv->v);
@@ -113,7 +127,8 @@ void luaF_close (lua_State *L, StkId level) {
 
 
 Proto *luaF_newproto (lua_State *L) {
-  Proto *f = luaM_new(L, Proto);
+  Proto *f;
+  luaM_tagged(L, LUA_MEMPROTO, f = luaM_new(L, Proto));
   luaC_link(L, obj2gco(f), LUA_TPROTO);
   f->k = NULL;
   f->sizek = 0;
@@ -134,34 +149,256 @@ Proto *luaF_newproto (lua_State *L) {
   f->linedefined = 0;
   f->lastlinedefined = 0;
   f->source = NULL;
+  f->shared = NULL;
   return f;
 }
 
 
 void luaF_freeproto (lua_State *L, Proto *f) {
-  luaM_freearray(L, f->code, f->sizecode, Instruction);
-  luaM_freearray(L, f->p, f->sizep, Proto *);
-  luaM_freearray(L, f->k, f->sizek, TValue);
-  luaM_freearray(L, f->lineinfo, f->sizelineinfo, int);
-  luaM_freearray(L, f->locvars, f->sizelocvars, struct LocVar);
-  luaM_freearray(L, f->upvalues, f->sizeupvalues, TString *);
-  luaM_free(L, f);
+  if (f->shared != NULL)  /* code and debug info belong to a shared chunk? */
+    luaF_releasechunk(f->shared->chunk);
+  else {
+    luaM_tagged(L, LUA_MEMPROTO,
+                luaM_freearray(L, f->code, f->sizecode, Instruction));
+    luaM_tagged(L, LUA_MEMPROTO,
+                luaM_freearray(L, f->lineinfo, f->sizelineinfo, int));
+    luaM_tagged(L, LUA_MEMPROTO,
+                luaM_freearray(L, f->locvars, f->sizelocvars, struct LocVar));
+    luaM_tagged(L, LUA_MEMPROTO,
+                luaM_freearray(L, f->upvalues, f->sizeupvalues, TString *));
+  }
+  luaM_tagged(L, LUA_MEMPROTO, luaM_freearray(L, f->p, f->sizep, Proto *));
+  luaM_tagged(L, LUA_MEMPROTO, luaM_freearray(L, f->k, f->sizek, TValue));
+  luaM_tagged(L, LUA_MEMPROTO, luaM_free(L, f));
 }
 
 
 void luaF_freeclosure (lua_State *L, Closure *c) {
   int size = (c->c.isC) ? sizeCclosure(c->c.nupvalues) :
                           sizeLclosure(c->l.nupvalues);
-  luaM_freemem(L, c, size);
+  luaM_tagged(L, LUA_TFUNCTION, luaM_freemem(L, c, size));
 }
 
 
+/*
+** {======================================================
+** Shared chunks
+** =======================================================
+*/
+
+/*
+** `freezeproto' runs twice over the same tree: first with no block, only
+** to add up the space it needs, and then to fill the allocated block.
+*/
+typedef struct Freezer {
+  char *block;  /* NULL while measuring */
+  size_t used;
+} Freezer;
+
+
+static void *place (Freezer *F, size_t size) {
+  void *p;
+  F->used = (F->used + sizeof(L_Umaxalign) - 1) &
+            ~(sizeof(L_Umaxalign) - 1);
+  p = (F->block == NULL) ? NULL : F->block + F->used;
+  F->used += size;
+  return p;
+}
+
+
+static void freezestr (Freezer *F, SharedStr *ss, const TString *ts) {
+  if (ts == NULL) {
+    if (ss != NULL) ss->s = NULL;
+  }
+  else {
+    size_t l = ts->tsv.len;
+    char *s = cast(char *, place(F, l + 1));
+    if (ss != NULL) {
+      memcpy(s, getstr(ts), l + 1);
+      ss->s = s;
+      ss->len = l;
+    }
+  }
+}
+
+
+static void freezeproto (Freezer *F, lua_Chunk *c, SharedProto *sp,
+                         const Proto *f) {
+  int i;
+  SharedK *k = cast(SharedK *, place(F, f->sizek * sizeof(SharedK)));
+  SharedProto *p = cast(SharedProto *,
+                        place(F, f->sizep * sizeof(SharedProto)));
+  SharedLocVar *lv = cast(SharedLocVar *,
+                          place(F, f->sizelocvars * sizeof(SharedLocVar)));
+  SharedStr *uv = cast(SharedStr *,
+                       place(F, f->sizeupvalues * sizeof(SharedStr)));
+  Instruction *code = cast(Instruction *,
+                           place(F, f->sizecode * sizeof(Instruction)));
+  int *lineinfo = cast(int *, place(F, f->sizelineinfo * sizeof(int)));
+  if (sp != NULL) {
+    memcpy(code, f->code, f->sizecode * sizeof(Instruction));
+    memcpy(lineinfo, f->lineinfo, f->sizelineinfo * sizeof(int));
+    sp->chunk = c;
+    sp->code = code;
+    sp->lineinfo = lineinfo;
+    sp->k = k;
+    sp->p = p;
+    sp->locvars = lv;
+    sp->upvalues = uv;
+    sp->sizecode = f->sizecode;
+    sp->sizelineinfo = f->sizelineinfo;
+    sp->sizek = f->sizek;
+    sp->sizep = f->sizep;
+    sp->sizelocvars = f->sizelocvars;
+    sp->sizeupvalues = f->sizeupvalues;
+    sp->linedefined = f->linedefined;
+    sp->lastlinedefined = f->lastlinedefined;
+    sp->nups = f->nups;
+    sp->numparams = f->numparams;
+    sp->is_vararg = f->is_vararg;
+    sp->maxstacksize = f->maxstacksize;
+  }
+  for (i = 0; i < f->sizek; i++) {
+    const TValue *o = &f->k[i];
+    if (sp != NULL) {
+      k[i].tt = rttype(o);
+      k[i].b = ttisboolean(o) ? bvalue(o) : 0;
+      k[i].n = ttisfloat(o) ? fltvalue(o) : 0;
+      k[i].i = ttisint(o) ? ivalue(o) : 0;
+      k[i].s.s = NULL;
+    }
+    if (ttisstring(o))
+      freezestr(F, (sp != NULL) ? &k[i].s : NULL, rawtsvalue(o));
+  }
+  for (i = 0; i < f->sizep; i++)
+    freezeproto(F, c, (sp != NULL) ? &p[i] : NULL, f->p[i]);
+  for (i = 0; i < f->sizelocvars; i++) {
+    freezestr(F, (sp != NULL) ? &lv[i].varname : NULL,
+                 f->locvars[i].varname);
+    if (sp != NULL) {
+      lv[i].startpc = f->locvars[i].startpc;
+      lv[i].endpc = f->locvars[i].endpc;
+    }
+  }
+  for (i = 0; i < f->sizeupvalues; i++)
+    freezestr(F, (sp != NULL) ? &uv[i] : NULL, f->upvalues[i]);
+}
+
+
+/*
+** Copies a prototype tree into a new shared chunk (with one reference,
+** for the caller). The block comes from the state's allocator but is not
+** charged to the state. Returns NULL if there is no memory.
+*/
+lua_Chunk *luaF_freeze (lua_State *L, const Proto *f) {
+  global_State *g = G(L);
+  lua_Chunk *c;
+  Freezer F;
+  size_t size;
+  F.block = NULL;
+  F.used = 0;
+  place(&F, sizeof(lua_Chunk));
+  freezestr(&F, NULL, f->source);
+  freezeproto(&F, NULL, NULL, f);
+  size = F.used;
+  c = cast(lua_Chunk *, (*g->frealloc)(g->ud, NULL, 0, size));
+  if (c == NULL) return NULL;
+  F.block = cast(char *, c);
+  F.used = 0;
+  place(&F, sizeof(lua_Chunk));
+  c->frealloc = g->frealloc;
+  c->ud = g->ud;
+  c->size = size;
+  c->ref = 1;
+  freezestr(&F, &c->source, f->source);
+  freezeproto(&F, c, &c->main, f);
+  lua_assert(F.used == size);
+  return c;
+}
+
+
+static TString *thawstr (lua_State *L, const SharedStr *ss) {
+  return (ss->s == NULL) ? NULL : luaS_newlstr(L, ss->s, ss->len);
+}
+
+
+static Proto *thawproto (lua_State *L, const SharedProto *sp,
+                         TString *source) {
+  int i;
+  Proto *f = luaF_newproto(L);
+  setptvalue2s(L, L->top, f); incr_top(L);
+  f->shared = sp;
+  luai_chunkref(sp->chunk->ref);
+  f->code = sp->code;
+  f->sizecode = sp->sizecode;
+  f->lineinfo = sp->lineinfo;
+  f->sizelineinfo = sp->sizelineinfo;
+  f->source = source;
+  f->linedefined = sp->linedefined;
+  f->lastlinedefined = sp->lastlinedefined;
+  f->nups = sp->nups;
+  f->numparams = sp->numparams;
+  f->is_vararg = sp->is_vararg;
+  f->maxstacksize = sp->maxstacksize;
+  luaM_tagged(L, LUA_MEMPROTO, f->k = luaM_newvector(L, sp->sizek, TValue));
+  f->sizek = sp->sizek;
+  for (i = 0; i < sp->sizek; i++) setnilvalue(&f->k[i]);
+  for (i = 0; i < sp->sizek; i++) {
+    const SharedK *k = &sp->k[i];
+    TValue *o = &f->k[i];
+    switch (k->tt) {
+      case LUA_TBOOLEAN: setbvalue(o, k->b); break;
+      case LUA_TNUMBER: setnvalue(o, k->n); break;
+      case LUA_TINT: setivalue(o, k->i); break;
+      case LUA_TSTRING: setsvalue2n(L, o, thawstr(L, &k->s)); break;
+      default: lua_assert(k->tt == LUA_TNIL); break;
+    }
+  }
+  luaM_tagged(L, LUA_MEMPROTO, f->p = luaM_newvector(L, sp->sizep, Proto *));
+  f->sizep = sp->sizep;
+  for (i = 0; i < sp->sizep; i++) f->p[i] = NULL;
+  for (i = 0; i < sp->sizep; i++)
+    f->p[i] = thawproto(L, &sp->p[i], source);
+  L->top--;
+  return f;
+}
+
+
+/*
+** Builds in `L' a prototype tree that runs the shared code of `c'.
+*/
+Proto *luaF_instance (lua_State *L, lua_Chunk *c) {
+  TString *source = thawstr(L, &c->source);
+  if (source == NULL) source = luaS_newliteral(L, "=?");
+  return thawproto(L, &c->main, source);
+}
+
+
+void luaF_releasechunk (lua_Chunk *c) {
+  if (luai_chunkunref(c->ref) == 0)
+    (*c->frealloc)(c->ud, c, c->size, 0);
+}
+
+/* }====================================================== */
+
+
 /*
 ** Look for n-th local variable at line `line' in function `func'.
 ** Returns NULL if not found.
 */
 const char *luaF_getlocalname (const Proto *f, int local_number, int pc) {
   int i;
+  if (f->shared != NULL) {
+    const SharedProto *sp = f->shared;
+    for (i = 0; i<sp->sizelocvars && sp->locvars[i].startpc <= pc; i++) {
+      if (pc < sp->locvars[i].endpc) {  /* is variable active? */
+        local_number--;
+        if (local_number == 0)
+          return sp->locvars[i].varname.s;
+      }
+    }
+    return NULL;  /* not found */
+  }
   for (i = 0; i<f->sizelocvars && f->locvars[i].startpc <= pc; i++) {
     if (pc < f->locvars[i].endpc) {  /* is variable active? */
       local_number--;
@@ -172,3 +409,14 @@ const char *luaF_getlocalname (const Proto *f, int local_number, int pc) {
   return NULL;  /* not found */
 }
 
+
+/*
+** Name of upvalue `n' (counting from 0) of `f'; NULL if `f' has no
+** debug information.
+*/
+const char *luaF_upvalname (const Proto *f, int n) {
+  if (f->shared != NULL)
+    return (f->shared->sizeupvalues == 0) ? NULL : f->shared->upvalues[n].s;
+  return (f->upvalues == NULL) ? NULL : getstr(f->upvalues[n]);
+}
+
@@ -18,6 +18,73 @@
                          cast(int, sizeof(TValue *)*((n)-1)))
 
 
+/*
+** A shared chunk is a single block, allocated outside any state, with
+** an immutable copy of a prototype tree. Prototypes instantiated from it
+** use its code and debug information in place and hold a reference to
+** it; only the constants (whose strings must be interned) and the
+** nested prototypes are rebuilt in each state.
+*/
+
+typedef struct SharedStr {
+  const char *s;  /* NULL for absent strings */
+  size_t len;
+} SharedStr;
+
+
+typedef struct SharedK {
+  int tt;  /* raw tag (tells the subtype of numbers) */
+  int b;
+  lua_Number n;
+  lua_Int i;
+  SharedStr s;
+} SharedK;
+
+
+typedef struct SharedLocVar {
+  SharedStr varname;
+  int startpc;
+  int endpc;
+} SharedLocVar;
+
+
+typedef struct SharedProto {
+  struct lua_Chunk *chunk;  /* block holding this prototype */
+  Instruction *code;
+  int *lineinfo;
+  SharedK *k;
+  struct SharedProto *p;
+  SharedLocVar *locvars;
+  SharedStr *upvalues;
+  int sizecode;
+  int sizelineinfo;
+  int sizek;
+  int sizep;
+  int sizelocvars;
+  int sizeupvalues;
+  int linedefined;
+  int lastlinedefined;
+  lu_byte nups;
+  lu_byte numparams;
+  lu_byte is_vararg;
+  lu_byte maxstacksize;
+} SharedProto;
+
+
+struct lua_Chunk {
+  lua_Alloc frealloc;  /* allocator of the creating state */
+  void *ud;
+  size_t size;  /* of the whole block */
+  volatile long ref;  /* one for each handle and instantiated prototype */
+  SharedStr source;
+  SharedProto main;
+};
+
+
+#define luaF_sizeupvalues(f)	((f)->shared ? (f)->shared->sizeupvalues : \
+                                               (f)->sizeupvalues)
+
+
 LUAI_FUNC Proto *luaF_newproto (lua_State *L);
 LUAI_FUNC Closure *luaF_newCclosure (lua_State *L, int nelems, Table *e);
 LUAI_FUNC Closure *luaF_newLclosure (lua_State *L, int nelems, Table *e);
@@ -27,8 +94,12 @@ LUAI_FUNC void luaF_close (lua_State *L, StkId level);
 LUAI_FUNC void luaF_freeproto (lua_State *L, Proto *f);
 LUAI_FUNC void luaF_freeclosure (lua_State *L, Closure *c);
 LUAI_FUNC void luaF_freeupval (lua_State *L, UpVal *uv);
+LUAI_FUNC lua_Chunk *luaF_freeze (lua_State *L, const Proto *f);
+LUAI_FUNC Proto *luaF_instance (lua_State *L, lua_Chunk *c);
+LUAI_FUNC void luaF_releasechunk (lua_Chunk *c);
 LUAI_FUNC const char *luaF_getlocalname (const Proto *func, int local_number,
                                          int pc);
+LUAI_FUNC const char *luaF_upvalname (const Proto *f, int n);
 
 
 #endif
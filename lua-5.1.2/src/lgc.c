@@ -59,10 +59,10 @@
 #define setthreshold(g)  (g->GCthreshold = (g->estimate/100) * g->gcpause)
 
 
-static void removeentry (Node *n) {
-  lua_assert(ttisnil(gval(n)));
-  if (iscollectable(gkey(n)))
-    setttype(gkey(n), LUA_TDEADKEY);  /* dead key; remove it */
+static void removeentry (Table *h, int i) {
+  lua_assert(ttisnil(gval(h, i)));
+  if (iscollectable(gkey(h, i)))
+    setttype(gkey(h, i), LUA_TDEADKEY);  /* dead key; remove it */
 }
 
 
@@ -182,14 +182,13 @@ static int traversetable (global_State *g, Table *h) {
   }
   i = sizenode(h);
   while (i--) {
-    Node *n = gnode(h, i);
-    lua_assert(ttype(gkey(n)) != LUA_TDEADKEY || ttisnil(gval(n)));
-    if (ttisnil(gval(n)))
-      removeentry(n);  /* remove empty entries */
+    lua_assert(ttype(gkey(h, i)) != LUA_TDEADKEY || ttisnil(gval(h, i)));
+    if (ttisnil(gval(h, i)))
+      removeentry(h, i);  /* remove empty entries */
     else {
-      lua_assert(!ttisnil(gkey(n)));
-      if (!weakkey) markvalue(g, gkey(n));
-      if (!weakvalue) markvalue(g, gval(n));
+      lua_assert(!ttisnil(gkey(h, i)));
+      if (!weakkey) markvalue(g, gkey(h, i));
+      if (!weakvalue) markvalue(g, gval(h, i));
     }
   }
   return weakkey || weakvalue;
@@ -285,7 +284,7 @@ static l_mem propagatemark (global_State *g) {
       if (traversetable(g, h))  /* table is weak? */
         black2gray(o);  /* keep it gray */
       return sizeof(Table) + sizeof(TValue) * h->sizearray +
-                             sizeof(Node) * sizenode(h);
+                             sizehash(sizenode(h));
     }
     case LUA_TFUNCTION: {
       Closure *cl = gco2cl(o);
@@ -363,11 +362,10 @@ static void cleartable (GCObject *l) {
     }
     i = sizenode(h);
     while (i--) {
-      Node *n = gnode(h, i);
-      if (!ttisnil(gval(n)) &&  /* non-empty entry? */
-          (iscleared(key2tval(n), 1) || iscleared(gval(n), 0))) {
-        setnilvalue(gval(n));  /* remove value ... */
-        removeentry(n);  /* remove entry from table */
+      if (!ttisnil(gval(h, i)) &&  /* non-empty entry? */
+          (iscleared(gkey(h, i), 1) || iscleared(gval(h, i), 0))) {
+        setnilvalue(gval(h, i));  /* remove value ... */
+        removeentry(h, i);  /* remove entry from table */
       }
     }
     l = h->gclist;
@@ -376,6 +374,7 @@ static void cleartable (GCObject *l) {
 
 
 static void freeobj (lua_State *L, GCObject *o) {
+  luaM_countobj(L, o->gch.tt, -1);
   switch (o->gch.tt) {
     case LUA_TPROTO: luaF_freeproto(L, gco2p(o)); break;
     case LUA_TFUNCTION: luaF_freeclosure(L, gco2cl(o)); break;
@@ -388,11 +387,11 @@ static void freeobj (lua_State *L, GCObject *o) {
     }
     case LUA_TSTRING: {
       G(L)->strt.nuse--;
-      luaM_freemem(L, o, sizestring(gco2ts(o)));
+      luaM_tagged(L, LUA_TSTRING, luaM_freemem(L, o, sizestring(gco2ts(o))));
       break;
     }
     case LUA_TUSERDATA: {
-      luaM_freemem(L, o, sizeudata(gco2u(o)));
+      luaM_tagged(L, LUA_TUSERDATA, luaM_freemem(L, o, sizeudata(gco2u(o))));
       break;
     }
     default: lua_assert(0);
@@ -487,6 +486,8 @@ void luaC_freeall (lua_State *L) {
   sweepwholelist(L, &g->rootgc);
   for (i = 0; i < g->strt.size; i++)  /* free all string lists */
     sweepwholelist(L, &g->strt.hash[i]);
+  for (i = g->strt.rehashpos; i < g->strt.oldsize; i++)
+    sweepwholelist(L, &g->strt.oldhash[i]);  /* and those not yet rehashed */
 }
 
 
@@ -571,8 +572,12 @@ static l_mem singlestep (lua_State *L) {
     }
     case GCSsweepstring: {
       lu_mem old = g->totalbytes;
-      sweepwholelist(L, &g->strt.hash[g->sweepstrgc++]);
-      if (g->sweepstrgc >= g->strt.size)  /* nothing more to sweep? */
+      int i = g->sweepstrgc++;
+      if (i < g->strt.size)
+        sweepwholelist(L, &g->strt.hash[i]);
+      else  /* buckets of a pending rehash come after the current ones */
+        sweepwholelist(L, &g->strt.oldhash[i - g->strt.size]);
+      if (g->sweepstrgc >= g->strt.size + g->strt.oldsize)
         g->gcstate = GCSsweep;  /* end sweep-string phase */
       lua_assert(old >= g->totalbytes);
       g->estimate -= old - g->totalbytes;
@@ -583,10 +588,12 @@ static l_mem singlestep (lua_State *L) {
       g->sweepgc = sweeplist(L, g->sweepgc, GCSWEEPMAX);
       if (*g->sweepgc == NULL) {  /* nothing more to sweep? */
         checkSizes(L);
+        luaM_flushfree(L);  /* hand over the last blocks swept */
         g->gcstate = GCSfinalize;  /* end sweep phase */
       }
-      lua_assert(old >= g->totalbytes);
-      g->estimate -= old - g->totalbytes;
+      /* shrinking the string table allocates before the rehash frees */
+      lua_assert(old >= g->totalbytes || g->strt.oldhash != NULL);
+      g->estimate = (g->estimate + g->totalbytes) - old;
       return GCSWEEPMAX*GCSWEEPCOST;
     }
     case GCSfinalize: {
@@ -613,6 +620,7 @@ void luaC_step (lua_State *L) {
   if (lim == 0)
     lim = (MAX_LUMEM-1)/2;  /* no limit */
   g->gcdept += g->totalbytes - g->GCthreshold;
+  luaS_rehashstep(L, STRTREHASHSTEP);  /* advance pending string rehash */
   do {
     lim -= singlestep(L);
     if (g->gcstate == GCSpause)
@@ -655,6 +663,7 @@ void luaC_fullgc (lua_State *L) {
   while (g->gcstate != GCSpause) {
     singlestep(L);
   }
+  luaE_freepool(L);  /* a full collection also returns pooled threads */
   setthreshold(g);
 }
 
@@ -689,6 +698,7 @@ void luaC_link (lua_State *L, GCObject *o, lu_byte tt) {
   g->rootgc = o;
   o->gch.marked = luaC_white(g);
   o->gch.tt = tt;
+  luaM_countobj(L, tt, 1);
 }
 
 
@@ -22,7 +22,10 @@ static const luaL_Reg lualibs[] = {
   {LUA_OSLIBNAME, luaopen_os},
   {LUA_STRLIBNAME, luaopen_string},
   {LUA_MATHLIBNAME, luaopen_math},
+  {LUA_ARRAYLIBNAME, luaopen_array},
+  {LUA_WORKLIBNAME, luaopen_worker},
   {LUA_DBLIBNAME, luaopen_debug},
+  {LUA_PROFLIBNAME, luaopen_profiler},
   {NULL, NULL}
 };
 
@@ -5,6 +5,7 @@
 */
 
 
+#include <ctype.h>
 #include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -27,6 +28,150 @@
 static const char *const fnames[] = {"input", "output"};
 
 
+/*
+** A file handle. Field `f' comes first, so that other modules may still
+** see a handle as a `FILE **'. Reads from regular files go through a
+** private buffer (or a memory map of the whole file), which is given
+** back to `f' before anything else uses it (see `syncfile').
+*/
+typedef struct LStream {
+  FILE *f;  /* NULL for closed files */
+  char *buf;  /* read buffer or mapped file, or NULL */
+  size_t pos;  /* next char to read in `buf' */
+  size_t n;  /* end of data in `buf' */
+  size_t size;  /* size of `buf' */
+  int rmode;  /* how reads are done (RM_*) */
+  int map;  /* map the file into memory when possible */
+} LStream;
+
+#define RM_UNKNOWN	0	/* not decided yet (see `readbuffer') */
+#define RM_STDIO	1	/* through `f' (not a regular file) */
+#define RM_BUFFER	2	/* through `buf' */
+#define RM_MAP		3	/* `buf' maps the whole file */
+
+
+#if defined(LUA_USE_MMAP)
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+static int isregular (FILE *f, size_t *size) {
+  struct stat st;
+  if (fstat(fileno(f), &st) != 0 || !S_ISREG(st.st_mode))
+    return 0;
+  *size = (size_t)st.st_size;
+  if ((off_t)*size != st.st_size)
+    *size = 0;  /* too large to be mapped */
+  return 1;
+}
+
+
+static char *mapfile (FILE *f, size_t size) {
+  void *p = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fileno(f), 0);
+  if (p == MAP_FAILED) return NULL;
+  posix_madvise(p, size, POSIX_MADV_SEQUENTIAL);
+  return (char *)p;
+}
+
+
+#define unmapfile(p,size)	munmap(p, size)
+
+#else
+
+/* ANSI C cannot tell regular files from terminals or pipes */
+#define isregular(f,size)	((void)(f), (void)(size), 0)
+#define mapfile(f,size)		((void)(f), (void)(size), (char *)NULL)
+#define unmapfile(p,size)	((void)(p), (void)(size))
+
+#endif
+
+
+static void freebuffer (lua_State *L, LStream *s) {
+  if (s->rmode == RM_MAP)
+    unmapfile(s->buf, s->size);
+  else if (s->rmode == RM_BUFFER) {
+    void *ud;
+    lua_Alloc allocf = lua_getallocf(L, &ud);
+    (*allocf)(ud, s->buf, s->size, 0);
+  }
+  s->buf = NULL;
+  s->pos = s->n = s->size = 0;
+  s->rmode = RM_UNKNOWN;
+}
+
+
+/*
+** Gives back to the stream the data read ahead and not used yet (by
+** moving its position back), so that it can be used directly.
+*/
+static FILE *syncfile (LStream *s) {
+  if (s->rmode == RM_BUFFER) {
+    if (s->pos < s->n)
+      fseek(s->f, -(long)(s->n - s->pos), SEEK_CUR);
+    s->pos = s->n = 0;
+  }
+  else if (s->rmode == RM_MAP) {
+    fseek(s->f, (long)s->pos, SEEK_SET);
+    unmapfile(s->buf, s->size);
+    s->buf = NULL;
+    s->pos = s->n = s->size = 0;
+    s->rmode = RM_UNKNOWN;  /* map it again at the next read */
+  }
+  return s->f;
+}
+
+
+/*
+** Decides how to read from stream `s' on its first read; returns true
+** if reads go through `s->buf'.
+*/
+static int readbuffer (lua_State *L, LStream *s) {
+  if (s->rmode == RM_UNKNOWN) {
+    size_t size;
+    long pos;
+    s->rmode = RM_STDIO;
+    if (!isregular(s->f, &size))
+      return 0;
+    if (s->map && size > 0 && (pos = ftell(s->f)) >= 0 &&
+        (size_t)pos <= size && (s->buf = mapfile(s->f, size)) != NULL) {
+      s->rmode = RM_MAP;
+      s->pos = (size_t)pos;
+      s->n = s->size = size;
+    }
+    else {
+      void *ud;
+      lua_Alloc allocf = lua_getallocf(L, &ud);
+      s->buf = (char *)(*allocf)(ud, NULL, 0, LUAL_READBUFSIZE);
+      if (s->buf != NULL) {  /* else keep reading through stdio */
+        s->rmode = RM_BUFFER;
+        s->pos = s->n = 0;
+        s->size = LUAL_READBUFSIZE;
+      }
+    }
+  }
+  return (s->rmode == RM_BUFFER || s->rmode == RM_MAP);
+}
+
+
+/*
+** Moves the unread data to the start of the buffer and reads more after
+** it; returns 0 if nothing could be read (end of file or error).
+*/
+static int fillbuffer (LStream *s) {
+  size_t nr;
+  if (s->rmode != RM_BUFFER)
+    return 0;  /* a mapped file is all there */
+  if (s->pos > 0) {
+    memmove(s->buf, s->buf + s->pos, s->n - s->pos);
+    s->n -= s->pos;
+    s->pos = 0;
+  }
+  nr = fread(s->buf + s->n, sizeof(char), s->size - s->n, s->f);
+  s->n += nr;
+  return (nr > 0);
+}
+
+
 static int pushresult (lua_State *L, int i, const char *filename) {
   int en = errno;  /* calls to Lua API may change this value */
   if (i) {
@@ -51,7 +196,7 @@ static void fileerror (lua_State *L, int arg, const char *filename) {
 }
 
 
-#define topfile(L)	((FILE **)luaL_checkudata(L, 1, LUA_FILEHANDLE))
+#define topfile(L)	((LStream *)luaL_checkudata(L, 1, LUA_FILEHANDLE))
 
 
 static int io_type (lua_State *L) {
@@ -69,11 +214,17 @@ static int io_type (lua_State *L) {
 }
 
 
-static FILE *tofile (lua_State *L) {
-  FILE **f = topfile(L);
-  if (*f == NULL)
+static LStream *tostream (lua_State *L) {
+  LStream *s = topfile(L);
+  if (s->f == NULL)
     luaL_error(L, "attempt to use a closed file");
-  return *f;
+  return s;
+}
+
+
+/* the stream of the file handle argument, ready to be used directly */
+static FILE *tofile (lua_State *L) {
+  return syncfile(tostream(L));
 }
 
 
@@ -83,12 +234,16 @@ static FILE *tofile (lua_State *L) {
 ** before opening the actual file; so, if there is a memory error, the
 ** file is not left opened.
 */
-static FILE **newfile (lua_State *L) {
-  FILE **pf = (FILE **)lua_newuserdata(L, sizeof(FILE *));
-  *pf = NULL;  /* file handle is currently `closed' */
+static LStream *newfile (lua_State *L) {
+  LStream *s = (LStream *)lua_newuserdata(L, sizeof(LStream));
+  s->f = NULL;  /* file handle is currently `closed' */
+  s->buf = NULL;
+  s->pos = s->n = s->size = 0;
+  s->rmode = RM_UNKNOWN;
+  s->map = 0;
   luaL_getmetatable(L, LUA_FILEHANDLE);
   lua_setmetatable(L, -2);
-  return pf;
+  return s;
 }
 
 
@@ -97,17 +252,21 @@ static FILE **newfile (lua_State *L) {
 ** correct __close for 'popen' files
 */
 static int io_pclose (lua_State *L) {
-  FILE **p = topfile(L);
-  int ok = lua_pclose(L, *p);
-  *p = NULL;
+  LStream *p = topfile(L);
+  int ok;
+  freebuffer(L, p);
+  ok = lua_pclose(L, p->f);
+  p->f = NULL;
   return pushresult(L, ok, NULL);
 }
 
 
 static int io_fclose (lua_State *L) {
-  FILE **p = topfile(L);
-  int ok = (fclose(*p) == 0);
-  *p = NULL;
+  LStream *p = topfile(L);
+  int ok;
+  freebuffer(L, p);
+  ok = (fclose(p->f) == 0);
+  p->f = NULL;
   return pushresult(L, ok, NULL);
 }
 
@@ -128,16 +287,19 @@ static int io_close (lua_State *L) {
 
 
 static int io_gc (lua_State *L) {
-  FILE *f = *topfile(L);
+  LStream *s = topfile(L);
+  FILE *f = s->f;
   /* ignore closed files and standard files */
   if (f != NULL && f != stdin && f != stdout && f != stderr)
     aux_close(L);
+  else
+    freebuffer(L, s);
   return 0;
 }
 
 
 static int io_tostring (lua_State *L) {
-  FILE *f = *topfile(L);
+  FILE *f = topfile(L)->f;
   if (f == NULL)
     lua_pushstring(L, "file (closed)");
   else
@@ -146,38 +308,52 @@ static int io_tostring (lua_State *L) {
 }
 
 
+/*
+** Mode `m' (e.g. "rm") asks for reads through a memory map of the file,
+** when it is a regular file and the system can map it. It is removed
+** from the mode given to `fopen'.
+*/
 static int io_open (lua_State *L) {
   const char *filename = luaL_checkstring(L, 1);
   const char *mode = luaL_optstring(L, 2, "r");
-  FILE **pf = newfile(L);
-  *pf = fopen(filename, mode);
-  return (*pf == NULL) ? pushresult(L, 0, filename) : 1;
+  LStream *pf = newfile(L);
+  char cmode[8];
+  const char *m = strchr(mode, 'm');
+  if (m != NULL && strlen(mode) < sizeof(cmode)) {
+    size_t l = m - mode;
+    memcpy(cmode, mode, l);
+    strcpy(cmode + l, m + 1);
+    mode = cmode;
+    pf->map = 1;
+  }
+  pf->f = fopen(filename, mode);
+  return (pf->f == NULL) ? pushresult(L, 0, filename) : 1;
 }
 
 
 static int io_popen (lua_State *L) {
   const char *filename = luaL_checkstring(L, 1);
   const char *mode = luaL_optstring(L, 2, "r");
-  FILE **pf = newfile(L);
-  *pf = lua_popen(L, filename, mode);
-  return (*pf == NULL) ? pushresult(L, 0, filename) : 1;
+  LStream *pf = newfile(L);
+  pf->f = lua_popen(L, filename, mode);
+  return (pf->f == NULL) ? pushresult(L, 0, filename) : 1;
 }
 
 
 static int io_tmpfile (lua_State *L) {
-  FILE **pf = newfile(L);
-  *pf = tmpfile();
-  return (*pf == NULL) ? pushresult(L, 0, NULL) : 1;
+  LStream *pf = newfile(L);
+  pf->f = tmpfile();
+  return (pf->f == NULL) ? pushresult(L, 0, NULL) : 1;
 }
 
 
-static FILE *getiofile (lua_State *L, int findex) {
-  FILE *f;
+static LStream *getiofile (lua_State *L, int findex) {
+  LStream *s;
   lua_rawgeti(L, LUA_ENVIRONINDEX, findex);
-  f = *(FILE **)lua_touserdata(L, -1);
-  if (f == NULL)
+  s = (LStream *)lua_touserdata(L, -1);
+  if (s->f == NULL)
     luaL_error(L, "standard %s file is closed", fnames[findex - 1]);
-  return f;
+  return s;
 }
 
 
@@ -185,9 +361,9 @@ static int g_iofile (lua_State *L, int f, const char *mode) {
   if (!lua_isnoneornil(L, 1)) {
     const char *filename = lua_tostring(L, 1);
     if (filename) {
-      FILE **pf = newfile(L);
-      *pf = fopen(filename, mode);
-      if (*pf == NULL)
+      LStream *pf = newfile(L);
+      pf->f = fopen(filename, mode);
+      if (pf->f == NULL)
         fileerror(L, 1, filename);
     }
     else {
@@ -223,7 +399,7 @@ static void aux_lines (lua_State *L, int idx, int toclose) {
 
 
 static int f_lines (lua_State *L) {
-  tofile(L);  /* check that it's a valid file handle */
+  tostream(L);  /* check that it's a valid file handle */
   aux_lines(L, 1, 0);
   return 1;
 }
@@ -237,9 +413,9 @@ static int io_lines (lua_State *L) {
   }
   else {
     const char *filename = luaL_checkstring(L, 1);
-    FILE **pf = newfile(L);
-    *pf = fopen(filename, "r");
-    if (*pf == NULL)
+    LStream *pf = newfile(L);
+    pf->f = fopen(filename, "r");
+    if (pf->f == NULL)
       fileerror(L, 1, filename);
     aux_lines(L, lua_gettop(L), 1);
     return 1;
@@ -312,13 +488,114 @@ static int read_chars (lua_State *L, FILE *f, size_t n) {
 }
 
 
-static int g_read (lua_State *L, FILE *f, int first) {
+/*
+** Readers for streams with a private buffer (see `readbuffer'). Data
+** goes from the buffer straight into Lua strings; lines are found with
+** `memchr'.
+*/
+
+static int bread_number (lua_State *L, LStream *s) {
+  char numeral[200];
+  size_t l = 0;
+  char *endp;
+  lua_Number d;
+  for (;;) {  /* skip white space */
+    while (s->pos < s->n && isspace((unsigned char)s->buf[s->pos]))
+      s->pos++;
+    if (s->pos < s->n || !fillbuffer(s)) break;
+  }
+  if (s->n - s->pos < sizeof(numeral))
+    fillbuffer(s);  /* try to have the whole numeral in the buffer */
+  while (l < sizeof(numeral) - 1 && s->pos + l < s->n) {
+    int c = (unsigned char)s->buf[s->pos + l];
+    if (!isalnum(c) && c != '.' && c != '+' && c != '-') break;
+    numeral[l++] = (char)c;
+  }
+  numeral[l] = '\0';
+  d = lua_str2number(numeral, &endp);
+  if (endp == numeral)
+    return 0;  /* read fails */
+  s->pos += endp - numeral;
+  lua_pushnumber(L, d);
+  return 1;
+}
+
+
+static int btest_eof (lua_State *L, LStream *s) {
+  lua_pushlstring(L, NULL, 0);
+  return (s->pos < s->n || fillbuffer(s));
+}
+
+
+static int bread_line (lua_State *L, LStream *s) {
+  luaL_Buffer b;
+  int partial = 0;  /* first pieces of the line are in `b' */
+  for (;;) {
+    const char *p = s->buf + s->pos;
+    size_t l = s->n - s->pos;
+    const char *eol = (const char *)memchr(p, '\n', l);
+    int done = (eol != NULL);
+    if (done)
+      l = eol - p;
+    else if (s->pos > 0 || s->n < s->size) {  /* room for more data? */
+      if (fillbuffer(s)) continue;  /* search again */
+      p = s->buf + s->pos;  /* end of file: the rest is the last line */
+      l = s->n - s->pos;
+      done = 1;
+    }  /* else the buffer is full with a piece of a long line */
+    s->pos += l + (eol != NULL);
+    if (done && !partial) {
+      lua_pushlstring(L, p, l);
+      return (eol != NULL || l > 0);
+    }
+    if (!partial) {
+      luaL_buffinit(L, &b);
+      partial = 1;
+    }
+    lua_pushlstring(L, p, l);
+    luaL_addvalue(&b);
+    if (done) {
+      luaL_pushresult(&b);
+      return 1;  /* read at least a piece */
+    }
+  }
+}
+
+
+static int bread_chars (lua_State *L, LStream *s, size_t n) {
+  luaL_Buffer b;
+  size_t l = s->n - s->pos;
+  if (l >= n || s->rmode == RM_MAP) {  /* all in the buffer? */
+    if (l > n) l = n;
+    lua_pushlstring(L, s->buf + s->pos, l);
+    s->pos += l;
+    return (l > 0);
+  }
+  luaL_buffinit(L, &b);
+  for (;;) {
+    if (l > n) l = n;
+    lua_pushlstring(L, s->buf + s->pos, l);
+    luaL_addvalue(&b);
+    s->pos += l;
+    n -= l;  /* still have to read `n' chars */
+    if (n == 0 || !fillbuffer(s)) break;  /* end of count or eof? */
+    l = s->n - s->pos;
+  }
+  luaL_pushresult(&b);
+  return (n == 0 || lua_strlen(L, -1) > 0);
+}
+
+
+static int g_read (lua_State *L, LStream *s, int first) {
+  FILE *f = s->f;
   int nargs = lua_gettop(L) - 1;
+  int buffered;
   int success;
   int n;
   clearerr(f);
+  buffered = readbuffer(L, s);
   if (nargs == 0) {  /* no arguments? */
-    success = read_line(L, f);
+    success = buffered ? bread_line(L, s) : read_line(L, f);
     n = first+1;  /* to return 1 result */
   }
   else {  /* ensure stack space for all results and for auxlib's buffer */
@@ -327,20 +604,26 @@ static int g_read (lua_State *L, FILE *f, int first) {
     for (n = first; nargs-- && success; n++) {
       if (lua_type(L, n) == LUA_TNUMBER) {
         size_t l = (size_t)lua_tointeger(L, n);
-        success = (l == 0) ? test_eof(L, f) : read_chars(L, f, l);
+        if (buffered)
+          success = (l == 0) ? btest_eof(L, s) : bread_chars(L, s, l);
+        else
+          success = (l == 0) ? test_eof(L, f) : read_chars(L, f, l);
       }
       else {
         const char *p = lua_tostring(L, n);
         luaL_argcheck(L, p && p[0] == '*', n, "invalid option");
         switch (p[1]) {
           case 'n':  /* number */
-            success = read_number(L, f);
+            success = buffered ? bread_number(L, s) : read_number(L, f);
             break;
           case 'l':  /* line */
-            success = read_line(L, f);
+            success = buffered ? bread_line(L, s) : read_line(L, f);
             break;
           case 'a':  /* file */
-            read_chars(L, f, ~((size_t)0));  /* read MAX_SIZE_T chars */
+            if (buffered)  /* read MAX_SIZE_T chars */
+              bread_chars(L, s, ~((size_t)0));
+            else
+              read_chars(L, f, ~((size_t)0));
             success = 1; /* always success */
             break;
           default:
@@ -365,16 +648,17 @@ static int io_read (lua_State *L) {
 
 
 static int f_read (lua_State *L) {
-  return g_read(L, tofile(L), 2);
+  return g_read(L, tostream(L), 2);
 }
 
 
 static int io_readline (lua_State *L) {
-  FILE *f = *(FILE **)lua_touserdata(L, lua_upvalueindex(1));
+  LStream *s = (LStream *)lua_touserdata(L, lua_upvalueindex(1));
+  FILE *f = s->f;
   int sucess;
   if (f == NULL)  /* file is already closed? */
     luaL_error(L, "file is already closed");
-  sucess = read_line(L, f);
+  sucess = readbuffer(L, s) ? bread_line(L, s) : read_line(L, f);
   if (ferror(f))
     return luaL_error(L, "%s", strerror(errno));
   if (sucess) return 1;
@@ -397,8 +681,9 @@ static int g_write (lua_State *L, FILE *f, int arg) {
   for (; nargs--; arg++) {
     if (lua_type(L, arg) == LUA_TNUMBER) {
       /* optimization: could be done exactly as for strings */
-      status = status &&
-          fprintf(f, LUA_NUMBER_FMT, lua_tonumber(L, arg)) > 0;
+      status = status && (lua_isinteger(L, arg) ?
+          fprintf(f, LUA_INTFMT, (LUAI_INT)lua_tointeger(L, arg)) :
+          fprintf(f, LUA_NUMBER_FMT, lua_tonumber(L, arg))) > 0;
     }
     else {
       size_t l;
@@ -411,7 +696,7 @@ static int g_write (lua_State *L, FILE *f, int arg) {
 
 
 static int io_write (lua_State *L) {
-  return g_write(L, getiofile(L, IO_OUTPUT), 1);
+  return g_write(L, syncfile(getiofile(L, IO_OUTPUT)), 1);
 }
 
 
@@ -449,7 +734,7 @@ static int f_setvbuf (lua_State *L) {
 
 
 static int io_flush (lua_State *L) {
-  return pushresult(L, fflush(getiofile(L, IO_OUTPUT)) == 0, NULL);
+  return pushresult(L, fflush(syncfile(getiofile(L, IO_OUTPUT))) == 0, NULL);
 }
 
 
@@ -497,7 +782,7 @@ static void createmeta (lua_State *L) {
 
 
 static void createstdfile (lua_State *L, FILE *f, int k, const char *fname) {
-  *newfile(L) = f;
+  newfile(L)->f = f;
   if (k > 0) {
     lua_pushvalue(L, -1);
     lua_rawseti(L, LUA_ENVIRONINDEX, k);
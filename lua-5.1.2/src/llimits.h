@@ -51,6 +51,11 @@ typedef LUAI_USER_ALIGNMENT_T L_Umaxalign;
 typedef LUAI_UACNUMBER l_uacNumber;
 
 
+/* integer numbers (see LUA_INTNUMBER) */
+typedef LUAI_INT lua_Int;
+typedef unsigned LUAI_INT lua_UInt;
+
+
 /* internal assertions for in-house debugging */
 #ifdef lua_assert
 
@@ -100,6 +105,12 @@ typedef lu_int32 Instruction;
 #endif
 
 
+/* number of old buckets moved per step of an incremental string-table rehash */
+#ifndef STRTREHASHSTEP
+#define STRTREHASHSTEP	4
+#endif
+
+
 /* minimum size for string buffer */
 #ifndef LUA_MINBUFFER
 #define LUA_MINBUFFER	32
@@ -116,6 +127,27 @@ typedef lu_int32 Instruction;
 #endif
 
 
+/*
+** reference count of shared chunks (which may be used by states running
+** in different threads); `luai_chunkunref' gives the new count
+*/
+#ifndef luai_chunkref
+#if defined(__GNUC__)
+#define luai_chunkref(n)	((void)__sync_add_and_fetch(&(n), 1))
+#define luai_chunkunref(n)	__sync_sub_and_fetch(&(n), 1)
+#elif defined(_MSC_VER)
+long __cdecl _InterlockedIncrement(long volatile *);
+long __cdecl _InterlockedDecrement(long volatile *);
+#pragma intrinsic(_InterlockedIncrement, _InterlockedDecrement)
+#define luai_chunkref(n)	((void)_InterlockedIncrement(&(n)))
+#define luai_chunkunref(n)	_InterlockedDecrement(&(n))
+#else
+#define luai_chunkref(n)	((void)++(n))
+#define luai_chunkunref(n)	(--(n))
+#endif
+#endif
+
+
 /*
 ** macro to control inclusion of some hard tests on stack reallocation
 */ 
@@ -249,7 +249,7 @@ static const luaL_Reg mathlib[] = {
 ** Open math library
 */
 LUALIB_API int luaopen_math (lua_State *L) {
-  luaL_register(L, LUA_MATHLIBNAME, mathlib);
+  luaL_registerlight(L, LUA_MATHLIBNAME, mathlib);
   lua_pushnumber(L, PI);
   lua_setfield(L, -2, "pi");
   lua_pushnumber(L, HUGE_VAL);
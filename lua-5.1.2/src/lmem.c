@@ -14,6 +14,7 @@
 
 #include "ldebug.h"
 #include "ldo.h"
+#include "lgc.h"
 #include "lmem.h"
 #include "lobject.h"
 #include "lstate.h"
@@ -70,17 +71,222 @@ void *luaM_toobig (lua_State *L) {
 
 
 
+/*
+** {======================================================
+** Background freeing
+** While a background thread is on, blocks freed during the sweep
+** phases are only collected into batches; the thread gives them back
+** to `frealloc' (which then must be thread safe). Accounting is done
+** when the block is collected, so the collector paces itself as usual.
+** If the thread falls more than LUAI_BGFREEMAX bytes behind, the
+** collector frees its next batch by itself.
+** =======================================================
+*/
+
+#if defined(LUA_USE_PTHREADS)
+
+#include <pthread.h>
+
+typedef struct FreeBatch {
+  struct FreeBatch *next;
+  size_t bytes;  /* total size of its blocks */
+  int n;  /* number of blocks */
+  struct {
+    void *block;
+    size_t size;
+  } b[LUAI_BGFREEBATCH];
+} FreeBatch;
+
+
+typedef struct FreeQueue {
+  lua_Alloc frealloc;
+  void *ud;
+  FreeBatch *current;  /* batch being filled by the collector */
+  FreeBatch *pending;  /* batches handed to the thread */
+  size_t pendingbytes;  /* bytes in `pending' not yet freed */
+  int stop;  /* thread must finish its work and quit */
+  pthread_mutex_t lock;
+  pthread_cond_t wake;
+  pthread_t thread;
+} FreeQueue;
+
+
+static void freebatch (FreeQueue *q, FreeBatch *b) {
+  int i;
+  for (i = 0; i < b->n; i++)
+    (*q->frealloc)(q->ud, b->b[i].block, b->b[i].size, 0);
+  b->n = 0;
+  b->bytes = 0;
+}
+
+
+static void *freemain (void *ud) {
+  FreeQueue *q = cast(FreeQueue *, ud);
+  pthread_mutex_lock(&q->lock);
+  for (;;) {
+    FreeBatch *b = q->pending;
+    size_t bytes;
+    if (b == NULL) {
+      if (q->stop) break;
+      pthread_cond_wait(&q->wake, &q->lock);
+      continue;
+    }
+    q->pending = b->next;
+    pthread_mutex_unlock(&q->lock);
+    bytes = b->bytes;
+    freebatch(q, b);
+    (*q->frealloc)(q->ud, b, sizeof(FreeBatch), 0);
+    pthread_mutex_lock(&q->lock);
+    q->pendingbytes -= bytes;
+  }
+  pthread_mutex_unlock(&q->lock);
+  return NULL;
+}
+
+
+static FreeBatch *newbatch (FreeQueue *q) {
+  FreeBatch *b = cast(FreeBatch *,
+                      (*q->frealloc)(q->ud, NULL, 0, sizeof(FreeBatch)));
+  if (b != NULL) {
+    b->n = 0;
+    b->bytes = 0;
+  }
+  return b;
+}
+
+
+static void handoff (FreeQueue *q) {
+  FreeBatch *b = q->current;
+  int queued = 0;
+  pthread_mutex_lock(&q->lock);
+  if (q->pendingbytes == 0 ||
+      q->pendingbytes + b->bytes <= cast(size_t, LUAI_BGFREEMAX)) {
+    b->next = q->pending;
+    q->pending = b;
+    q->pendingbytes += b->bytes;
+    pthread_cond_signal(&q->wake);
+    queued = 1;
+  }
+  pthread_mutex_unlock(&q->lock);
+  if (queued)
+    q->current = newbatch(q);  /* if it fails, later blocks are freed here */
+  else  /* thread is behind */
+    freebatch(q, b);  /* so the collector does it */
+}
+
+
+/*
+** collects a dead block; returns 0 if it could not (and so the block
+** must be freed now)
+*/
+static int deferfree (global_State *g, void *block, size_t size) {
+  FreeQueue *q = g->bgfree;
+  FreeBatch *b = q->current;
+  if (b == NULL && (b = q->current = newbatch(q)) == NULL)
+    return 0;
+  b->b[b->n].block = block;
+  b->b[b->n].size = size;
+  b->n++;
+  b->bytes += size;
+  if (b->n == LUAI_BGFREEBATCH || b->bytes >= LUAI_BGFREEMAX/4)
+    handoff(q);
+  return 1;
+}
+
+
+void luaM_flushfree (lua_State *L) {
+  FreeQueue *q = G(L)->bgfree;
+  if (q != NULL && q->current != NULL && q->current->n > 0)
+    handoff(q);
+}
+
+
+int luaM_bgfree (lua_State *L, int on) {
+  global_State *g = G(L);
+  FreeQueue *q = g->bgfree;
+  if (on && q == NULL) {
+    q = cast(FreeQueue *, (*g->frealloc)(g->ud, NULL, 0, sizeof(FreeQueue)));
+    if (q == NULL) return 0;
+    q->frealloc = g->frealloc;
+    q->ud = g->ud;
+    q->current = q->pending = NULL;
+    q->pendingbytes = 0;
+    q->stop = 0;
+    pthread_mutex_init(&q->lock, NULL);
+    pthread_cond_init(&q->wake, NULL);
+    if (pthread_create(&q->thread, NULL, freemain, q) != 0) {
+      pthread_cond_destroy(&q->wake);
+      pthread_mutex_destroy(&q->lock);
+      (*g->frealloc)(g->ud, q, sizeof(FreeQueue), 0);
+      return 0;
+    }
+    g->bgfree = q;
+  }
+  else if (!on && q != NULL) {
+    g->bgfree = NULL;
+    pthread_mutex_lock(&q->lock);
+    q->stop = 1;  /* thread frees what is pending and quits */
+    pthread_cond_signal(&q->wake);
+    pthread_mutex_unlock(&q->lock);
+    pthread_join(q->thread, NULL);
+    if (q->current != NULL) {
+      freebatch(q, q->current);
+      (*q->frealloc)(q->ud, q->current, sizeof(FreeBatch), 0);
+    }
+    pthread_cond_destroy(&q->wake);
+    pthread_mutex_destroy(&q->lock);
+    (*q->frealloc)(q->ud, q, sizeof(FreeQueue), 0);
+  }
+  return g->bgfree != NULL;
+}
+
+#else
+
+#define deferfree(g,b,s)	((void)(g), (void)(b), (void)(s), 0)
+
+void luaM_flushfree (lua_State *L) {
+  (void)L;
+}
+
+
+int luaM_bgfree (lua_State *L, int on) {
+  (void)L; (void)on;
+  return 0;  /* no threads on this system */
+}
+
+#endif
+
+
+#define sweeping(g) \
+	((g)->gcstate == GCSsweepstring || (g)->gcstate == GCSsweep)
+
+/* }====================================================== */
+
+
+
 /*
 ** generic allocation routine.
 */
 void *luaM_realloc_ (lua_State *L, void *block, size_t osize, size_t nsize) {
   global_State *g = G(L);
   lua_assert((osize == 0) == (block == NULL));
-  block = (*g->frealloc)(g->ud, block, osize, nsize);
-  if (block == NULL && nsize > 0)
-    luaD_throw(L, LUA_ERRMEM);
+  if (nsize == 0 && block != NULL && g->bgfree != NULL && sweeping(g) &&
+      deferfree(g, block, osize))
+    block = NULL;  /* the background thread will free it */
+  else {
+    block = (*g->frealloc)(g->ud, block, osize, nsize);
+    if (block == NULL && nsize > 0)
+      luaD_throw(L, LUA_ERRMEM);
+  }
   lua_assert((nsize == 0) == (block == NULL));
   g->totalbytes = (g->totalbytes - osize) + nsize;
+  if (g->totalbytes > g->peakbytes)
+    g->peakbytes = g->totalbytes;
+#if defined(LUA_USE_GCSTATS)
+  g->memstat[g->memtag].bytes = (g->memstat[g->memtag].bytes - osize) + nsize;
+  if (osize == 0 && nsize > 0)
+    g->memstat[g->memtag].allocs++;
+#endif
   return block;
 }
 
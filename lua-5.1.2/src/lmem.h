@@ -38,12 +38,34 @@
    ((v)=cast(t *, luaM_reallocv(L, v, oldn, n, sizeof(t))))
 
 
+/*
+** Per-type memory accounting: with LUA_USE_GCSTATS the allocations done
+** by statement `s' of `luaM_tagged' are charged to category `t'; all
+** others go to LUA_MEMOTHER. Object counts are kept by `luaM_countobj'.
+** Both reduce to `s' and nothing otherwise. An error raised inside `s'
+** skips the restore, so `luaD_throw' resets the category.
+*/
+#if defined(LUA_USE_GCSTATS)
+#define luaM_tagged(L,t,s) \
+	{ lu_byte oldtag_ = G(L)->memtag; G(L)->memtag = cast_byte(t); \
+	  s; G(L)->memtag = oldtag_; }
+#define luaM_resettag(L)	(G(L)->memtag = LUA_MEMOTHER)
+#define luaM_countobj(L,t,d)	(G(L)->memstat[t].objects += (d))
+#else
+#define luaM_tagged(L,t,s)	{ s; }
+#define luaM_resettag(L)	((void)0)
+#define luaM_countobj(L,t,d)	((void)0)
+#endif
+
+
 LUAI_FUNC void *luaM_realloc_ (lua_State *L, void *block, size_t oldsize,
                                                           size_t size);
 LUAI_FUNC void *luaM_toobig (lua_State *L);
 LUAI_FUNC void *luaM_growaux_ (lua_State *L, void *block, int *size,
                                size_t size_elem, int limit,
                                const char *errormsg);
+LUAI_FUNC int luaM_bgfree (lua_State *L, int on);
+LUAI_FUNC void luaM_flushfree (lua_State *L);
 
 #endif
 
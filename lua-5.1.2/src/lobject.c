@@ -75,7 +75,7 @@ int luaO_rawequalObj (const TValue *t1, const TValue *t2) {
     case LUA_TNIL:
       return 1;
     case LUA_TNUMBER:
-      return luai_numeq(nvalue(t1), nvalue(t2));
+      return luaO_numequal(t1, t2);
     case LUA_TBOOLEAN:
       return bvalue(t1) == bvalue(t2);  /* boolean true must be 1 !! */
     case LUA_TLIGHTUSERDATA:
@@ -87,6 +87,39 @@ int luaO_rawequalObj (const TValue *t1, const TValue *t2) {
 }
 
 
+/*
+** equality of two numbers of any subtype: an integer and a lua_Number
+** are equal only if the lua_Number has exactly that integer value
+*/
+int luaO_numequal (const TValue *t1, const TValue *t2) {
+  lua_Int i;
+  if (ttisints(t1, t2))
+    return ivalue(t1) == ivalue(t2);
+  else if (ttisfloat(t1) && ttisfloat(t2))
+    return luai_numeq(fltvalue(t1), fltvalue(t2));
+  else if (ttisint(t1))
+    return luaO_n2int(fltvalue(t2), &i) && i == ivalue(t1);
+  else
+    return luaO_n2int(fltvalue(t1), &i) && i == ivalue(t2);
+}
+
+
+/*
+** converts a lua_Number with an integral value (that fits) to lua_Int
+*/
+int luaO_n2int (lua_Number n, lua_Int *result) {
+  /* -2^63 <= n < 2^63 (false for NaN) */
+  if (n >= cast_num(LUAI_INTMIN) && n < -cast_num(LUAI_INTMIN)) {
+    lua_Int i = cast(lua_Int, n);
+    if (luai_numeq(cast_num(i), n)) {
+      *result = i;
+      return 1;
+    }
+  }
+  return 0;
+}
+
+
 int luaO_str2d (const char *s, lua_Number *result) {
   char *endptr;
   *result = lua_str2number(s, &endptr);
@@ -100,6 +133,55 @@ int luaO_str2d (const char *s, lua_Number *result) {
 }
 
 
+/*
+** converts a decimal or hexadecimal numeral (maybe signed), without
+** point or exponent, to lua_Int; fails if the value does not fit or
+** is -0 (which only a lua_Number can hold)
+*/
+int luaO_str2int (const char *s, lua_Int *result) {
+  lua_UInt a = 0;
+  lua_UInt lim = cast(lua_UInt, LUAI_INTMAX);
+  int base = 10;
+  int neg = 0;
+  int empty = 1;
+  while (isspace(cast(unsigned char, *s))) s++;
+  if (*s == '-') { s++; neg = 1; lim++; }
+  else if (*s == '+') s++;
+  if (*s == '0' && (s[1] == 'x' || s[1] == 'X')) { s += 2; base = 16; }
+  for (;; s++, empty = 0) {
+    int c = cast(unsigned char, *s);
+    int d;
+    if (isdigit(c)) d = c - '0';
+    else if (base == 16 && isxdigit(c)) d = tolower(c) - 'a' + 10;
+    else break;
+    if (a > (lim - d) / base) return 0;  /* overflow */
+    a = a * base + d;
+  }
+  while (isspace(cast(unsigned char, *s))) s++;
+  if (empty || *s != '\0' || (neg && a == 0)) return 0;
+  *result = neg ? cast(lua_Int, 0u - a) : cast(lua_Int, a);
+  return 1;
+}
+
+
+/*
+** converts a numeral to a number of the appropriate subtype
+*/
+int luaO_str2num (const char *s, TValue *result) {
+  lua_Number n;
+#if defined(LUA_INTNUMBER)
+  lua_Int i;
+  if (luaO_str2int(s, &i)) {
+    setivalue(result, i);
+    return 1;
+  }
+#endif
+  if (!luaO_str2d(s, &n)) return 0;
+  setnvalue(result, n);
+  return 1;
+}
+
+
 
 static void pushstr (lua_State *L, const char *str) {
   setsvalue2s(L, L->top, luaS_new(L, str));
@@ -131,7 +213,7 @@ const char *luaO_pushvfstring (lua_State *L, const char *fmt, va_list argp) {
         break;
       }
       case 'd': {
-        setnvalue(L->top, cast_num(va_arg(argp, int)));
+        setivalue(L->top, va_arg(argp, int));
         incr_top(L);
         break;
       }
@@ -60,6 +60,7 @@ typedef union {
   GCObject *gc;
   void *p;
   lua_Number n;
+  lua_Int i;
   int b;
 } Value;
 
@@ -75,9 +76,28 @@ typedef struct lua_TValue {
 } TValue;
 
 
+/*
+** Numbers have two variants, told apart by the bits of `tt' above the
+** type: lua_Number (LUA_TNUMBER) and, with LUA_INTNUMBER, lua_Int
+** (LUA_TINT). `ttype' gives LUA_TNUMBER for both; `nvalue' gives the
+** value of either as a lua_Number.
+*/
+#define LUA_TINT	(LUA_TNUMBER | 0x100)
+
+#if defined(LUA_INTNUMBER)
+#define ttisint(o)	((o)->tt == LUA_TINT)
+/* both integers? (no other tag has the 0x100 bit) */
+#define ttisints(a,b)	(((a)->tt & (b)->tt) == LUA_TINT)
+#else
+#define ttisint(o)	0
+#define ttisints(a,b)	0
+#endif
+
+
 /* Macros to test type */
 #define ttisnil(o)	(ttype(o) == LUA_TNIL)
 #define ttisnumber(o)	(ttype(o) == LUA_TNUMBER)
+#define ttisfloat(o)	((o)->tt == LUA_TNUMBER)
 #define ttisstring(o)	(ttype(o) == LUA_TSTRING)
 #define ttistable(o)	(ttype(o) == LUA_TTABLE)
 #define ttisfunction(o)	(ttype(o) == LUA_TFUNCTION)
@@ -87,10 +107,14 @@ typedef struct lua_TValue {
 #define ttislightuserdata(o)	(ttype(o) == LUA_TLIGHTUSERDATA)
 
 /* Macros to access values */
-#define ttype(o)	((o)->tt)
+#define ttype(o)	((o)->tt & 0xff)
+#define rttype(o)	((o)->tt)
 #define gcvalue(o)	check_exp(iscollectable(o), (o)->value.gc)
 #define pvalue(o)	check_exp(ttislightuserdata(o), (o)->value.p)
-#define nvalue(o)	check_exp(ttisnumber(o), (o)->value.n)
+#define nvalue(o)	check_exp(ttisnumber(o), \
+			  ttisint(o) ? cast_num((o)->value.i) : (o)->value.n)
+#define fltvalue(o)	check_exp(ttisfloat(o), (o)->value.n)
+#define ivalue(o)	check_exp(ttisint(o), (o)->value.i)
 #define rawtsvalue(o)	check_exp(ttisstring(o), &(o)->value.gc->ts)
 #define tsvalue(o)	(&rawtsvalue(o)->tsv)
 #define rawuvalue(o)	check_exp(ttisuserdata(o), &(o)->value.gc->u)
@@ -119,6 +143,13 @@ typedef struct lua_TValue {
 #define setnvalue(obj,x) \
   { TValue *i_o=(obj); i_o->value.n=(x); i_o->tt=LUA_TNUMBER; }
 
+#if defined(LUA_INTNUMBER)
+#define setivalue(obj,x) \
+  { TValue *i_o=(obj); i_o->value.i=(x); i_o->tt=LUA_TINT; }
+#else
+#define setivalue(obj,x)	setnvalue(obj, cast_num(x))
+#endif
+
 #define setpvalue(obj,x) \
   { TValue *i_o=(obj); i_o->value.p=(x); i_o->tt=LUA_TLIGHTUSERDATA; }
 
@@ -183,7 +214,7 @@ typedef struct lua_TValue {
 #define setobj2n	setobj
 #define setsvalue2n	setsvalue
 
-#define setttype(obj, tt) (ttype(obj) = (tt))
+#define setttype(obj, tt) (rttype(obj) = (tt))
 
 
 #define iscollectable(o)	(ttype(o) >= LUA_TSTRING)
@@ -237,6 +268,7 @@ typedef struct Proto {
   struct LocVar *locvars;  /* information about local variables */
   TString **upvalues;  /* upvalue names */
   TString  *source;
+  const struct SharedProto *shared;  /* shared code and debug info, or NULL */
   int sizeupvalues;
   int sizek;  /* size of `k' */
   int sizecode;
@@ -289,8 +321,8 @@ typedef struct UpVal {
 */
 
 #define ClosureHeader \
-	CommonHeader; lu_byte isC; lu_byte nupvalues; GCObject *gclist; \
-	struct Table *env
+	CommonHeader; lu_byte isC; lu_byte nupvalues; lu_byte islight; \
+	GCObject *gclist; struct Table *env
 
 typedef struct CClosure {
   ClosureHeader;
@@ -320,31 +352,18 @@ typedef union Closure {
 ** Tables
 */
 
-typedef union TKey {
-  struct {
-    TValuefields;
-    struct Node *next;  /* for chaining */
-  } nk;
-  TValue tvk;
-} TKey;
-
-
-typedef struct Node {
-  TValue i_val;
-  TKey i_key;
-} Node;
-
-
 typedef struct Table {
   CommonHeader;
   lu_byte flags;  /* 1<<p means tagmethod(p) is not present */ 
-  lu_byte lsizenode;  /* log2 of size of `node' array */
+  lu_byte lsizenode;  /* log2 of number of slots in hash part */
+  int nfree;  /* number of keys that fit before the next rehash */
   struct Table *metatable;
   TValue *array;  /* array part */
-  Node *node;
-  Node *lastfree;  /* any free position is before this position */
+  TValue *node;  /* hash part: values, then keys, then control bytes */
+  TValue *hkey;  /* keys of hash part (inside the `node' block) */
   GCObject *gclist;
   int sizearray;  /* size of `array' array */
+  unsigned int border;  /* last result of `luaH_getn' (a hint) */
 } Table;
 
 
@@ -370,7 +389,11 @@ LUAI_FUNC int luaO_log2 (unsigned int x);
 LUAI_FUNC int luaO_int2fb (unsigned int x);
 LUAI_FUNC int luaO_fb2int (int x);
 LUAI_FUNC int luaO_rawequalObj (const TValue *t1, const TValue *t2);
+LUAI_FUNC int luaO_numequal (const TValue *t1, const TValue *t2);
+LUAI_FUNC int luaO_n2int (lua_Number n, lua_Int *result);
 LUAI_FUNC int luaO_str2d (const char *s, lua_Number *result);
+LUAI_FUNC int luaO_str2int (const char *s, lua_Int *result);
+LUAI_FUNC int luaO_str2num (const char *s, TValue *result);
 LUAI_FUNC const char *luaO_pushvfstring (lua_State *L, const char *fmt,
                                                        va_list argp);
 LUAI_FUNC const char *luaO_pushfstring (lua_State *L, const char *fmt, ...);
@@ -52,10 +52,26 @@ const char *const luaP_opnames[NUM_OPCODES+1] = {
   "CLOSE",
   "CLOSURE",
   "VARARG",
+  "MOVE_MOVE",
+  "MOVE_CALL",
+  "GETGLOBAL_CALL",
+  "GETTABLE_GETTABLE",
+  "GETTABLE_ADD",
+  "ADD_FORLOOP",
   NULL
 };
 
 
+const lu_byte luaP_fusedops[NUM_OPCODES-FIRST_FUSEDOP][2] = {
+  {OP_MOVE, OP_MOVE},			/* OP_MOVE_MOVE */
+  {OP_MOVE, OP_CALL},			/* OP_MOVE_CALL */
+  {OP_GETGLOBAL, OP_CALL},		/* OP_GETGLOBAL_CALL */
+  {OP_GETTABLE, OP_GETTABLE},		/* OP_GETTABLE_GETTABLE */
+  {OP_GETTABLE, OP_ADD},		/* OP_GETTABLE_ADD */
+  {OP_ADD, OP_FORLOOP}			/* OP_ADD_FORLOOP */
+};
+
+
 #define opmode(t,a,b,c,m) (((t)<<7) | ((a)<<6) | ((b)<<4) | ((c)<<2) | (m))
 
 const lu_byte luaP_opmodes[NUM_OPCODES] = {
@@ -98,5 +114,11 @@ const lu_byte luaP_opmodes[NUM_OPCODES] = {
  ,opmode(0, 0, OpArgN, OpArgN, iABC)		/* OP_CLOSE */
  ,opmode(0, 1, OpArgU, OpArgN, iABx)		/* OP_CLOSURE */
  ,opmode(0, 1, OpArgU, OpArgN, iABC)		/* OP_VARARG */
+ ,opmode(0, 1, OpArgR, OpArgN, iABC) 		/* OP_MOVE_MOVE */
+ ,opmode(0, 1, OpArgR, OpArgN, iABC) 		/* OP_MOVE_CALL */
+ ,opmode(0, 1, OpArgK, OpArgN, iABx)		/* OP_GETGLOBAL_CALL */
+ ,opmode(0, 1, OpArgR, OpArgK, iABC)		/* OP_GETTABLE_GETTABLE */
+ ,opmode(0, 1, OpArgR, OpArgK, iABC)		/* OP_GETTABLE_ADD */
+ ,opmode(0, 1, OpArgK, OpArgK, iABC)		/* OP_ADD_FORLOOP */
 };
 
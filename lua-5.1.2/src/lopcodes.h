@@ -204,11 +204,21 @@ OP_SETLIST,/*	A B C	R(A)[(C-1)*FPF+i] := R(A+i), 1 <= i <= B	*/
 OP_CLOSE,/*	A 	close all variables in the stack up to (>=) R(A)*/
 OP_CLOSURE,/*	A Bx	R(A) := closure(KPROTO[Bx], R(A), ... ,R(A+n))	*/
 
-OP_VARARG/*	A B	R(A), R(A+1), ..., R(A+B-1) = vararg		*/
+OP_VARARG,/*	A B	R(A), R(A+1), ..., R(A+B-1) = vararg		*/
+
+/* fused pairs (see `luaK_fuse'): the first instruction of a pair takes
+   one of these opcodes and keeps its arguments; the second is unchanged */
+OP_MOVE_MOVE,/*		MOVE; MOVE					*/
+OP_MOVE_CALL,/*		MOVE; CALL					*/
+OP_GETGLOBAL_CALL,/*	GETGLOBAL; CALL					*/
+OP_GETTABLE_GETTABLE,/*	GETTABLE; GETTABLE				*/
+OP_GETTABLE_ADD,/*	GETTABLE; ADD					*/
+OP_ADD_FORLOOP/*	ADD; FORLOOP					*/
 } OpCode;
 
 
-#define NUM_OPCODES	(cast(int, OP_VARARG) + 1)
+#define NUM_OPCODES	(cast(int, OP_ADD_FORLOOP) + 1)
+#define FIRST_FUSEDOP	OP_MOVE_MOVE
 
 
 
@@ -230,6 +240,9 @@ OP_VARARG/*	A B	R(A), R(A+1), ..., R(A+B-1) = vararg		*/
       (true or false).
 
   (*) All `skips' (pc++) assume that next instruction is a jump
+
+  (*) A fused opcode behaves exactly as its first half followed by the
+      next instruction, which is always its second half.
 ===========================================================================*/
 
 
@@ -261,6 +274,15 @@ LUAI_DATA const lu_byte luaP_opmodes[NUM_OPCODES];
 LUAI_DATA const char *const luaP_opnames[NUM_OPCODES+1];  /* opcode names */
 
 
+/* the two halves of each fused opcode */
+LUAI_DATA const lu_byte luaP_fusedops[NUM_OPCODES-FIRST_FUSEDOP][2];
+
+#define isfusedop(o)	((o) >= FIRST_FUSEDOP)
+#define firstop(o)	(isfusedop(o) ? \
+	cast(OpCode, luaP_fusedops[(o)-FIRST_FUSEDOP][0]) : cast(OpCode, (o)))
+#define secondop(o)	cast(OpCode, luaP_fusedops[(o)-FIRST_FUSEDOP][1])
+
+
 /* number of list items to accumulate before a SETLIST instruction */
 #define LFIELDS_PER_FLUSH	50
 
@@ -144,8 +144,9 @@ static int registerlocalvar (LexState *ls, TString *varname) {
   FuncState *fs = ls->fs;
   Proto *f = fs->f;
   int oldsize = f->sizelocvars;
-  luaM_growvector(ls->L, f->locvars, fs->nlocvars, f->sizelocvars,
-                  LocVar, SHRT_MAX, "too many local variables");
+  luaM_tagged(ls->L, LUA_MEMPROTO,
+              luaM_growvector(ls->L, f->locvars, fs->nlocvars, f->sizelocvars,
+                              LocVar, SHRT_MAX, "too many local variables"));
   while (oldsize < f->sizelocvars) f->locvars[oldsize++].varname = NULL;
   f->locvars[fs->nlocvars].varname = varname;
   luaC_objbarrier(ls->L, f, varname);
@@ -192,8 +193,9 @@ static int indexupvalue (FuncState *fs, TString *name, expdesc *v) {
   }
   /* new one */
   luaY_checklimit(fs, f->nups + 1, LUAI_MAXUPVALUES, "upvalues");
-  luaM_growvector(fs->L, f->upvalues, f->nups, f->sizeupvalues,
-                  TString *, MAX_INT, "");
+  luaM_tagged(fs->L, LUA_MEMPROTO,
+              luaM_growvector(fs->L, f->upvalues, f->nups, f->sizeupvalues,
+                              TString *, MAX_INT, ""));
   while (oldsize < f->sizeupvalues) f->upvalues[oldsize++] = NULL;
   f->upvalues[f->nups] = name;
   luaC_objbarrier(fs->L, f, name);
@@ -312,8 +314,9 @@ static void pushclosure (LexState *ls, FuncState *func, expdesc *v) {
   Proto *f = fs->f;
   int oldsize = f->sizep;
   int i;
-  luaM_growvector(ls->L, f->p, fs->np, f->sizep, Proto *,
-                  MAXARG_Bx, "constant table overflow");
+  luaM_tagged(ls->L, LUA_MEMPROTO,
+              luaM_growvector(ls->L, f->p, fs->np, f->sizep, Proto *,
+                              MAXARG_Bx, "constant table overflow"));
   while (oldsize < f->sizep) f->p[oldsize++] = NULL;
   f->p[fs->np++] = func->f;
   luaC_objbarrier(ls->L, f, func->f);
@@ -359,17 +362,28 @@ static void close_func (LexState *ls) {
   Proto *f = fs->f;
   removevars(ls, 0);
   luaK_ret(fs, 0, 0);  /* final return */
-  luaM_reallocvector(L, f->code, f->sizecode, fs->pc, Instruction);
+#if defined(LUA_FUSEOPS)
+  luaK_fuse(fs);
+#endif
+  luaM_tagged(L, LUA_MEMPROTO,
+              luaM_reallocvector(L, f->code, f->sizecode, fs->pc, Instruction));
   f->sizecode = fs->pc;
-  luaM_reallocvector(L, f->lineinfo, f->sizelineinfo, fs->pc, int);
+  luaM_tagged(L, LUA_MEMPROTO,
+              luaM_reallocvector(L, f->lineinfo, f->sizelineinfo, fs->pc, int));
   f->sizelineinfo = fs->pc;
-  luaM_reallocvector(L, f->k, f->sizek, fs->nk, TValue);
+  luaM_tagged(L, LUA_MEMPROTO,
+              luaM_reallocvector(L, f->k, f->sizek, fs->nk, TValue));
   f->sizek = fs->nk;
-  luaM_reallocvector(L, f->p, f->sizep, fs->np, Proto *);
+  luaM_tagged(L, LUA_MEMPROTO,
+              luaM_reallocvector(L, f->p, f->sizep, fs->np, Proto *));
   f->sizep = fs->np;
-  luaM_reallocvector(L, f->locvars, f->sizelocvars, fs->nlocvars, LocVar);
+  luaM_tagged(L, LUA_MEMPROTO,
+              luaM_reallocvector(L, f->locvars, f->sizelocvars, fs->nlocvars,
+                                 LocVar));
   f->sizelocvars = fs->nlocvars;
-  luaM_reallocvector(L, f->upvalues, f->sizeupvalues, f->nups, TString *);
+  luaM_tagged(L, LUA_MEMPROTO,
+              luaM_reallocvector(L, f->upvalues, f->sizeupvalues, f->nups,
+                                 TString *));
   f->sizeupvalues = f->nups;
   lua_assert(luaG_checkcode(f));
   lua_assert(fs->bl == NULL);
@@ -725,7 +739,7 @@ static void primaryexp (LexState *ls, expdesc *v) {
 
 
 static void simpleexp (LexState *ls, expdesc *v) {
-  /* simpleexp -> NUMBER | STRING | NIL | true | false | ... |
+  /* simpleexp -> NUMBER | INT | STRING | NIL | true | false | ... |
                   constructor | FUNCTION body | primaryexp */
   switch (ls->t.token) {
     case TK_NUMBER: {
@@ -733,6 +747,11 @@ static void simpleexp (LexState *ls, expdesc *v) {
       v->u.nval = ls->t.seminfo.r;
       break;
     }
+    case TK_INT: {
+      init_exp(v, VKINT, 0);
+      v->u.ival = ls->t.seminfo.i;
+      break;
+    }
     case TK_STRING: {
       codestring(ls, v, ls->t.seminfo.ts);
       break;
@@ -1077,7 +1096,7 @@ static void fornum (LexState *ls, TString *varname, int line) {
   if (testnext(ls, ','))
     exp1(ls);  /* optional step */
   else {  /* default step = 1 */
-    luaK_codeABx(fs, OP_LOADK, fs->freereg, luaK_numberK(fs, 1));
+    luaK_codeABx(fs, OP_LOADK, fs->freereg, luaK_intK(fs, 1));
     luaK_reserveregs(fs, 1);
   }
   forbody(ls, base, line, 1, 1);
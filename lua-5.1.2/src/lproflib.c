@@ -0,0 +1,487 @@
+/*
+** $Id: lproflib.c $
+** Sampling profiler for Lua programs
+** See Copyright Notice in lua.h
+*/
+
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#define lproflib_c
+#define LUA_LIB
+
+#include "lua.h"
+
+#include "lauxlib.h"
+#include "lualib.h"
+
+
+/*
+** The profiler never installs a debug hook: an interval timer calls
+** `lua_sample', which only raises a flag, and the interpreter runs
+** `samplehook' at the next backward jump or call. Each sample records
+** the collapsed call stack (root first, frames separated by ';', as
+** expected by flamegraph tools) plus self and total counts for each
+** function on it.
+*/
+
+
+#define PROF_MAXDEPTH	64	/* frames recorded per sample */
+#define PROF_INTERVAL	1000	/* default sampling interval (microseconds) */
+
+
+/* slots of the profile table (kept in the registry) */
+#define PROF_STACKS	1	/* collapsed stack -> samples */
+#define PROF_SELF	2	/* function -> samples as leaf */
+#define PROF_TOTAL	3	/* function -> samples on stack */
+#define PROF_NSLOTS	3
+
+
+static const char KEY_PROFILE = 'p';
+
+static lua_State *volatile profstate = NULL;  /* state being profiled */
+static clock_t profstart;  /* CPU clock when the profiler was (re)started */
+static double profcpu = 0;  /* CPU seconds profiled before `profstart' */
+
+
+
+static void newprofile (lua_State *L) {
+  int i;
+  lua_pushlightuserdata(L, (void *)&KEY_PROFILE);
+  lua_createtable(L, PROF_NSLOTS, 0);
+  for (i = 1; i <= PROF_NSLOTS; i++) {
+    lua_newtable(L);
+    lua_rawseti(L, -2, i);
+  }
+  lua_rawset(L, LUA_REGISTRYINDEX);
+}
+
+
+static void getprofile (lua_State *L) {
+  lua_pushlightuserdata(L, (void *)&KEY_PROFILE);
+  lua_rawget(L, LUA_REGISTRYINDEX);
+  if (!lua_istable(L, -1)) {
+    lua_pop(L, 1);
+    newprofile(L);
+    lua_pushlightuserdata(L, (void *)&KEY_PROFILE);
+    lua_rawget(L, LUA_REGISTRYINDEX);
+  }
+}
+
+
+/* t[key] = t[key] + 1, where `key' is on the top (and is popped) */
+static void incrcount (lua_State *L, int t) {
+  lua_Integer n;
+  lua_pushvalue(L, -1);
+  lua_rawget(L, t);
+  n = lua_tointeger(L, -1);
+  lua_pop(L, 1);
+  lua_pushinteger(L, n + 1);
+  lua_rawset(L, t);
+}
+
+
+static void pushframe (lua_State *L, lua_Debug *ar) {
+  const char *name = ar->name;
+  if (name == NULL)
+    name = (*ar->what == 'm') ? "main" : "?";
+  if (*ar->what == 'C')
+    lua_pushfstring(L, "%s@[C]", name);
+  else
+    lua_pushfstring(L, "%s@%s:%d", name, ar->short_src, ar->linedefined);
+}
+
+
+static void samplehook (lua_State *L, lua_Debug *ar) {
+  lua_Debug fr;
+  luaL_Buffer b;
+  int prof, base, depth, i, j;
+  (void)ar;
+  if (!lua_checkstack(L, PROF_MAXDEPTH + LUA_MINSTACK))
+    return;  /* skip this sample */
+  getprofile(L);
+  prof = lua_gettop(L);
+  for (i = 1; i <= PROF_NSLOTS; i++)
+    lua_rawgeti(L, prof, i);
+  base = lua_gettop(L);
+  for (depth = 0; depth < PROF_MAXDEPTH && lua_getstack(L, depth, &fr);
+       depth++) {
+    lua_getinfo(L, "Sn", &fr);
+    pushframe(L, &fr);  /* frame `depth' goes to `base+depth+1' */
+  }
+  if (depth > 0) {
+    luaL_buffinit(L, &b);
+    for (i = depth; i >= 1; i--) {  /* root first */
+      lua_pushvalue(L, base + i);
+      luaL_addvalue(&b);
+      if (i > 1) luaL_addchar(&b, ';');
+    }
+    luaL_pushresult(&b);
+    incrcount(L, prof + PROF_STACKS);
+    lua_pushvalue(L, base + 1);
+    incrcount(L, prof + PROF_SELF);
+    for (i = 1; i <= depth; i++) {
+      for (j = 1; j < i; j++)  /* count recursive functions only once */
+        if (lua_rawequal(L, base + j, base + i)) break;
+      if (j == i) {
+        lua_pushvalue(L, base + i);
+        incrcount(L, prof + PROF_TOTAL);
+      }
+    }
+  }
+  lua_settop(L, prof - 1);
+}
+
+
+/*
+** {======================================================
+** Wall clock and hardware counters
+** =======================================================
+*/
+
+#if defined(LUA_USE_POSIX)
+
+static double wallclock (void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+#else
+
+static double wallclock (void) {
+  return (double)clock() / CLOCKS_PER_SEC;  /* best we can do */
+}
+
+#endif
+
+
+#if defined(LUA_USE_PERFEVENTS)
+
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+static const struct {
+  const char *name;
+  unsigned long long config;
+} perfcounters[] = {
+  {"instructions", PERF_COUNT_HW_INSTRUCTIONS},
+  {"cycles", PERF_COUNT_HW_CPU_CYCLES},
+  {"cachemisses", PERF_COUNT_HW_CACHE_MISSES},
+  {"branchmisses", PERF_COUNT_HW_BRANCH_MISSES}
+};
+
+#define NPERFCOUNTERS	(sizeof(perfcounters)/sizeof(perfcounters[0]))
+
+static const char KEY_COUNTERS = 'c';
+
+/* file descriptors of the counters of a state (kept in its registry) */
+typedef struct Counters {
+  int fd[NPERFCOUNTERS];
+} Counters;
+
+
+static int closecounters (lua_State *L) {
+  Counters *c = (Counters *)lua_touserdata(L, 1);
+  size_t i;
+  for (i = 0; i < NPERFCOUNTERS; i++) {
+    if (c->fd[i] >= 0) close(c->fd[i]);
+    c->fd[i] = -1;
+  }
+  return 0;
+}
+
+
+/*
+** Counts user-space events of the calling thread, from the first call
+** on; the counters are closed with the state.
+*/
+static Counters *getcounters (lua_State *L) {
+  Counters *c;
+  size_t i;
+  lua_pushlightuserdata(L, (void *)&KEY_COUNTERS);
+  lua_rawget(L, LUA_REGISTRYINDEX);
+  c = (Counters *)lua_touserdata(L, -1);
+  lua_pop(L, 1);
+  if (c != NULL) return c;
+  lua_pushlightuserdata(L, (void *)&KEY_COUNTERS);
+  c = (Counters *)lua_newuserdata(L, sizeof(Counters));
+  for (i = 0; i < NPERFCOUNTERS; i++)
+    c->fd[i] = -1;
+  lua_createtable(L, 0, 1);
+  lua_pushcfunction(L, closecounters);
+  lua_setfield(L, -2, "__gc");
+  lua_setmetatable(L, -2);
+  lua_rawset(L, LUA_REGISTRYINDEX);
+  for (i = 0; i < NPERFCOUNTERS; i++) {
+    struct perf_event_attr pe;
+    memset(&pe, 0, sizeof(pe));
+    pe.type = PERF_TYPE_HARDWARE;
+    pe.size = sizeof(pe);
+    pe.config = perfcounters[i].config;
+    pe.exclude_kernel = 1;
+    pe.exclude_hv = 1;
+    c->fd[i] = (int)syscall(__NR_perf_event_open, &pe, 0, -1, -1, 0);
+  }
+  return c;
+}
+
+
+static int pushcounters (lua_State *L) {
+  Counters *ct = getcounters(L);
+  size_t i;
+  int n = 0;
+  lua_createtable(L, 0, NPERFCOUNTERS);
+  for (i = 0; i < NPERFCOUNTERS; i++) {
+    unsigned long long c;
+    if (ct->fd[i] >= 0 && read(ct->fd[i], &c, sizeof(c)) == sizeof(c)) {
+      lua_pushinteger(L, (lua_Integer)c);
+      lua_setfield(L, -2, perfcounters[i].name);
+      n++;
+    }
+  }
+  return n;
+}
+
+#else
+
+static int pushcounters (lua_State *L) {
+  lua_newtable(L);
+  return 0;  /* no counters on this system */
+}
+
+#endif
+
+/* }====================================================== */
+
+
+#if defined(LUA_USE_ITIMER)
+
+#include <signal.h>
+#include <sys/time.h>
+
+static struct sigaction oldaction;
+
+static void profsignal (int i) {
+  lua_State *L = profstate;
+  (void)i;
+  if (L != NULL)
+    lua_sample(L);  /* only raises a flag; safe inside a handler */
+}
+
+
+static int starttimer (long usec) {
+  struct sigaction sa;
+  struct itimerval tv;
+  sa.sa_handler = profsignal;
+  sigemptyset(&sa.sa_mask);
+  sa.sa_flags = SA_RESTART;
+  if (sigaction(SIGPROF, &sa, &oldaction) != 0)
+    return 0;
+  tv.it_interval.tv_sec = usec / 1000000;
+  tv.it_interval.tv_usec = usec % 1000000;
+  tv.it_value = tv.it_interval;
+  if (setitimer(ITIMER_PROF, &tv, NULL) != 0) {
+    sigaction(SIGPROF, &oldaction, NULL);
+    return 0;
+  }
+  return 1;
+}
+
+
+static void stoptimer (void) {
+  struct itimerval tv;
+  memset(&tv, 0, sizeof(tv));
+  setitimer(ITIMER_PROF, &tv, NULL);
+  sigaction(SIGPROF, &oldaction, NULL);
+}
+
+#else
+
+static int starttimer (long usec) {
+  (void)usec;
+  return 0;  /* no interval timers on this system */
+}
+
+
+static void stoptimer (void) {
+}
+
+#endif
+
+
+
+static int prof_start (lua_State *L) {
+  long usec = (long)luaL_optinteger(L, 1, PROF_INTERVAL);
+  luaL_argcheck(L, usec > 0, 1, "interval must be positive");
+  if (profstate != NULL)
+    return luaL_error(L, "profiler already running");
+  getprofile(L);  /* make sure the profile table exists */
+  lua_setsamplehook(L, samplehook);
+  profstart = clock();
+  profstate = L;
+  if (!starttimer(usec)) {
+    profstate = NULL;
+    lua_setsamplehook(L, NULL);
+    return luaL_error(L, "cannot start profiler timer");
+  }
+  return 0;
+}
+
+
+static int prof_stop (lua_State *L) {
+  if (profstate != NULL) {
+    stoptimer();
+    lua_setsamplehook(profstate, NULL);
+    profstate = NULL;
+    profcpu += (double)(clock() - profstart) / CLOCKS_PER_SEC;
+  }
+  (void)L;
+  return 0;
+}
+
+
+static int prof_reset (lua_State *L) {
+  newprofile(L);
+  profstart = clock();
+  profcpu = 0;
+  return 0;
+}
+
+
+/* failure results of `prof_dump', as returned by `io.open' */
+static int prof_fileerror (lua_State *L, const char *filename) {
+  int en = errno;  /* calls to Lua API may change this value */
+  lua_pushnil(L);
+  lua_pushfstring(L, "%s: %s", filename, strerror(en));
+  lua_pushinteger(L, en);
+  return 3;
+}
+
+
+/*
+** Writes (or returns) the collapsed stacks, one "stack count" per line.
+*/
+static int prof_dump (lua_State *L) {
+  const char *filename = luaL_optstring(L, 1, NULL);
+  luaL_Buffer b;
+  int n = 0;
+  int i;
+  lua_settop(L, 1);
+  getprofile(L);
+  lua_rawgeti(L, 2, PROF_STACKS);
+  lua_newtable(L);  /* lines */
+  lua_pushnil(L);
+  while (lua_next(L, 3)) {
+    lua_pushfstring(L, "%s %d\n", lua_tostring(L, -2),
+                       (int)lua_tointeger(L, -1));
+    lua_rawseti(L, 4, ++n);
+    lua_pop(L, 1);  /* remove count; keep key for next iteration */
+  }
+  luaL_buffinit(L, &b);
+  for (i = 1; i <= n; i++) {
+    lua_rawgeti(L, 4, i);
+    luaL_addvalue(&b);
+  }
+  luaL_pushresult(&b);
+  if (filename != NULL) {
+    size_t l;
+    const char *s = lua_tolstring(L, -1, &l);
+    FILE *f = fopen(filename, "w");
+    int ok;
+    if (f == NULL)
+      return prof_fileerror(L, filename);
+    ok = (fwrite(s, 1, l, f) == l);
+    if (fclose(f) != 0) ok = 0;
+    if (!ok)
+      return prof_fileerror(L, filename);
+    lua_pushboolean(L, 1);
+    return 1;
+  }
+  return 1;
+}
+
+
+/*
+** Returns a table mapping each function to {self=, total=} seconds.
+** Timers may deliver fewer signals than asked for, so the profiled CPU
+** time is spread evenly over the samples actually taken.
+*/
+static int prof_report (lua_State *L) {
+  double cpu = profcpu;
+  lua_Integer nsamples = 0;
+  lua_Number secs;
+  lua_settop(L, 0);
+  getprofile(L);
+  lua_rawgeti(L, 1, PROF_SELF);
+  lua_rawgeti(L, 1, PROF_TOTAL);
+  lua_pushnil(L);
+  while (lua_next(L, 2)) {  /* every sample has exactly one leaf */
+    nsamples += lua_tointeger(L, -1);
+    lua_pop(L, 1);
+  }
+  if (profstate != NULL)
+    cpu += (double)(clock() - profstart) / CLOCKS_PER_SEC;
+  secs = (nsamples > 0) ? (lua_Number)(cpu / nsamples) : 0;
+  lua_newtable(L);
+  lua_pushnil(L);
+  while (lua_next(L, 3)) {  /* for each function on any stack */
+    lua_Integer total = lua_tointeger(L, -1);
+    lua_pop(L, 1);
+    lua_pushvalue(L, -1);
+    lua_rawget(L, 2);
+    lua_createtable(L, 0, 2);
+    lua_pushnumber(L, (lua_Number)lua_tointeger(L, -2) * secs);
+    lua_setfield(L, -2, "self");
+    lua_pushnumber(L, (lua_Number)total * secs);
+    lua_setfield(L, -2, "total");
+    lua_remove(L, -2);  /* remove self count */
+    lua_pushvalue(L, -2);
+    lua_insert(L, -2);
+    lua_rawset(L, 4);
+  }
+  return 1;
+}
+
+
+static int prof_clock (lua_State *L) {
+  lua_pushnumber(L, (lua_Number)wallclock());
+  return 1;
+}
+
+
+/*
+** Returns a table with the hardware counters available (instructions,
+** cycles, cachemisses, branchmisses), or nil if there are none.
+*/
+static int prof_counters (lua_State *L) {
+  if (pushcounters(L) == 0) {
+    lua_pushnil(L);
+    lua_pushliteral(L, "hardware counters not available");
+    return 2;
+  }
+  return 1;
+}
+
+
+static const luaL_Reg proflib[] = {
+  {"clock", prof_clock},
+  {"counters", prof_counters},
+  {"dump", prof_dump},
+  {"report", prof_report},
+  {"reset", prof_reset},
+  {"start", prof_start},
+  {"stop", prof_stop},
+  {NULL, NULL}
+};
+
+
+LUALIB_API int luaopen_profiler (lua_State *L) {
+  luaL_register(L, LUA_PROFLIBNAME, proflib);
+  return 1;
+}
+
@@ -6,6 +6,7 @@
 
 
 #include <stddef.h>
+#include <time.h>
 
 #define lstate_c
 #define LUA_CORE
@@ -39,15 +40,9 @@ typedef struct LG {
   
 
 
-static void stack_init (lua_State *L1, lua_State *L) {
-  /* initialize CallInfo array */
-  L1->base_ci = luaM_newvector(L, BASIC_CI_SIZE, CallInfo);
+static void stack_reset (lua_State *L1) {
   L1->ci = L1->base_ci;
-  L1->size_ci = BASIC_CI_SIZE;
   L1->end_ci = L1->base_ci + L1->size_ci - 1;
-  /* initialize stack array */
-  L1->stack = luaM_newvector(L, BASIC_STACK_SIZE + EXTRA_STACK, TValue);
-  L1->stacksize = BASIC_STACK_SIZE + EXTRA_STACK;
   L1->top = L1->stack;
   L1->stack_last = L1->stack+(L1->stacksize - EXTRA_STACK)-1;
   /* initialize first ci */
@@ -58,9 +53,40 @@ static void stack_init (lua_State *L1, lua_State *L) {
 }
 
 
+static void stack_init (lua_State *L1, lua_State *L, int size) {
+  /* initialize CallInfo array */
+  luaM_tagged(L, LUA_TTHREAD,
+              L1->base_ci = luaM_newvector(L, BASIC_CI_SIZE, CallInfo));
+  L1->size_ci = BASIC_CI_SIZE;
+  /* initialize stack array */
+  luaM_tagged(L, LUA_TTHREAD,
+              L1->stack = luaM_newvector(L, size + EXTRA_STACK, TValue));
+  L1->stacksize = size + EXTRA_STACK;
+  stack_reset(L1);
+}
+
+
 static void freestack (lua_State *L, lua_State *L1) {
-  luaM_freearray(L, L1->base_ci, L1->size_ci, CallInfo);
-  luaM_freearray(L, L1->stack, L1->stacksize, TValue);
+  luaM_tagged(L, LUA_TTHREAD,
+              luaM_freearray(L, L1->base_ci, L1->size_ci, CallInfo));
+  luaM_tagged(L, LUA_TTHREAD,
+              luaM_freearray(L, L1->stack, L1->stacksize, TValue));
+}
+
+
+/*
+** a seed for the string hash; mixing in some addresses keeps it
+** unpredictable even when the clock is not
+*/
+#if !defined(luai_makeseed)
+#define luai_makeseed()		cast(unsigned int, time(NULL))
+#endif
+
+static unsigned int makeseed (lua_State *L) {
+  unsigned int h = luai_makeseed();
+  size_t a = cast(size_t, L) ^ cast(size_t, &h);
+  h ^= cast(unsigned int, a) ^ cast(unsigned int, (a >> 16) >> 16);
+  return h;
 }
 
 
@@ -70,7 +96,7 @@ static void freestack (lua_State *L, lua_State *L1) {
 static void f_luaopen (lua_State *L, void *ud) {
   global_State *g = G(L);
   UNUSED(ud);
-  stack_init(L, L);  /* init stack */
+  stack_init(L, L, BASIC_STACK_SIZE);  /* init stack */
   sethvalue(L, gt(L), luaH_new(L, 0, 2));  /* table of globals */
   sethvalue(L, registry(L), luaH_new(L, 0, 2));  /* registry */
   luaS_resize(L, MINSTRTABSIZE);  /* initial size of string table */
@@ -96,6 +122,7 @@ static void preinit_state (lua_State *L, global_State *g) {
   L->nCcalls = 0;
   L->status = 0;
   L->base_ci = L->ci = NULL;
+  L->lightfunc = NULL;
   L->savedpc = NULL;
   L->errfunc = 0;
   setnilvalue(gt(L));
@@ -104,11 +131,14 @@ static void preinit_state (lua_State *L, global_State *g) {
 
 static void close_state (lua_State *L) {
   global_State *g = G(L);
+  luaM_bgfree(L, 0);  /* wait for pending frees; free the rest here */
   luaF_close(L, L->stack);  /* close all upvalues for this thread */
   luaC_freeall(L);  /* collect all objects */
+  luaE_freepool(L);
   lua_assert(g->rootgc == obj2gco(L));
   lua_assert(g->strt.nuse == 0);
   luaM_freearray(L, G(L)->strt.hash, G(L)->strt.size, TString *);
+  luaM_freearray(L, G(L)->strt.oldhash, G(L)->strt.oldsize, TString *);
   luaZ_freebuffer(L, &g->buff);
   freestack(L, L);
   lua_assert(g->totalbytes == sizeof(LG));
@@ -116,11 +146,36 @@ static void close_state (lua_State *L) {
 }
 
 
+/*
+** Collected threads go to list `freethreads' (linked by field `next')
+** with their stacks, so that creating a coroutine usually costs no
+** allocation at all. Only threads with small stacks are kept.
+*/
 lua_State *luaE_newthread (lua_State *L) {
-  lua_State *L1 = tostate(luaM_malloc(L, state_size(lua_State)));
-  luaC_link(L, obj2gco(L1), LUA_TTHREAD);
-  preinit_state(L1, G(L));
-  stack_init(L1, L);  /* init stack */
+  global_State *g = G(L);
+  lua_State *L1;
+  if (g->freethreads != NULL) {  /* reuse a dead thread? */
+    StkId stack;
+    CallInfo *base_ci;
+    int stacksize, size_ci;
+    L1 = gco2th(g->freethreads);
+    g->freethreads = L1->next;
+    g->nfreethreads--;
+    stack = L1->stack; stacksize = L1->stacksize;
+    base_ci = L1->base_ci; size_ci = L1->size_ci;
+    luaC_link(L, obj2gco(L1), LUA_TTHREAD);
+    preinit_state(L1, g);
+    L1->stack = stack; L1->stacksize = stacksize;
+    L1->base_ci = base_ci; L1->size_ci = size_ci;
+    stack_reset(L1);
+  }
+  else {
+    luaM_tagged(L, LUA_TTHREAD,
+                L1 = tostate(luaM_malloc(L, state_size(lua_State))));
+    luaC_link(L, obj2gco(L1), LUA_TTHREAD);
+    preinit_state(L1, g);
+    stack_init(L1, L, THREAD_STACK_SIZE);  /* init stack */
+  }
   setobj2n(L, gt(L1), gt(L));  /* share table of globals */
   L1->hookmask = L->hookmask;
   L1->basehookcount = L->basehookcount;
@@ -135,8 +190,29 @@ void luaE_freethread (lua_State *L, lua_State *L1) {
   luaF_close(L1, L1->stack);  /* close all upvalues for this thread */
   lua_assert(L1->openupval == NULL);
   luai_userstatefree(L1);
+  if (G(L)->nfreethreads < LUAI_MAXFREETHREADS &&
+      L1->stacksize <= MAXFREE_STACK_SIZE && L1->size_ci <= MAXFREE_CI_SIZE) {
+    L1->next = G(L)->freethreads;  /* keep it for `luaE_newthread' */
+    G(L)->freethreads = obj2gco(L1);
+    G(L)->nfreethreads++;
+    return;
+  }
   freestack(L, L1);
-  luaM_freemem(L, fromstate(L1), state_size(lua_State));
+  luaM_tagged(L, LUA_TTHREAD,
+              luaM_freemem(L, fromstate(L1), state_size(lua_State)));
+}
+
+
+void luaE_freepool (lua_State *L) {
+  global_State *g = G(L);
+  while (g->freethreads != NULL) {
+    lua_State *L1 = gco2th(g->freethreads);
+    g->freethreads = L1->next;
+    freestack(L, L1);
+    luaM_tagged(L, LUA_TTHREAD,
+                luaM_freemem(L, fromstate(L1), state_size(lua_State)));
+  }
+  g->nfreethreads = 0;
 }
 
 
@@ -157,15 +233,24 @@ LUA_API lua_State *lua_newstate (lua_Alloc f, void *ud) {
   g->frealloc = f;
   g->ud = ud;
   g->mainthread = L;
+  g->freethreads = NULL;
+  g->nfreethreads = 0;
+  g->bgfree = NULL;
   g->uvhead.u.l.prev = &g->uvhead;
   g->uvhead.u.l.next = &g->uvhead;
   g->GCthreshold = 0;  /* mark it as unfinished state */
   g->strt.size = 0;
   g->strt.nuse = 0;
   g->strt.hash = NULL;
+  g->strt.oldhash = NULL;
+  g->strt.oldsize = 0;
+  g->strt.rehashpos = 0;
+  g->seed = makeseed(L);
   setnilvalue(registry(L));
   luaZ_initbuffer(L, &g->buff);
   g->panic = NULL;
+  g->samplehook = NULL;
+  g->samplepending = 0;
   g->gcstate = GCSpause;
   g->rootgc = obj2gco(L);
   g->sweepstrgc = 0;
@@ -175,6 +260,15 @@ LUA_API lua_State *lua_newstate (lua_Alloc f, void *ud) {
   g->weak = NULL;
   g->tmudata = NULL;
   g->totalbytes = sizeof(LG);
+  g->peakbytes = sizeof(LG);
+#if defined(LUA_USE_GCSTATS)
+  for (i=0; i<LUA_NUMMEMSTAT; i++) {
+    g->memstat[i].bytes = g->memstat[i].objects = g->memstat[i].allocs = 0;
+  }
+  g->memtag = LUA_MEMOTHER;
+  g->memstat[LUA_TTHREAD].bytes = sizeof(LG);  /* main thread */
+  g->memstat[LUA_TTHREAD].objects = g->memstat[LUA_TTHREAD].allocs = 1;
+#endif
   g->gcpause = LUAI_GCPAUSE;
   g->gcstepmul = LUAI_GCMUL;
   g->gcdept = 0;
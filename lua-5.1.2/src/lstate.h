@@ -33,12 +33,23 @@ struct lua_longjmp;  /* defined in ldo.c */
 
 #define BASIC_STACK_SIZE        (2*LUA_MINSTACK)
 
+/* coroutines start with a smaller stack (just enough for the first `ci')
+   and grow it on demand */
+#define THREAD_STACK_SIZE       (LUA_MINSTACK+2)
+
+/* largest stacks kept by dead threads waiting for reuse */
+#define MAXFREE_CI_SIZE         (4*BASIC_CI_SIZE)
+#define MAXFREE_STACK_SIZE      (4*BASIC_STACK_SIZE+EXTRA_STACK)
+
 
 
 typedef struct stringtable {
   GCObject **hash;
-  lu_int32 nuse;  /* number of elements */
+  lu_int32 nuse;  /* number of elements (in both arrays) */
   int size;
+  GCObject **oldhash;  /* previous array while a rehash is in progress */
+  int oldsize;
+  int rehashpos;  /* first bucket of `oldhash' not yet migrated */
 } stringtable;
 
 
@@ -67,8 +78,15 @@ typedef struct CallInfo {
 */
 typedef struct global_State {
   stringtable strt;  /* hash table for strings */
+  unsigned int seed;  /* randomized seed for string hashes */
   lua_Alloc frealloc;  /* function to reallocate memory */
   void *ud;         /* auxiliary data to `frealloc' */
+#if defined(LUA_USE_GCSTATS)
+  lu_byte memtag;  /* category charged for allocations (see `luaM_tagged') */
+  lua_MemStat memstat[LUA_NUMMEMSTAT];
+#endif
+  lua_Hook samplehook;  /* profiler hook (see `lua_sample') */
+  volatile lu_byte samplepending;  /* sample requested (e.g. by a timer) */
   lu_byte currentwhite;
   lu_byte gcstate;  /* state of garbage collector */
   int sweepstrgc;  /* position of sweep in `strt' */
@@ -81,13 +99,17 @@ typedef struct global_State {
   Mbuffer buff;  /* temporary buffer for string concatentation */
   lu_mem GCthreshold;
   lu_mem totalbytes;  /* number of bytes currently allocated */
+  lu_mem peakbytes;  /* highest `totalbytes' since the last reset */
   lu_mem estimate;  /* an estimate of number of bytes actually in use */
   lu_mem gcdept;  /* how much GC is `behind schedule' */
+  struct FreeQueue *bgfree;  /* background freeing thread (see lmem.c) */
   int gcpause;  /* size of pause between successive GCs */
   int gcstepmul;  /* GC `granularity' */
   lua_CFunction panic;  /* to be called in unprotected errors */
   TValue l_registry;
   struct lua_State *mainthread;
+  GCObject *freethreads;  /* dead threads kept for reuse (see `luaE_newthread') */
+  int nfreethreads;  /* length of list `freethreads' */
   UpVal uvhead;  /* head of double-linked list of all open upvalues */
   struct Table *mt[NUM_TAGS];  /* metatables for basic types */
   TString *tmname[TM_N];  /* array with tag-method names */
@@ -104,6 +126,8 @@ struct lua_State {
   StkId base;  /* base of current function */
   global_State *l_G;
   CallInfo *ci;  /* call info for current function */
+  StkId lightfunc;  /* light C function running without a `ci' (or NULL) */
+  int lightnres;  /* number of results it must leave */
   const Instruction *savedpc;  /* `savedpc' of current function */
   StkId stack_last;  /* last free slot in the stack */
   StkId stack;  /* stack base */
@@ -163,6 +187,7 @@ union GCObject {
 
 LUAI_FUNC lua_State *luaE_newthread (lua_State *L);
 LUAI_FUNC void luaE_freethread (lua_State *L, lua_State *L1);
+LUAI_FUNC void luaE_freepool (lua_State *L);
 
 #endif
 
@@ -19,29 +19,97 @@
 
 
 
+/*
+** Seeded hash over the whole string. The body is consumed one 32-bit
+** word at a time (a MurmurHash3-style mix), so long strings that only
+** differ in a few bytes still spread over the table.
+*/
+#define rotl32(x,n)	(((x) << (n)) | ((x) >> (32 - (n))))
+
+static unsigned int hashstr (const char *str, size_t l, unsigned int seed) {
+  const unsigned char *s = cast(const unsigned char *, str);
+  lu_int32 h = cast(lu_int32, seed) ^ cast(lu_int32, l);
+  lu_int32 k;
+  for (; l >= 4; l -= 4, s += 4) {
+    memcpy(&k, s, sizeof(k));
+    k *= 0xcc9e2d51;
+    k = rotl32(k, 15);
+    k *= 0x1b873593;
+    h ^= k;
+    h = rotl32(h, 13);
+    h = h*5 + 0xe6546b64;
+  }
+  k = 0;
+  switch (l) {  /* remaining bytes */
+    case 3: k ^= cast(lu_int32, s[2]) << 16;  /* FALLTHROUGH */
+    case 2: k ^= cast(lu_int32, s[1]) << 8;  /* FALLTHROUGH */
+    case 1: k ^= s[0];
+      k *= 0xcc9e2d51;
+      k = rotl32(k, 15);
+      k *= 0x1b873593;
+      h ^= k;
+  }
+  h ^= h >> 16;  /* final avalanche */
+  h *= 0x85ebca6b;
+  h ^= h >> 13;
+  h *= 0xc2b2ae35;
+  h ^= h >> 16;
+  return cast(unsigned int, h);
+}
+
+
+/*
+** move the chain of the next old bucket into the current hash array
+*/
+static void migratebucket (stringtable *tb) {
+  GCObject *p = tb->oldhash[tb->rehashpos];
+  tb->oldhash[tb->rehashpos++] = NULL;
+  while (p) {  /* for each node in the list */
+    GCObject *next = p->gch.next;  /* save next */
+    unsigned int h = gco2ts(p)->hash;
+    int h1 = lmod(h, tb->size);  /* new position */
+    lua_assert(cast_int(h%tb->size) == lmod(h, tb->size));
+    p->gch.next = tb->hash[h1];  /* chain it */
+    tb->hash[h1] = p;
+    p = next;
+  }
+}
+
+
+/*
+** Migrate up to `n' buckets of a pending rehash. Called on string
+** creation and from GC steps, so a resize never stops the world.
+*/
+void luaS_rehashstep (lua_State *L, int n) {
+  stringtable *tb = &G(L)->strt;
+  if (tb->oldhash == NULL || G(L)->gcstate == GCSsweepstring)
+    return;  /* nothing to do, or cannot move strings during GC traverse */
+  while (n-- > 0 && tb->rehashpos < tb->oldsize)
+    migratebucket(tb);
+  if (tb->rehashpos >= tb->oldsize) {  /* done? */
+    luaM_freearray(L, tb->oldhash, tb->oldsize, TString *);
+    tb->oldhash = NULL;
+    tb->oldsize = 0;
+    tb->rehashpos = 0;
+  }
+}
+
+
 void luaS_resize (lua_State *L, int newsize) {
   GCObject **newhash;
   stringtable *tb;
   int i;
   if (G(L)->gcstate == GCSsweepstring)
     return;  /* cannot resize during GC traverse */
-  newhash = luaM_newvector(L, newsize, GCObject *);
   tb = &G(L)->strt;
+  luaS_rehashstep(L, MAX_INT);  /* finish previous rehash, if any */
+  newhash = luaM_newvector(L, newsize, GCObject *);
   for (i=0; i<newsize; i++) newhash[i] = NULL;
-  /* rehash */
-  for (i=0; i<tb->size; i++) {
-    GCObject *p = tb->hash[i];
-    while (p) {  /* for each node in the list */
-      GCObject *next = p->gch.next;  /* save next */
-      unsigned int h = gco2ts(p)->hash;
-      int h1 = lmod(h, newsize);  /* new position */
-      lua_assert(cast_int(h%newsize) == lmod(h, newsize));
-      p->gch.next = newhash[h1];  /* chain it */
-      newhash[h1] = p;
-      p = next;
-    }
+  if (tb->size > 0) {  /* old buckets are migrated incrementally */
+    tb->oldhash = tb->hash;
+    tb->oldsize = tb->size;
+    tb->rehashpos = 0;
   }
-  luaM_freearray(L, tb->hash, tb->size, TString *);
   tb->size = newsize;
   tb->hash = newhash;
 }
@@ -53,11 +121,14 @@ static TString *newlstr (lua_State *L, const char *str, size_t l,
   stringtable *tb;
   if (l+1 > (MAX_SIZET - sizeof(TString))/sizeof(char))
     luaM_toobig(L);
-  ts = cast(TString *, luaM_malloc(L, (l+1)*sizeof(char)+sizeof(TString)));
+  luaM_tagged(L, LUA_TSTRING,
+              ts = cast(TString *, luaM_malloc(L, (l+1)*sizeof(char) +
+                                                  sizeof(TString))));
   ts->tsv.len = l;
   ts->tsv.hash = h;
   ts->tsv.marked = luaC_white(G(L));
   ts->tsv.tt = LUA_TSTRING;
+  luaM_countobj(L, LUA_TSTRING, 1);
   ts->tsv.reserved = 0;
   memcpy(ts+1, str, l*sizeof(char));
   ((char *)(ts+1))[l] = '\0';  /* ending 0 */
@@ -66,22 +137,17 @@ static TString *newlstr (lua_State *L, const char *str, size_t l,
   ts->tsv.next = tb->hash[h];  /* chain new entry */
   tb->hash[h] = obj2gco(ts);
   tb->nuse++;
-  if (tb->nuse > cast(lu_int32, tb->size) && tb->size <= MAX_INT/2)
+  if (tb->oldhash)
+    luaS_rehashstep(L, STRTREHASHSTEP);
+  else if (tb->nuse > cast(lu_int32, tb->size) && tb->size <= MAX_INT/2)
     luaS_resize(L, tb->size*2);  /* too crowded */
   return ts;
 }
 
 
-TString *luaS_newlstr (lua_State *L, const char *str, size_t l) {
-  GCObject *o;
-  unsigned int h = cast(unsigned int, l);  /* seed */
-  size_t step = (l>>5)+1;  /* if string is too long, don't hash all its chars */
-  size_t l1;
-  for (l1=l; l1>=step; l1-=step)  /* compute hash */
-    h = h ^ ((h<<5)+(h>>2)+cast(unsigned char, str[l1-1]));
-  for (o = G(L)->strt.hash[lmod(h, G(L)->strt.size)];
-       o != NULL;
-       o = o->gch.next) {
+static TString *findstr (lua_State *L, GCObject *o, const char *str,
+                                        size_t l) {
+  for (; o != NULL; o = o->gch.next) {
     TString *ts = rawgco2ts(o);
     if (ts->tsv.len == l && (memcmp(str, getstr(ts), l) == 0)) {
       /* string may be dead */
@@ -89,6 +155,21 @@ TString *luaS_newlstr (lua_State *L, const char *str, size_t l) {
       return ts;
     }
   }
+  return NULL;
+}
+
+
+TString *luaS_newlstr (lua_State *L, const char *str, size_t l) {
+  stringtable *tb = &G(L)->strt;
+  unsigned int h = hashstr(str, l, G(L)->seed);
+  TString *ts = findstr(L, tb->hash[lmod(h, tb->size)], str, l);
+  if (ts == NULL && tb->oldhash != NULL) {  /* rehash in progress? */
+    int h1 = lmod(h, tb->oldsize);
+    if (h1 >= tb->rehashpos)  /* bucket not migrated yet? */
+      ts = findstr(L, tb->oldhash[h1], str, l);
+  }
+  if (ts != NULL)
+    return ts;
   return newlstr(L, str, l, h);  /* not found */
 }
 
@@ -97,9 +178,11 @@ Udata *luaS_newudata (lua_State *L, size_t s, Table *e) {
   Udata *u;
   if (s > MAX_SIZET - sizeof(Udata))
     luaM_toobig(L);
-  u = cast(Udata *, luaM_malloc(L, s + sizeof(Udata)));
+  luaM_tagged(L, LUA_TUSERDATA,
+              u = cast(Udata *, luaM_malloc(L, s + sizeof(Udata))));
   u->uv.marked = luaC_white(G(L));  /* is not finalized */
   u->uv.tt = LUA_TUSERDATA;
+  luaM_countobj(L, LUA_TUSERDATA, 1);
   u->uv.len = s;
   u->uv.metatable = NULL;
   u->uv.env = e;
@@ -6,6 +6,7 @@
 
 
 #include <ctype.h>
+#include <limits.h>
 #include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -24,6 +25,13 @@
 #define uchar(c)        ((unsigned char)(c))
 
 
+#if !defined(LUA_ANSI) && (defined(__SSE2__) || defined(_M_X64) || \
+                           (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define STR_SSE2
+#include <emmintrin.h>
+#endif
+
+
 
 static int str_len (lua_State *L) {
   size_t l;
@@ -277,14 +285,9 @@ static int singlematch (int c, const char *p, const char *ep) {
 static const char *match (MatchState *ms, const char *s, const char *p);
 
 
-static const char *matchbalance (MatchState *ms, const char *s,
-                                   const char *p) {
-  if (*p == 0 || *(p+1) == 0)
-    luaL_error(ms->L, "unbalanced pattern");
-  if (*s != *p) return NULL;
+static const char *balance (MatchState *ms, const char *s, int b, int e) {
+  if (*s != b) return NULL;
   else {
-    int b = *p;
-    int e = *(p+1);
     int cont = 1;
     while (++s < ms->src_end) {
       if (*s == e) {
@@ -297,6 +300,14 @@ static const char *matchbalance (MatchState *ms, const char *s,
 }
 
 
+static const char *matchbalance (MatchState *ms, const char *s,
+                                   const char *p) {
+  if (*p == 0 || *(p+1) == 0)
+    luaL_error(ms->L, "unbalanced pattern");
+  return balance(ms, s, *p, *(p+1));
+}
+
+
 static const char *max_expand (MatchState *ms, const char *s,
                                  const char *p, const char *ep) {
   ptrdiff_t i = 0;  /* counts maximum expand for item */
@@ -440,17 +451,375 @@ static const char *match (MatchState *ms, const char *s, const char *p) {
 
 
 
+/*
+** {======================================================
+** COMPILED PATTERNS
+** =======================================================
+*/
+
+/*
+** A well-formed pattern is translated once into an array of items, where
+** each single-char class becomes a 256-bit set, and kept in a cache
+** keyed by the pattern string (its values are weak, so unused patterns
+** go away with the next collection). Character classes are evaluated
+** when a pattern is compiled. Malformed patterns are never compiled:
+** they go through `match', which reports errors only when it reaches them.
+*/
+
+#define PI_END		0	/* end of pattern */
+#define PI_EOS		1	/* `$' at the end of the pattern */
+#define PI_OPEN		2	/* `(' */
+#define PI_POSITION	3	/* `()' */
+#define PI_CLOSE	4	/* `)' */
+#define PI_BALANCE	5	/* %bxy */
+#define PI_FRONTIER	6	/* %f[set] */
+#define PI_BACKREF	7	/* %1-%9 */
+#define PI_CHAR		8	/* single char items: a literal char, */
+#define PI_SET		9	/* `.', a class or a set */
+
+typedef struct PatItem {
+  unsigned char kind;
+  unsigned char rep;  /* `?', `*', `+', `-', or 0 for one repetition */
+  unsigned char c1, c2;  /* PI_CHAR and PI_BACKREF: c1; PI_BALANCE: both */
+  unsigned char set[32];  /* PI_CHAR, PI_SET and PI_FRONTIER */
+} PatItem;
+
+#define inset(set,c)	((set)[(c) >> 3] & (1 << ((c) & 7)))
+
+typedef struct Pattern {
+  int anchor;  /* pattern starts with `^' */
+  const unsigned char *first;  /* chars that may start a match, or NULL */
+  const char *prefix;  /* literal prefix of every match */
+  size_t lprefix;
+  PatItem item[1];  /* variable length */
+} Pattern;
+
+
+static const char KEY_PATTERNS = 'p';
+
+
+static const char *cmatch (MatchState *ms, const char *s, const PatItem *p);
+
+
+static const char *cmax_expand (MatchState *ms, const char *s,
+                                  const PatItem *p) {
+  ptrdiff_t i = 0;  /* counts maximum expand for item */
+  while ((s+i)<ms->src_end && inset(p->set, uchar(*(s+i))))
+    i++;
+  if ((p+1)->kind == PI_END)  /* nothing else to match? */
+    return s+i;
+  /* keeps trying to match with the maximum repetitions */
+  while (i>=0) {
+    const char *res = cmatch(ms, (s+i), p+1);
+    if (res) return res;
+    i--;  /* else didn't match; reduce 1 repetition to try again */
+  }
+  return NULL;
+}
+
+
+static const char *cmin_expand (MatchState *ms, const char *s,
+                                  const PatItem *p) {
+  for (;;) {
+    const char *res = cmatch(ms, s, p+1);
+    if (res != NULL)
+      return res;
+    else if (s<ms->src_end && inset(p->set, uchar(*s)))
+      s++;  /* try with one more repetition */
+    else return NULL;
+  }
+}
+
+
+static const char *cstart_capture (MatchState *ms, const char *s,
+                                     const PatItem *p, int what) {
+  const char *res;
+  int level = ms->level;
+  if (level >= LUA_MAXCAPTURES) luaL_error(ms->L, "too many captures");
+  ms->capture[level].init = s;
+  ms->capture[level].len = what;
+  ms->level = level+1;
+  if ((res=cmatch(ms, s, p)) == NULL)  /* match failed? */
+    ms->level--;  /* undo capture */
+  return res;
+}
+
+
+static const char *cend_capture (MatchState *ms, const char *s,
+                                   const PatItem *p) {
+  int l = capture_to_close(ms);
+  const char *res;
+  ms->capture[l].len = s - ms->capture[l].init;  /* close capture */
+  if ((res = cmatch(ms, s, p)) == NULL)  /* match failed? */
+    ms->capture[l].len = CAP_UNFINISHED;  /* undo capture */
+  return res;
+}
+
+
+/* same as `match', for a compiled pattern */
+static const char *cmatch (MatchState *ms, const char *s, const PatItem *p) {
+  init: /* using goto's to optimize tail recursion */
+  switch (p->kind) {
+    case PI_END: {
+      return s;  /* match succeeded */
+    }
+    case PI_EOS: {
+      return (s == ms->src_end) ? s : NULL;
+    }
+    case PI_OPEN: {
+      return cstart_capture(ms, s, p+1, CAP_UNFINISHED);
+    }
+    case PI_POSITION: {
+      return cstart_capture(ms, s, p+1, CAP_POSITION);
+    }
+    case PI_CLOSE: {
+      return cend_capture(ms, s, p+1);
+    }
+    case PI_BALANCE: {
+      s = balance(ms, s, p->c1, p->c2);
+      if (s == NULL) return NULL;
+      p++; goto init;
+    }
+    case PI_FRONTIER: {
+      int previous = (s == ms->src_init) ? '\0' : uchar(*(s-1));
+      if (inset(p->set, previous) || !inset(p->set, uchar(*s)))
+        return NULL;
+      p++; goto init;
+    }
+    case PI_BACKREF: {
+      s = match_capture(ms, s, p->c1);
+      if (s == NULL) return NULL;
+      p++; goto init;
+    }
+    default: {  /* single char item */
+      int m = s<ms->src_end && inset(p->set, uchar(*s));
+      switch (p->rep) {
+        case '?': {
+          const char *res;
+          if (m && ((res=cmatch(ms, s+1, p+1)) != NULL))
+            return res;
+          p++; goto init;
+        }
+        case '*': {
+          return cmax_expand(ms, s, p);
+        }
+        case '+': {
+          return (m ? cmax_expand(ms, s+1, p) : NULL);
+        }
+        case '-': {
+          return cmin_expand(ms, s, p);
+        }
+        default: {
+          if (!m) return NULL;
+          s++; p++; goto init;
+        }
+      }
+    }
+  }
+}
+
+
+/* like `classend', but returns NULL for a malformed item */
+static const char *itemend (const char *p) {
+  switch (*p++) {
+    case L_ESC: {
+      return (*p == '\0') ? NULL : p+1;
+    }
+    case '[': {
+      if (*p == '^') p++;
+      do {  /* look for a `]' */
+        if (*p == '\0') return NULL;
+        if (*(p++) == L_ESC && *p != '\0')
+          p++;  /* skip escapes (e.g. `%]') */
+      } while (*p != ']');
+      return p+1;
+    }
+    default: {
+      return p;
+    }
+  }
+}
+
+
+/*
+** Translates pattern `p' into `item' (or only counts its items, when
+** `item' is NULL). Returns the number of items, or -1 if `p' is malformed.
+*/
+static int compile (const char *p, PatItem *item) {
+  int n = 0;
+  for (;; n++) {
+    PatItem dummy;
+    PatItem *it = (item != NULL) ? &item[n] : &dummy;
+    const char *ep;
+    int c;
+    it->rep = 0;
+    switch (*p) {
+      case '\0': {
+        it->kind = PI_END;
+        return n+1;
+      }
+      case '(': {
+        it->kind = (*(p+1) == ')') ? PI_POSITION : PI_OPEN;
+        p += (it->kind == PI_POSITION) ? 2 : 1;
+        continue;
+      }
+      case ')': {
+        it->kind = PI_CLOSE;
+        p++;
+        continue;
+      }
+      case '$': {
+        if (*(p+1) == '\0') {
+          it->kind = PI_EOS;
+          p++;
+          continue;
+        }
+        break;
+      }
+      case L_ESC: {
+        if (*(p+1) == 'b') {
+          if (*(p+2) == '\0' || *(p+3) == '\0') return -1;
+          it->kind = PI_BALANCE;
+          it->c1 = uchar(*(p+2));
+          it->c2 = uchar(*(p+3));
+          p += 4;
+          continue;
+        }
+        else if (*(p+1) == 'f') {
+          p += 2;
+          if (*p != '[' || (ep = itemend(p)) == NULL) return -1;
+          it->kind = PI_FRONTIER;
+          if (item != NULL) {
+            memset(it->set, 0, sizeof(it->set));
+            for (c = 0; c <= UCHAR_MAX; c++)
+              if (matchbracketclass(c, p, ep-1))
+                it->set[c >> 3] |= 1 << (c & 7);
+          }
+          p = ep;
+          continue;
+        }
+        else if (isdigit(uchar(*(p+1)))) {
+          it->kind = PI_BACKREF;
+          it->c1 = uchar(*(p+1));
+          p += 2;
+          continue;
+        }
+        break;
+      }
+    }
+    /* a single char item */
+    if ((ep = itemend(p)) == NULL) return -1;
+    it->kind = (*p == L_ESC || *p == '[' || *p == '.') ? PI_SET : PI_CHAR;
+    it->c1 = uchar(*p);
+    if (item != NULL) {
+      memset(it->set, 0, sizeof(it->set));
+      for (c = 0; c <= UCHAR_MAX; c++)
+        if (singlematch(c, p, ep))
+          it->set[c >> 3] |= 1 << (c & 7);
+    }
+    if (*ep == '?' || *ep == '*' || *ep == '+' || *ep == '-')
+      it->rep = uchar(*ep++);
+    p = ep;
+  }
+}
+
+
+/*
+** Pushes the compiled form of the pattern at index `idx' (a string) and
+** returns it; pushes nil and returns NULL if the pattern is malformed.
+*/
+static const Pattern *getpattern (lua_State *L, int idx) {
+  Pattern *pat;
+  lua_pushlightuserdata(L, (void *)&KEY_PATTERNS);
+  lua_rawget(L, LUA_REGISTRYINDEX);
+  lua_pushvalue(L, idx);
+  lua_rawget(L, -2);
+  if (lua_isnil(L, -1)) {
+    const char *p = lua_tostring(L, idx);
+    int anchor = (*p == '^');
+    int n = compile(p + anchor, NULL);
+    const PatItem *it;
+    char *prefix;
+    lua_pop(L, 1);
+    if (n < 0) {
+      lua_pop(L, 1);  /* remove cache */
+      lua_pushnil(L);
+      return NULL;
+    }
+    /* the prefix has at most one char for each item but the last */
+    pat = (Pattern *)lua_newuserdata(L, sizeof(Pattern) +
+                                        (n-1)*sizeof(PatItem) + n);
+    compile(p + anchor, pat->item);
+    pat->anchor = anchor;
+    pat->first = NULL;
+    prefix = (char *)&pat->item[n];
+    pat->prefix = prefix;
+    pat->lprefix = 0;
+    for (it = pat->item; it->kind == PI_OPEN || it->kind == PI_POSITION; it++)
+      ;  /* captures do not move the start of a match */
+    for (; it->kind == PI_CHAR && (it->rep == 0 || it->rep == '+'); it++) {
+      prefix[pat->lprefix++] = (char)it->c1;
+      if (it->rep == '+') break;
+    }
+    if (pat->lprefix == 0 && it->kind == PI_SET &&
+        (it->rep == 0 || it->rep == '+'))
+      pat->first = it->set;
+    lua_pushvalue(L, idx);
+    lua_pushvalue(L, -2);
+    lua_rawset(L, -4);  /* cache[pattern] = pat */
+  }
+  pat = (Pattern *)lua_touserdata(L, -1);
+  lua_remove(L, -2);  /* remove cache */
+  return pat;
+}
+
+
+static void createpatterncache (lua_State *L) {
+  lua_pushlightuserdata(L, (void *)&KEY_PATTERNS);
+  lua_newtable(L);
+  lua_createtable(L, 0, 1);
+  lua_pushliteral(L, "v");
+  lua_setfield(L, -2, "__mode");
+  lua_setmetatable(L, -2);
+  lua_rawset(L, LUA_REGISTRYINDEX);
+}
+
+/* }====================================================== */
+
+
+
 static const char *lmemfind (const char *s1, size_t l1,
                                const char *s2, size_t l2) {
   if (l2 == 0) return s1;  /* empty strings are everywhere */
   else if (l2 > l1) return NULL;  /* avoids a negative `l1' */
+  else if (l2 == 1) return (const char *)memchr(s1, *s2, l1);
   else {
     const char *init;  /* to search for a `*s2' inside `s1' */
+#if defined(STR_SSE2)
+    /* look for the first and the last char of `s2' in 16 places at once
+       (all loads stay inside `s1') */
+    const __m128i first = _mm_set1_epi8(s2[0]);
+    const __m128i last = _mm_set1_epi8(s2[l2-1]);
+    while (l1 >= l2 + 15) {
+      __m128i bf = _mm_loadu_si128((const __m128i *)s1);
+      __m128i bl = _mm_loadu_si128((const __m128i *)(s1 + l2 - 1));
+      int mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(bf, first),
+                                                 _mm_cmpeq_epi8(bl, last)));
+      int i;
+      for (i = 0; mask != 0; i++, mask >>= 1) {
+        if ((mask & 1) && memcmp(s1 + i + 1, s2 + 1, l2 - 2) == 0)
+          return s1 + i;
+      }
+      s1 += 16;
+      l1 -= 16;
+    }
+    if (l2 > l1) return NULL;
+#endif
     l2--;  /* 1st char will be checked by `memchr' */
     l1 = l1-l2;  /* `s2' cannot be found after that */
     while (l1 > 0 && (init = (const char *)memchr(s1, *s2, l1)) != NULL) {
       init++;   /* 1st char is already checked */
-      if (memcmp(init, s2+1, l2) == 0)
+      if (init[l2-1] == s2[l2] && memcmp(init, s2+1, l2) == 0)
         return init-1;
       else {  /* correct `l1' and `s1' to try again */
         l1 -= init-s1;
@@ -462,6 +831,28 @@ static const char *lmemfind (const char *s1, size_t l1,
 }
 
 
+/*
+** First place in [s, e) where compiled pattern `pat' may match, or NULL;
+** a pattern with a prefix or a set of first chars cannot match an empty
+** string.
+*/
+static const char *nextstart (const Pattern *pat, const char *s,
+                                const char *e) {
+  if (pat->lprefix > 0)
+    return lmemfind(s, e - s, pat->prefix, pat->lprefix);
+  else if (pat->first != NULL) {
+    while (s < e && !inset(pat->first, uchar(*s))) s++;
+    return (s < e) ? s : NULL;
+  }
+  else
+    return s;
+}
+
+
+#define domatch(ms,s,p,pat) \
+	((pat) != NULL ? cmatch(ms, s, (pat)->item) : match(ms, s, p))
+
+
 static void push_onecapture (MatchState *ms, int i, const char *s,
                                                     const char *e) {
   if (i >= ms->level) {
@@ -510,6 +901,7 @@ static int str_find_aux (lua_State *L, int find) {
   }
   else {
     MatchState ms;
+    const Pattern *pat = getpattern(L, 2);
     int anchor = (*p == '^') ? (p++, 1) : 0;
     const char *s1=s+init;
     ms.L = L;
@@ -517,8 +909,11 @@ static int str_find_aux (lua_State *L, int find) {
     ms.src_end = s+l1;
     do {
       const char *res;
+      if (pat != NULL && !anchor &&
+          (s1 = nextstart(pat, s1, ms.src_end)) == NULL)
+        break;
       ms.level = 0;
-      if ((res=match(&ms, s1, p)) != NULL) {
+      if ((res=domatch(&ms, s1, p, pat)) != NULL) {
         if (find) {
           lua_pushinteger(L, s1-s+1);  /* start */
           lua_pushinteger(L, res-s);   /* end */
@@ -549,6 +944,7 @@ static int gmatch_aux (lua_State *L) {
   size_t ls;
   const char *s = lua_tolstring(L, lua_upvalueindex(1), &ls);
   const char *p = lua_tostring(L, lua_upvalueindex(2));
+  const Pattern *pat = (const Pattern *)lua_touserdata(L, lua_upvalueindex(4));
   const char *src;
   ms.L = L;
   ms.src_init = s;
@@ -557,8 +953,10 @@ static int gmatch_aux (lua_State *L) {
        src <= ms.src_end;
        src++) {
     const char *e;
+    if (pat != NULL && (src = nextstart(pat, src, ms.src_end)) == NULL)
+      break;
     ms.level = 0;
-    if ((e = match(&ms, src, p)) != NULL) {
+    if ((e = domatch(&ms, src, p, pat)) != NULL) {
       lua_Integer newstart = e-s;
       if (e == src) newstart++;  /* empty match? go at least one position */
       lua_pushinteger(L, newstart);
@@ -575,7 +973,11 @@ static int gmatch (lua_State *L) {
   luaL_checkstring(L, 2);
   lua_settop(L, 2);
   lua_pushinteger(L, 0);
-  lua_pushcclosure(L, gmatch_aux, 3);
+  if (getpattern(L, 2) != NULL && lua_tostring(L, 2)[0] == '^') {
+    lua_pop(L, 1);  /* here `^' is not an anchor; use `match' */
+    lua_pushnil(L);
+  }
+  lua_pushcclosure(L, gmatch_aux, 4);
   return 1;
 }
 
@@ -651,16 +1053,25 @@ static int str_gsub (lua_State *L) {
   int max_s = luaL_optint(L, 4, srcl+1);
   int anchor = (*p == '^') ? (p++, 1) : 0;
   int n = 0;
+  const Pattern *pat;
   MatchState ms;
   luaL_Buffer b;
+  lua_settop(L, 4);  /* keep the compiled pattern above the arguments */
+  pat = getpattern(L, 2);
   luaL_buffinit(L, &b);
   ms.L = L;
   ms.src_init = src;
   ms.src_end = src+srcl;
   while (n < max_s) {
     const char *e;
+    if (pat != NULL && !anchor) {
+      const char *next = nextstart(pat, src, ms.src_end);
+      if (next == NULL) break;
+      luaL_addlstring(&b, src, next - src);  /* keep skipped text */
+      src = next;
+    }
     ms.level = 0;
-    e = match(&ms, src, p);
+    e = domatch(&ms, src, p, pat);
     if (e) {
       n++;
       add_value(&ms, &b, src, e);
@@ -752,6 +1163,14 @@ static void addintlen (char *form) {
 }
 
 
+/* argument of an integer conversion; exact for integer numbers */
+static LUA_INTFRM_T getintarg (lua_State *L, int arg) {
+  if (lua_isinteger(L, arg))
+    return (LUA_INTFRM_T)lua_tointeger(L, arg);
+  return (LUA_INTFRM_T)luaL_checknumber(L, arg);
+}
+
+
 static int str_format (lua_State *L) {
   int arg = 1;
   size_t sfl;
@@ -776,12 +1195,12 @@ static int str_format (lua_State *L) {
         }
         case 'd':  case 'i': {
           addintlen(form);
-          sprintf(buff, form, (LUA_INTFRM_T)luaL_checknumber(L, arg));
+          sprintf(buff, form, getintarg(L, arg));
           break;
         }
         case 'o':  case 'u':  case 'x':  case 'X': {
           addintlen(form);
-          sprintf(buff, form, (unsigned LUA_INTFRM_T)luaL_checknumber(L, arg));
+          sprintf(buff, form, (unsigned LUA_INTFRM_T)getintarg(L, arg));
           break;
         }
         case 'e':  case 'E': case 'f':
@@ -822,17 +1241,23 @@ static int str_format (lua_State *L) {
 
 
 static const luaL_Reg strlib[] = {
-  {"byte", str_byte},
-  {"char", str_char},
   {"dump", str_dump},
   {"find", str_find},
   {"format", str_format},
   {"gfind", gfind_nodef},
   {"gmatch", gmatch},
   {"gsub", str_gsub},
+  {"match", str_match},
+  {NULL, NULL}
+};
+
+
+/* short functions, called as light C functions */
+static const luaL_Reg strlib_light[] = {
+  {"byte", str_byte},
+  {"char", str_char},
   {"len", str_len},
   {"lower", str_lower},
-  {"match", str_match},
   {"rep", str_rep},
   {"reverse", str_reverse},
   {"sub", str_sub},
@@ -858,6 +1283,8 @@ static void createmetatable (lua_State *L) {
 */
 LUALIB_API int luaopen_string (lua_State *L) {
   luaL_register(L, LUA_STRLIBNAME, strlib);
+  luaL_registerlight(L, NULL, strlib_light);
+  createpatterncache(L);
 #if defined(LUA_COMPAT_GFIND)
   lua_getfield(L, -1, "gmatch");
   lua_setfield(L, -2, "gfind");
@@ -11,11 +11,16 @@
 ** Non-negative integer keys are all candidates to be kept in the array
 ** part. The actual size of the array is the largest `n' such that at
 ** least half the slots between 0 and n are in use.
-** Hash uses a mix of chained scatter table with Brent's variation.
-** A main invariant of these tables is that, if an element is not
-** in its main position (i.e. the `original' position that its hash gives
-** to it), then the colliding element is in its own main position.
-** Hence even when the load factor reaches 100%, performance remains good.
+** Hash uses open addressing. Values, keys, and a control byte per slot
+** live in three separate arrays, so a probe reads the control bytes
+** (HGROUP slots at a time) and touches a key only when the 7-bit tag
+** from its hash matches. Groups are visited in triangular order
+** starting at the key's main position. Keys are never removed from a
+** slot (a nil value only marks the entry as empty, which also keeps
+** `next' working while a traversal clears fields), so there are no
+** tombstones: a free control byte always ends a search. Tables grow
+** before they get more than 7/8 full (small ones, whose slots all fit
+** in one group, may get full).
 */
 
 #include <math.h>
@@ -35,6 +40,13 @@
 #include "ltable.h"
 
 
+#if !defined(LUA_ANSI) && (defined(__SSE2__) || defined(_M_X64) || \
+                           (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define HASH_SSE2
+#include <emmintrin.h>
+#endif
+
+
 /*
 ** max size of array part is 2^MAXBITS
 */
@@ -47,20 +59,22 @@
 #define MAXASIZE	(1 << MAXBITS)
 
 
-#define hashpow2(t,n)      (gnode(t, lmod((n), sizenode(t))))
-  
-#define hashstr(t,str)  hashpow2(t, (str)->tsv.hash)
-#define hashboolean(t,p)        hashpow2(t, p)
-
-
 /*
-** for some types, it is better to avoid modulus by power of 2, as
-** they tend to have many 2 factors.
+** control byte of a free slot; used slots keep a 7-bit tag of the hash
 */
-#define hashmod(t,n)	(gnode(t, ((n) % ((sizenode(t)-1)|1))))
+#define CTRLFREE	0x80
+
+/* the main position uses the low bits of a hash, the tag its high bits */
+#define hashpos(t,h)	lmod(h, sizenode(t))
+#define hashtag(h)	cast_int(((h) >> 25) & 0x7f)
 
+#define slot(t,i)	lmod(i, sizenode(t))
 
-#define hashpointer(t,p)	hashmod(t, IntPoint(p))
+/* number of keys a hash part with `n' slots may hold */
+#define hashlimit(n)	((n) <= HGROUP/2 ? (n) : (n) - (n)/8)
+
+
+#define hashpointer(p)	cast(lu_int32, IntPoint(p))
 
 
 /*
@@ -70,46 +84,184 @@
 
 
 
-#define dummynode		(&dummynode_)
+#define dummynode		(cast(TValue *, &dummynode_.val))
 
-static const Node dummynode_ = {
+static const struct {
+  TValue val;
+  TValue key;
+  lu_byte ctrl[HGROUP];
+} dummynode_ = {
   {{NULL}, LUA_TNIL},  /* value */
-  {{{NULL}, LUA_TNIL, NULL}}  /* key */
+  {{NULL}, LUA_TNIL},  /* key */
+  {CTRLFREE, CTRLFREE, CTRLFREE, CTRLFREE, CTRLFREE, CTRLFREE, CTRLFREE,
+   CTRLFREE, CTRLFREE, CTRLFREE, CTRLFREE, CTRLFREE, CTRLFREE, CTRLFREE,
+   CTRLFREE, CTRLFREE}
 };
 
 
 /*
 ** hash for lua_Numbers
 */
-static Node *hashnum (const Table *t, lua_Number n) {
+static lu_int32 hashnum (lua_Number n) {
   unsigned int a[numints];
   int i;
   n += 1;  /* normalize number (avoid -0) */
   lua_assert(sizeof(a) <= sizeof(n));
   memcpy(a, &n, sizeof(a));
   for (i = 1; i < numints; i++) a[0] += a[i];
-  return hashmod(t, a[0]);
+  return cast(lu_int32, a[0]);
 }
 
 
+/*
+** hash for integers, and test for an integer key, for the subtype that
+** holds integral keys
+*/
+#if defined(LUA_INTNUMBER)
+#define hashint(i)	mixhash(cast(lu_int32, cast(lua_UInt, i) ^ \
+                                              (cast(lua_UInt, i) >> 32)))
+#define isintkey(k,i)	(ttisint(k) && ivalue(k) == (i))
+#else
+#define hashint(i)	mixhash(hashnum(cast_num(i)))
+#define isintkey(k,i)	(ttisnumber(k) && luai_numeq(nvalue(k), cast_num(i)))
+#endif
+
 
 /*
-** returns the `main' position of an element in a table (that is, the index
-** of its hash value)
+** spreads the bits of a raw hash, so that both its low and its high
+** bits depend on all of them (pointers, for instance, have their low
+** bits fixed); string hashes are already well mixed
 */
-static Node *mainposition (const Table *t, const TValue *key) {
+static lu_int32 mixhash (lu_int32 h) {
+  h = (h * 0x9E3779B1u) & 0xffffffffu;
+  return h ^ (h >> 16);
+}
+
+
+static lu_int32 hashkey (const TValue *key) {
   switch (ttype(key)) {
     case LUA_TNUMBER:
-      return hashnum(t, nvalue(key));
+      if (ttisint(key)) return hashint(ivalue(key));
+      return mixhash(hashnum(nvalue(key)));
     case LUA_TSTRING:
-      return hashstr(t, rawtsvalue(key));
+      return rawtsvalue(key)->tsv.hash;
     case LUA_TBOOLEAN:
-      return hashboolean(t, bvalue(key));
+      return mixhash(bvalue(key));
     case LUA_TLIGHTUSERDATA:
-      return hashpointer(t, pvalue(key));
+      return mixhash(hashpointer(pvalue(key)));
     default:
-      return hashpointer(t, gcvalue(key));
+      return mixhash(hashpointer(gcvalue(key)));
+  }
+}
+
+
+#if defined(__GNUC__)
+#define lowbit(m)	__builtin_ctz(m)
+#else
+static int lowbit (unsigned int m) {
+  int k = 0;
+  while ((m & 1) == 0) { m >>= 1; k++; }
+  return k;
+}
+#endif
+
+
+/*
+** bit `k' of the result is set when control byte `g[k]' is `tag'; bit
+** `k' of `*isfree' is set when that slot is free
+*/
+static unsigned int matchgroup (const lu_byte *g, int tag,
+                                unsigned int *isfree) {
+#if defined(HASH_SSE2)
+  __m128i c = _mm_loadu_si128((const __m128i *)g);
+  *isfree = cast(unsigned int, _mm_movemask_epi8(c));  /* CTRLFREE has bit 7 */
+  return cast(unsigned int,
+              _mm_movemask_epi8(_mm_cmpeq_epi8(c, _mm_set1_epi8((char)tag))));
+#else
+  unsigned int m = 0;
+  unsigned int f = 0;
+  int k;
+  for (k = HGROUP - 1; k >= 0; k--) {
+    m = (m << 1) | (g[k] == tag);
+    f = (f << 1) | (g[k] == CTRLFREE);
+  }
+  *isfree = f;
+  return m;
+#endif
+}
+
+
+/*
+** Probing loop shared by all searches: runs `found' for each slot `i'
+** whose tag matches, in probe order, and stops after the first group
+** with a free slot (a key is never stored past a free slot of its
+** probe sequence). Most keys are in their main position, which is
+** checked alone (and without its control byte) first.
+*/
+#define probe(t,h,i,found) { \
+  unsigned int mask_ = cast(unsigned int, sizenode(t) - 1); \
+  unsigned int pos_ = (h) & mask_; \
+  i = cast_int(pos_); found; \
+  if (!ttisnil(gkey(t, pos_))) {  /* main position is taken? */ \
+    const lu_byte *ctrl_ = gctrl(t); \
+    unsigned int step_ = 0; \
+    for (;;) { \
+      unsigned int free_; \
+      unsigned int m_ = matchgroup(ctrl_ + pos_, hashtag(h), &free_); \
+      for (; m_ != 0; m_ &= m_ - 1) { \
+        i = cast_int((pos_ + lowbit(m_)) & mask_); \
+        found; \
+      } \
+      if (free_ != 0 || step_ == mask_ / HGROUP) break;  /* no more groups? */ \
+      pos_ = (pos_ + HGROUP * ++step_) & mask_; \
+    } \
+  } }
+
+
+/*
+** returns the slot holding `key' (or -1); with `dead' set, a dead key
+** with the same object also counts
+*/
+static int findslot (const Table *t, const TValue *key, int dead) {
+  lu_int32 h = hashkey(key);
+  int i;
+  probe(t, h, i,
+    if (luaO_rawequalObj(gkey(t, i), key) ||
+        (dead && ttype(gkey(t, i)) == LUA_TDEADKEY && iscollectable(key) &&
+         gcvalue(gkey(t, i)) == gcvalue(key)))
+      return i)
+  return -1;
+}
+
+
+/*
+** if `key' is a number with an integral value, puts that value in `k'
+*/
+static int intkey (const TValue *key, lua_Int *k) {
+  if (ttisint(key)) {
+    *k = ivalue(key);
+    return 1;
   }
+  return ttisnumber(key) && luaO_n2int(nvalue(key), k);
+}
+
+
+/*
+** Number keys with an integral value are stored as integers, so that
+** (for instance) 1 and 1.0 are the same key; returns the key to store
+** or search for `key', using `aux' if it must be converted.
+*/
+static const TValue *normkey (const TValue *key, TValue *aux) {
+#if defined(LUA_INTNUMBER)
+  lua_Int k;
+  if (ttisfloat(key) && luaO_n2int(fltvalue(key), &k)) {
+    setivalue(aux, k);
+    return aux;
+  }
+#else
+  UNUSED(aux);
+#endif
+  return key;
 }
 
 
@@ -118,13 +270,9 @@ static Node *mainposition (const Table *t, const TValue *key) {
 ** the array part of the table, -1 otherwise.
 */
 static int arrayindex (const TValue *key) {
-  if (ttisnumber(key)) {
-    lua_Number n = nvalue(key);
-    int k;
-    lua_number2int(k, n);
-    if (luai_numeq(cast_num(k), n))
-      return k;
-  }
+  lua_Int k;
+  if (intkey(key, &k) && 0 < k && k <= MAXASIZE)
+    return cast_int(k);
   return -1;  /* `key' did not match some condition */
 }
 
@@ -141,20 +289,15 @@ static int findindex (lua_State *L, Table *t, StkId key) {
   if (0 < i && i <= t->sizearray)  /* is `key' inside array part? */
     return i-1;  /* yes; that's the index (corrected to C) */
   else {
-    Node *n = mainposition(t, key);
-    do {  /* check whether `key' is somewhere in the chain */
-      /* key may be dead already, but it is ok to use it in `next' */
-      if (luaO_rawequalObj(key2tval(n), key) ||
-            (ttype(gkey(n)) == LUA_TDEADKEY && iscollectable(key) &&
-             gcvalue(gkey(n)) == gcvalue(key))) {
-        i = cast_int(n - gnode(t, 0));  /* key index in hash table */
-        /* hash elements are numbered after array ones */
-        return i + t->sizearray;
-      }
-      else n = gnext(n);
-    } while (n);
-    luaG_runerror(L, "invalid key to " LUA_QL("next"));  /* key not found */
-    return 0;  /* to avoid warnings */
+    TValue aux;
+    const TValue *k = normkey(key, &aux);
+    i = findslot(t, k, 0);
+    if (i < 0)  /* key may be dead already, but it is ok to use it in `next' */
+      i = findslot(t, k, 1);
+    if (i < 0)
+      luaG_runerror(L, "invalid key to " LUA_QL("next"));  /* key not found */
+    /* hash elements are numbered after array ones */
+    return i + t->sizearray;
   }
 }
 
@@ -163,15 +306,15 @@ int luaH_next (lua_State *L, Table *t, StkId key) {
   int i = findindex(L, t, key);  /* find original element */
   for (i++; i < t->sizearray; i++) {  /* try first array part */
     if (!ttisnil(&t->array[i])) {  /* a non-nil value? */
-      setnvalue(key, cast_num(i+1));
+      setivalue(key, i+1);
       setobj2s(L, key+1, &t->array[i]);
       return 1;
     }
   }
   for (i -= t->sizearray; i < sizenode(t); i++) {  /* then hash part */
-    if (!ttisnil(gval(gnode(t, i)))) {  /* a non-nil value? */
-      setobj2s(L, key, key2tval(gnode(t, i)));
-      setobj2s(L, key+1, gval(gnode(t, i)));
+    if (!ttisnil(gval(t, i))) {  /* a non-nil value? */
+      setobj2s(L, key, gkey(t, i));
+      setobj2s(L, key+1, gval(t, i));
       return 1;
     }
   }
@@ -249,9 +392,8 @@ static int numusehash (const Table *t, int *nums, int *pnasize) {
   int ause = 0;  /* summation of `nums' */
   int i = sizenode(t);
   while (i--) {
-    Node *n = &t->node[i];
-    if (!ttisnil(gval(n))) {
-      ause += countint(key2tval(n), nums);
+    if (!ttisnil(gval(t, i))) {
+      ause += countint(gkey(t, i), nums);
       totaluse++;
     }
   }
@@ -262,43 +404,50 @@ static int numusehash (const Table *t, int *nums, int *pnasize) {
 
 static void setarrayvector (lua_State *L, Table *t, int size) {
   int i;
-  luaM_reallocvector(L, t->array, t->sizearray, size, TValue);
+  luaM_tagged(L, LUA_TTABLE,
+              luaM_reallocvector(L, t->array, t->sizearray, size, TValue));
   for (i=t->sizearray; i<size; i++)
      setnilvalue(&t->array[i]);
   t->sizearray = size;
 }
 
 
-static void setnodevector (lua_State *L, Table *t, int size) {
-  int lsize;
-  if (size == 0) {  /* no elements to hash part? */
-    t->node = cast(Node *, dummynode);  /* use common `dummynode' */
-    lsize = 0;
+/*
+** creates a hash part able to hold `nkeys' keys
+*/
+static void setnodevector (lua_State *L, Table *t, int nkeys) {
+  if (nkeys == 0) {  /* no elements to hash part? */
+    t->node = dummynode;  /* use common `dummynode' */
+    t->hkey = dummynode + 1;
+    t->lsizenode = 0;
+    t->nfree = 0;  /* first insertion must rehash */
   }
   else {
-    int i;
-    lsize = ceillog2(size);
+    int i, size;
+    int lsize = ceillog2(nkeys);
+    while (hashlimit(twoto(lsize)) < nkeys) lsize++;
     if (lsize > MAXBITS)
       luaG_runerror(L, "table overflow");
     size = twoto(lsize);
-    t->node = luaM_newvector(L, size, Node);
+    luaM_tagged(L, LUA_TTABLE,
+                t->node = cast(TValue *, luaM_malloc(L, sizehash(size))));
+    t->hkey = t->node + size;
+    t->lsizenode = cast_byte(lsize);
+    t->nfree = hashlimit(size);
     for (i=0; i<size; i++) {
-      Node *n = gnode(t, i);
-      gnext(n) = NULL;
-      setnilvalue(gkey(n));
-      setnilvalue(gval(n));
+      setnilvalue(gkey(t, i));
+      setnilvalue(gval(t, i));
     }
+    memset(gctrl(t), CTRLFREE, size + HGROUP-1);  /* all positions are free */
   }
-  t->lsizenode = cast_byte(lsize);
-  t->lastfree = gnode(t, size);  /* all positions are free */
 }
 
 
 static void resize (lua_State *L, Table *t, int nasize, int nhsize) {
   int i;
   int oldasize = t->sizearray;
-  int oldhsize = t->lsizenode;
-  Node *nold = t->node;  /* save old hash ... */
+  int oldhsize = sizenode(t);
+  TValue *nold = t->node;  /* save old hash ... */
   if (nasize > oldasize)  /* array part must grow? */
     setarrayvector(L, t, nasize);
   /* create new hash part with appropriate size */
@@ -311,21 +460,22 @@ static void resize (lua_State *L, Table *t, int nasize, int nhsize) {
         setobjt2t(L, luaH_setnum(L, t, i+1), &t->array[i]);
     }
     /* shrink array */
-    luaM_reallocvector(L, t->array, oldasize, nasize, TValue);
+    luaM_tagged(L, LUA_TTABLE,
+                luaM_reallocvector(L, t->array, oldasize, nasize, TValue));
   }
   /* re-insert elements from hash part */
-  for (i = twoto(oldhsize) - 1; i >= 0; i--) {
-    Node *old = nold+i;
-    if (!ttisnil(gval(old)))
-      setobjt2t(L, luaH_set(L, t, key2tval(old)), gval(old));
+  for (i = 0; i < oldhsize; i++) {
+    TValue *old = nold+i;  /* old value; its key is `oldhsize' slots later */
+    if (!ttisnil(old))
+      setobjt2t(L, luaH_set(L, t, old + oldhsize), old);
   }
-  if (nold != dummynode)
-    luaM_freearray(L, nold, twoto(oldhsize), Node);  /* free old array */
+  if (nold != dummynode)  /* free old hash part */
+    luaM_tagged(L, LUA_TTABLE, luaM_freemem(L, nold, sizehash(oldhsize)));
 }
 
 
 void luaH_resizearray (lua_State *L, Table *t, int nasize) {
-  int nsize = (t->node == dummynode) ? 0 : sizenode(t);
+  int nsize = (t->node == dummynode) ? 0 : hashlimit(sizenode(t));
   resize(L, t, nasize, nsize);
 }
 
@@ -356,7 +506,8 @@ static void rehash (lua_State *L, Table *t, const TValue *ek) {
 
 
 Table *luaH_new (lua_State *L, int narray, int nhash) {
-  Table *t = luaM_new(L, Table);
+  Table *t;
+  luaM_tagged(L, LUA_TTABLE, t = luaM_new(L, Table));
   luaC_link(L, obj2gco(t), LUA_TTABLE);
   t->metatable = NULL;
   t->flags = cast_byte(~0);
@@ -364,7 +515,10 @@ Table *luaH_new (lua_State *L, int narray, int nhash) {
   t->array = NULL;
   t->sizearray = 0;
   t->lsizenode = 0;
-  t->node = cast(Node *, dummynode);
+  t->node = dummynode;
+  t->hkey = dummynode + 1;
+  t->nfree = 0;
+  t->border = 0;
   setarrayvector(L, t, narray);
   setnodevector(L, t, nhash);
   return t;
@@ -373,79 +527,85 @@ Table *luaH_new (lua_State *L, int narray, int nhash) {
 
 void luaH_free (lua_State *L, Table *t) {
   if (t->node != dummynode)
-    luaM_freearray(L, t->node, sizenode(t), Node);
-  luaM_freearray(L, t->array, t->sizearray, TValue);
-  luaM_free(L, t);
+    luaM_tagged(L, LUA_TTABLE,
+                luaM_freemem(L, t->node, sizehash(sizenode(t))));
+  luaM_tagged(L, LUA_TTABLE,
+              luaM_freearray(L, t->array, t->sizearray, TValue));
+  luaM_tagged(L, LUA_TTABLE, luaM_free(L, t));
 }
 
 
-static Node *getfreepos (Table *t) {
-  while (t->lastfree-- > t->node) {
-    if (ttisnil(gkey(t->lastfree)))
-      return t->lastfree;
-  }
-  return NULL;  /* could not find a free place */
+/*
+** sets the control byte of slot `i' and its copies past the end
+*/
+static void setctrl (Table *t, int i, lu_byte c) {
+  lu_byte *ctrl = gctrl(t);
+  int size = sizenode(t);
+  int j;
+  ctrl[i] = c;
+  for (j = i + size; j < size + HGROUP-1; j += size)
+    ctrl[j] = c;
 }
 
 
-
 /*
-** inserts a new key into a hash table; first, check whether key's main 
-** position is free. If not, check whether colliding node is in its main 
-** position or not: if it is not, move colliding node to an empty place and 
-** put new key in its main position; otherwise (colliding node is in its main 
-** position), new key goes to an empty position. 
+** inserts a new key into a hash table, in the first free slot of its
+** probe sequence; if the table is full enough, grows it first
 */
 static TValue *newkey (lua_State *L, Table *t, const TValue *key) {
-  Node *mp = mainposition(t, key);
-  if (!ttisnil(gval(mp)) || mp == dummynode) {
-    Node *othern;
-    Node *n = getfreepos(t);  /* get a free place */
-    if (n == NULL) {  /* cannot find a free place? */
-      rehash(L, t, key);  /* grow table */
-      return luaH_set(L, t, key);  /* re-insert key into grown table */
-    }
-    lua_assert(n != dummynode);
-    othern = mainposition(t, key2tval(mp));
-    if (othern != mp) {  /* is colliding node out of its main position? */
-      /* yes; move colliding node into free position */
-      while (gnext(othern) != mp) othern = gnext(othern);  /* find previous */
-      gnext(othern) = n;  /* redo the chain with `n' in place of `mp' */
-      *n = *mp;  /* copy colliding node into free pos. (mp->next also goes) */
-      gnext(mp) = NULL;  /* now `mp' is free */
-      setnilvalue(gval(mp));
-    }
-    else {  /* colliding node is in its own main position */
-      /* new node will go into free position */
-      gnext(n) = gnext(mp);  /* chain new position */
-      gnext(mp) = n;
-      mp = n;
+  lu_int32 h;
+  int pos, step = 0;
+  if (t->nfree == 0) {  /* cannot take one more key? */
+    rehash(L, t, key);  /* grow table */
+    return luaH_set(L, t, key);  /* re-insert key into grown table */
+  }
+  lua_assert(t->node != dummynode);
+  h = hashkey(key);
+  pos = hashpos(t, h);
+  for (;;) {  /* there is a free slot somewhere, as `nfree' > 0 */
+    unsigned int isfree;
+    matchgroup(gctrl(t) + pos, CTRLFREE, &isfree);
+    if (isfree != 0) {
+      int i = slot(t, pos + lowbit(isfree));
+      setctrl(t, i, cast_byte(hashtag(h)));
+      t->nfree--;
+      gkey(t, i)->value = key->value; gkey(t, i)->tt = key->tt;
+      luaC_barriert(L, t, key);
+      lua_assert(ttisnil(gval(t, i)));
+      return gval(t, i);
     }
+    pos = slot(t, pos + HGROUP * ++step);
   }
-  gkey(mp)->value = key->value; gkey(mp)->tt = key->tt;
-  luaC_barriert(L, t, key);
-  lua_assert(ttisnil(gval(mp)));
-  return gval(mp);
+}
+
+
+static const TValue *getinthash (Table *t, lua_Int key) {
+  lu_int32 h = hashint(key);
+  int i;
+  probe(t, h, i,
+    if (isintkey(gkey(t, i), key))
+      return gval(t, i))  /* that's it */
+  return luaO_nilobject;
 }
 
 
 /*
-** search function for integers
+** search functions for integers
 */
 const TValue *luaH_getnum (Table *t, int key) {
   /* (1 <= key && key <= t->sizearray) */
   if (cast(unsigned int, key-1) < cast(unsigned int, t->sizearray))
     return &t->array[key-1];
-  else {
-    lua_Number nk = cast_num(key);
-    Node *n = hashnum(t, nk);
-    do {  /* check whether `key' is somewhere in the chain */
-      if (ttisnumber(gkey(n)) && luai_numeq(nvalue(gkey(n)), nk))
-        return gval(n);  /* that's it */
-      else n = gnext(n);
-    } while (n);
-    return luaO_nilobject;
-  }
+  else
+    return getinthash(t, key);
+}
+
+
+const TValue *luaH_getint (Table *t, lua_Int key) {
+  if (cast(lua_UInt, key) - 1u < cast(lua_UInt, t->sizearray))
+    return &t->array[key-1];
+  else
+    return getinthash(t, key);
 }
 
 
@@ -453,12 +613,11 @@ const TValue *luaH_getnum (Table *t, int key) {
 ** search function for strings
 */
 const TValue *luaH_getstr (Table *t, TString *key) {
-  Node *n = hashstr(t, key);
-  do {  /* check whether `key' is somewhere in the chain */
-    if (ttisstring(gkey(n)) && rawtsvalue(gkey(n)) == key)
-      return gval(n);  /* that's it */
-    else n = gnext(n);
-  } while (n);
+  lu_int32 h = key->tsv.hash;
+  int i;
+  probe(t, h, i,
+    if (ttisstring(gkey(t, i)) && rawtsvalue(gkey(t, i)) == key)
+      return gval(t, i))  /* that's it */
   return luaO_nilobject;
 }
 
@@ -471,21 +630,14 @@ const TValue *luaH_get (Table *t, const TValue *key) {
     case LUA_TNIL: return luaO_nilobject;
     case LUA_TSTRING: return luaH_getstr(t, rawtsvalue(key));
     case LUA_TNUMBER: {
-      int k;
-      lua_Number n = nvalue(key);
-      lua_number2int(k, n);
-      if (luai_numeq(cast_num(k), nvalue(key))) /* index is int? */
-        return luaH_getnum(t, k);  /* use specialized version */
+      lua_Int k;
+      if (intkey(key, &k))  /* index is integral? */
+        return luaH_getint(t, k);  /* use specialized version */
       /* else go through */
     }
     default: {
-      Node *n = mainposition(t, key);
-      do {  /* check whether `key' is somewhere in the chain */
-        if (luaO_rawequalObj(key2tval(n), key))
-          return gval(n);  /* that's it */
-        else n = gnext(n);
-      } while (n);
-      return luaO_nilobject;
+      int i = findslot(t, key, 0);
+      return (i < 0) ? luaO_nilobject : gval(t, i);
     }
   }
 }
@@ -497,10 +649,11 @@ TValue *luaH_set (lua_State *L, Table *t, const TValue *key) {
   if (p != luaO_nilobject)
     return cast(TValue *, p);
   else {
+    TValue aux;
     if (ttisnil(key)) luaG_runerror(L, "table index is nil");
-    else if (ttisnumber(key) && luai_numisnan(nvalue(key)))
+    else if (ttisfloat(key) && luai_numisnan(fltvalue(key)))
       luaG_runerror(L, "table index is NaN");
-    return newkey(L, t, key);
+    return newkey(L, t, normkey(key, &aux));
   }
 }
 
@@ -511,7 +664,7 @@ TValue *luaH_setnum (lua_State *L, Table *t, int key) {
     return cast(TValue *, p);
   else {
     TValue k;
-    setnvalue(&k, cast_num(key));
+    setivalue(&k, key);
     return newkey(L, t, &k);
   }
 }
@@ -553,11 +706,14 @@ static int unbound_search (Table *t, unsigned int j) {
 }
 
 
-/*
-** Try to find a boundary in table `t'. A `boundary' is an integer index
-** such that t[i] is non-nil and t[i+1] is nil (and 0 if t[1] is nil).
-*/
-int luaH_getn (Table *t) {
+static int isboundary (Table *t, unsigned int i) {
+  if (i >= cast(unsigned int, MAX_INT)) return 0;
+  return (i == 0 || !ttisnil(luaH_getnum(t, i))) &&
+         ttisnil(luaH_getnum(t, i + 1));
+}
+
+
+static int findboundary (Table *t) {
   unsigned int j = t->sizearray;
   if (j > 0 && ttisnil(&t->array[j - 1])) {
     /* there is a boundary in the array part: (binary) search for it */
@@ -576,13 +732,32 @@ int luaH_getn (Table *t) {
 }
 
 
+/*
+** Try to find a boundary in table `t'. A `boundary' is an integer index
+** such that t[i] is non-nil and t[i+1] is nil (and 0 if t[1] is nil).
+** Values are stored through pointers returned by `luaH_set*', so the
+** table cannot keep its boundary up to date; instead, the last one
+** found and its neighbors are checked first, which is all it takes for
+** loops that add or remove elements at the end.
+*/
+int luaH_getn (Table *t) {
+  unsigned int b = t->border;
+  if (isboundary(t, b)) return b;
+  else if (isboundary(t, b + 1)) b++;
+  else if (b > 0 && isboundary(t, b - 1)) b--;
+  else b = findboundary(t);
+  t->border = b;
+  return b;
+}
+
+
 
 #if defined(LUA_DEBUG)
 
-Node *luaH_mainposition (const Table *t, const TValue *key) {
-  return mainposition(t, key);
+int luaH_mainposition (const Table *t, const TValue *key) {
+  return hashpos(t, hashkey(key));
 }
 
-int luaH_isdummy (Node *n) { return n == dummynode; }
+int luaH_isdummy (const Table *t) { return t->node == dummynode; }
 
 #endif
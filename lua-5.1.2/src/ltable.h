@@ -10,16 +10,23 @@
 #include "lobject.h"
 
 
-#define gnode(t,i)	(&(t)->node[i])
-#define gkey(n)		(&(n)->i_key.nk)
-#define gval(n)		(&(n)->i_val)
-#define gnext(n)	((n)->i_key.nk.next)
+/*
+** The hash part is one block: `sizenode' values, then as many keys,
+** then one control byte per slot (plus HGROUP-1 copies of the first
+** ones, so that any HGROUP consecutive slots can be read at once).
+*/
+#define HGROUP		16
+
+#define gval(t,i)	(&(t)->node[i])
+#define gkey(t,i)	(&(t)->hkey[i])
+#define gctrl(t)	(cast(lu_byte *, (t)->hkey + sizenode(t)))
 
-#define key2tval(n)	(&(n)->i_key.tvk)
+#define sizehash(n)	((n)*2*sizeof(TValue) + (n) + HGROUP-1)
 
 
 LUAI_FUNC const TValue *luaH_getnum (Table *t, int key);
 LUAI_FUNC TValue *luaH_setnum (lua_State *L, Table *t, int key);
+LUAI_FUNC const TValue *luaH_getint (Table *t, lua_Int key);
 LUAI_FUNC const TValue *luaH_getstr (Table *t, TString *key);
 LUAI_FUNC TValue *luaH_setstr (lua_State *L, Table *t, TString *key);
 LUAI_FUNC const TValue *luaH_get (Table *t, const TValue *key);
@@ -32,8 +39,8 @@ LUAI_FUNC int luaH_getn (Table *t);
 
 
 #if defined(LUA_DEBUG)
-LUAI_FUNC Node *luaH_mainposition (const Table *t, const TValue *key);
-LUAI_FUNC int luaH_isdummy (Node *n);
+LUAI_FUNC int luaH_mainposition (const Table *t, const TValue *key);
+LUAI_FUNC int luaH_isdummy (const Table *t);
 #endif
 
 
@@ -53,6 +53,20 @@ static int foreach (lua_State *L) {
 }
 
 
+/*
+** table.create(narray [, nhash]) returns an empty table with room for
+** `narray' elements in its array part and `nhash' other fields.
+*/
+static int tcreate (lua_State *L) {
+  int narray = luaL_checkint(L, 1);
+  int nhash = luaL_optint(L, 2, 0);
+  luaL_argcheck(L, narray >= 0, 1, "size must be non-negative");
+  luaL_argcheck(L, nhash >= 0, 2, "size must be non-negative");
+  lua_createtable(L, narray, nhash);
+  return 1;
+}
+
+
 static int maxn (lua_State *L) {
   lua_Number max = 0;
   luaL_checktype(L, 1, LUA_TTABLE);
@@ -259,6 +273,7 @@ static int sort (lua_State *L) {
 
 static const luaL_Reg tab_funcs[] = {
   {"concat", tconcat},
+  {"create", tcreate},
   {"foreach", foreach},
   {"foreachi", foreachi},
   {"getn", getn},
@@ -318,6 +318,13 @@ static int runargs (lua_State *L, char **argv, int n) {
 }
 
 
+static void handle_luacache (lua_State *L) {
+  const char *dir = getenv(LUA_CACHE);
+  if (dir != NULL)
+    luaL_setloadcache(L, dir);
+}
+
+
 static int handle_luainit (lua_State *L) {
   const char *init = getenv(LUA_INIT);
   if (init == NULL) return 0;  /* status OK */
@@ -345,6 +352,7 @@ static int pmain (lua_State *L) {
   lua_gc(L, LUA_GCSTOP, 0);  /* stop collector during initialization */
   luaL_openlibs(L);  /* open libraries */
   lua_gc(L, LUA_GCRESTART, 0);
+  handle_luacache(L);
   s->status = handle_luainit(L);
   if (s->status != 0) return 0;
   script = collectargs(argv, &has_i, &has_v, &has_e);
@@ -52,6 +52,12 @@ typedef struct lua_State lua_State;
 typedef int (*lua_CFunction) (lua_State *L);
 
 
+/*
+** frozen Lua function that many states can share
+*/
+typedef struct lua_Chunk lua_Chunk;
+
+
 /*
 ** functions that read/write blocks when loading/dumping Lua chunks
 */
@@ -133,6 +139,7 @@ LUA_API void  (lua_xmove) (lua_State *from, lua_State *to, int n);
 */
 
 LUA_API int             (lua_isnumber) (lua_State *L, int idx);
+LUA_API int             (lua_isinteger) (lua_State *L, int idx);
 LUA_API int             (lua_isstring) (lua_State *L, int idx);
 LUA_API int             (lua_iscfunction) (lua_State *L, int idx);
 LUA_API int             (lua_isuserdata) (lua_State *L, int idx);
@@ -166,6 +173,7 @@ LUA_API const char *(lua_pushvfstring) (lua_State *L, const char *fmt,
                                                       va_list argp);
 LUA_API const char *(lua_pushfstring) (lua_State *L, const char *fmt, ...);
 LUA_API void  (lua_pushcclosure) (lua_State *L, lua_CFunction fn, int n);
+LUA_API void  (lua_pushlightfunction) (lua_State *L, lua_CFunction fn);
 LUA_API void  (lua_pushboolean) (lua_State *L, int b);
 LUA_API void  (lua_pushlightuserdata) (lua_State *L, void *p);
 LUA_API int   (lua_pushthread) (lua_State *L);
@@ -206,6 +214,24 @@ LUA_API int   (lua_load) (lua_State *L, lua_Reader reader, void *dt,
 
 LUA_API int (lua_dump) (lua_State *L, lua_Writer writer, void *data);
 
+/* identity of the precompiled chunks this Lua reads and writes */
+#define LUA_CHUNKIDSIZE	16
+LUA_API void  (lua_chunkid) (char *id);
+
+/*
+** A shared chunk is one block allocated with the allocator (and its `ud')
+** of the state that created it, but it is not charged to that state. It
+** is reference counted: `lua_sharechunk' returns it with one reference,
+** the functions pushed from it hold more, and `lua_releasechunk'
+** drops one. The block is freed by whichever thread drops the last
+** reference (perhaps while collecting or closing another state), so the
+** allocator must be thread safe when chunks cross threads and must stay
+** valid until every chunk it made is gone, even after `lua_close'.
+*/
+LUA_API lua_Chunk *(lua_sharechunk) (lua_State *L, int idx);
+LUA_API void  (lua_pushchunk) (lua_State *L, lua_Chunk *c);
+LUA_API void  (lua_releasechunk) (lua_Chunk *c);
+
 
 /*
 ** coroutine functions
@@ -214,6 +240,23 @@ LUA_API int  (lua_yield) (lua_State *L, int nresults);
 LUA_API int  (lua_resume) (lua_State *L, int narg);
 LUA_API int  (lua_status) (lua_State *L);
 
+/*
+** per-type memory statistics (only when built with LUA_USE_GCSTATS)
+*/
+#define LUA_MEMOTHER	LUA_TNIL	/* internal buffers and string table */
+#define LUA_MEMPROTO	(LUA_TTHREAD+1)
+#define LUA_MEMUPVAL	(LUA_TTHREAD+2)
+#define LUA_NUMMEMSTAT	(LUA_TTHREAD+3)
+
+typedef struct lua_MemStat {
+  size_t bytes;  /* live bytes charged to the type */
+  size_t objects;  /* live objects of the type */
+  size_t allocs;  /* allocations so far (objects and their parts) */
+} lua_MemStat;
+
+LUA_API int (lua_memstat) (lua_State *L, int type, lua_MemStat *ms);
+
+
 /*
 ** garbage-collection function and options
 */
@@ -226,6 +269,10 @@ LUA_API int  (lua_status) (lua_State *L);
 #define LUA_GCSTEP		5
 #define LUA_GCSETPAUSE		6
 #define LUA_GCSETSTEPMUL	7
+#define LUA_GCBACKGROUND	8
+#define LUA_GCPEAK		9
+#define LUA_GCPEAKB		10
+#define LUA_GCRESETPEAK		11
 
 LUA_API int (lua_gc) (lua_State *L, int what, int data);
 
@@ -310,6 +357,7 @@ LUA_API void lua_setallocf (lua_State *L, lua_Alloc f, void *ud);
 #define LUA_HOOKLINE	2
 #define LUA_HOOKCOUNT	3
 #define LUA_HOOKTAILRET 4
+#define LUA_HOOKSAMPLE	5
 
 
 /*
@@ -338,6 +386,8 @@ LUA_API int lua_sethook (lua_State *L, lua_Hook func, int mask, int count);
 LUA_API lua_Hook lua_gethook (lua_State *L);
 LUA_API int lua_gethookmask (lua_State *L);
 LUA_API int lua_gethookcount (lua_State *L);
+LUA_API void lua_setsamplehook (lua_State *L, lua_Hook func);
+LUA_API void lua_sample (lua_State *L);
 
 
 struct lua_Debug {
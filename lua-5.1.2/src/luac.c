@@ -128,9 +128,9 @@ static const Proto* combine(lua_State* L, int n)
   f->source=luaS_newliteral(L,"=(" PROGNAME ")");
   f->maxstacksize=1;
   pc=2*n+1;
-  f->code=luaM_newvector(L,pc,Instruction);
+  luaM_tagged(L,LUA_MEMPROTO,f->code=luaM_newvector(L,pc,Instruction));
   f->sizecode=pc;
-  f->p=luaM_newvector(L,n,Proto*);
+  luaM_tagged(L,LUA_MEMPROTO,f->p=luaM_newvector(L,n,Proto*));
   f->sizep=n;
   pc=0;
   for (i=0; i<n; i++)
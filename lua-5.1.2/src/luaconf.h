@@ -37,11 +37,14 @@
 #define LUA_USE_POSIX
 #define LUA_USE_DLOPEN		/* needs an extra library: -ldl */
 #define LUA_USE_READLINE	/* needs some extra libraries */
+#define LUA_USE_PTHREADS	/* needs an extra library: -lpthread */
+#define LUA_USE_PERFEVENTS	/* needs linux/perf_event.h */
 #endif
 
 #if defined(LUA_USE_MACOSX)
 #define LUA_USE_POSIX
 #define LUA_DL_DYLD		/* does not need extra library */
+#define LUA_USE_PTHREADS	/* does not need extra library */
 #endif
 
 
@@ -56,19 +59,32 @@
 #define LUA_USE_ISATTY
 #define LUA_USE_POPEN
 #define LUA_USE_ULONGJMP
+#define LUA_USE_ITIMER
+#define LUA_USE_MMAP
 #endif
 
 
+/*
+@@ LUA_USE_PERFEVENTS lets profiler.counters read hardware counters
+@* (instructions, cycles, cache and branch misses) with perf_event_open.
+** CHANGE it (define it) if your system is Linux and has that call.
+** Without it profiler.counters gives no counters.
+*/
+
+
 /*
 @@ LUA_PATH and LUA_CPATH are the names of the environment variables that
 @* Lua check to set its paths.
 @@ LUA_INIT is the name of the environment variable that Lua
 @* checks for initialization code.
+@@ LUA_CACHE is the name of the environment variable that names the
+@* directory where the stand-alone interpreter caches precompiled chunks.
 ** CHANGE them if you want different names.
 */
 #define LUA_PATH        "LUA_PATH"
 #define LUA_CPATH       "LUA_CPATH"
 #define LUA_INIT	"LUA_INIT"
+#define LUA_CACHE	"LUA_CACHE"
 
 
 /*
@@ -313,6 +329,18 @@
 #define LUAI_GCMUL	200 /* GC runs 'twice the speed' of memory allocation */
 
 
+/*
+@@ LUAI_BGFREEBATCH is the number of blocks the collector hands at once
+@* to its background freeing thread (see collectgarbage("background")).
+@@ LUAI_BGFREEMAX is how many bytes may wait for that thread; past it
+@* the collector frees its batches itself, so memory cannot pile up.
+** CHANGE them if freeing lags behind a very fast sweep (or if you want
+** memory back sooner).
+*/
+#define LUAI_BGFREEBATCH	1024
+#define LUAI_BGFREEMAX		(64*1024*1024)
+
+
 
 /*
 @@ LUA_COMPAT_GETN controls compatibility with old getn behavior.
@@ -367,6 +395,28 @@
 
 
 
+/*
+@@ LUA_USE_GCSTATS keeps per-type memory statistics (live bytes, live
+@* objects and allocation counts for strings, tables, functions, etc.),
+@* available through 'lua_memstat' and collectgarbage("stats").
+** CHANGE it (define it) if you need to know what is using your heap.
+** Without it the accounting is compiled out entirely.
+*/
+/* #define LUA_USE_GCSTATS */
+
+
+/*
+@@ LUA_FUSEOPS makes the code generator fuse frequent pairs of
+@* instructions into single opcodes (see lopcodes.h) and compute values
+@* for locals straight into their registers, saving a MOVE.
+** CHANGE it (define it) if you do not need precompiled chunks to run
+** on a Lua without those opcodes: its chunks get a format of their own
+** (see LUAC_FORMAT in lundump.h). The VM runs fused code either way.
+*/
+/* #define LUA_FUSEOPS */
+
+
+
 /*
 @@ luai_apicheck is the assert macro used by the Lua-C API.
 ** CHANGE luai_apicheck if you want Lua to perform some checks in the
@@ -435,6 +485,14 @@
 #define LUAI_MAXCALLS	20000
 
 
+/*
+@@ LUAI_MAXFREETHREADS is the number of dead coroutines kept for reuse.
+** Reusing one saves allocating its state and stacks again; CHANGE it
+** to 0 to free coroutines as soon as they are collected.
+*/
+#define LUAI_MAXFREETHREADS	64
+
+
 /*
 @@ LUAI_MAXCSTACK limits the number of Lua stack slots that a C function
 @* can use.
@@ -486,6 +544,14 @@
 */
 #define LUAL_BUFFERSIZE		BUFSIZ
 
+
+/*
+@@ LUAL_READBUFSIZE is the size of the private read buffer that the io
+@* library gives to regular files (when it can tell them from terminals
+@* and pipes, that is, with LUA_USE_MMAP).
+*/
+#define LUAL_READBUFSIZE	(64*1024)
+
 /* }================================================================== */
 
 
@@ -581,6 +647,61 @@ union luai_Cast { double l_d; long l_l; };
 
 #endif
 
+
+/*
+@@ LUA_INTNUMBER gives numbers an integer subtype.
+** CHANGE it (define it) if you need integers exact beyond 2^53. With
+** it, integral numerals and the results of `+', `-', `*', `%' and unary
+** minus over integers are kept exactly; when such an operation
+** overflows (or would give -0) it is done over lua_Number instead, and
+** `/' and `^' always are. So both subtypes behave as the same number,
+** except that integers do not lose precision beyond 2^53. It is off by
+** default because it is not compatible with standard Lua: integers are
+** written with all their digits (print(1e15) shows 1000000000000000,
+** not 1e+15), and binary chunks get a format of their own (see
+** LUAC_FORMAT in lundump.h).
+*/
+/* #define LUA_INTNUMBER */
+
+
+/*
+@@ LUAI_INT is the type of integer numbers.
+@@ LUAI_INTMAX and LUAI_INTMIN are its limits.
+@@ LUA_INTFMT is the format for writing integers.
+@@ lua_int2str converts an integer to a string.
+** CHANGE them if your system does not support long long. The API
+** (lua_pushinteger/lua_tointeger) only keeps integers exact if
+** LUA_INTEGER is as wide as LUAI_INT.
+*/
+#define LUAI_INT		long long
+#define LUAI_INTMAX		LLONG_MAX
+#define LUAI_INTMIN		LLONG_MIN
+#define LUA_INTFMT		"%lld"
+#define lua_int2str(s,i)	sprintf((s), LUA_INTFMT, (i))
+
+
+/*
+@@ luai_intadd, luai_intsub and luai_intmul store the integer result
+@* of an operation in `*r' and return 0 if it overflowed.
+*/
+#if defined(LUA_CORE)
+#if defined(__GNUC__) && __GNUC__ >= 5
+#define luai_intadd(a,b,r)	(!__builtin_add_overflow((a), (b), (r)))
+#define luai_intsub(a,b,r)	(!__builtin_sub_overflow((a), (b), (r)))
+#define luai_intmul(a,b,r)	(!__builtin_mul_overflow((a), (b), (r)))
+#else
+#define luai_intadd(a,b,r) \
+	(*(r) = (LUAI_INT)((unsigned LUAI_INT)(a) + (unsigned LUAI_INT)(b)), \
+	 (((a) ^ *(r)) & ((b) ^ *(r))) >= 0)
+#define luai_intsub(a,b,r) \
+	(*(r) = (LUAI_INT)((unsigned LUAI_INT)(a) - (unsigned LUAI_INT)(b)), \
+	 (((a) ^ (b)) & ((a) ^ *(r))) >= 0)
+#define luai_intmul(a,b,r) \
+	(*(r) = (LUAI_INT)((unsigned LUAI_INT)(a) * (unsigned LUAI_INT)(b)), \
+	 (a) == 0 || ((a) == -1 ? (b) != LUAI_INTMIN : *(r) / (a) == (b)))
+#endif
+#endif
+
 /* }================================================================== */
 
 
@@ -659,6 +780,46 @@ union luai_Cast { double l_d; long l_l; };
 #endif
 
 
+/*
+@@ LUAL_BUILDID goes into the keys of the bytecode cache, along with
+@* the identity of the chunk format (see lua_chunkid).
+** CHANGE it (e.g., to a revision number) if cached chunks must not
+** survive a change that format does not show, such as a VM that runs
+** the same opcodes differently.
+*/
+#define LUAL_BUILDID	LUA_RELEASE
+
+
+/*
+@@ lua_opentemp creates and opens (for binary writing) a new file whose
+@* name is the template `b' with its final "XXXXXX" made unique.
+** CHANGE it if you have a way to create files exclusively in your
+** system. The bytecode cache renames these files over its entries, so
+** it must never open a file someone else made; without mkstemp (or C11
+** exclusive fopen) it gives no file and the cache stores nothing.
+*/
+#if defined(lauxlib_c) || defined(luaall_c)
+
+#if defined(LUA_USE_MKSTEMP)
+#include <unistd.h>
+#define lua_opentemp(b,f)	{ int fd_ = mkstemp(b); \
+	f = (fd_ == -1) ? NULL : fdopen(fd_, "wb"); }
+
+#elif defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L
+#include <time.h>
+#define lua_opentemp(b,f)	{ \
+	sprintf((b) + strlen(b) - 6, "%06lx", \
+	        ((unsigned long)clock() ^ (unsigned long)time(NULL) ^ \
+	         (unsigned long)(size_t)&(f)) & 0xffffffUL); \
+	f = fopen(b, "wbx"); }
+
+#else
+#define lua_opentemp(b,f)	{ (void)(b); f = NULL; }
+#endif
+
+#endif
+
+
 /*
 @@ lua_popen spawns a new process connected to the current one through
 @* the file streams.
@@ -33,12 +33,21 @@ LUALIB_API int (luaopen_string) (lua_State *L);
 #define LUA_MATHLIBNAME	"math"
 LUALIB_API int (luaopen_math) (lua_State *L);
 
+#define LUA_ARRAYLIBNAME	"array"
+LUALIB_API int (luaopen_array) (lua_State *L);
+
+#define LUA_WORKLIBNAME	"worker"
+LUALIB_API int (luaopen_worker) (lua_State *L);
+
 #define LUA_DBLIBNAME	"debug"
 LUALIB_API int (luaopen_debug) (lua_State *L);
 
 #define LUA_LOADLIBNAME	"package"
 LUALIB_API int (luaopen_package) (lua_State *L);
 
+#define LUA_PROFLIBNAME	"profiler"
+LUALIB_API int (luaopen_profiler) (lua_State *L);
+
 
 /* open all previous libraries */
 LUALIB_API void (luaL_openlibs) (lua_State *L); 
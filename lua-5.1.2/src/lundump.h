@@ -27,8 +27,24 @@ LUAI_FUNC void luaU_print (const Proto* f, int full);
 /* for header of binary files -- this is Lua 5.1 */
 #define LUAC_VERSION		0x51
 
-/* for header of binary files -- this is the official format */
-#define LUAC_FORMAT		0
+/* for header of binary files -- 0 is the official format; each option
+** that changes what chunks may contain sets a bit of its own */
+#if defined(LUA_INTNUMBER)
+#define LUAC_FMTINT		1	/* integer constants (LUAC_TINT) */
+#else
+#define LUAC_FMTINT		0
+#endif
+
+#if defined(LUA_FUSEOPS)
+#define LUAC_FMTFUSED		2	/* fused opcodes */
+#else
+#define LUAC_FMTFUSED		0
+#endif
+
+#define LUAC_FORMAT		(LUAC_FMTINT | LUAC_FMTFUSED)
+
+/* tag of integer constants in binary files */
+#define LUAC_TINT		(LAST_TAG+4)
 
 /* size of header of binary files */
 #define LUAC_HEADERSIZE		12
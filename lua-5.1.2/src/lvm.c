@@ -33,12 +33,9 @@
 
 
 const TValue *luaV_tonumber (const TValue *obj, TValue *n) {
-  lua_Number num;
   if (ttisnumber(obj)) return obj;
-  if (ttisstring(obj) && luaO_str2d(svalue(obj), &num)) {
-    setnvalue(n, num);
+  if (ttisstring(obj) && luaO_str2num(svalue(obj), n))
     return n;
-  }
   else
     return NULL;
 }
@@ -49,14 +46,56 @@ int luaV_tostring (lua_State *L, StkId obj) {
     return 0;
   else {
     char s[LUAI_MAXNUMBER2STR];
-    lua_Number n = nvalue(obj);
-    lua_number2str(s, n);
+    if (ttisint(obj))
+      lua_int2str(s, ivalue(obj));
+    else {
+      lua_Number n = fltvalue(obj);
+      lua_number2str(s, n);
+    }
     setsvalue2s(L, obj, luaS_new(L, s));
     return 1;
   }
 }
 
 
+/*
+** Integer versions of the arithmetic operators. They fail (return 0)
+** whenever the lua_Number operation must be used instead: for `/' and
+** `^', on overflow, and when the result would be -0 or NaN.
+*/
+
+#define intmul(a,b,r) \
+	(luai_intmul(a, b, r) && (*(r) != 0 || ((a) | (b)) >= 0))
+
+#define intunm(a,r)	((a) != 0 && (a) != LUAI_INTMIN && (*(r) = -(a), 1))
+
+
+static int intmod (lua_Int a, lua_Int b, lua_Int *r) {
+  if (b == 0) return 0;
+  else if (b == -1) *r = 0;  /* (avoids overflow of LUAI_INTMIN % -1) */
+  else {
+    lua_Int m = a % b;
+    if (m != 0 && (m ^ b) < 0) m += b;  /* result has the sign of `b' */
+    *r = m;
+  }
+  return 1;
+}
+
+
+int luaV_intarith (TMS op, lua_Int a, lua_Int b, lua_Int *r) {
+  switch (op) {
+    case TM_ADD: return luai_intadd(a, b, r);
+    case TM_SUB: return luai_intsub(a, b, r);
+    case TM_MUL: return intmul(a, b, r);
+    case TM_MOD: return intmod(a, b, r);
+    case TM_UNM: return intunm(a, r);
+    default: return 0;
+  }
+}
+
+#define nointop(a,b,r)	0
+
+
 static void traceexec (lua_State *L, const Instruction *pc) {
   lu_byte mask = L->hookmask;
   const Instruction *oldpc = L->savedpc;
@@ -220,12 +259,62 @@ static int l_strcmp (const TString *ls, const TString *rs) {
 }
 
 
+/*
+** compares an integer with a lua_Number exactly; returns -1, 0 or 1,
+** or 2 if `n' is NaN
+*/
+/* integers in [-MAXEXACT, MAXEXACT] are exact as lua_Numbers */
+#define MAXEXACT	(cast(lua_Int, 1) << 53)
+
+static int intcmp (lua_Int i, lua_Number n) {
+  lua_Int f;
+  if (-MAXEXACT <= i && i <= MAXEXACT) {  /* `i' converts exactly? */
+    lua_Number m = cast_num(i);
+    if (luai_numlt(m, n)) return -1;
+    else if (luai_numlt(n, m)) return 1;
+    else return luai_numeq(m, n) ? 0 : 2;
+  }
+  if (luai_numisnan(n)) return 2;
+  else if (n >= -cast_num(LUAI_INTMIN)) return -1;  /* n >= 2^63 */
+  else if (n < cast_num(LUAI_INTMIN)) return 1;
+  f = cast(lua_Int, floor(n));
+  if (i != f) return (i < f) ? -1 : 1;
+  else return luai_numeq(cast_num(f), n) ? 0 : -1;
+}
+
+
+static int numlt (const TValue *l, const TValue *r) {
+  if (ttisints(l, r))
+    return ivalue(l) < ivalue(r);
+  else if (ttisfloat(l) && ttisfloat(r))
+    return luai_numlt(fltvalue(l), fltvalue(r));
+  else if (ttisint(l))
+    return intcmp(ivalue(l), fltvalue(r)) == -1;
+  else
+    return intcmp(ivalue(r), fltvalue(l)) == 1;
+}
+
+
+static int numle (const TValue *l, const TValue *r) {
+  if (ttisints(l, r))
+    return ivalue(l) <= ivalue(r);
+  else if (ttisfloat(l) && ttisfloat(r))
+    return luai_numle(fltvalue(l), fltvalue(r));
+  else if (ttisint(l))
+    return intcmp(ivalue(l), fltvalue(r)) <= 0;
+  else {
+    int c = intcmp(ivalue(r), fltvalue(l));
+    return c == 0 || c == 1;
+  }
+}
+
+
 int luaV_lessthan (lua_State *L, const TValue *l, const TValue *r) {
   int res;
   if (ttype(l) != ttype(r))
     return luaG_ordererror(L, l, r);
   else if (ttisnumber(l))
-    return luai_numlt(nvalue(l), nvalue(r));
+    return numlt(l, r);
   else if (ttisstring(l))
     return l_strcmp(rawtsvalue(l), rawtsvalue(r)) < 0;
   else if ((res = call_orderTM(L, l, r, TM_LT)) != -1)
@@ -239,7 +328,7 @@ static int lessequal (lua_State *L, const TValue *l, const TValue *r) {
   if (ttype(l) != ttype(r))
     return luaG_ordererror(L, l, r);
   else if (ttisnumber(l))
-    return luai_numle(nvalue(l), nvalue(r));
+    return numle(l, r);
   else if (ttisstring(l))
     return l_strcmp(rawtsvalue(l), rawtsvalue(r)) <= 0;
   else if ((res = call_orderTM(L, l, r, TM_LE)) != -1)  /* first try `le' */
@@ -255,7 +344,10 @@ int luaV_equalval (lua_State *L, const TValue *t1, const TValue *t2) {
   lua_assert(ttype(t1) == ttype(t2));
   switch (ttype(t1)) {
     case LUA_TNIL: return 1;
-    case LUA_TNUMBER: return luai_numeq(nvalue(t1), nvalue(t2));
+    case LUA_TNUMBER: {
+      if (ttisints(t1, t2)) return ivalue(t1) == ivalue(t2);
+      return luaO_numequal(t1, t2);
+    }
     case LUA_TBOOLEAN: return bvalue(t1) == bvalue(t2);  /* true must be 1 !! */
     case LUA_TLIGHTUSERDATA: return pvalue(t1) == pvalue(t2);
     case LUA_TUSERDATA: {
@@ -318,7 +410,14 @@ static void Arith (lua_State *L, StkId ra, const TValue *rb,
   const TValue *b, *c;
   if ((b = luaV_tonumber(rb, &tempb)) != NULL &&
       (c = luaV_tonumber(rc, &tempc)) != NULL) {
-    lua_Number nb = nvalue(b), nc = nvalue(c);
+    lua_Number nb, nc;
+    lua_Int r;
+    if (ttisints(b, c) &&
+        luaV_intarith(op, ivalue(b), ivalue(c), &r)) {
+      setivalue(ra, r);
+      return;
+    }
+    nb = nvalue(b); nc = nvalue(c);
     switch (op) {
       case TM_ADD: setnvalue(ra, luai_numadd(nb, nc)); break;
       case TM_SUB: setnvalue(ra, luai_numsub(nb, nc)); break;
@@ -336,6 +435,50 @@ static void Arith (lua_State *L, StkId ra, const TValue *rb,
 
 
 
+/*
+** Prepares the numeric loop at `ra' to run over integers, if its initial
+** value and step are integers and its limit fits (once rounded towards
+** the values the loop may reach). Such a loop runs through the same
+** values as over lua_Number, and stops before overflowing. The limit
+** slot is replaced by the number of iterations left, so that
+** OP_FORLOOP needs neither an overflow check nor the sign of the step.
+*/
+static int forprepint (StkId ra) {
+  lua_Int init, limit, step;
+  lua_UInt count;
+  if (!ttisint(ra) || !ttisint(ra+2))
+    return 0;
+  init = ivalue(ra);
+  step = ivalue(ra+2);
+  if (step == 0)
+    return 0;  /* never ends; leave it to the lua_Number loop */
+  if (ttisint(ra+1))
+    limit = ivalue(ra+1);
+  else {
+    lua_Number l = fltvalue(ra+1);
+    if (!luaO_n2int((0 < step) ? floor(l) : ceil(l), &limit))
+      return 0;  /* NaN or out of range */
+  }
+  if ((0 < step) ? init > limit : init < limit)
+    count = 0;  /* skip the loop */
+  else {
+    if (0 < step)
+      count = (cast(lua_UInt, limit) - cast(lua_UInt, init)) /
+              cast(lua_UInt, step);
+    else  /* avoid negating LUAI_INTMIN */
+      count = (cast(lua_UInt, init) - cast(lua_UInt, limit)) /
+              (cast(lua_UInt, -(step + 1)) + 1u);
+    if (count < ~cast(lua_UInt, 0))
+      count++;  /* the first iteration; 2^64 iterations may as well be 2^64-1 */
+  }
+  /* index before the first increment (wraps around harmlessly) */
+  setivalue(ra, cast(lua_Int, cast(lua_UInt, init) - cast(lua_UInt, step)));
+  setivalue(ra+1, cast(lua_Int, count));
+  return 1;
+}
+
+
+
 /*
 ** some macros for common tasks in `luaV_execute'
 */
@@ -359,10 +502,22 @@ static void Arith (lua_State *L, StkId ra, const TValue *rb,
 #define Protect(x)	{ L->savedpc = pc; {x;}; base = L->base; }
 
 
-#define arith_op(op,tm) { \
+/* take a pending profiler sample (the hook may realloc the stack) */
+#define samplepoint(L) \
+	if (G(L)->samplepending) { Protect(luaD_sample(L)); ra = RA(i); }
+
+
+#define arith_op(op,iop,tm) { \
         TValue *rb = RKB(i); \
         TValue *rc = RKC(i); \
-        if (ttisnumber(rb) && ttisnumber(rc)) { \
+        lua_Int ir; \
+        if (ttisints(rb, rc) && iop(ivalue(rb), ivalue(rc), &ir)) { \
+          setivalue(ra, ir); \
+        } \
+        else if (ttisfloat(rb) && ttisfloat(rc)) { \
+          setnvalue(ra, op(fltvalue(rb), fltvalue(rc))); \
+        } \
+        else if (ttisnumber(rb) && ttisnumber(rc)) { \
           lua_Number nb = nvalue(rb), nc = nvalue(rc); \
           setnvalue(ra, op(nb, nc)); \
         } \
@@ -372,6 +527,21 @@ static void Arith (lua_State *L, StkId ra, const TValue *rb,
 
 
 
+/*
+** ends the first half of a fused instruction (see `luaK_fuse') by going
+** straight to the code of its second half, unless hooks need to see the
+** second half as an instruction of its own
+*/
+#define dosecond(o,l) { \
+        if (L->hookmask & (LUA_MASKLINE | LUA_MASKCOUNT)) continue; \
+        i = *pc++; \
+        lua_assert(GET_OPCODE(i) == (o)); \
+        ra = RA(i); \
+        goto l; \
+      }
+
+
+
 void luaV_execute (lua_State *L, int nexeccalls) {
   LClosure *cl;
   StkId base;
@@ -385,7 +555,7 @@ void luaV_execute (lua_State *L, int nexeccalls) {
   k = cl->p->k;
   /* main loop of interpreter */
   for (;;) {
-    const Instruction i = *pc++;
+    Instruction i = *pc++;
     StkId ra;
     if ((L->hookmask & (LUA_MASKLINE | LUA_MASKCOUNT)) &&
         (--L->hookcount == 0 || L->hookmask & LUA_MASKLINE)) {
@@ -402,7 +572,7 @@ void luaV_execute (lua_State *L, int nexeccalls) {
     lua_assert(base <= L->top && L->top <= L->stack + L->stacksize);
     lua_assert(L->top == L->ci->top || luaG_checkopenop(i));
     switch (GET_OPCODE(i)) {
-      case OP_MOVE: {
+      case OP_MOVE: domove: {
         setobjs2s(L, ra, RB(i));
         continue;
       }
@@ -435,7 +605,7 @@ void luaV_execute (lua_State *L, int nexeccalls) {
         Protect(luaV_gettable(L, &g, rb, ra));
         continue;
       }
-      case OP_GETTABLE: {
+      case OP_GETTABLE: dogettable: {
         Protect(luaV_gettable(L, RB(i), RKC(i), ra));
         continue;
       }
@@ -469,33 +639,37 @@ void luaV_execute (lua_State *L, int nexeccalls) {
         Protect(luaV_gettable(L, rb, RKC(i), ra));
         continue;
       }
-      case OP_ADD: {
-        arith_op(luai_numadd, TM_ADD);
+      case OP_ADD: doadd: {
+        arith_op(luai_numadd, luai_intadd, TM_ADD);
         continue;
       }
       case OP_SUB: {
-        arith_op(luai_numsub, TM_SUB);
+        arith_op(luai_numsub, luai_intsub, TM_SUB);
         continue;
       }
       case OP_MUL: {
-        arith_op(luai_nummul, TM_MUL);
+        arith_op(luai_nummul, intmul, TM_MUL);
         continue;
       }
       case OP_DIV: {
-        arith_op(luai_numdiv, TM_DIV);
+        arith_op(luai_numdiv, nointop, TM_DIV);
         continue;
       }
       case OP_MOD: {
-        arith_op(luai_nummod, TM_MOD);
+        arith_op(luai_nummod, intmod, TM_MOD);
         continue;
       }
       case OP_POW: {
-        arith_op(luai_numpow, TM_POW);
+        arith_op(luai_numpow, nointop, TM_POW);
         continue;
       }
       case OP_UNM: {
         TValue *rb = RB(i);
-        if (ttisnumber(rb)) {
+        lua_Int ib;
+        if (ttisint(rb) && intunm(ivalue(rb), &ib)) {
+          setivalue(ra, ib);
+        }
+        else if (ttisnumber(rb)) {
           lua_Number nb = nvalue(rb);
           setnvalue(ra, luai_numunm(nb));
         }
@@ -513,11 +687,11 @@ void luaV_execute (lua_State *L, int nexeccalls) {
         const TValue *rb = RB(i);
         switch (ttype(rb)) {
           case LUA_TTABLE: {
-            setnvalue(ra, cast_num(luaH_getn(hvalue(rb))));
+            setivalue(ra, luaH_getn(hvalue(rb)));
             break;
           }
           case LUA_TSTRING: {
-            setnvalue(ra, cast_num(tsvalue(rb)->len));
+            setivalue(ra, tsvalue(rb)->len);
             break;
           }
           default: {  /* try metamethod */
@@ -538,6 +712,7 @@ void luaV_execute (lua_State *L, int nexeccalls) {
       }
       case OP_JMP: {
         dojump(L, pc, GETARG_sBx(i));
+        if (GETARG_sBx(i) < 0) samplepoint(L);  /* backward jump */
         continue;
       }
       case OP_EQ: {
@@ -551,16 +726,28 @@ void luaV_execute (lua_State *L, int nexeccalls) {
         continue;
       }
       case OP_LT: {
-        Protect(
-          if (luaV_lessthan(L, RKB(i), RKC(i)) == GETARG_A(i))
+        TValue *rb = RKB(i);
+        TValue *rc = RKC(i);
+        if (ttisnumber(rb) && ttisnumber(rc)) {
+          if (numlt(rb, rc) == GETARG_A(i))
+            dojump(L, pc, GETARG_sBx(*pc));
+        }
+        else Protect(
+          if (luaV_lessthan(L, rb, rc) == GETARG_A(i))
             dojump(L, pc, GETARG_sBx(*pc));
         )
         pc++;
         continue;
       }
       case OP_LE: {
-        Protect(
-          if (lessequal(L, RKB(i), RKC(i)) == GETARG_A(i))
+        TValue *rb = RKB(i);
+        TValue *rc = RKC(i);
+        if (ttisnumber(rb) && ttisnumber(rc)) {
+          if (numle(rb, rc) == GETARG_A(i))
+            dojump(L, pc, GETARG_sBx(*pc));
+        }
+        else Protect(
+          if (lessequal(L, rb, rc) == GETARG_A(i))
             dojump(L, pc, GETARG_sBx(*pc));
         )
         pc++;
@@ -581,11 +768,19 @@ void luaV_execute (lua_State *L, int nexeccalls) {
         pc++;
         continue;
       }
-      case OP_CALL: {
+      case OP_CALL: docall: {
         int b = GETARG_B(i);
         int nresults = GETARG_C(i) - 1;
+        samplepoint(L);
         if (b != 0) L->top = ra+b;  /* else previous instruction set top */
         L->savedpc = pc;
+        if (ttisfunction(ra) && luaD_islight(L, ra)) {  /* light C function? */
+          if (luaD_lightcall(L, ra, nresults) == PCRYIELD)
+            return;  /* yield */
+          if (nresults >= 0) L->top = L->ci->top;
+          base = L->base;
+          continue;
+        }
         switch (luaD_precall(L, ra, nresults)) {
           case PCRLUA: {
             nexeccalls++;
@@ -604,6 +799,7 @@ void luaV_execute (lua_State *L, int nexeccalls) {
       }
       case OP_TAILCALL: {
         int b = GETARG_B(i);
+        samplepoint(L);
         if (b != 0) L->top = ra+b;  /* else previous instruction set top */
         L->savedpc = pc;
         lua_assert(GETARG_C(i) - 1 == LUA_MULTRET);
@@ -649,15 +845,30 @@ void luaV_execute (lua_State *L, int nexeccalls) {
           goto reentry;
         }
       }
-      case OP_FORLOOP: {
-        lua_Number step = nvalue(ra+2);
-        lua_Number idx = luai_numadd(nvalue(ra), step); /* increment index */
-        lua_Number limit = nvalue(ra+1);
-        if (luai_numlt(0, step) ? luai_numle(idx, limit)
-                                : luai_numle(limit, idx)) {
-          dojump(L, pc, GETARG_sBx(i));  /* jump back */
-          setnvalue(ra, idx);  /* update internal index... */
-          setnvalue(ra+3, idx);  /* ...and external index */
+      case OP_FORLOOP: doforloop: {
+        if (ttisint(ra)) {  /* integer loop? (see `forprepint') */
+          lua_UInt count = cast(lua_UInt, ivalue(ra+1));
+          if (count > 0) {
+            lua_Int idx = cast(lua_Int, cast(lua_UInt, ivalue(ra)) +
+                                        cast(lua_UInt, ivalue(ra+2)));
+            dojump(L, pc, GETARG_sBx(i));  /* jump back */
+            setivalue(ra+1, cast(lua_Int, count - 1));
+            setivalue(ra, idx);  /* update internal index... */
+            setivalue(ra+3, idx);  /* ...and external index */
+            samplepoint(L);
+          }
+        }
+        else {
+          lua_Number step = fltvalue(ra+2);
+          lua_Number idx = luai_numadd(fltvalue(ra), step); /* increment index */
+          lua_Number limit = fltvalue(ra+1);
+          if (luai_numlt(0, step) ? luai_numle(idx, limit)
+                                  : luai_numle(limit, idx)) {
+            dojump(L, pc, GETARG_sBx(i));  /* jump back */
+            setnvalue(ra, idx);  /* update internal index... */
+            setnvalue(ra+3, idx);  /* ...and external index */
+            samplepoint(L);
+          }
         }
         continue;
       }
@@ -672,7 +883,12 @@ void luaV_execute (lua_State *L, int nexeccalls) {
           luaG_runerror(L, LUA_QL("for") " limit must be a number");
         else if (!tonumber(pstep, ra+2))
           luaG_runerror(L, LUA_QL("for") " step must be a number");
-        setnvalue(ra, luai_numsub(nvalue(ra), nvalue(pstep)));
+        if (!forprepint(ra)) {  /* loop over lua_Number */
+          lua_Number step = nvalue(ra+2);
+          setnvalue(ra+1, nvalue(ra+1));
+          setnvalue(ra+2, step);
+          setnvalue(ra, luai_numsub(nvalue(ra), step));
+        }
         dojump(L, pc, GETARG_sBx(i));
         continue;
       }
@@ -688,8 +904,10 @@ void luaV_execute (lua_State *L, int nexeccalls) {
         if (!ttisnil(cb)) {  /* continue loop? */
           setobjs2s(L, cb-1, cb);  /* save control variable */
           dojump(L, pc, GETARG_sBx(*pc));  /* jump back */
+          pc++;
+          samplepoint(L);  /* `pc' must be final before sampling */
         }
-        pc++;
+        else pc++;
         continue;
       }
       case OP_SETLIST: {
@@ -759,6 +977,33 @@ void luaV_execute (lua_State *L, int nexeccalls) {
         }
         continue;
       }
+      case OP_MOVE_MOVE: {
+        setobjs2s(L, ra, RB(i));
+        dosecond(OP_MOVE, domove);
+      }
+      case OP_MOVE_CALL: {
+        setobjs2s(L, ra, RB(i));
+        dosecond(OP_CALL, docall);
+      }
+      case OP_GETGLOBAL_CALL: {
+        TValue g;
+        sethvalue(L, &g, cl->env);
+        lua_assert(ttisstring(KBx(i)));
+        Protect(luaV_gettable(L, &g, KBx(i), ra));
+        dosecond(OP_CALL, docall);
+      }
+      case OP_GETTABLE_GETTABLE: {
+        Protect(luaV_gettable(L, RB(i), RKC(i), ra));
+        dosecond(OP_GETTABLE, dogettable);
+      }
+      case OP_GETTABLE_ADD: {
+        Protect(luaV_gettable(L, RB(i), RKC(i), ra));
+        dosecond(OP_ADD, doadd);
+      }
+      case OP_ADD_FORLOOP: {
+        arith_op(luai_numadd, luai_intadd, TM_ADD);
+        dosecond(OP_FORLOOP, doforloop);
+      }
     }
   }
 }
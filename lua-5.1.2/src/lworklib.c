@@ -0,0 +1,1173 @@
+/*
+** $Id: lworklib.c $
+** Pools of worker states running on OS threads
+** See Copyright Notice in lua.h
+*/
+
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define lworklib_c
+#define LUA_LIB
+
+#include "lua.h"
+
+#include "lauxlib.h"
+#include "lualib.h"
+
+
+/*
+** A pool owns N independent states, each one running on its own thread
+** a copy of the same function (shared through `lua_sharechunk', so it
+** must not use upvalues). Jobs and results travel through two bounded
+** lock-free queues as self-contained messages: numbers, booleans, strings
+** and tables (even cyclic ones) are serialized into a compact binary
+** form; shared strings (see `worker.share') travel by reference.
+*/
+
+
+#define POOL_MAXPENDING	1024	/* default limit of jobs without results */
+#define INT_ENCODABLE(n)	((n) >= -2147483647.0 && (n) <= 2147483647.0 && \
+				 (n) == (int)(n))
+
+#define POOLHANDLE	"WorkerPool"
+#define SHAREDHANDLE	"SharedString"
+
+
+
+/*
+** {======================================================
+** Atomic operations and threads
+** =======================================================
+*/
+
+/*
+** `atomic_load' has acquire semantics and `atomic_store' has release
+** semantics: a message written before a store is visible to whoever loads
+** the stored value.
+*/
+#if defined(__GNUC__) && ((__GNUC__*100 + __GNUC_MINOR__) >= 407)
+#define atomic_load(p)		__atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define atomic_store(p,v)	__atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#define atomic_cas(p,o,n)	__sync_bool_compare_and_swap((p), (o), (n))
+#define atomic_inc(p)		__sync_add_and_fetch((p), 1)
+#define atomic_dec(p)		__sync_sub_and_fetch((p), 1)
+
+#elif defined(_MSC_VER)
+/* volatile accesses are acquire/release operations in MSVC */
+long __cdecl _InterlockedCompareExchange(long volatile *, long, long);
+long __cdecl _InterlockedIncrement(long volatile *);
+long __cdecl _InterlockedDecrement(long volatile *);
+#pragma intrinsic(_InterlockedCompareExchange)
+#pragma intrinsic(_InterlockedIncrement, _InterlockedDecrement)
+#define atomic_load(p)		(*(p))
+#define atomic_store(p,v)	(*(p) = (v))
+#define atomic_cas(p,o,n)	(_InterlockedCompareExchange((volatile long *)(p), \
+				   (long)(n), (long)(o)) == (long)(o))
+#define atomic_inc(p)		_InterlockedIncrement((volatile long *)(p))
+#define atomic_dec(p)		_InterlockedDecrement((volatile long *)(p))
+
+#else  /* no threads anyway (see below) */
+#define atomic_load(p)		(*(p))
+#define atomic_store(p,v)	(*(p) = (v))
+#define atomic_cas(p,o,n)	(*(p) == (o) ? (*(p) = (n), 1) : 0)
+#define atomic_inc(p)		(++*(p))
+#define atomic_dec(p)		(--*(p))
+#endif
+
+
+#if defined(LUA_USE_PTHREADS)
+
+#include <pthread.h>
+#include <sched.h>
+
+#define WORKER_THREADS	1
+
+typedef pthread_t Thread;
+
+typedef struct Signal {
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+} Signal;
+
+static void *threadmain (void *ud);
+
+static int startthread (Thread *t, void *ud) {
+  return pthread_create(t, NULL, threadmain, ud) == 0;
+}
+
+static void jointhread (Thread *t) {
+  pthread_join(*t, NULL);
+}
+
+static void yieldthread (void) {
+  sched_yield();
+}
+
+static int initsignal (Signal *s) {
+  if (pthread_mutex_init(&s->lock, NULL) != 0) return 0;
+  if (pthread_cond_init(&s->cond, NULL) != 0) {
+    pthread_mutex_destroy(&s->lock);
+    return 0;
+  }
+  return 1;
+}
+
+static void freesignal (Signal *s) {
+  pthread_cond_destroy(&s->cond);
+  pthread_mutex_destroy(&s->lock);
+}
+
+/* a waiter calls `beginwait', checks again and only then `blockwait' */
+static void beginwait (Signal *s) {
+  pthread_mutex_lock(&s->lock);
+}
+
+static void blockwait (Signal *s) {
+  pthread_cond_wait(&s->cond, &s->lock);
+}
+
+static void endwait (Signal *s) {
+  pthread_mutex_unlock(&s->lock);
+}
+
+static void wakeall (Signal *s) {
+  pthread_mutex_lock(&s->lock);
+  pthread_cond_broadcast(&s->cond);
+  pthread_mutex_unlock(&s->lock);
+}
+
+#elif defined(LUA_WIN)
+
+#include <windows.h>
+#include <process.h>
+
+#define WORKER_THREADS	1
+
+typedef HANDLE Thread;
+
+typedef HANDLE Signal;  /* a manual-reset event */
+
+static void *threadmain (void *ud);
+
+static unsigned __stdcall winthreadmain (void *ud) {
+  threadmain(ud);
+  return 0;
+}
+
+static int startthread (Thread *t, void *ud) {
+  *t = (HANDLE)_beginthreadex(NULL, 0, winthreadmain, ud, 0, NULL);
+  return *t != 0;
+}
+
+static void jointhread (Thread *t) {
+  WaitForSingleObject(*t, INFINITE);
+  CloseHandle(*t);
+}
+
+static void yieldthread (void) {
+  Sleep(0);
+}
+
+static int initsignal (Signal *s) {
+  *s = CreateEvent(NULL, TRUE, FALSE, NULL);
+  return *s != NULL;
+}
+
+static void freesignal (Signal *s) {
+  CloseHandle(*s);
+}
+
+/*
+** A waiter resets the event before checking again, so a wake that comes
+** after that check finds it reset and sets it; a wake that comes before
+** the reset is not lost either, as that check then sees its change.
+*/
+static void beginwait (Signal *s) {
+  ResetEvent(*s);
+}
+
+static void blockwait (Signal *s) {
+  WaitForSingleObject(*s, INFINITE);
+}
+
+static void endwait (Signal *s) {
+  (void)s;
+}
+
+static void wakeall (Signal *s) {
+  SetEvent(*s);
+}
+
+#else
+
+#define WORKER_THREADS	0
+
+typedef int Thread;
+
+typedef int Signal;
+
+static void *threadmain (void *ud);
+
+static int startthread (Thread *t, void *ud) {
+  (void)t; (void)ud; (void)threadmain;
+  return 0;  /* no threads on this system */
+}
+
+static void jointhread (Thread *t) {
+  (void)t;
+}
+
+static void yieldthread (void) {
+}
+
+static int initsignal (Signal *s) {
+  *s = 0;
+  return 1;
+}
+
+static void freesignal (Signal *s) { (void)s; }
+static void beginwait (Signal *s) { (void)s; }
+static void blockwait (Signal *s) { (void)s; }
+static void endwait (Signal *s) { (void)s; }
+static void wakeall (Signal *s) { (void)s; }
+
+#endif
+
+
+/* spins a little, then yields; returns 0 when it is time to block */
+static int backoff (int *n) {
+  if (*n < 100) {
+    volatile int i;
+    for (i = 0; i < 50; i++) ;
+  }
+  else if (*n < 110)
+    yieldthread();
+  else
+    return 0;
+  (*n)++;
+  return 1;
+}
+
+/* }====================================================== */
+
+
+
+/*
+** {======================================================
+** Shared strings
+** =======================================================
+*/
+
+typedef struct Blob {
+  volatile long ref;
+  size_t len;
+  char data[1];
+} Blob;
+
+
+static void releaseblob (Blob *b) {
+  if (atomic_dec(&b->ref) == 0)
+    free(b);
+}
+
+
+static Blob **toblob (lua_State *L, int idx) {
+  return (Blob **)luaL_checkudata(L, idx, SHAREDHANDLE);
+}
+
+
+static const luaL_Reg blobmeta[];
+
+/* pushes a new handle for `b', taking over one of its references */
+static void pushblob (lua_State *L, Blob *b) {
+  Blob **h = (Blob **)lua_newuserdata(L, sizeof(Blob *));
+  *h = b;
+  if (luaL_newmetatable(L, SHAREDHANDLE)) {  /* not created by luaopen? */
+    luaL_register(L, NULL, blobmeta);
+    lua_pushvalue(L, -1);
+    lua_setfield(L, -2, "__index");
+  }
+  lua_setmetatable(L, -2);
+}
+
+
+static int worker_share (lua_State *L) {
+  size_t l;
+  const char *s = luaL_checklstring(L, 1, &l);
+  Blob *b = (Blob *)malloc(sizeof(Blob) + l);
+  if (b == NULL)
+    return luaL_error(L, "not enough memory");
+  b->ref = 1;
+  b->len = l;
+  memcpy(b->data, s, l);
+  pushblob(L, b);
+  return 1;
+}
+
+
+static int blob_gc (lua_State *L) {
+  Blob **h = toblob(L, 1);
+  if (*h != NULL) {
+    releaseblob(*h);
+    *h = NULL;
+  }
+  return 0;
+}
+
+
+static int blob_len (lua_State *L) {
+  lua_pushinteger(L, (lua_Integer)(*toblob(L, 1))->len);
+  return 1;
+}
+
+
+static int blob_tostring (lua_State *L) {
+  Blob *b = *toblob(L, 1);
+  lua_pushlstring(L, b->data, b->len);
+  return 1;
+}
+
+
+static ptrdiff_t work_posrelat (ptrdiff_t pos, size_t len) {
+  /* relative string position: negative means back from end */
+  return (pos>=0) ? pos : (ptrdiff_t)len+pos+1;
+}
+
+
+/* same as string.sub, but copies only the slice */
+static int blob_sub (lua_State *L) {
+  Blob *b = *toblob(L, 1);
+  ptrdiff_t start = work_posrelat(luaL_checkinteger(L, 2), b->len);
+  ptrdiff_t end = work_posrelat(luaL_optinteger(L, 3, -1), b->len);
+  if (start < 1) start = 1;
+  if (end > (ptrdiff_t)b->len) end = (ptrdiff_t)b->len;
+  if (start <= end)
+    lua_pushlstring(L, b->data+start-1, end-start+1);
+  else lua_pushliteral(L, "");
+  return 1;
+}
+
+
+static const luaL_Reg blobmeta[] = {
+  {"__gc", blob_gc},
+  {"__len", blob_len},
+  {"__tostring", blob_tostring},
+  {"len", blob_len},
+  {"sub", blob_sub},
+  {"tostring", blob_tostring},
+  {NULL, NULL}
+};
+
+/* }====================================================== */
+
+
+
+/*
+** {======================================================
+** Messages
+** =======================================================
+*/
+
+enum { M_NIL, M_FALSE, M_TRUE, M_INT, M_INTEGER, M_NUMBER, M_STRING,
+       M_SHARED, M_TABLE, M_REF, M_END };
+
+enum { MSG_JOB, MSG_STOP, MSG_OK, MSG_ERROR };
+
+
+typedef struct Msg {
+  int kind;  /* MSG_* */
+  int nvalues;
+  lua_Number id;
+  char *data;
+  size_t size;
+  size_t capacity;
+  Blob **blobs;  /* shared strings referenced by the message */
+  int nblobs;
+  int sizeblobs;
+} Msg;
+
+
+static Msg *newmsg (int kind) {
+  Msg *m = (Msg *)malloc(sizeof(Msg));
+  if (m != NULL) {
+    m->kind = kind;
+    m->nvalues = 0;
+    m->id = 0;
+    m->data = NULL;
+    m->size = m->capacity = 0;
+    m->blobs = NULL;
+    m->nblobs = m->sizeblobs = 0;
+  }
+  return m;
+}
+
+
+/* tells a worker to finish (preallocated, so closing never fails) */
+static Msg stopmsg = {MSG_STOP, 0, 0, NULL, 0, 0, NULL, 0, 0};
+
+
+static void freemsg (Msg *m) {
+  int i;
+  if (m == NULL || m == &stopmsg) return;
+  for (i = 0; i < m->nblobs; i++)
+    releaseblob(m->blobs[i]);
+  free(m->blobs);
+  free(m->data);
+  free(m);
+}
+
+
+static void resetmsg (Msg *m, int kind) {
+  int i;
+  for (i = 0; i < m->nblobs; i++)
+    releaseblob(m->blobs[i]);
+  m->nblobs = 0;
+  m->size = 0;
+  m->nvalues = 0;
+  m->kind = kind;
+}
+
+
+/* appends `n' bytes to the message; returns 0 if there is no memory */
+static int putraw (Msg *m, const void *p, size_t n) {
+  if (m->size + n > m->capacity) {
+    size_t newsize = (m->capacity == 0) ? 64 : 2 * m->capacity;
+    char *newdata;
+    while (newsize < m->size + n) newsize *= 2;
+    newdata = (char *)realloc(m->data, newsize);
+    if (newdata == NULL) return 0;
+    m->data = newdata;
+    m->capacity = newsize;
+  }
+  memcpy(m->data + m->size, p, n);
+  m->size += n;
+  return 1;
+}
+
+
+/* sizes use 7 bits per byte, with the high bit set while more follow */
+#define MAXSIZEBYTES	(sizeof(size_t) * 8 / 7 + 1)
+
+static size_t sizebytes (unsigned char *buff, size_t n) {
+  size_t i = 0;
+  do {
+    buff[i++] = (unsigned char)((n & 0x7f) | (n > 0x7f ? 0x80 : 0));
+    n >>= 7;
+  } while (n != 0);
+  return i;
+}
+
+
+static void putbytes (lua_State *L, Msg *m, const void *p, size_t n) {
+  if (!putraw(m, p, n))
+    luaL_error(L, "not enough memory");
+}
+
+
+static void puttag (lua_State *L, Msg *m, int tag) {
+  unsigned char c = (unsigned char)tag;
+  putbytes(L, m, &c, 1);
+}
+
+
+static void putsize (lua_State *L, Msg *m, size_t n) {
+  unsigned char buff[MAXSIZEBYTES];
+  putbytes(L, m, buff, sizebytes(buff, n));
+}
+
+
+/* turns `m' into an error reply with message `s' (never raises errors) */
+static void seterror (Msg *m, const char *s) {
+  unsigned char buff[MAXSIZEBYTES];
+  unsigned char tag = M_STRING;
+  size_t l = strlen(s);
+  resetmsg(m, MSG_ERROR);
+  if (putraw(m, &tag, 1) && putraw(m, buff, sizebytes(buff, l)) &&
+      putraw(m, s, l))
+    m->nvalues = 1;
+  else
+    m->size = 0;  /* receiver reports a memory error */
+}
+
+
+/*
+** Encodes the value at `idx'; `seen' (a table) maps each table already
+** encoded to its order number, so shared and cyclic tables keep their
+** structure.
+*/
+static void encode (lua_State *L, Msg *m, int idx, int seen, int *ntables) {
+  switch (lua_type(L, idx)) {
+    case LUA_TNIL:
+      puttag(L, m, M_NIL);
+      break;
+    case LUA_TBOOLEAN:
+      puttag(L, m, lua_toboolean(L, idx) ? M_TRUE : M_FALSE);
+      break;
+    case LUA_TNUMBER: {
+      lua_Number n = lua_tonumber(L, idx);
+      if (INT_ENCODABLE(n)) {
+        int i = (int)n;
+        puttag(L, m, M_INT);
+        putbytes(L, m, &i, sizeof(i));
+      }
+      else if (lua_isinteger(L, idx)) {  /* keep all its digits */
+        lua_Integer i = lua_tointeger(L, idx);
+        puttag(L, m, M_INTEGER);
+        putbytes(L, m, &i, sizeof(i));
+      }
+      else {
+        puttag(L, m, M_NUMBER);
+        putbytes(L, m, &n, sizeof(n));
+      }
+      break;
+    }
+    case LUA_TSTRING: {
+      size_t l;
+      const char *s = lua_tolstring(L, idx, &l);
+      puttag(L, m, M_STRING);
+      putsize(L, m, l);
+      putbytes(L, m, s, l);
+      break;
+    }
+    case LUA_TTABLE: {
+      lua_pushvalue(L, idx);
+      lua_rawget(L, seen);
+      if (!lua_isnil(L, -1)) {  /* already encoded? */
+        puttag(L, m, M_REF);
+        putsize(L, m, (size_t)lua_tointeger(L, -1));
+        lua_pop(L, 1);
+        break;
+      }
+      lua_pop(L, 1);
+      luaL_checkstack(L, 4, "table too deep");
+      lua_pushvalue(L, idx);
+      lua_pushinteger(L, ++(*ntables));
+      lua_rawset(L, seen);
+      puttag(L, m, M_TABLE);
+      lua_pushnil(L);
+      while (lua_next(L, idx)) {
+        int top = lua_gettop(L);
+        encode(L, m, top - 1, seen, ntables);
+        encode(L, m, top, seen, ntables);
+        lua_pop(L, 1);
+      }
+      puttag(L, m, M_END);
+      break;
+    }
+    case LUA_TUSERDATA: {
+      Blob **h = (Blob **)lua_touserdata(L, idx);
+      int isblob;
+      lua_getmetatable(L, idx);
+      luaL_getmetatable(L, SHAREDHANDLE);
+      isblob = lua_rawequal(L, -1, -2);
+      lua_pop(L, 2);
+      if (isblob && *h != NULL) {
+        if (m->nblobs == m->sizeblobs) {
+          int newsize = (m->sizeblobs == 0) ? 4 : 2 * m->sizeblobs;
+          Blob **newblobs = (Blob **)realloc(m->blobs,
+                                             newsize * sizeof(Blob *));
+          if (newblobs == NULL)
+            luaL_error(L, "not enough memory");
+          m->blobs = newblobs;
+          m->sizeblobs = newsize;
+        }
+        atomic_inc(&(*h)->ref);
+        m->blobs[m->nblobs] = *h;
+        puttag(L, m, M_SHARED);
+        putsize(L, m, (size_t)m->nblobs++);
+        break;
+      }
+      /* else go through */
+    }
+    default:
+      luaL_error(L, "cannot send a %s value", luaL_typename(L, idx));
+  }
+}
+
+
+/* encodes the values from `first' to the top */
+static void encodeall (lua_State *L, Msg *m, int first) {
+  int top = lua_gettop(L);
+  int ntables = 0;
+  int i;
+  lua_newtable(L);  /* seen */
+  for (i = first; i <= top; i++)
+    encode(L, m, i, top + 1, &ntables);
+  m->nvalues += top - first + 1;
+  lua_pop(L, 1);
+}
+
+
+typedef struct Reader {
+  const Msg *m;
+  size_t pos;
+  int ntables;
+} Reader;
+
+
+static const char *getbytes (lua_State *L, Reader *r, size_t n) {
+  const char *p = r->m->data + r->pos;
+  if (n > r->m->size - r->pos)
+    luaL_error(L, "malformed message");
+  r->pos += n;
+  return p;
+}
+
+
+static int gettag (lua_State *L, Reader *r) {
+  return (unsigned char)*getbytes(L, r, 1);
+}
+
+
+static size_t getsize (lua_State *L, Reader *r) {
+  size_t n = 0;
+  int shift = 0;
+  int c;
+  do {
+    c = gettag(L, r);
+    n |= (size_t)(c & 0x7f) << shift;
+    shift += 7;
+  } while (c & 0x80);
+  return n;
+}
+
+
+/* pushes the next value; `tables' lists the tables decoded so far */
+static void decode (lua_State *L, Reader *r, int tables) {
+  int tag = gettag(L, r);
+  switch (tag) {
+    case M_NIL: lua_pushnil(L); break;
+    case M_FALSE: lua_pushboolean(L, 0); break;
+    case M_TRUE: lua_pushboolean(L, 1); break;
+    case M_INT: {
+      int i;
+      memcpy(&i, getbytes(L, r, sizeof(i)), sizeof(i));
+      lua_pushinteger(L, i);
+      break;
+    }
+    case M_INTEGER: {
+      lua_Integer i;
+      memcpy(&i, getbytes(L, r, sizeof(i)), sizeof(i));
+      lua_pushinteger(L, i);
+      break;
+    }
+    case M_NUMBER: {
+      lua_Number n;
+      memcpy(&n, getbytes(L, r, sizeof(n)), sizeof(n));
+      lua_pushnumber(L, n);
+      break;
+    }
+    case M_STRING: {
+      size_t l = getsize(L, r);
+      lua_pushlstring(L, getbytes(L, r, l), l);
+      break;
+    }
+    case M_SHARED: {
+      size_t i = getsize(L, r);
+      Blob *b;
+      if (i >= (size_t)r->m->nblobs)
+        luaL_error(L, "malformed message");
+      b = r->m->blobs[i];
+      atomic_inc(&b->ref);  /* the handle gets its own reference */
+      pushblob(L, b);
+      break;
+    }
+    case M_TABLE: {
+      luaL_checkstack(L, 4, "table too deep");
+      lua_newtable(L);
+      lua_pushvalue(L, -1);
+      lua_rawseti(L, tables, ++r->ntables);
+      for (;;) {
+        if (r->pos < r->m->size &&
+            (unsigned char)r->m->data[r->pos] == M_END) {
+          r->pos++;
+          break;
+        }
+        decode(L, r, tables);  /* key */
+        decode(L, r, tables);  /* value */
+        if (lua_isnil(L, -2))
+          luaL_error(L, "malformed message");
+        lua_rawset(L, -3);
+      }
+      break;
+    }
+    case M_REF: {
+      size_t i = getsize(L, r);
+      if (i < 1 || i > (size_t)r->ntables)
+        luaL_error(L, "malformed message");
+      lua_rawgeti(L, tables, (int)i);
+      break;
+    }
+    default:
+      luaL_error(L, "malformed message");
+  }
+}
+
+
+/* pushes all values of a message; returns their number */
+static int decodeall (lua_State *L, const Msg *m) {
+  Reader r;
+  int tables, i;
+  r.m = m;
+  r.pos = 0;
+  r.ntables = 0;
+  luaL_checkstack(L, m->nvalues + 2, "too many values in message");
+  lua_newtable(L);
+  tables = lua_gettop(L);
+  for (i = 0; i < m->nvalues; i++)
+    decode(L, &r, tables);
+  lua_remove(L, tables);
+  return m->nvalues;
+}
+
+/* }====================================================== */
+
+
+
+/*
+** {======================================================
+** Channels: bounded multi-producer/multi-consumer queues
+** (each cell has a sequence number that tells whose turn it is)
+** =======================================================
+*/
+
+/*
+** A thread that finds a channel empty (or full) spins and yields for a
+** while, then parks on the channel's signal; every push and pop that
+** finds some thread parked wakes them all up. A waiter counts itself in
+** `waiters' before it checks the channel again, and a push or pop reads
+** `waiters' after it changes the channel, both with full barriers, so
+** either the waiter sees the change or the changer sees the waiter.
+*/
+
+typedef struct Cell {
+  volatile unsigned long seq;
+  Msg *msg;
+} Cell;
+
+
+typedef struct Channel {
+  Cell *cells;
+  unsigned long mask;
+  volatile unsigned long head;  /* next cell to write */
+  char pad[64];  /* keep writers and readers on different cache lines */
+  volatile unsigned long tail;  /* next cell to read */
+  volatile long waiters;  /* threads parked (or about to park) */
+  Signal signal;
+} Channel;
+
+
+static int chan_init (Channel *c, unsigned long size) {
+  unsigned long i;
+  Cell *cells = (Cell *)malloc(size * sizeof(Cell));
+  if (cells == NULL) return 0;
+  if (!initsignal(&c->signal)) {
+    free(cells);
+    return 0;
+  }
+  for (i = 0; i < size; i++)
+    cells[i].seq = i;
+  c->cells = cells;
+  c->mask = size - 1;
+  c->head = c->tail = 0;
+  c->waiters = 0;
+  return 1;
+}
+
+
+/* wakes the parked threads, if any, after a change to the channel */
+static void chan_wake (Channel *c) {
+  if (!atomic_cas(&c->waiters, 0, 0))  /* a load with a full barrier */
+    wakeall(&c->signal);
+}
+
+
+static int chan_trypush (Channel *c, Msg *m) {
+  unsigned long pos = atomic_load(&c->head);
+  Cell *cell;
+  for (;;) {
+    long diff;
+    cell = &c->cells[pos & c->mask];
+    diff = (long)(atomic_load(&cell->seq) - pos);
+    if (diff == 0) {
+      if (atomic_cas(&c->head, pos, pos + 1)) break;
+    }
+    else if (diff < 0)
+      return 0;  /* full */
+    pos = atomic_load(&c->head);
+  }
+  cell->msg = m;
+  atomic_store(&cell->seq, pos + 1);  /* publish it */
+  return 1;
+}
+
+
+static Msg *chan_trypop (Channel *c) {
+  unsigned long pos = atomic_load(&c->tail);
+  Cell *cell;
+  Msg *m;
+  for (;;) {
+    long diff;
+    cell = &c->cells[pos & c->mask];
+    diff = (long)(atomic_load(&cell->seq) - (pos + 1));
+    if (diff == 0) {
+      if (atomic_cas(&c->tail, pos, pos + 1)) break;
+    }
+    else if (diff < 0)
+      return NULL;  /* empty */
+    pos = atomic_load(&c->tail);
+  }
+  m = cell->msg;
+  atomic_store(&cell->seq, pos + c->mask + 1);  /* free the cell */
+  return m;
+}
+
+
+static Msg *chan_pop (Channel *c) {
+  Msg *m = chan_trypop(c);
+  if (m != NULL) chan_wake(c);
+  return m;
+}
+
+
+static void chan_pushwait (Channel *c, Msg *m) {
+  int n = 0;
+  int done;
+  while (!(done = chan_trypush(c, m)) && backoff(&n)) ;
+  while (!done) {
+    beginwait(&c->signal);
+    atomic_inc(&c->waiters);
+    if (!(done = chan_trypush(c, m)))
+      blockwait(&c->signal);
+    atomic_dec(&c->waiters);
+    endwait(&c->signal);
+  }
+  chan_wake(c);
+}
+
+
+static Msg *chan_popwait (Channel *c) {
+  int n = 0;
+  Msg *m;
+  while ((m = chan_trypop(c)) == NULL && backoff(&n)) ;
+  while (m == NULL) {
+    beginwait(&c->signal);
+    atomic_inc(&c->waiters);
+    if ((m = chan_trypop(c)) == NULL)
+      blockwait(&c->signal);
+    atomic_dec(&c->waiters);
+    endwait(&c->signal);
+  }
+  chan_wake(c);
+  return m;
+}
+
+
+static void chan_free (Channel *c) {
+  Msg *m;
+  if (c->cells == NULL) return;
+  while ((m = chan_trypop(c)) != NULL)
+    freemsg(m);
+  free(c->cells);
+  c->cells = NULL;
+  freesignal(&c->signal);
+}
+
+/* }====================================================== */
+
+
+
+/*
+** {======================================================
+** Pools
+** =======================================================
+*/
+
+typedef struct Worker {
+  struct Pool *pool;
+  lua_State *L;
+  Msg *job;  /* job being run */
+  Msg *reply;  /* reply being built */
+  Thread thread;
+  int running;  /* thread was started */
+} Worker;
+
+
+typedef struct Pool {
+  Channel jobs;
+  Channel results;
+  Worker *workers;
+  int nworkers;
+  int maxpending;
+  int pending;  /* jobs sent but not received */
+  lua_Number nextid;
+  Msg *scratch;  /* message being encoded by the owner */
+  Msg *last;  /* message being decoded by the owner */
+  int closed;
+} Pool;
+
+
+static Pool *topool (lua_State *L) {
+  Pool *p = (Pool *)luaL_checkudata(L, 1, POOLHANDLE);
+  if (p->closed)
+    luaL_error(L, "attempt to use a closed pool");
+  return p;
+}
+
+
+/* runs in a new worker state, through `lua_cpcall' */
+static int initworker (lua_State *L) {
+  lua_Chunk *c = (lua_Chunk *)lua_touserdata(L, 1);
+  luaL_openlibs(L);
+  lua_pushlightuserdata(L, (void *)&stopmsg);  /* key for the function */
+  lua_pushchunk(L, c);
+  lua_rawset(L, LUA_REGISTRYINDEX);
+  return 0;
+}
+
+
+/* runs a job in a worker state, through `lua_cpcall' */
+static int runjob (lua_State *L) {
+  Worker *w = (Worker *)lua_touserdata(L, 1);
+  int n;
+  lua_settop(L, 0);
+  lua_pushlightuserdata(L, (void *)&stopmsg);
+  lua_rawget(L, LUA_REGISTRYINDEX);
+  n = decodeall(L, w->job);
+  lua_call(L, n, LUA_MULTRET);
+  encodeall(L, w->reply, 1);
+  return 0;
+}
+
+
+static void *threadmain (void *ud) {
+  Worker *w = (Worker *)ud;
+  Pool *p = w->pool;
+  for (;;) {
+    Msg *job = chan_popwait(&p->jobs);
+    Msg *reply;
+    if (job == &stopmsg) break;
+    reply = newmsg(MSG_OK);
+    if (reply == NULL) {  /* no memory: answer with the job itself */
+      seterror(job, "not enough memory");
+      chan_pushwait(&p->results, job);
+      continue;
+    }
+    reply->id = job->id;
+    w->job = job;
+    w->reply = reply;
+    if (lua_cpcall(w->L, runjob, w) != 0) {
+      const char *msg = lua_tostring(w->L, -1);
+      seterror(reply, msg ? msg : "(error object is not a string)");
+      lua_settop(w->L, 0);
+    }
+    w->job = w->reply = NULL;
+    freemsg(job);
+    chan_pushwait(&p->results, reply);
+  }
+  return NULL;
+}
+
+
+static void closepool (Pool *p) {
+  int i;
+  for (i = 0; i < p->nworkers; i++)
+    if (p->workers[i].running)
+      chan_pushwait(&p->jobs, &stopmsg);
+  for (i = 0; i < p->nworkers; i++) {
+    Worker *w = &p->workers[i];
+    if (w->running)
+      jointhread(&w->thread);
+    if (w->L != NULL)
+      lua_close(w->L);
+  }
+  free(p->workers);
+  p->workers = NULL;
+  p->nworkers = 0;
+  chan_free(&p->jobs);
+  chan_free(&p->results);
+  freemsg(p->scratch);
+  freemsg(p->last);
+  p->scratch = p->last = NULL;
+  p->closed = 1;
+}
+
+
+static int worker_pool (lua_State *L) {
+  int n = luaL_checkint(L, 1);
+  int maxpending = luaL_optint(L, 3, POOL_MAXPENDING);
+  unsigned long size = 1;
+  lua_Chunk *c;
+  Pool *p;
+  int i;
+  luaL_argcheck(L, n >= 1, 1, "must be positive");
+  luaL_argcheck(L, maxpending >= 1, 3, "must be positive");
+  if (lua_type(L, 2) == LUA_TSTRING) {  /* source code? */
+    size_t l;
+    const char *s = lua_tolstring(L, 2, &l);
+    if (luaL_loadbuffer(L, s, l, "=worker") != 0)
+      return lua_error(L);
+    lua_replace(L, 2);
+  }
+  luaL_checktype(L, 2, LUA_TFUNCTION);
+  luaL_argcheck(L, !lua_iscfunction(L, 2) && lua_getupvalue(L, 2, 1) == NULL,
+                2, "Lua function without upvalues expected");
+  if (!WORKER_THREADS)
+    return luaL_error(L, "no threads on this system");
+  while (size < (unsigned long)maxpending) size <<= 1;
+  p = (Pool *)lua_newuserdata(L, sizeof(Pool));
+  p->jobs.cells = p->results.cells = NULL;
+  p->workers = NULL;
+  p->nworkers = 0;
+  p->maxpending = maxpending;
+  p->pending = 0;
+  p->nextid = 0;
+  p->scratch = p->last = NULL;
+  p->closed = 0;
+  luaL_getmetatable(L, POOLHANDLE);
+  lua_setmetatable(L, -2);  /* from now on, __gc cleans up */
+  if (!chan_init(&p->jobs, size) || !chan_init(&p->results, size) ||
+      (p->workers = (Worker *)malloc(n * sizeof(Worker))) == NULL)
+    return luaL_error(L, "not enough memory");
+  c = lua_sharechunk(L, 2);
+  if (c == NULL)
+    return luaL_error(L, "not enough memory");
+  for (i = 0; i < n; i++) {
+    Worker *w = &p->workers[i];
+    w->pool = p;
+    w->job = w->reply = NULL;
+    w->running = 0;
+    w->L = luaL_newstate();
+    p->nworkers++;
+    if (w->L == NULL || lua_cpcall(w->L, initworker, c) != 0) {
+      if (w->L == NULL) lua_pushliteral(L, "cannot create worker state");
+      else lua_pushstring(L, lua_tostring(w->L, -1));
+      lua_releasechunk(c);
+      return lua_error(L);
+    }
+  }
+  lua_releasechunk(c);
+  for (i = 0; i < n; i++) {
+    if (!startthread(&p->workers[i].thread, &p->workers[i]))
+      return luaL_error(L, "cannot start worker thread");
+    p->workers[i].running = 1;
+  }
+  return 1;
+}
+
+
+static int pool_send (lua_State *L) {
+  Pool *p = topool(L);
+  lua_Number id;
+  if (p->pending >= p->maxpending)
+    return luaL_error(L, "too many pending jobs (receive some results first)");
+  if (p->scratch == NULL && (p->scratch = newmsg(MSG_JOB)) == NULL)
+    return luaL_error(L, "not enough memory");
+  resetmsg(p->scratch, MSG_JOB);  /* may hold a failed encoding */
+  encodeall(L, p->scratch, 2);
+  id = p->scratch->id = ++p->nextid;
+  chan_pushwait(&p->jobs, p->scratch);
+  p->scratch = NULL;
+  p->pending++;
+  lua_pushnumber(L, id);
+  return 1;
+}
+
+
+/*
+** Returns the id of a finished job, a success flag and its results (or
+** its error message); returns nothing if no job is pending or, when
+** `wait' is false, if no job has finished yet.
+*/
+static int pool_receive (lua_State *L) {
+  Pool *p = topool(L);
+  int wait = lua_isnoneornil(L, 2) || lua_toboolean(L, 2);
+  Msg *m;
+  freemsg(p->last);  /* previous message is fully decoded by now */
+  p->last = NULL;
+  if (p->pending == 0) return 0;
+  m = wait ? chan_popwait(&p->results) : chan_pop(&p->results);
+  if (m == NULL) return 0;
+  p->pending--;
+  p->last = m;  /* keep it to be freed even if decoding fails */
+  lua_pushnumber(L, m->id);
+  lua_pushboolean(L, m->kind == MSG_OK);
+  if (m->kind == MSG_ERROR && m->nvalues == 0) {
+    lua_pushliteral(L, "not enough memory");
+    return 3;
+  }
+  return 2 + decodeall(L, m);
+}
+
+
+static int pool_pending (lua_State *L) {
+  lua_pushinteger(L, topool(L)->pending);
+  return 1;
+}
+
+
+static int pool_size (lua_State *L) {
+  lua_pushinteger(L, topool(L)->nworkers);
+  return 1;
+}
+
+
+static int pool_close (lua_State *L) {
+  Pool *p = (Pool *)luaL_checkudata(L, 1, POOLHANDLE);
+  if (!p->closed)
+    closepool(p);
+  return 0;
+}
+
+
+static int pool_tostring (lua_State *L) {
+  Pool *p = (Pool *)luaL_checkudata(L, 1, POOLHANDLE);
+  if (p->closed)
+    lua_pushliteral(L, "worker pool (closed)");
+  else
+    lua_pushfstring(L, "worker pool (%p)", (void *)p);
+  return 1;
+}
+
+/* }====================================================== */
+
+
+static const luaL_Reg poolmeta[] = {
+  {"close", pool_close},
+  {"pending", pool_pending},
+  {"receive", pool_receive},
+  {"send", pool_send},
+  {"size", pool_size},
+  {"__gc", pool_close},
+  {"__tostring", pool_tostring},
+  {NULL, NULL}
+};
+
+
+static const luaL_Reg worklib[] = {
+  {"pool", worker_pool},
+  {"share", worker_share},
+  {NULL, NULL}
+};
+
+
+static void work_createmeta (lua_State *L, const char *name,
+                            const luaL_Reg *l) {
+  luaL_newmetatable(L, name);
+  lua_pushvalue(L, -1);
+  lua_setfield(L, -2, "__index");
+  luaL_register(L, NULL, l);
+  lua_pop(L, 1);
+}
+
+
+LUALIB_API int luaopen_worker (lua_State *L) {
+  work_createmeta(L, POOLHANDLE, poolmeta);
+  work_createmeta(L, SHAREDHANDLE, blobmeta);
+  luaL_register(L, LUA_WORKLIBNAME, worklib);
+  return 1;
+}
+
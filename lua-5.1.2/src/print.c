@@ -60,7 +60,10 @@ static void PrintConstant(const Proto* f, int i)
 	printf(bvalue(o) ? "true" : "false");
 	break;
   case LUA_TNUMBER:
-	printf(LUA_NUMBER_FMT,nvalue(o));
+	if (ttisint(o))
+	 printf(LUA_INTFMT,ivalue(o));
+	else
+	 printf(LUA_NUMBER_FMT,nvalue(o));
 	break;
   case LUA_TSTRING:
 	PrintString(rawtsvalue(o));
@@ -102,7 +105,7 @@ static void PrintCode(const Proto* f)
     if (o==OP_JMP) printf("%d",sbx); else printf("%d %d",a,sbx);
     break;
   }
-  switch (o)
+  switch (firstop(o))
   {
    case OP_LOADK:
     printf("\t; "); PrintConstant(f,bx);
@@ -0,0 +1,77 @@
+-- check the typed arrays of the array library
+
+local kinds = {"float32", "float64", "int32"}
+
+local function fails(msg, f, ...)
+  local ok, err = pcall(f, ...)
+  assert(not ok, "expected an error")
+  assert(string.find(err, msg, 1, true), err)
+end
+
+local function same(a, t)
+  assert(#a == #t)
+  for i = 1, #t do assert(a[i] == t[i], i) end
+end
+
+for _, kind in ipairs(kinds) do
+  -- construction, length, element access
+  local a = array.new(kind, 5)
+  assert(a:kind() == kind and #a == 5)
+  same(a, {0, 0, 0, 0, 0})
+  a = array.new(kind, 3, 7)
+  same(a, {7, 7, 7})
+  a = array.fromtable(kind, {1, 2, 3, 4, 5, 6, 7})
+  same(a, {1, 2, 3, 4, 5, 6, 7})
+  same(a:copy(), a:totable())
+  a[1] = 10; a[7] = -2
+  assert(a[1] == 10 and a[7] == -2)
+  assert(#array.new(kind, 0) == 0)
+  fails("negative size", array.new, kind, -1)
+
+  -- bounds and keys
+  assert(a[0] == nil and a[8] == nil and a[-1] == nil)
+  fails("index out of range", function () a[0] = 1 end)
+  fails("index out of range", function () a[8] = 1 end)
+  fails("integer index expected", function () a[1.5] = 1 end)
+  fails("integer index expected", function () return a[2.5] end)
+  fails("integer index expected", function () return a[0/0] end)
+  fails("number expected", function () a[1] = "x" end)
+
+  -- bulk operations
+  local x = array.fromtable(kind, {1, 2, 3, 4, 5, 6, 7, 8, 9})
+  local y = array.new(kind, 9, 1)
+  assert(x:sum() == 45 and y:sum() == 9)
+  assert(x:dot(y) == 45 and x:dot(x) == 285)
+  assert(x:min() == 1 and x:max() == 9)
+  assert(array.fromtable(kind, {3, -4, 8, 0}):min() == -4)
+  assert(array.fromtable(kind, {3, -4, 8, 0}):max() == 8)
+  assert(array.new(kind, 0):min() == nil and array.new(kind, 0):max() == nil)
+  assert(array.new(kind, 0):sum() == 0)
+  assert(y:axpy(2, x) == y)
+  same(y, {3, 5, 7, 9, 11, 13, 15, 17, 19})
+  same(x:copy():scale(3), {3, 6, 9, 12, 15, 18, 21, 24, 27})
+  assert(y:fill(4) == y)
+  same(y, {4, 4, 4, 4, 4, 4, 4, 4, 4})
+  assert(y:sum() == 36)
+
+  -- mismatched operands
+  local short = array.new(kind, 8)
+  fails("array sizes differ", x.dot, x, short)
+  fails("array sizes differ", x.axpy, x, 1, short)
+  local other = kind == "float64" and "int32" or "float64"
+  fails("array kinds differ", x.dot, x, array.new(other, 9))
+  fails("array kinds differ", x.axpy, x, 1, array.new(other, 9))
+  fails("NumArray expected", x.dot, x, {})
+end
+
+-- element types
+local f = array.new("float32", 1, 0.1)
+assert(f[1] ~= 0.1 and math.abs(f[1] - 0.1) < 1e-7)
+assert(array.new("float64", 1, 0.1)[1] == 0.1)
+local i = array.new("int32", 2)
+i[1] = 2147483647; i[2] = -2147483647
+assert(i[1] == 2147483647 and i[2] == -2147483647)
+i[1] = 3.75  -- values (unlike keys) need not be integral
+assert(i[1] == 3 or i[1] == 4)
+
+print("array: ok")
@@ -0,0 +1,403 @@
+-- benchmark the VM on a fixed set of workloads and report them as JSON
+-- usage: lua bench.lua [-n runs] [-s scale] [-o out.json] [-c old.json]
+--                      [-t percent] [workload ...]
+--   -n  times each workload is run (default 5); medians are reported
+--   -s  multiplies the size of every workload (default 1)
+--   -o  writes the JSON report to a file instead of stdout
+--   -c  compares with an earlier report and exits with status 1 if some
+--       median time got slower by more than -t percent (default 5)
+
+local clock = profiler and profiler.clock or os.clock
+local counters = profiler and profiler.counters or function () end
+
+------------------------------------------------------------------------
+-- workloads: each one is run as f(n), with n = size * scale
+------------------------------------------------------------------------
+
+local workloads = {}
+
+local function workload (name, kind, size, f)
+  workloads[#workloads+1] = {name=name, kind=kind, size=size, f=f}
+end
+
+workload("fib", "recursion", 30, function (n)
+  local function fib (k)
+    if k < 2 then return k end
+    return fib(k-1) + fib(k-2)
+  end
+  return fib(n)
+end)
+
+workload("ack", "recursion", 600, function (n)
+  local function ack (m, k)
+    if m == 0 then return k+1 end
+    if k == 0 then return ack(m-1, 1) end
+    return ack(m-1, ack(m, k-1))
+  end
+  local s = 0
+  for i = 1, n do s = s + ack(2, 50) end
+  return s
+end)
+
+workload("methods", "calls", 1000000, function (n)
+  local Point = {}
+  Point.__index = Point
+  function Point.new (x, y) return setmetatable({x=x, y=y}, Point) end
+  function Point:add (o) self.x = self.x + o.x; self.y = self.y + o.y end
+  local p, d = Point.new(0, 0), Point.new(1, 2)
+  for i = 1, n do p:add(d) end
+  return p.x + p.y
+end)
+
+workload("array", "table", 1000000, function (n)
+  local a = {}
+  for i = 1, n do a[i] = i end
+  local s = 0
+  for r = 1, 5 do
+    for i = 1, #a do s = s + a[i] end
+  end
+  for i = 1, n/10 do table.insert(a, i) end
+  for i = 1, n/10 do table.remove(a) end
+  return s
+end)
+
+workload("hash", "table", 100000, function (n)
+  local h, s = {}, 0
+  for i = 1, n do h["k" .. i] = i end
+  for r = 1, 5 do
+    for i = 1, n, 7 do s = s + h["k" .. i] end
+  end
+  for k, v in pairs(h) do s = s + v end
+  local g = {}
+  for i = 1, n do g[i * 7919] = i end
+  for i = 1, n do s = s + g[i * 7919] end
+  return s
+end)
+
+workload("sort", "table", 200000, function (n)
+  local a, seed = {}, 42
+  for i = 1, n do
+    seed = (seed * 16807) % 2147483647
+    a[i] = seed
+  end
+  table.sort(a, function (x, y) return x > y end)
+  return a[1]
+end)
+
+workload("concat", "string", 100000, function (n)
+  local t = {}
+  for i = 1, n do t[i] = string.format("%d:%s", i, "item" .. i) end
+  local s = table.concat(t, ",")
+  local u = ""
+  for i = 1, n/100 do u = u .. "x" end
+  return #s + #u + #string.rep("ab", n)
+end)
+
+workload("pattern", "string", 20000, function (n)
+  local line = "the quick brown fox jumps over the lazy dog 12345 times"
+  local text = string.rep(line .. "\n", n)
+  local c = 0
+  for w in string.gmatch(text, "%a+") do c = c + 1 end
+  local s, k = string.gsub(text, "(%w+) (%w+)", "%2 %1")
+  c = c + k
+  local init = 1
+  while true do
+    local i, j = string.find(text, "lazy", init, true)
+    if not i then break end
+    c, init = c + 1, j + 1
+  end
+  return c + #string.upper(s)
+end)
+
+workload("trees", "gc", 15, function (n)
+  local function tree (d)
+    if d == 0 then return {} end
+    return {tree(d-1), tree(d-1)}
+  end
+  local function check (t)
+    if t[1] then return 1 + check(t[1]) + check(t[2]) end
+    return 1
+  end
+  local long = tree(n)  -- lives through the whole run
+  local c = 0
+  for d = 4, n, 2 do
+    for i = 1, 2^(n - d) do c = c + check(tree(d)) end
+  end
+  return c + check(long)
+end)
+
+workload("closures", "gc", 1000000, function (n)
+  local keep, s = {}, 0
+  for i = 1, n do
+    local f = function () return i end
+    s = s + f()
+    if i % 1000 == 0 then keep[#keep+1] = {f, tostring(i)} end
+  end
+  return s + #keep
+end)
+
+workload("generators", "coroutine", 300000, function (n)
+  local function gen (k)
+    return coroutine.wrap(function ()
+      for i = 1, k do coroutine.yield(i) end
+    end)
+  end
+  local function filter (g)
+    return coroutine.wrap(function ()
+      for v in g do
+        if v % 3 ~= 0 then coroutine.yield(v) end
+      end
+    end)
+  end
+  local s = 0
+  for v in filter(gen(n)) do s = s + v end
+  return s
+end)
+
+workload("spawn", "coroutine", 100000, function (n)
+  local s = 0
+  for i = 1, n do
+    local co = coroutine.create(function (a) local b = coroutine.yield(a+1)
+                                             return b*2 end)
+    local _, x = coroutine.resume(co, i)
+    local _, y = coroutine.resume(co, x)
+    s = s + y
+  end
+  return s
+end)
+
+------------------------------------------------------------------------
+-- JSON
+------------------------------------------------------------------------
+
+-- fields that hold arrays (an empty table would look like an object)
+local arrayfields = {benchmarks=true}
+
+local escapes = {['"'] = '\\"', ["\\"] = "\\\\", ["\b"] = "\\b",
+                 ["\f"] = "\\f", ["\n"] = "\\n", ["\r"] = "\\r", ["\t"] = "\\t"}
+
+local function quote (s)
+  return '"' .. string.gsub(s, '[%c"\\]', function (c)
+    return escapes[c] or string.format("\\u%04x", string.byte(c))
+  end) .. '"'
+end
+
+local function encode (v, indent, isarray)
+  indent = indent or ""
+  local t = type(v)
+  if t == "table" then
+    local inner, parts = indent .. "  ", {}
+    if isarray and #v == 0 then return "[]" end
+    if #v > 0 then
+      for i = 1, #v do parts[i] = inner .. encode(v[i], inner) end
+      return "[\n" .. table.concat(parts, ",\n") .. "\n" .. indent .. "]"
+    end
+    local keys = {}
+    for k in pairs(v) do keys[#keys+1] = k end
+    table.sort(keys)
+    for i, k in ipairs(keys) do
+      parts[i] = string.format("%s%s: %s", inner, quote(k),
+                               encode(v[k], inner, arrayfields[k]))
+    end
+    return "{\n" .. table.concat(parts, ",\n") .. "\n" .. indent .. "}"
+  elseif t == "string" then
+    return quote(v)
+  elseif t == "number" then
+    if v ~= v or v == math.huge or v == -math.huge then
+      return "null"  -- JSON has no nan or inf
+    end
+    return string.format(math.floor(v) == v and "%d" or "%.6g", v)
+  else
+    return tostring(v)
+  end
+end
+
+-- enough of a parser to read back what `encode' writes
+local function decode (s)
+  local pos = 1
+  local value
+  local function skip () pos = string.find(s, "[^%s]", pos) or #s + 1 end
+  local function char () skip(); return string.sub(s, pos, pos) end
+  local function expect (c)
+    assert(char() == c, "bad JSON: `" .. c .. "' expected at " .. pos)
+    pos = pos + 1
+  end
+  local unescapes = {b = "\b", f = "\f", n = "\n", r = "\r", t = "\t"}
+  local function str ()
+    local parts = {}
+    assert(string.sub(s, pos, pos) == '"', "bad JSON string at " .. pos)
+    pos = pos + 1
+    while true do
+      local i = assert(string.find(s, '["\\]', pos), "unfinished JSON string")
+      parts[#parts+1] = string.sub(s, pos, i - 1)
+      if string.sub(s, i, i) == '"' then pos = i + 1; break end
+      local c = string.sub(s, i + 1, i + 1)
+      if c == "u" then
+        local code = tonumber(string.sub(s, i + 2, i + 5), 16)
+        assert(code and code < 256, "bad JSON escape at " .. i)
+        parts[#parts+1] = string.char(code)
+        pos = i + 6
+      else
+        parts[#parts+1] = unescapes[c] or c
+        pos = i + 2
+      end
+    end
+    return table.concat(parts)
+  end
+  function value ()
+    local c = char()
+    if c == "{" then
+      local t = {}
+      pos = pos + 1
+      if char() == "}" then pos = pos + 1; return t end
+      repeat
+        skip()
+        local k = str()
+        expect(":")
+        t[k] = value()
+        c = char(); pos = pos + 1
+      until c ~= ","
+      assert(c == "}", "bad JSON object at " .. pos)
+      return t
+    elseif c == "[" then
+      local t = {}
+      pos = pos + 1
+      if char() == "]" then pos = pos + 1; return t end
+      repeat
+        t[#t+1] = value()
+        c = char(); pos = pos + 1
+      until c ~= ","
+      assert(c == "]", "bad JSON array at " .. pos)
+      return t
+    elseif c == '"' then
+      return str()
+    else
+      local i, j, w = string.find(s, "^([%w%.%+%-]+)", pos)
+      assert(i, "bad JSON value at " .. pos)
+      pos = j + 1
+      if w == "true" then return true
+      elseif w == "false" then return false
+      elseif w == "null" then return nil
+      else return assert(tonumber(w), "bad JSON number at " .. pos) end
+    end
+  end
+  return value()
+end
+
+------------------------------------------------------------------------
+-- measuring
+------------------------------------------------------------------------
+
+local function median (t)
+  table.sort(t)
+  local m = math.floor((#t + 1) / 2)
+  if #t % 2 == 1 then return t[m] end
+  return (t[m] + t[m+1]) / 2
+end
+
+local function measure (w, runs, scale)
+  local n = math.max(1, math.floor(w.size * scale + 0.5))  -- whole sizes
+  local times, events, peak = {}, {}, 0
+  w.f(n)  -- warm up
+  for r = 1, runs do
+    collectgarbage("collect")
+    collectgarbage("resetpeak")
+    local c0 = counters()
+    local t0 = clock()
+    w.f(n)
+    local t1 = clock()
+    local c1 = counters()
+    times[r] = t1 - t0
+    peak = math.max(peak, collectgarbage("peak"))
+    if c0 and c1 then
+      for k, v in pairs(c1) do
+        events[k] = events[k] or {}
+        events[k][r] = v - c0[k]
+      end
+    end
+  end
+  local res = {name=w.name, kind=w.kind, n=n, median=median(times),
+               min=math.min(unpack(times)), max=math.max(unpack(times)),
+               peakkb=math.ceil(peak)}
+  for k, v in pairs(events) do res[k] = median(v) end
+  return res
+end
+
+------------------------------------------------------------------------
+-- main
+------------------------------------------------------------------------
+
+local function usage (msg)
+  io.stderr:write("bench.lua: ", msg, " (see the usage at its top)\n")
+  os.exit(1)
+end
+
+local runs, scale, out, old, threshold = 5, 1, nil, nil, 5
+local only, filtered = {}, false
+local i = 1
+while arg[i] do
+  local a = arg[i]
+  if a == "-n" then i = i + 1; runs = assert(tonumber(arg[i]), "bad -n")
+  elseif a == "-s" then i = i + 1; scale = assert(tonumber(arg[i]), "bad -s")
+  elseif a == "-o" then i = i + 1; out = arg[i]
+  elseif a == "-c" then i = i + 1; old = arg[i]
+  elseif a == "-t" then i = i + 1; threshold = assert(tonumber(arg[i]), "bad -t")
+  elseif string.sub(a, 1, 1) == "-" then
+    usage("unknown option `" .. a .. "'")
+  else only[a] = true; filtered = true end
+  i = i + 1
+end
+
+for a in pairs(only) do  -- a misspelt name must not give an empty report
+  local known = false
+  for _, w in ipairs(workloads) do
+    if w.name == a or w.kind == a then known = true end
+  end
+  if not known then
+    usage("no workload or kind named `" .. a .. "'")
+  end
+end
+
+local report = {version=_VERSION, runs=runs, scale=scale,
+                counters=counters() and true or false, benchmarks={}}
+for _, w in ipairs(workloads) do
+  if not filtered or only[w.name] or only[w.kind] then
+    local r = measure(w, runs, scale)
+    report.benchmarks[#report.benchmarks+1] = r
+    io.stderr:write(string.format("%-12s %-10s %9.4fs %10d KB\n",
+                                  r.name, r.kind, r.median, r.peakkb))
+  end
+end
+
+local json = encode(report) .. "\n"
+if out then
+  local f = assert(io.open(out, "w"))
+  f:write(json)
+  f:close()
+else
+  io.write(json)
+end
+
+if old then
+  local f = assert(io.open(old))
+  local base = decode(f:read("*a"))
+  f:close()
+  local byname, worse = {}, 0
+  for _, b in ipairs(base.benchmarks or {}) do byname[b.name] = b end
+  io.stderr:write("\nchange against ", old, "\n")
+  for _, r in ipairs(report.benchmarks) do
+    local b = byname[r.name]
+    if b and b.n ~= r.n then
+      io.stderr:write(string.format("%-12s not comparable (n=%s, was %s)\n",
+                                    r.name, tostring(r.n), tostring(b.n)))
+    elseif b then
+      local pct = (r.median / b.median - 1) * 100
+      local mark = ""
+      if pct > threshold then mark = "  SLOWER"; worse = worse + 1
+      elseif pct < -threshold then mark = "  faster" end
+      io.stderr:write(string.format("%-12s %9.4fs -> %9.4fs %+7.1f%%%s\n",
+                                    r.name, b.median, r.median, pct, mark))
+    end
+  end
+  if worse > 0 then os.exit(1) end
+end
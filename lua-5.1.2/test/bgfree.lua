@@ -0,0 +1,77 @@
+-- stress the background freeing of collected memory
+
+local rounds = tonumber(arg and arg[1]) or 100
+
+if not collectgarbage("background", 1) then
+  print("bgfree: no background freeing on this system")
+  return
+end
+
+-- live data that must survive every collection intact
+local live = {}
+for i = 1, 1000 do live[i] = {i, tostring(i), string.rep("x", i % 64)} end
+
+local function checklive()
+  for i = 1, #live do
+    local t = live[i]
+    assert(t[1] == i and t[2] == tostring(i) and #t[3] == i % 64)
+  end
+end
+
+local finalized = 0
+local function finalizer(u)
+  finalized = finalized + 1
+end
+
+-- all kinds of garbage: tables, strings, closures, userdata with __gc,
+-- coroutines and a few big arrays (so bytes pile up faster than blocks)
+local function garbage(n)
+  local created = 0
+  for i = 1, n do
+    local t = {i, tostring(i) .. "garbage", function () return i end}
+    t.co = coroutine.create(function () coroutine.yield(t) end)
+    coroutine.resume(t.co)
+    local u = newproxy(true)
+    getmetatable(u).__gc = finalizer
+    t.u = u
+    created = created + 1
+  end
+  for i = 1, 64 do
+    local a = array.new("float64", 32*1024 + i)
+  end
+  return created
+end
+
+local weak = setmetatable({}, {__mode = "k"})
+local made = 0
+
+for r = 1, rounds do
+  made = made + garbage(200)
+  weak[{}] = r
+  if r % 3 == 0 then
+    collectgarbage("collect")
+    collectgarbage("collect")  -- again, while the last frees are queued
+  else
+    for i = 1, 20 do collectgarbage("step") end
+  end
+  if r % 25 == 0 then  -- stop the thread with frees pending, then restart
+    assert(collectgarbage("background", 0) == false)
+    assert(collectgarbage("background", 1) == true)
+  end
+  checklive()
+end
+
+collectgarbage("collect")
+collectgarbage("collect")
+checklive()
+assert(finalized == made, finalized .. " finalized of " .. made)
+assert(next(weak) == nil)
+
+-- leave garbage behind, partly swept, so that lua_close finds frees
+-- still queued for the thread
+garbage(200)
+collectgarbage("collect")
+garbage(200)
+for i = 1, 10 do collectgarbage("step") end
+
+print("bgfree: ok")
@@ -0,0 +1,46 @@
+-- time creation, resumption and yielding of coroutines
+
+local N = tonumber(arg and arg[1]) or 200000
+local create, resume, yield, wrap = coroutine.create, coroutine.resume,
+                                    coroutine.yield, coroutine.wrap
+
+local function time(what, f)
+  collectgarbage()
+  local t = os.clock()
+  f()
+  t = os.clock() - t
+  print(string.format("%-28s %6.3fs  %7.0f ns/op", what, t, t / N * 1e9))
+end
+
+local function id(x) return x end
+local function echo(x) while true do x = yield(x) end end
+local function handler(x) local y = yield(x + 1) return x + y end
+
+time("function call", function()
+  for i = 1, N do id(i) end
+end)
+
+time("create + finish", function()
+  for i = 1, N do resume(create(id), i) end
+end)
+
+time("create + yield + finish", function()
+  for i = 1, N do
+    local co = create(handler)
+    resume(co, i)
+    resume(co, i)
+  end
+end)
+
+time("wrap + yield + finish", function()
+  for i = 1, N do
+    local f = wrap(handler)
+    f(i)
+    f(i)
+  end
+end)
+
+time("resume + yield", function()
+  local co = create(echo)
+  for i = 1, N do resume(co, i) end
+end)
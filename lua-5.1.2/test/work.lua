@@ -0,0 +1,117 @@
+-- check worker pools, their channels and shared strings
+
+local function fails(msg, f, ...)
+  local ok, err = pcall(f, ...)
+  assert(not ok, "expected an error")
+  assert(string.find(err, msg, 1, true), err)
+end
+
+-- shared strings
+local s = worker.share("hello, world")
+assert(#s == 12 and s:len() == 12 and tostring(s) == "hello, world")
+assert(s:sub(1, 5) == "hello" and s:sub(-5) == "world")
+assert(s:sub(8, 100) == "world" and s:sub(5, 2) == "")
+assert(#worker.share("") == 0)
+
+-- arguments
+fails("must be positive", worker.pool, 0, "return 1")
+fails("must be positive", worker.pool, 1, "return 1", 0)
+fails("without upvalues", worker.pool, 1, function () return s end)
+fails("without upvalues", worker.pool, 1, print)
+
+local ok, p = pcall(worker.pool, 4, [[
+  local op, a, b = ...
+  if op == "add" then return a + b
+  elseif op == "echo" then return select(2, ...)
+  elseif op == "shared" then return a:len(), a:sub(1, 5), a
+  elseif op == "share" then return worker.share(a)
+  elseif op == "fail" then error("job failed", 0)
+  elseif op == "table" then error({}, 0)
+  end
+]], 8)
+if not ok and string.find(p, "no threads", 1, true) then
+  print("work: no threads on this system")
+  return
+end
+assert(ok, p)
+assert(p:size() == 4 and p:pending() == 0)
+assert(p:receive() == nil and p:receive(false) == nil)
+
+-- results come back with the id of their job
+local ids = {}
+for i = 1, 8 do ids[p:send("add", i, 10 * i)] = i end
+assert(p:pending() == 8)
+fails("too many pending jobs", p.send, p, "add", 1, 2)
+for i = 1, 8 do
+  local id, ok, sum = p:receive()
+  assert(ok and sum == 11 * ids[id])
+  ids[id] = nil
+end
+assert(next(ids) == nil and p:pending() == 0)
+
+-- many more jobs than channel cells, so workers wait for both ends
+local total, expected = 0, 0
+for i = 1, 2000 do
+  if p:pending() == 8 then total = total + select(3, p:receive()) end
+  p:send("add", i, 1)
+  expected = expected + i + 1
+end
+while p:pending() > 0 do total = total + select(3, p:receive()) end
+assert(total == expected)
+
+-- values keep their types and structure
+local t = {1, 2.5, "x", true, {n = 1}, [10] = false}
+t.self = t
+t.twice = {t[5], t[5]}
+p:send("echo", nil, 2^53, -0.5, "\0z", t)
+local _, ok, a, b, c, d, tt = p:receive()
+assert(ok and a == nil and b == 2^53 and c == -0.5 and d == "\0z")
+assert(tt ~= t and tt.self == tt and tt[1] == 1 and tt[2] == 2.5)
+assert(tt[3] == "x" and tt[4] == true and tt[10] == false and tt[5].n == 1)
+assert(tt.twice[1] == tt[5] and tt.twice[2] == tt[5])
+fails("cannot send a function value", p.send, p, "echo", print)
+fails("cannot send a userdata value", p.send, p, "echo", io.stdout)
+assert(p:pending() == 0)
+
+-- shared strings travel both ways by reference
+local big = worker.share(string.rep("abc", 10000))
+p:send("shared", big)
+local _, ok, len, head, back = p:receive()
+assert(ok and len == 30000 and head == "abcab" and #back == 30000)
+assert(tostring(back) == tostring(big))
+p:send("share", "made by a worker")
+_, ok, back = p:receive()
+assert(ok and tostring(back) == "made by a worker")
+
+-- errors
+p:send("fail")
+local _, ok, msg = p:receive()
+assert(not ok and msg == "job failed")
+p:send("table")
+_, ok, msg = p:receive()
+assert(not ok and msg == "(error object is not a string)")
+
+-- a pool whose workers went idle (and blocked) still answers
+for i = 1, 2 do
+  local t0 = os.time()
+  while os.time() == t0 do end
+  p:send("add", i, i)
+  assert(select(3, p:receive()) == 2 * i)
+end
+
+-- closing
+assert(string.find(tostring(p), "worker pool", 1, true))
+p:send("add", 1, 2)  -- left pending
+p:close()
+p:close()
+assert(tostring(p) == "worker pool (closed)")
+fails("closed pool", p.send, p, "add", 1, 2)
+fails("closed pool", p.receive, p)
+
+-- a pool collected with jobs pending
+p = worker.pool(2, "return ...")
+for i = 1, 10 do p:send(i) end
+p = nil
+collectgarbage("collect")
+
+print("work: ok")
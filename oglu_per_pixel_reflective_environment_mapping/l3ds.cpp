@@ -5,10 +5,23 @@
 #endif
 
 #include "l3ds.h"
+#include <algorithm>
+#include <queue>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#  define WIN32_LEAN_AND_MEAN
+#  include <windows.h>
+#else
+#  include <sys/mman.h>
+#  include <fcntl.h>
+#  include <unistd.h>
+#endif
 
 //using namespace std;
 
@@ -106,6 +119,13 @@ typedef unsigned long ulong;
 
 #define MAX_SHARED_TRIS     100
 
+// the entries of the post-transform vertex cache oCache optimizes for
+#define VERTEX_CACHE_SIZE   32
+
+// the cosine of the largest angle a triangle may turn away from its original normal while
+// LMesh::Simplify works on the mesh
+#define SIMPLIFY_MIN_COS    0.5f
+
 // the error reporting routine
 
 void ErrorMsg(const char *msg)
@@ -196,6 +216,11 @@ LVector3 CrossProduct(const LVector3 &a, const LVector3 &b)
     return v;
 }
 
+float DotProduct(const LVector3 &a, const LVector3 &b)
+{
+    return a.x*b.x + a.y*b.y + a.z*b.z;
+}
+
 void LoadIdentityMatrix(LMatrix4 &m)
 {
     m._11 = 1.0f;
@@ -245,6 +270,53 @@ void QuatToMatrix(const LVector4 &quat, LMatrix4 &m)
 
 }
 
+// maps a file read-only, returns 0 if it cannot be opened, is empty or cannot be mapped
+
+static const void* MapFile(const char *filename, uint &size)
+{
+#ifdef _WIN32
+    HANDLE file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING,
+                              FILE_ATTRIBUTE_NORMAL, 0);
+    if (file == INVALID_HANDLE_VALUE)
+        return 0;
+    DWORD fileSize = GetFileSize(file, 0);
+    HANDLE mapping = 0;
+    const void *data = 0;
+    if ((fileSize != 0) && (fileSize != 0xFFFFFFFF))
+        mapping = CreateFileMapping(file, 0, PAGE_READONLY, 0, 0, 0);
+    if (mapping != 0)
+        data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    // the view keeps the mapping and the file open
+    if (mapping != 0)
+        CloseHandle(mapping);
+    CloseHandle(file);
+    size = fileSize;
+    return data;
+#else
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0)
+        return 0;
+    struct stat st;
+    void *data = MAP_FAILED;
+    if ((fstat(fd, &st) == 0) && (st.st_size > 0))
+        data = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+        return 0;
+    size = (uint)st.st_size;
+    return data;
+#endif
+}
+
+static void UnmapFile(const void *data, uint size)
+{
+#ifdef _WIN32
+    UnmapViewOfFile(data);
+#else
+    munmap((void*)data, size);
+#endif
+}
+
 //-------------------------------------------------------
 // LObject implementation
 //-------------------------------------------------------
@@ -435,6 +507,7 @@ void LMesh::Clear()
     m_triangles.clear();
     m_tris.clear();
     m_materials.clear();
+    memset(&m_cacheStats, 0, sizeof(m_cacheStats));
     LoadIdentityMatrix(m_matrix);
 }
 
@@ -523,6 +596,26 @@ void LMesh::SetBinormal(const LVector3 &vec, uint index)
     m_binormals[index] = vec;
 }
 
+void LMesh::SetVertices(const void *xyz, uint count)
+{
+    const byte *p = (const byte*)xyz;
+    if (count > m_vertices.size())
+        count = m_vertices.size();
+    for (uint i=0; i<count; i++, p += 3*sizeof(float))
+    {
+        memcpy(&m_vertices[i], p, 3*sizeof(float));
+        m_vertices[i].w = 1.0f;
+    }
+}
+
+void LMesh::SetUVs(const void *uv, uint count)
+{
+    if (count > m_uv.size())
+        count = m_uv.size();
+    if (count > 0)
+        memcpy(&m_uv[0], uv, count*sizeof(LVector2));
+}
+
 const LTriangle& LMesh::GetTriangle(uint index)
 {
     return m_triangles[index];
@@ -574,154 +667,172 @@ void LMesh::TransformVertices()
         m_vertices[i] = VectorByMatrix(m_matrix, m_vertices[i]);
 }
 
-void LMesh::CalcNormals(bool useSmoothingGroups)
+// the loops over vertices and triangles below run on all cores when compiled with OpenMP
+// (/openmp, -fopenmp); each iteration writes only its own vertex, triangle or triangle corner
+
+static unsigned short& TriCorner(LTri &tri, uint corner)
+{
+    return (corner == 0) ? tri.a : ((corner == 1) ? tri.b : tri.c);
+}
+
+void LMesh::BuildAdjacency(std::vector<uint> &first, std::vector<uint> &corners)
 {
     uint i;
-    // first calculate the face normals
-    for (i=0; i<m_triangles.size(); i++)
+    // count the corners of each vertex, then turn the counts into row offsets
+    first.assign(m_vertices.size()+1, 0);
+    for (i=0; i<m_tris.size(); i++)
     {
-        LVector3 a, b;
-        a = SubtractVectors(_4to3(m_vertices[m_tris[i].b]), _4to3(m_vertices[m_tris[i].a]));
-        b = SubtractVectors(_4to3(m_vertices[m_tris[i].b]), _4to3(m_vertices[m_tris[i].c]));
-        m_tris[i].normal = NormalizeVector(CrossProduct(b, a));
+        first[m_tris[i].a+1]++;
+        first[m_tris[i].b+1]++;
+        first[m_tris[i].c+1]++;
     }
-
-    std::vector< std::vector<int> > array;
-    array.resize(m_vertices.size());
-    for (i=0; i<m_triangles.size(); i++)
+    for (i=1; i<first.size(); i++)
+        first[i] += first[i-1];
+    corners.resize(first[m_vertices.size()]);
+    std::vector<uint> next(first.begin(), first.end()-1);
+    for (i=0; i<m_tris.size(); i++)
     {
-        uint k = m_tris[i].a;
-        array[k].push_back(i);
-
-        k = m_tris[i].b;
-        array[k].push_back(i);
-
-        k = m_tris[i].c;
-        array[k].push_back(i);
-    } 
+        corners[next[m_tris[i].a]++] = 3*i;
+        corners[next[m_tris[i].b]++] = 3*i+1;
+        corners[next[m_tris[i].c]++] = 3*i+2;
+    }
+}
 
-    LVector3 temp;
-    
-    if (!useSmoothingGroups)
+void LMesh::SplitSmoothingGroups(const std::vector<uint> &first, const std::vector<uint> &corners)
+{
+    // I'm assuming a triangle can only belong to one smoothing group at a time!
+    // the groups around a vertex are numbered in the order they are met; group j > 0 gets
+    // the copy number j-1 of the vertex, and the copies are appended vertex by vertex
+    int count = m_vertices.size();
+    int i;
+    std::vector<uint> copies(count+1, 0);
+#ifdef _OPENMP
+#pragma omp parallel
+#endif
     {
-        // now calculate the normals without using smoothing groups
-        for (i=0; i<m_vertices.size(); i++)
+        std::vector<ulong> groups;
+#ifdef _OPENMP
+#pragma omp for
+#endif
+        for (i=0; i<count; i++)
         {
-            temp = zero3;
-            int t = array[i].size();
-
-            for (int k=0; k<t; k++)
+            groups.clear();
+            for (uint k=first[i]; k<first[i+1]; k++)
             {
-                temp.x += m_tris[array[i][k]].normal.x;
-                temp.y += m_tris[array[i][k]].normal.y;
-                temp.z += m_tris[array[i][k]].normal.z;
+                ulong sg = m_tris[corners[k]/3].smoothingGroups;
+                uint j = 0;
+                while ((j < groups.size()) && (groups[j] != sg))
+                    j++;
+                if (j == groups.size())
+                    groups.push_back(sg);
             }
-            m_normals[i] = NormalizeVector(temp);
+            if (groups.size() > 1)
+                copies[i+1] = groups.size()-1;
         }
     }
-    else
-    {
-        // now calculate the normals _USING_ smoothing groups
-        // I'm assuming a triangle can only belong to one smoothing group at a time!
-        std::vector<ulong> smGroups;
-        std::vector< std::vector <uint> > smList;
-        
-        uint loop_size = m_vertices.size();
+    for (i=1; i<=count; i++)
+        copies[i] += copies[i-1];
+    if (copies[count] == 0)
+        return;
 
-        for (i=0; i<loop_size; i++)
+    uint size = count + copies[count];
+    m_vertices.resize(size);
+    m_normals.resize(size);
+    m_uv.resize(size);
+    m_tangents.resize(size);
+    m_binormals.resize(size);
+#ifdef _OPENMP
+#pragma omp parallel
+#endif
+    {
+        std::vector<ulong> groups;
+#ifdef _OPENMP
+#pragma omp for
+#endif
+        for (i=0; i<count; i++)
         {
-            int t = array[i].size();
-
-            if (t == 0)
+            if (copies[i+1] == copies[i])
                 continue;
-
-            smGroups.clear();
-            smList.clear();
-            smGroups.push_back(m_tris[array[i][0]].smoothingGroups);
-            smList.resize(smGroups.size());
-            smList[smGroups.size()-1].push_back(array[i][0]);
-
-            // first build a list of smoothing groups for the vertex
-            for (int k=0; k<t; k++)
+            groups.clear();
+            for (uint k=first[i]; k<first[i+1]; k++)
             {
-                bool found = false;
-                for (uint j=0; j<smGroups.size(); j++)
+                LTri &tri = m_tris[corners[k]/3];
+                uint j = 0;
+                while ((j < groups.size()) && (groups[j] != tri.smoothingGroups))
+                    j++;
+                uint v = count + copies[i] + j - 1;
+                if (j == groups.size())
                 {
-                    if (m_tris[array[i][k]].smoothingGroups == smGroups[j])
+                    groups.push_back(tri.smoothingGroups);
+                    if (j > 0)
                     {
-                        smList[j].push_back(array[i][k]);
-                        found = true;
+                        m_vertices[v] = m_vertices[i];
+                        m_normals[v] = m_normals[i];
+                        m_uv[v] = m_uv[i];
+                        m_tangents[v] = m_tangents[i];
+                        m_binormals[v] = m_binormals[i];
                     }
                 }
-                if (!found)
-                {
-                    smGroups.push_back(m_tris[array[i][k]].smoothingGroups);
-                    smList.resize(smGroups.size());
-                    smList[smGroups.size()-1].push_back(array[i][k]);
-                }
+                if (j > 0)
+                    TriCorner(tri, corners[k]%3) = v;
             }
-            // now we have the list of faces for the vertex sorted by smoothing groups
-
-
-            // now duplicate the vertices so that there's only one smoothing group "per vertex"
-            if (smGroups.size() > 1)
-                for (uint j=1; j< smGroups.size(); j++)
-                {
-                    m_vertices.push_back(m_vertices[i]);
-                    m_normals.push_back(m_normals[i]);
-                    m_uv.push_back(m_uv[i]);
-                    m_tangents.push_back(m_tangents[i]);
-                    m_binormals.push_back(m_binormals[i]);
-                    
-                    uint t = m_vertices.size()-1;
-                    for (uint h=0; h<smList[j].size(); h++)
-                    {
-                        if (m_tris[smList[j][h]].a == i)
-                            m_tris[smList[j][h]].a = t;
-                        if (m_tris[smList[j][h]].b == i)
-                            m_tris[smList[j][h]].b = t;
-                        if (m_tris[smList[j][h]].c == i)
-                            m_tris[smList[j][h]].c = t;
-                    }
-                }
         }
-        
-        // now rebuild a face list for each vertex, since the old one is invalidated
-        for (i=0; i<array.size(); i++)
-            array[i].clear();
-        array.clear();
-        array.resize(m_vertices.size());
-        for (i=0; i<m_triangles.size(); i++)
-        {
-            uint k = m_tris[i].a;
-            array[k].push_back(i);
+    }
+}
 
-            k = m_tris[i].b;
-            array[k].push_back(i);
+void LMesh::CalcNormals(bool useSmoothingGroups)
+{
+    int i;
+    int count = m_tris.size();
+    // first calculate the face normals, into a packed array for the sums below
+    std::vector<LVector3> faceNormals(count);
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+    for (i=0; i<count; i++)
+    {
+        LVector3 a, b;
+        a = SubtractVectors(_4to3(m_vertices[m_tris[i].b]), _4to3(m_vertices[m_tris[i].a]));
+        b = SubtractVectors(_4to3(m_vertices[m_tris[i].b]), _4to3(m_vertices[m_tris[i].c]));
+        faceNormals[i] = NormalizeVector(CrossProduct(b, a));
+        m_tris[i].normal = faceNormals[i];
+    }
 
-            k = m_tris[i].c;
-            array[k].push_back(i);
-        } 
+    std::vector<uint> first, corners;
+    BuildAdjacency(first, corners);
+    if (useSmoothingGroups)
+    {
+        // duplicate the vertices so that there's only one smoothing group "per vertex",
+        // then rebuild the adjacency, since the old one is invalidated
+        SplitSmoothingGroups(first, corners);
+        if (first.size() != m_vertices.size()+1)
+            BuildAdjacency(first, corners);
+    }
 
-        // now compute the normals
-        for (i=0; i<m_vertices.size(); i++)
+    // now sum the face normals around each vertex (in triangle order, as ever)
+    count = m_vertices.size();
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+    for (i=0; i<count; i++)
+    {
+        LVector3 temp = zero3;
+        for (uint k=first[i]; k<first[i+1]; k++)
         {
-            temp = zero3;
-            int t = array[i].size();
-
-            for (int k=0; k<t; k++)
-            {
-                temp.x += m_tris[array[i][k]].normal.x;
-                temp.y += m_tris[array[i][k]].normal.y;
-                temp.z += m_tris[array[i][k]].normal.z;
-            }
-            m_normals[i] = NormalizeVector(temp);
+            const LVector3 &n = faceNormals[corners[k]/3];
+            temp.x += n.x;
+            temp.y += n.y;
+            temp.z += n.z;
         }
-
+        m_normals[i] = NormalizeVector(temp);
     }
    
-    // copy m_tris to m_triangles
-    for (i=0; i<m_triangles.size(); i++)
+    CopyTriangles();
+}
+
+void LMesh::CopyTriangles()
+{
+    for (uint i=0; i<m_triangles.size(); i++)
     {
         m_triangles[i].a = m_tris[i].a;
         m_triangles[i].b = m_tris[i].b;
@@ -734,43 +845,51 @@ void LMesh::CalcTextureSpace()
     // a understandable description of how to do that can be found here:
     // http://members.rogers.com/deseric/tangentspace.htm
     // first calculate the tangent for each triangle
-    LVector3 x_vec,
-             y_vec,
-             z_vec;
-    LVector3 v1, v2;
-	uint i;
-    for (i=0; i<m_triangles.size(); i++)
-    {
-        v1.x = m_vertices[m_tris[i].b].x - m_vertices[m_tris[i].a].x;
-        v1.y = m_uv[m_tris[i].b].x - m_uv[m_tris[i].a].x;
-        v1.z = m_uv[m_tris[i].b].y - m_uv[m_tris[i].a].y;
-        
-        v2.x = m_vertices[m_tris[i].c].x - m_vertices[m_tris[i].a].x;
-        v2.y = m_uv[m_tris[i].c].x - m_uv[m_tris[i].a].x;
-        v2.z = m_uv[m_tris[i].c].y - m_uv[m_tris[i].a].y;
-
+    int i;
+    int count = m_tris.size();
+    std::vector<LVector3> faceTangents(count);
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+    for (i=0; i<count; i++)
+    {
+        const LVector4 &pa = m_vertices[m_tris[i].a];
+        const LVector4 &pb = m_vertices[m_tris[i].b];
+        const LVector4 &pc = m_vertices[m_tris[i].c];
+        const LVector2 &ta = m_uv[m_tris[i].a];
+        const LVector2 &tb = m_uv[m_tris[i].b];
+        const LVector2 &tc = m_uv[m_tris[i].c];
+        LVector3 x_vec,
+                 y_vec,
+                 z_vec;
+        LVector3 v1, v2;
+
+        v1.y = tb.x - ta.x;
+        v1.z = tb.y - ta.y;
+        v2.y = tc.x - ta.x;
+        v2.z = tc.y - ta.y;
+
+        v1.x = pb.x - pa.x;
+        v2.x = pc.x - pa.x;
         x_vec = CrossProduct(v1, v2);
 
-        v1.x = m_vertices[m_tris[i].b].y - m_vertices[m_tris[i].a].y;
-        v1.y = m_uv[m_tris[i].b].x - m_uv[m_tris[i].a].x;
-        v1.z = m_uv[m_tris[i].b].y - m_uv[m_tris[i].a].y;
-
-        v2.x = m_vertices[m_tris[i].c].y - m_vertices[m_tris[i].a].y;
-        v2.y = m_uv[m_tris[i].c].x - m_uv[m_tris[i].a].x;
-        v2.z = m_uv[m_tris[i].c].y - m_uv[m_tris[i].a].y;
-
+        v1.x = pb.y - pa.y;
+        v2.x = pc.y - pa.y;
         y_vec = CrossProduct(v1, v2);
 
-        v1.x = m_vertices[m_tris[i].b].z - m_vertices[m_tris[i].a].z;
-        v1.y = m_uv[m_tris[i].b].x - m_uv[m_tris[i].a].x;
-        v1.z = m_uv[m_tris[i].b].y - m_uv[m_tris[i].a].y;
-
-        v2.x = m_vertices[m_tris[i].c].z - m_vertices[m_tris[i].a].z;
-        v2.y = m_uv[m_tris[i].c].x - m_uv[m_tris[i].a].x;
-        v2.z = m_uv[m_tris[i].c].y - m_uv[m_tris[i].a].y;
-
+        v1.x = pb.z - pa.z;
+        v2.x = pc.z - pa.z;
         z_vec = CrossProduct(v1, v2);
 
+        // x_vec.x = y_vec.x = z_vec.x is twice the area of the triangle in texture space; without
+        // any the triangle has no texture direction and adds nothing to its vertices
+        if (x_vec.x == 0)
+        {
+            m_tris[i].tangent = zero3;
+            m_tris[i].binormal = zero3;
+            faceTangents[i] = zero3;
+            continue;
+        }
         m_tris[i].tangent.x = -(x_vec.y/x_vec.x);
         m_tris[i].tangent.y = -(y_vec.y/y_vec.x);
         m_tris[i].tangent.z = -(z_vec.y/z_vec.x);
@@ -779,43 +898,27 @@ void LMesh::CalcTextureSpace()
         m_tris[i].binormal.y = -(y_vec.z/y_vec.x);
         m_tris[i].binormal.z = -(z_vec.z/z_vec.x);
 
+        faceTangents[i] = m_tris[i].tangent;
     }
 
-    // now for each vertex build a list of face that share this vertex
-    std::vector< std::vector<int> > array;
-    array.resize(m_vertices.size());
-    for (i=0; i<m_triangles.size(); i++)
-    {
-        uint k = m_tris[i].a;
-        array[k].push_back(i);
-
-        k = m_tris[i].b;
-        array[k].push_back(i);
-
-        k = m_tris[i].c;
-        array[k].push_back(i);
-    } 
-
-    // now average the tangents and compute the binormals as (tangent X normal)
-    for (i=0; i<m_vertices.size(); i++)
+    // now average the tangents around each vertex and compute the binormals as (tangent X normal)
+    std::vector<uint> first, corners;
+    BuildAdjacency(first, corners);
+    count = m_vertices.size();
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+    for (i=0; i<count; i++)
     {
-        v1 = zero3;
-        v2 = zero3;
-        int t = array[i].size();
-
-        for (int k=0; k<t; k++)
+        LVector3 v1 = zero3;
+        for (uint k=first[i]; k<first[i+1]; k++)
         {
-            v1.x += m_tris[array[i][k]].tangent.x;
-            v1.y += m_tris[array[i][k]].tangent.y;
-            v1.z += m_tris[array[i][k]].tangent.z;
-
-            v2.x += m_tris[array[i][k]].binormal.x;
-            v2.y += m_tris[array[i][k]].binormal.y;
-            v2.z += m_tris[array[i][k]].binormal.z;
+            const LVector3 &t = faceTangents[corners[k]/3];
+            v1.x += t.x;
+            v1.y += t.y;
+            v1.z += t.z;
         }
         m_tangents[i] = NormalizeVector(v1);
-        //m_binormals[i] = NormalizeVector(v2);
-        
         m_binormals[i] = NormalizeVector(CrossProduct(m_tangents[i], m_normals[i]));
     }
 }
@@ -836,9 +939,732 @@ void LMesh::Optimize(LOptimizationLevel value)
         CalcNormals(true);
         CalcTextureSpace();
         break;
+    case oCache:
+        OptimizeVertexCache(VERTEX_CACHE_SIZE);
+        break;
     }
 }
 
+// the hash of a cell of the welding grid, "mask" is the table size - 1
+
+static uint CellHash(int x, int y, int z, uint mask)
+{
+    return (((uint)x*73856093u) ^ ((uint)y*19349663u) ^ ((uint)z*83492791u)) & mask;
+}
+
+static bool Near(const float *a, const float *b, int count, float tolerance)
+{
+    for (int i=0; i<count; i++)
+        if (!(fabs(a[i]-b[i]) <= tolerance))
+            return false;
+    return true;
+}
+
+uint LMesh::WeldVertices(float tolerance)
+{
+    uint count = m_vertices.size();
+    uint i;
+    if (count == 0)
+        return 0;
+    // hash the vertices into a grid with cells at least "tolerance" wide, so a vertex only has to
+    // be compared with the ones already kept in its own and the neighbouring cells; the kept
+    // vertices move down in place and the grid holds their new indices
+    float lo[3], hi[3], extent = 0;
+    int k;
+    for (k=0; k<3; k++)
+    {
+        lo[k] = hi[k] = (&m_vertices[0].x)[k];
+        for (i=1; i<count; i++)
+        {
+            float v = (&m_vertices[i].x)[k];
+            if (v < lo[k])
+                lo[k] = v;
+            if (v > hi[k])
+                hi[k] = v;
+        }
+        if (hi[k]-lo[k] > extent)
+            extent = hi[k]-lo[k];
+    }
+    float cell = extent/(1<<20);
+    if (cell < tolerance)
+        cell = tolerance;
+    if (!(cell > 0))
+        cell = 1;
+    int reach = (tolerance > 0) ? 1 : 0;
+    uint mask = 1;
+    while (mask < 2*count)
+        mask <<= 1;
+    mask--;
+
+    const uint none = 0xFFFFFFFF;
+    std::vector<uint> head(mask+1, none), next(count), remap(count);
+    uint kept = 0;
+    for (i=0; i<count; i++)
+    {
+        const LVector4 &p = m_vertices[i];
+        int x = (int)floor((p.x-lo[0])/cell);
+        int y = (int)floor((p.y-lo[1])/cell);
+        int z = (int)floor((p.z-lo[2])/cell);
+        uint found = none;
+        for (int dz=-reach; (found == none) && (dz<=reach); dz++)
+            for (int dy=-reach; (found == none) && (dy<=reach); dy++)
+                for (int dx=-reach; (found == none) && (dx<=reach); dx++)
+                    for (uint j=head[CellHash(x+dx, y+dy, z+dz, mask)]; j!=none; j=next[j])
+                        if (Near(&p.x, &m_vertices[j].x, 4, tolerance) &&
+                            Near(&m_uv[i].x, &m_uv[j].x, 2, tolerance) &&
+                            Near(&m_normals[i].x, &m_normals[j].x, 3, tolerance) &&
+                            Near(&m_tangents[i].x, &m_tangents[j].x, 3, tolerance) &&
+                            Near(&m_binormals[i].x, &m_binormals[j].x, 3, tolerance))
+                        {
+                            found = j;
+                            break;
+                        }
+        if (found != none)
+        {
+            remap[i] = found;
+            continue;
+        }
+        uint h = CellHash(x, y, z, mask);
+        next[kept] = head[h];
+        head[h] = kept;
+        remap[i] = kept;
+        m_vertices[kept] = m_vertices[i];
+        m_normals[kept] = m_normals[i];
+        m_uv[kept] = m_uv[i];
+        m_tangents[kept] = m_tangents[i];
+        m_binormals[kept] = m_binormals[i];
+        kept++;
+    }
+    if (kept == count)
+        return 0;
+    for (i=0; i<m_tris.size(); i++)
+    {
+        m_tris[i].a = remap[m_tris[i].a];
+        m_tris[i].b = remap[m_tris[i].b];
+        m_tris[i].c = remap[m_tris[i].c];
+    }
+    CopyTriangles();
+    SetVertexArraySize(kept);
+    return count-kept;
+}
+
+// the vertex score of Forsyth's algorithm: vertices recently used score higher, so do vertices
+// with few triangles left, so that they're finished off instead of left behind
+
+static float VertexScore(int cachePos, uint remaining, uint cacheSize)
+{
+    if (remaining == 0)
+        return -1.0f;
+    float score = 0;
+    if (cachePos >= 0)
+    {
+        // the vertices of the last triangle get a fixed score, so the next triangle doesn't
+        // depend on the order they were added in
+        if (cachePos < 3)
+            score = 0.75f;
+        else
+            score = (float)pow(1.0f - (cachePos-3)/(float)(cacheSize-3), 1.5f);
+    }
+    return score + 2.0f*(float)pow((float)remaining, -0.5f);
+}
+
+void LMesh::ReorderTriangles(uint cacheSize)
+{
+    uint count = m_tris.size();
+    uint vcount = m_vertices.size();
+    uint i, k;
+    if ((count < 2) || (cacheSize < 4))
+        return;
+    // the first live[v] entries of the row of vertex v are its triangles not emitted yet
+    std::vector<uint> first, corners;
+    BuildAdjacency(first, corners);
+    std::vector<uint> live(vcount);
+    std::vector<int> cachePos(vcount, -1);
+    std::vector<float> vertexScore(vcount);
+    for (i=0; i<vcount; i++)
+    {
+        live[i] = first[i+1]-first[i];
+        vertexScore[i] = VertexScore(-1, live[i], cacheSize);
+    }
+    std::vector<float> triScore(count);
+    std::vector<bool> emitted(count, false);
+    for (i=0; i<count; i++)
+        triScore[i] = vertexScore[m_tris[i].a] + vertexScore[m_tris[i].b] + vertexScore[m_tris[i].c];
+
+    std::vector<LTri> order;
+    order.reserve(count);
+    std::vector<uint> cache, grown;
+    cache.reserve(cacheSize+3);
+    grown.reserve(cacheSize+3);
+    uint cursor = 0;
+    int best = -1;
+    while (order.size() < count)
+    {
+        // nothing in the cache has triangles left, carry on with the first triangle not emitted
+        if (best < 0)
+        {
+            while (emitted[cursor])
+                cursor++;
+            best = cursor;
+        }
+        LTri &tri = m_tris[best];
+        emitted[best] = true;
+        order.push_back(tri);
+
+        // take the triangle out of the rows of its vertices and put them at the front of the cache
+        grown.clear();
+        for (uint c=0; c<3; c++)
+        {
+            uint v = TriCorner(tri, c);
+            uint *row = &corners[first[v]];
+            for (k=0; (row[k]/3 != (uint)best); k++)
+                ;
+            row[k] = row[--live[v]];
+            row[live[v]] = 3*best+c;
+            if ((grown.size() == 0) || ((grown[0] != v) && (grown.back() != v)))
+                grown.push_back(v);
+        }
+        for (i=0; i<cache.size(); i++)
+            if ((cache[i] != tri.a) && (cache[i] != tri.b) && (cache[i] != tri.c))
+                grown.push_back(cache[i]);
+
+        // rescore the vertices in the cache and the ones pushed out of it, then their triangles,
+        // the best of which comes next
+        for (i=0; i<grown.size(); i++)
+        {
+            uint v = grown[i];
+            cachePos[v] = (i < cacheSize) ? (int)i : -1;
+            vertexScore[v] = VertexScore(cachePos[v], live[v], cacheSize);
+        }
+        best = -1;
+        float bestScore = -1.0f;
+        for (i=0; i<grown.size(); i++)
+        {
+            uint v = grown[i];
+            for (k=first[v]; k<first[v]+live[v]; k++)
+            {
+                uint t = corners[k]/3;
+                triScore[t] = vertexScore[m_tris[t].a] + vertexScore[m_tris[t].b] + vertexScore[m_tris[t].c];
+                if (triScore[t] > bestScore)
+                {
+                    bestScore = triScore[t];
+                    best = t;
+                }
+            }
+        }
+        if (grown.size() > cacheSize)
+            grown.resize(cacheSize);
+        cache.swap(grown);
+    }
+    m_tris.swap(order);
+    CopyTriangles();
+}
+
+void LMesh::ReorderVertices()
+{
+    const uint none = 0xFFFFFFFF;
+    uint count = m_vertices.size();
+    uint i, kept = 0;
+    std::vector<uint> remap(count, none);
+    for (i=0; i<m_tris.size(); i++)
+        for (uint c=0; c<3; c++)
+        {
+            unsigned short &v = TriCorner(m_tris[i], c);
+            if (remap[v] == none)
+                remap[v] = kept++;
+            v = remap[v];
+        }
+    CopyTriangles();
+
+    std::vector<LVector4> vertices(kept);
+    std::vector<LVector3> normals(kept), tangents(kept), binormals(kept);
+    std::vector<LVector2> uv(kept);
+    for (i=0; i<count; i++)
+    {
+        uint v = remap[i];
+        if (v == none)
+            continue;
+        vertices[v] = m_vertices[i];
+        normals[v] = m_normals[i];
+        uv[v] = m_uv[i];
+        tangents[v] = m_tangents[i];
+        binormals[v] = m_binormals[i];
+    }
+    m_vertices.swap(vertices);
+    m_normals.swap(normals);
+    m_uv.swap(uv);
+    m_tangents.swap(tangents);
+    m_binormals.swap(binormals);
+}
+
+float LMesh::GetACMR(uint cacheSize)
+{
+    if (m_tris.size() == 0)
+        return 0;
+    // a vertex is still in a FIFO cache if fewer than cacheSize vertices went in after it
+    std::vector<uint> stamp(m_vertices.size(), 0);
+    uint time = cacheSize+1;
+    uint misses = 0;
+    for (uint i=0; i<m_tris.size(); i++)
+        for (uint c=0; c<3; c++)
+        {
+            uint v = TriCorner(m_tris[i], c);
+            if (time - stamp[v] > cacheSize)
+            {
+                stamp[v] = time++;
+                misses++;
+            }
+        }
+    return (float)misses/m_tris.size();
+}
+
+void LMesh::OptimizeVertexCache(uint cacheSize)
+{
+    m_cacheStats.vertexCountBefore = m_vertices.size();
+    m_cacheStats.acmrBefore = GetACMR(cacheSize);
+    // weld before the normals are calculated, so that they're shared across the welded seams;
+    // the smoothing groups still split the vertices where the surface has an edge
+    WeldVertices(0);
+    CalcNormals(true);
+    CalcTextureSpace();
+    // a mesh laid out well already (a regular grid, say) can come out worse, it's kept as it is then
+    std::vector<LTri> original(m_tris);
+    float acmr = GetACMR(cacheSize);
+    ReorderTriangles(cacheSize);
+    if (GetACMR(cacheSize) > acmr)
+    {
+        m_tris.swap(original);
+        CopyTriangles();
+    }
+    ReorderVertices();
+    m_cacheStats.vertexCountAfter = m_vertices.size();
+    m_cacheStats.acmrAfter = GetACMR(cacheSize);
+}
+
+const LCacheStats& LMesh::GetCacheStats()
+{
+    return m_cacheStats;
+}
+
+// a quadric error metric: the symmetric 4x4 matrix that sums the squared distances to planes,
+// and the number of planes
+
+struct LQuadric
+{
+    double a[10];
+    double planes;
+};
+
+static void AddPlane(LQuadric &q, double a, double b, double c, double d)
+{
+    q.a[0] += a*a; q.a[1] += a*b; q.a[2] += a*c; q.a[3] += a*d;
+    q.a[4] += b*b; q.a[5] += b*c; q.a[6] += b*d;
+    q.a[7] += c*c; q.a[8] += c*d;
+    q.a[9] += d*d;
+    q.planes += 1;
+}
+
+static double QuadricError(const LQuadric &q, const LVector4 &p)
+{
+    double x = p.x, y = p.y, z = p.z;
+    return q.a[0]*x*x + 2*q.a[1]*x*y + 2*q.a[2]*x*z + 2*q.a[3]*x +
+           q.a[4]*y*y + 2*q.a[5]*y*z + 2*q.a[6]*y +
+           q.a[7]*z*z + 2*q.a[8]*z +
+           q.a[9];
+}
+
+// an edge collapse waiting in the queue, "version" tells if it's still current
+
+struct LCollapse
+{
+    double cost;
+    uint from;
+    uint to;
+    uint version;
+    // the cheapest collapse comes first out of a std::priority_queue
+    bool operator<(const LCollapse &other) const
+    {
+        return cost > other.cost;
+    }
+};
+
+// orders the vertices by position
+
+struct LPositionLess
+{
+    const std::vector<LVector4> *vertices;
+    bool operator()(uint a, uint b) const
+    {
+        const LVector4 &p = (*vertices)[a], &q = (*vertices)[b];
+        if (p.x != q.x)
+            return p.x < q.x;
+        if (p.y != q.y)
+            return p.y < q.y;
+        return p.z < q.z;
+    }
+};
+
+// the edge collapser of LMesh::Simplify. It works on positions: every vertex belongs to the
+// position of the first vertex at the same place, and only positions whose triangles all see the
+// same vertex may be collapsed onto one of their neighbours (half-edge collapses, nothing moves)
+
+struct LSimplifier
+{
+    std::vector<LTri> &tris;
+    const std::vector<LVector4> &vertices;
+    const std::vector<LVector2> *uv;
+    // the unit normal each triangle started with (zero if it had no area)
+    std::vector<LVector3> normals;
+    // the position of each vertex
+    std::vector<uint> pos;
+    // the live triangles around each position
+    std::vector<std::vector<uint> > around;
+    std::vector<LQuadric> quadrics;
+    std::vector<char> locked;
+    std::vector<char> dead;
+    std::vector<uint> version;
+    std::priority_queue<LCollapse> queue;
+
+    // the triangles left and the largest error so far
+    uint live;
+    double error;
+
+    LSimplifier(std::vector<LTri> &t, const std::vector<LVector4> &v)
+    : tris(t), vertices(v)
+    {
+        uv = 0;
+        live = 0;
+        error = 0;
+    }
+
+    uint Corner(uint t, uint c)
+    {
+        return (c == 0) ? tris[t].a : ((c == 1) ? tris[t].b : tris[t].c);
+    }
+
+    // returns the corner of triangle t at position p, or 3
+    uint CornerAt(uint t, uint p)
+    {
+        uint c = 0;
+        while ((c < 3) && (pos[Corner(t, c)] != p))
+            c++;
+        return c;
+    }
+
+    void Neighbours(uint p, std::vector<uint> &out)
+    {
+        out.clear();
+        for (uint i=0; i<around[p].size(); i++)
+            for (uint c=0; c<3; c++)
+            {
+                uint n = pos[Corner(around[p][i], c)];
+                if ((n != p) && (std::find(out.begin(), out.end(), n) == out.end()))
+                    out.push_back(n);
+            }
+    }
+
+    // checks if u can go onto v and finds the vertex at v that takes the place of u
+    bool CanCollapse(uint u, uint v, uint &wedge)
+    {
+        uint i, shared = 0;
+        const uint none = 0xFFFFFFFF;
+        wedge = none;
+        for (i=0; i<around[u].size(); i++)
+        {
+            uint t = around[u][i];
+            uint c = CornerAt(t, v);
+            if (c == 3)
+                continue;
+            shared++;
+            if (wedge == none)
+                wedge = Corner(t, c);
+            else if (wedge != Corner(t, c))
+                return false;
+        }
+        if (shared == 0)
+            return false;
+        // the link condition: only the triangles on the edge may have both ends as neighbours,
+        // or the surface would fold onto itself
+        std::vector<uint> nu, nv;
+        Neighbours(u, nu);
+        Neighbours(v, nv);
+        uint common = 0;
+        for (i=0; i<nu.size(); i++)
+            if (std::find(nv.begin(), nv.end(), nu[i]) != nv.end())
+                common++;
+        if (common != shared)
+            return false;
+        // none of the triangles that stay may turn too far from their original normal, lose their
+        // area in space or in texture space, or end up with all their corners locked (such a
+        // triangle could never be fixed by later collapses)
+        for (i=0; i<around[u].size(); i++)
+        {
+            uint t = around[u][i];
+            if (CornerAt(t, v) != 3)
+                continue;
+            LVector3 q[3];
+            LVector2 s[3], r[3];
+            bool stuck = true;
+            for (uint c=0; c<3; c++)
+            {
+                uint k = Corner(t, c);
+                bool moved = (pos[k] == u);
+                q[c] = _4to3(vertices[moved ? v : k]);
+                r[c] = (*uv)[k];
+                s[c] = (*uv)[moved ? wedge : k];
+                stuck = stuck && locked[moved ? v : pos[k]];
+            }
+            if (stuck)
+                return false;
+            LVector3 after = CrossProduct(SubtractVectors(q[1], q[0]), SubtractVectors(q[2], q[0]));
+            const LVector3 &n = normals[t];
+            float length = VectorLength(after);
+            if (!(n.x*after.x + n.y*after.y + n.z*after.z > SIMPLIFY_MIN_COS*length))
+                return false;
+            float uvBefore = (r[1].x-r[0].x)*(r[2].y-r[0].y) - (r[1].y-r[0].y)*(r[2].x-r[0].x);
+            float uvAfter = (s[1].x-s[0].x)*(s[2].y-s[0].y) - (s[1].y-s[0].y)*(s[2].x-s[0].x);
+            if ((uvBefore != 0) && (uvAfter == 0))
+                return false;
+        }
+        return true;
+    }
+
+    // queues the cheapest collapse of u, if it can be collapsed at all
+    void Update(uint u)
+    {
+        version[u]++;
+        if (locked[u])
+            return;
+        std::vector<uint> n;
+        Neighbours(u, n);
+        LCollapse best;
+        best.from = u;
+        best.to = u;
+        best.cost = 0;
+        best.version = version[u];
+        for (uint i=0; i<n.size(); i++)
+        {
+            uint wedge;
+            if (!CanCollapse(u, n[i], wedge))
+                continue;
+            // the mean squared distance to the planes of both ends
+            double cost = (QuadricError(quadrics[u], vertices[n[i]]) + QuadricError(quadrics[n[i]], vertices[n[i]])) /
+                          (quadrics[u].planes + quadrics[n[i]].planes);
+            if ((best.to == u) || (cost < best.cost))
+            {
+                best.cost = cost;
+                best.to = n[i];
+            }
+        }
+        if (best.to != u)
+            queue.push(best);
+    }
+
+    // moves u onto v, returns the number of triangles removed
+    uint Collapse(uint u, uint v, uint wedge)
+    {
+        uint removed = 0;
+        for (int k=0; k<10; k++)
+            quadrics[v].a[k] += quadrics[u].a[k];
+        quadrics[v].planes += quadrics[u].planes;
+        for (uint i=0; i<around[u].size(); i++)
+        {
+            uint t = around[u][i];
+            if (CornerAt(t, v) != 3)
+            {
+                // the triangle is on the edge, take it out of the lists of its other corners
+                dead[t] = 1;
+                removed++;
+                for (uint c=0; c<3; c++)
+                {
+                    std::vector<uint> &list = around[pos[Corner(t, c)]];
+                    if (pos[Corner(t, c)] != u)
+                        list.erase(std::remove(list.begin(), list.end(), t), list.end());
+                }
+                continue;
+            }
+            TriCorner(tris[t], CornerAt(t, u)) = wedge;
+            around[v].push_back(t);
+        }
+        around[u].clear();
+        return removed;
+    }
+
+    // finds the positions, locks those that have to stay and queues the first collapses
+    void Init(const std::vector<LVector2> &texCoords);
+    // collapses edges until about "targetCount" triangles are left, returns the largest error so far
+    double Run(uint targetCount);
+    // copies the triangles left
+    void LiveTriangles(std::vector<LTri> &out);
+};
+
+void LSimplifier::Init(const std::vector<LVector2> &texCoords)
+{
+    uv = &texCoords;
+    uint count = tris.size();
+    uint vcount = vertices.size();
+    uint i, c;
+
+    // a position is the first vertex at the same place
+    std::vector<uint> order(vcount);
+    for (i=0; i<vcount; i++)
+        order[i] = i;
+    LPositionLess less;
+    less.vertices = &vertices;
+    std::sort(order.begin(), order.end(), less);
+    pos.resize(vcount);
+    for (i=0; i<vcount; i++)
+        pos[order[i]] = ((i > 0) && !less(order[i-1], order[i])) ? pos[order[i-1]] : order[i];
+
+    around.resize(vcount);
+    locked.assign(vcount, 0);
+    for (i=0; i<count; i++)
+        for (c=0; c<3; c++)
+        {
+            std::vector<uint> &list = around[pos[Corner(i, c)]];
+            if ((list.size() > 0) && (list.back() == i))
+                locked[pos[Corner(i, c)]] = 1;   // a degenerate triangle
+            else
+                list.push_back(i);
+        }
+
+    // a position may only move if all its triangles see the same texture coordinates, material
+    // and smoothing group, and they close up around it (no border, nothing non-manifold)
+    std::vector<uint> n;
+    for (i=0; i<vcount; i++)
+    {
+        if ((pos[i] != i) || locked[i])
+            continue;
+        const std::vector<uint> &list = around[i];
+        bool ok = (list.size() > 0);
+        for (uint k=0; ok && (k<list.size()); k++)
+        {
+            const LTri &t0 = tris[list[0]], &t = tris[list[k]];
+            const LVector2 &uv0 = texCoords[Corner(list[0], CornerAt(list[0], i))];
+            const LVector2 &uvk = texCoords[Corner(list[k], CornerAt(list[k], i))];
+            ok = (uvk.x == uv0.x) && (uvk.y == uv0.y) && (t.materialId == t0.materialId) &&
+                 (t.smoothingGroups == t0.smoothingGroups);
+        }
+        if (ok)
+        {
+            Neighbours(i, n);
+            for (uint k=0; ok && (k<n.size()); k++)
+            {
+                uint shared = 0;
+                for (uint j=0; j<list.size(); j++)
+                    if (CornerAt(list[j], n[k]) != 3)
+                        shared++;
+                ok = (shared == 2);
+            }
+        }
+        locked[i] = !ok;
+    }
+    // the vertices of a position that may move differ in their normals at most, which are
+    // calculated again anyway, so the triangles can all use the first one
+    for (i=0; i<count; i++)
+        for (c=0; c<3; c++)
+        {
+            unsigned short &v = TriCorner(tris[i], c);
+            if (!locked[pos[v]])
+                v = pos[v];
+        }
+
+    // the planes of the triangles make up the quadrics of their positions
+    LQuadric zero;
+    memset(&zero, 0, sizeof(zero));
+    quadrics.assign(vcount, zero);
+    normals.assign(count, zero3);
+    for (i=0; i<count; i++)
+    {
+        LVector3 p0 = _4to3(vertices[tris[i].a]);
+        LVector3 normal = CrossProduct(SubtractVectors(_4to3(vertices[tris[i].b]), p0),
+                                       SubtractVectors(_4to3(vertices[tris[i].c]), p0));
+        if (VectorLength(normal) == 0)
+            continue;
+        normal = NormalizeVector(normal);
+        normals[i] = normal;
+        double d = -(normal.x*p0.x + normal.y*p0.y + normal.z*p0.z);
+        for (c=0; c<3; c++)
+            AddPlane(quadrics[pos[Corner(i, c)]], normal.x, normal.y, normal.z, d);
+    }
+
+    dead.assign(count, 0);
+    version.assign(vcount, 0);
+    for (i=0; i<vcount; i++)
+        if (pos[i] == i)
+            Update(i);
+    live = count;
+    error = 0;
+}
+
+double LSimplifier::Run(uint targetCount)
+{
+    std::vector<uint> n;
+    while ((live > targetCount) && !queue.empty())
+    {
+        LCollapse best = queue.top();
+        queue.pop();
+        if (best.version != version[best.from])
+            continue;
+        uint wedge;
+        if (!CanCollapse(best.from, best.to, wedge))
+        {
+            Update(best.from);
+            continue;
+        }
+        live -= Collapse(best.from, best.to, wedge);
+        version[best.from]++;
+        if (best.cost > error)
+            error = best.cost;
+        // the collapse changed the costs around the position it went to
+        Update(best.to);
+        Neighbours(best.to, n);
+        for (uint i=0; i<n.size(); i++)
+            Update(n[i]);
+    }
+    return error;
+}
+
+void LSimplifier::LiveTriangles(std::vector<LTri> &out)
+{
+    out.clear();
+    out.reserve(live);
+    for (uint i=0; i<tris.size(); i++)
+        if (!dead[i])
+            out.push_back(tris[i]);
+}
+
+void LMesh::SimplifyLevels(const std::vector<uint> &targets, std::vector<LMesh> &levels,
+                           std::vector<float> &errors)
+{
+    LMesh work(*this);
+    LSimplifier s(work.m_tris, work.m_vertices);
+    s.Init(work.m_uv);
+    for (uint i=0; i<targets.size(); i++)
+    {
+        double error = s.Run(targets[i]);
+        levels.push_back(work);
+        LMesh &lod = levels.back();
+        s.LiveTriangles(lod.m_tris);
+        lod.m_triangles.resize(lod.m_tris.size());
+        lod.CalcNormals(true);
+        lod.CalcTextureSpace();
+        lod.ReorderTriangles(VERTEX_CACHE_SIZE);
+        lod.ReorderVertices();
+        errors.push_back((float)sqrt(error));
+    }
+}
+
+float LMesh::Simplify(uint targetCount, LMesh &lod)
+{
+    std::vector<uint> targets(1, targetCount);
+    std::vector<LMesh> levels;
+    std::vector<float> errors;
+    SimplifyLevels(targets, levels, errors);
+    lod = levels[0];
+    return errors[0];
+}
+
 void LMesh::SetTri(const LTri &tri, uint index)
 {
     if (index >= m_triangles.size())
@@ -846,25 +1672,372 @@ void LMesh::SetTri(const LTri &tri, uint index)
     m_tris[index] = tri;
 }
 
-LTri& LMesh::GetTri(uint index)
-{
-    return m_tris[index];
+LTri& LMesh::GetTri(uint index)
+{
+    return m_tris[index];
+}
+
+uint LMesh::GetMaterial(uint index)
+{
+    return m_materials[index];
+}
+
+uint LMesh::AddMaterial(uint id)
+{
+    m_materials.push_back(id);
+    return m_materials.size()-1;
+}
+
+uint LMesh::GetMaterialCount()
+{
+    return m_materials.size();
+}
+
+//-------------------------------------------------------
+// LMeshLOD implementation
+//-------------------------------------------------------
+
+LMeshLOD::LMeshLOD()
+{
+    Clear();
+}
+
+LMeshLOD::~LMeshLOD()
+{
+    Clear();
+}
+
+void LMeshLOD::Clear()
+{
+    m_levels.clear();
+    m_errors.clear();
+    m_radius = 0;
+}
+
+void LMeshLOD::Build(LMesh &mesh, uint maxLevels, float ratio, float maxError)
+{
+    Clear();
+    uint i, count = mesh.GetVertexCount();
+    if (!(ratio > 0) || !(ratio < 1))
+    {
+        ErrorMsg("LMeshLOD::Build - the ratio has to be between 0 and 1");
+        return;
+    }
+    if (count == 0)
+        return;
+    // the bounding sphere around the centre of the bounding box
+    LVector3 lo = _4to3(mesh.GetVertex(0)), hi = lo, centre;
+    for (i=1; i<count; i++)
+    {
+        const LVector4 &p = mesh.GetVertex(i);
+        lo.x = (p.x < lo.x) ? p.x : lo.x;
+        lo.y = (p.y < lo.y) ? p.y : lo.y;
+        lo.z = (p.z < lo.z) ? p.z : lo.z;
+        hi.x = (p.x > hi.x) ? p.x : hi.x;
+        hi.y = (p.y > hi.y) ? p.y : hi.y;
+        hi.z = (p.z > hi.z) ? p.z : hi.z;
+    }
+    centre.x = (lo.x+hi.x)/2;
+    centre.y = (lo.y+hi.y)/2;
+    centre.z = (lo.z+hi.z)/2;
+    for (i=0; i<count; i++)
+    {
+        float d = VectorLength(SubtractVectors(_4to3(mesh.GetVertex(i)), centre));
+        if (d > m_radius)
+            m_radius = d;
+    }
+
+    // the levels come out of one pass of the simplifier, each carries on from the one before
+    std::vector<uint> targets;
+    std::vector<LMesh> levels;
+    std::vector<float> errors;
+    float target = (float)mesh.GetTriangleCount();
+    for (i=1; i<maxLevels; i++)
+    {
+        target *= ratio;
+        targets.push_back((uint)target);
+    }
+    mesh.SimplifyLevels(targets, levels, errors);
+    m_levels.push_back(mesh);
+    m_errors.push_back(0);
+    // stop where the simplifier can't get on much further, or where the shape goes
+    for (i=0; i<levels.size(); i++)
+    {
+        uint last = m_levels.back().GetTriangleCount();
+        if (levels[i].GetTriangleCount() > last - (uint)(last*(1-ratio)/2))
+            break;
+        if (errors[i] > maxError*m_radius)
+            break;
+        m_levels.push_back(levels[i]);
+        m_errors.push_back(errors[i]);
+    }
+}
+
+uint LMeshLOD::GetLevelCount()
+{
+    return m_levels.size();
+}
+
+LMesh& LMeshLOD::GetLevel(uint index)
+{
+    return m_levels[index];
+}
+
+float LMeshLOD::GetError(uint index)
+{
+    return m_errors[index];
+}
+
+float LMeshLOD::GetRadius()
+{
+    return m_radius;
+}
+
+float LMeshLOD::GetProjectedRadius(float distance, float fovy, uint viewportHeight)
+{
+    // from inside the sphere it covers the screen
+    if (distance <= m_radius)
+        return (float)viewportHeight;
+    return m_radius*viewportHeight/(2*distance*(float)tan(fovy*3.14159265/360));
+}
+
+uint LMeshLOD::SelectLevel(float projectedRadius, float maxPixelError)
+{
+    if ((m_levels.size() == 0) || (m_radius <= 0))
+        return 0;
+    // the error grows from level to level, take the last one that is small enough
+    float pixelsPerUnit = projectedRadius/m_radius;
+    uint level = 0;
+    for (uint i=1; i<m_levels.size(); i++)
+        if (m_errors[i]*pixelsPerUnit <= maxPixelError)
+            level = i;
+    return level;
+}
+
+//-------------------------------------------------------
+// LMeshlets implementation
+//-------------------------------------------------------
+
+LMeshlets::LMeshlets()
+{
+    Clear();
+}
+
+LMeshlets::~LMeshlets()
+{
+    Clear();
+}
+
+void LMeshlets::Clear()
+{
+    m_meshlets.clear();
+    m_indices.clear();
+}
+
+void LMeshlets::Build(LMesh &mesh, uint maxTriangles)
+{
+    Clear();
+    uint count = mesh.GetTriangleCount();
+    uint vcount = mesh.GetVertexCount();
+    if ((count == 0) || (maxTriangles == 0))
+        return;
+    uint i, c, k;
+
+    // the meshlets grow over positions rather than vertices, so they carry on across UV seams
+    std::vector<LVector4> vertices(vcount);
+    std::vector<uint> order(vcount), pos(vcount);
+    for (i=0; i<vcount; i++)
+    {
+        vertices[i] = mesh.GetVertex(i);
+        order[i] = i;
+    }
+    LPositionLess less;
+    less.vertices = &vertices;
+    std::sort(order.begin(), order.end(), less);
+    for (i=0; i<vcount; i++)
+        pos[order[i]] = ((i > 0) && !less(order[i-1], order[i])) ? pos[order[i-1]] : order[i];
+
+    // the corners of the triangles and their face normals, and the triangles around each position
+    // in compressed rows
+    std::vector<uint> corners(3*count), first(vcount+1, 0), around(3*count);
+    std::vector<LVector3> normals(count);
+    for (i=0; i<count; i++)
+    {
+        const LTriangle &t = mesh.GetTriangle(i);
+        corners[3*i] = pos[t.a];
+        corners[3*i+1] = pos[t.b];
+        corners[3*i+2] = pos[t.c];
+        for (c=0; c<3; c++)
+            first[corners[3*i+c]+1]++;
+        LVector3 a = SubtractVectors(_4to3(vertices[t.b]), _4to3(vertices[t.a]));
+        LVector3 b = SubtractVectors(_4to3(vertices[t.b]), _4to3(vertices[t.c]));
+        normals[i] = NormalizeVector(CrossProduct(b, a));
+    }
+    for (i=0; i<vcount; i++)
+        first[i+1] += first[i];
+    std::vector<uint> fill(first.begin(), first.end()-1);
+    for (i=0; i<3*count; i++)
+        around[fill[corners[i]]++] = i/3;
+
+    const uint none = 0xFFFFFFFF;
+    std::vector<char> used(count, 0);
+    // the meshlet a position was last taken into
+    std::vector<uint> owner(vcount, none);
+    std::vector<uint> members, candidates;
+    uint seed = 0;
+    for (;;)
+    {
+        // start next to the last meshlet if anything is left there, to keep them together
+        uint next = none;
+        for (k=0; (k<candidates.size()) && (next == none); k++)
+            if (!used[candidates[k]])
+                next = candidates[k];
+        if (next == none)
+        {
+            while ((seed < count) && used[seed])
+                seed++;
+            if (seed == count)
+                break;
+            next = seed;
+        }
+        uint id = m_meshlets.size();
+        LVector3 sum;
+        sum.x = sum.y = sum.z = 0;
+        members.clear();
+        candidates.clear();
+        for (;;)
+        {
+            used[next] = 1;
+            members.push_back(next);
+            sum = AddVectors(sum, normals[next]);
+            for (c=0; c<3; c++)
+            {
+                uint p = corners[3*next+c];
+                if (owner[p] == id)
+                    continue;
+                owner[p] = id;
+                for (k=first[p]; k<first[p+1]; k++)
+                    if (!used[around[k]])
+                        candidates.push_back(around[k]);
+            }
+            if (members.size() == maxTriangles)
+                break;
+            // take the triangle that shares the most corners with the meshlet and faces its way
+            LVector3 axis = NormalizeVector(sum);
+            float bestScore = 0;
+            uint last = 0;
+            next = none;
+            for (k=0; k<candidates.size(); k++)
+            {
+                uint t = candidates[k];
+                if (used[t])
+                    continue;
+                candidates[last++] = t;
+                float score = DotProduct(normals[t], axis);
+                for (c=0; c<3; c++)
+                    if (owner[corners[3*t+c]] == id)
+                        score += 1;
+                if ((next == none) || (score > bestScore))
+                {
+                    bestScore = score;
+                    next = t;
+                }
+            }
+            candidates.resize(last);
+            if (next == none)
+                break;
+        }
+
+        // the triangles keep their order in the mesh, which is the one the vertex cache likes
+        std::sort(members.begin(), members.end());
+        LMeshlet m;
+        m.firstIndex = m_indices.size();
+        m.triangleCount = members.size();
+        LVector3 lo = _4to3(vertices[mesh.GetTriangle(members[0]).a]), hi = lo;
+        for (i=0; i<members.size(); i++)
+        {
+            const LTriangle &t = mesh.GetTriangle(members[i]);
+            uint v[3] = {t.a, t.b, t.c};
+            for (c=0; c<3; c++)
+            {
+                const LVector4 &p = vertices[v[c]];
+                lo.x = (p.x < lo.x) ? p.x : lo.x;
+                lo.y = (p.y < lo.y) ? p.y : lo.y;
+                lo.z = (p.z < lo.z) ? p.z : lo.z;
+                hi.x = (p.x > hi.x) ? p.x : hi.x;
+                hi.y = (p.y > hi.y) ? p.y : hi.y;
+                hi.z = (p.z > hi.z) ? p.z : hi.z;
+                m_indices.push_back(v[c]);
+            }
+        }
+        m.centre.x = (lo.x+hi.x)/2;
+        m.centre.y = (lo.y+hi.y)/2;
+        m.centre.z = (lo.z+hi.z)/2;
+        m.radius = 0;
+        for (i=m.firstIndex; i<m_indices.size(); i++)
+        {
+            float d = VectorLength(SubtractVectors(_4to3(vertices[m_indices[i]]), m.centre));
+            if (d > m.radius)
+                m.radius = d;
+        }
+        // the cone is only of use when all the normals are less than 90 degrees from its axis
+        m.coneAxis = NormalizeVector(sum);
+        m.coneCos = 1;
+        for (i=0; i<members.size(); i++)
+        {
+            if (VectorLength(normals[members[i]]) == 0)
+                continue;
+            float d = DotProduct(normals[members[i]], m.coneAxis);
+            if (d < m.coneCos)
+                m.coneCos = d;
+        }
+        if (m.coneCos <= 0)
+            m.coneCos = 0;
+        m.coneSin = sqrt(1 - m.coneCos*m.coneCos);
+        m_meshlets.push_back(m);
+    }
 }
 
-uint LMesh::GetMaterial(uint index)
+uint LMeshlets::GetMeshletCount()
 {
-    return m_materials[index];
+    return m_meshlets.size();
 }
 
-uint LMesh::AddMaterial(uint id)
+const LMeshlet& LMeshlets::GetMeshlet(uint index)
 {
-    m_materials.push_back(id);
-    return m_materials.size()-1;
+    return m_meshlets[index];
 }
 
-uint LMesh::GetMaterialCount()
+uint LMeshlets::Cull(const float planes[6][4], const LVector3 &eye, bool backfaces, std::vector<uint> &indices)
 {
-    return m_materials.size();
+    indices.clear();
+    for (uint i=0; i<m_meshlets.size(); i++)
+    {
+        const LMeshlet &m = m_meshlets[i];
+        bool visible = true;
+        for (int j=0; (j<6) && visible; j++)
+            if (planes[j][0]*m.centre.x + planes[j][1]*m.centre.y + planes[j][2]*m.centre.z + planes[j][3] <= -m.radius)
+                visible = false;
+        // every triangle faces away if the eye is behind its plane for all the normals in the cone
+        // and all the points in the sphere: the normal closest to the direction of the eye is at
+        // the angle of the axis less the cone angle
+        if (visible && backfaces && (m.coneCos > 0))
+        {
+            LVector3 v = SubtractVectors(m.centre, eye);
+            float d = VectorLength(v);
+            if (d > m.radius)
+            {
+                float cosA = DotProduct(v, m.coneAxis)/d;
+                float sinA = sqrt((cosA < 1) ? 1 - cosA*cosA : 0);
+                if (d*(cosA*m.coneCos - sinA*m.coneSin) > m.radius)
+                    visible = false;
+            }
+        }
+        if (visible)
+            indices.insert(indices.end(), m_indices.begin() + m.firstIndex,
+                           m_indices.begin() + m.firstIndex + 3*m.triangleCount);
+    }
+    return indices.size()/3;
 }
 
 //-------------------------------------------------------
@@ -1062,6 +2235,7 @@ float LLight::GetAttenuationend()
 
 LImporter::LImporter()
 {
+    m_optLevel = oFull;
     Clear();
 }       
 
@@ -1122,7 +2296,7 @@ LMesh* LImporter::FindMesh(const std::string& name)
 {
     for (uint i=0; i<m_meshes.size(); i++)
         if (m_meshes[i].IsObject(name))
-            return &m_meshes[i];
+            return &GetMesh(i);
     return 0;
 }
 
@@ -1139,7 +2313,6 @@ void LImporter::Clear()
     m_meshes.clear();
     m_lights.clear();
     m_materials.clear();
-    m_optLevel = oFull;
 }
 
 void LImporter::SetOptimizationLevel(LOptimizationLevel value)
@@ -1152,6 +2325,190 @@ LOptimizationLevel LImporter::GetOptimizationLevel()
     return m_optLevel;
 }
 
+// appends "size" bytes at the next 16 byte boundary and returns their offset
+
+static uint AppendCooked(std::vector<byte> &data, const void *src, uint size)
+{
+    uint offset = (data.size() + 15) & ~15;
+    data.resize(offset + size);
+    if ((src != 0) && (size > 0))
+        memcpy(&data[offset], src, size);
+    return offset;
+}
+
+static void CookName(char *dest, uint max_count, const char *src)
+{
+    size_t n = strlen(src);
+    if (n >= max_count)
+        n = max_count-1;
+    memset(dest, 0, max_count);
+    memcpy(dest, src, n);
+}
+
+static void CookMap(LCookedMap &dest, const LMap &map)
+{
+    CookName(dest.mapName, sizeof(dest.mapName), map.mapName);
+    dest.strength = map.strength;
+    dest.uScale = map.uScale;
+    dest.vScale = map.vScale;
+    dest.uOffset = map.uOffset;
+    dest.vOffset = map.vOffset;
+    dest.angle = map.angle;
+}
+
+bool LImporter::Cook(std::vector<byte> &data)
+{
+    LCookedHeader header;
+    uint i, j;
+    uint byteOrder = 0x01020304;
+    if (*(byte*)&byteOrder != 0x04)
+    {
+        ErrorMsg("LImporter::Cook - cooked files can only be written on little-endian machines");
+        return false;
+    }
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, "L3DC", 4);
+    header.byteOrder = byteOrder;
+    header.version = L3DC_VERSION;
+    header.meshCount = m_meshes.size();
+    header.materialCount = m_materials.size();
+
+    // the header and the tables come first, they're filled in at the end
+    std::vector<LCookedMesh> meshes(header.meshCount);
+    std::vector<LCookedMaterial> materials(header.materialCount);
+    data.clear();
+    AppendCooked(data, &header, sizeof(header));
+    header.meshOffset = AppendCooked(data, 0, header.meshCount*sizeof(LCookedMesh));
+    header.materialOffset = AppendCooked(data, 0, header.materialCount*sizeof(LCookedMaterial));
+
+    for (i=0; i<header.materialCount; i++)
+    {
+        LMaterial &mat = m_materials[i];
+        LCookedMaterial &cm = materials[i];
+        CookName(cm.name, sizeof(cm.name), mat.GetName().c_str());
+        cm.ambient = mat.GetAmbientColor();
+        cm.diffuse = mat.GetDiffuseColor();
+        cm.specular = mat.GetSpecularColor();
+        cm.shininess = mat.GetShininess();
+        cm.transparency = mat.GetTransparency();
+        cm.shading = mat.GetShadingType();
+        CookMap(cm.maps[0], mat.GetTextureMap1());
+        CookMap(cm.maps[1], mat.GetTextureMap2());
+        CookMap(cm.maps[2], mat.GetOpacityMap());
+        CookMap(cm.maps[3], mat.GetSpecularMap());
+        CookMap(cm.maps[4], mat.GetBumpMap());
+        CookMap(cm.maps[5], mat.GetReflectionMap());
+    }
+
+    std::vector<LCookedVertex> vertices;
+    std::vector<uint> indices;
+    std::vector<LCookedRange> ranges;
+    std::vector<uint> first;
+    for (i=0; i<header.meshCount; i++)
+    {
+        LMesh &mesh = GetMesh(i);
+        LCookedMesh &cm = meshes[i];
+        uint vcount = mesh.GetVertexCount();
+        uint tcount = mesh.GetTriangleCount();
+        memset(&cm, 0, sizeof(cm));
+        CookName(cm.name, sizeof(cm.name), mesh.GetName().c_str());
+
+        vertices.resize(vcount);
+        for (j=0; j<vcount; j++)
+        {
+            LCookedVertex &v = vertices[j];
+            v.position = mesh.GetVertex(j);
+            v.normal = mesh.GetNormal(j);
+            v.tangent = mesh.GetTangent(j);
+            v.binormal = mesh.GetBinormal(j);
+            v.uv = mesh.GetUV(j);
+            v.pad = 0;
+            const float *p = &v.position.x;
+            for (int k=0; k<3; k++)
+            {
+                if ((j == 0) || (p[k] < cm.boundsMin[k]))
+                    cm.boundsMin[k] = p[k];
+                if ((j == 0) || (p[k] > cm.boundsMax[k]))
+                    cm.boundsMax[k] = p[k];
+            }
+        }
+
+        // sort the triangles by material with a counting sort that keeps their order within
+        // a material, the last slot takes the triangles without a (valid) material
+        uint mcount = header.materialCount;
+        first.assign(mcount+2, 0);
+        for (j=0; j<tcount; j++)
+        {
+            uint m = mesh.GetTri(j).materialId;
+            first[(m < mcount ? m : mcount)+1]++;
+        }
+        ranges.clear();
+        for (j=0; j<=mcount; j++)
+        {
+            if (first[j+1] > 0)
+            {
+                LCookedRange r;
+                r.material = (j < mcount) ? j : L3DC_NO_MATERIAL;
+                r.firstIndex = 3*first[j];
+                r.indexCount = 3*first[j+1];
+                r.reserved = 0;
+                ranges.push_back(r);
+            }
+            first[j+1] += first[j];
+        }
+        indices.resize(3*tcount);
+        for (j=0; j<tcount; j++)
+        {
+            uint m = mesh.GetTri(j).materialId;
+            uint slot = 3*first[m < mcount ? m : mcount]++;
+            const LTriangle &tri = mesh.GetTriangle(j);
+            indices[slot] = tri.a;
+            indices[slot+1] = tri.b;
+            indices[slot+2] = tri.c;
+        }
+
+        cm.vertexCount = vcount;
+        cm.vertexOffset = AppendCooked(data, vcount ? &vertices[0] : 0, vcount*sizeof(LCookedVertex));
+        cm.indexCount = 3*tcount;
+        cm.indexOffset = AppendCooked(data, tcount ? &indices[0] : 0, 3*tcount*sizeof(uint));
+        cm.rangeCount = ranges.size();
+        cm.rangeOffset = AppendCooked(data, ranges.size() ? &ranges[0] : 0, ranges.size()*sizeof(LCookedRange));
+    }
+    AppendCooked(data, 0, 0);
+    header.fileSize = data.size();
+
+    memcpy(&data[0], &header, sizeof(header));
+    if (header.meshCount > 0)
+        memcpy(&data[header.meshOffset], &meshes[0], header.meshCount*sizeof(LCookedMesh));
+    if (header.materialCount > 0)
+        memcpy(&data[header.materialOffset], &materials[0], header.materialCount*sizeof(LCookedMaterial));
+    return true;
+}
+
+bool LImporter::SaveCooked(const char *filename)
+{
+    std::vector<byte> data;
+    if (!Cook(data))
+        return false;
+    // a scene that still maps the old file keeps reading the old data
+    remove(filename);
+    FILE *f = fopen(filename, "wb");
+    if (f == 0)
+    {
+        ErrorMsg("LImporter::SaveCooked - cannot create file");
+        return false;
+    }
+    bool res = (fwrite(&data[0], 1, data.size(), f) == data.size());
+    if (fclose(f) != 0)
+        res = false;
+    if (!res)
+    {
+        ErrorMsg("LImporter::SaveCooked - error writing to file");
+        remove(filename);
+    }
+    return res;
+}
+
 //-------------------------------------------------------
 // L3DS implementation
 //-------------------------------------------------------
@@ -1163,6 +2520,9 @@ L3DS::L3DS()
     m_bufferSize = 0;
     m_pos = 0;
     m_eof = false;
+    m_lazy = false;
+    m_map = 0;
+    m_mapSize = 0;
 } 
 
 L3DS::L3DS(const char *filename)
@@ -1172,56 +2532,135 @@ L3DS::L3DS(const char *filename)
     m_bufferSize = 0;
     m_pos = 0;
     m_eof = false;
+    m_lazy = false;
+    m_map = 0;
+    m_mapSize = 0;
     LoadFile(filename);
 }
 
 L3DS::~L3DS()
 {
-    if (m_bufferSize > 0)
-        free(m_buffer);
+    Clear();
+}
+
+void L3DS::Clear()
+{
+    LImporter::Clear();
+    m_directory.clear();
+    m_meshEntries.clear();
+    m_meshLoaded.clear();
+    if (m_map != 0)
+        UnmapFile(m_map, m_mapSize);
+    m_map = 0;
+    m_mapSize = 0;
+    m_buffer = 0;
+    m_bufferSize = 0;
 }
 
 bool L3DS::LoadFile(const char *filename)
 {
-    FILE *f;
-    f = fopen(filename, "rb");
-    if (f == 0)
+    uint size;
+    const void *data = MapFile(filename, size);
+    if (data == 0)
     {
-        ErrorMsg("L3DS::LoadFile - cannot open file");
+        ErrorMsg("L3DS::LoadFile - cannot read file");
         return false;
     }
-    fseek(f, 0, SEEK_END);
-    m_bufferSize = ftell(f);
-    fseek(f, 0, SEEK_SET);
-    m_buffer = (unsigned char*) calloc(m_bufferSize, 1);
-    if (m_buffer == 0)
+    bool res = LoadBuffer(data, size);
+    if (res && m_lazy)
     {
-        ErrorMsg("L3DS::LoadFile - not enough memory (malloc failed)");
-        return false;
+        // the meshes are read from the mapping later
+        m_map = data;
+        m_mapSize = size;
     }
-    if (fread(m_buffer, m_bufferSize, 1, f) != 1)
+    else
+        UnmapFile(data, size);
+    return res;
+}
+
+bool L3DS::LoadBuffer(const void *data, uint size)
+{
+    if ((data == 0) || (size == 0))
     {
-        fclose(f);
-        free(m_buffer);
-        m_bufferSize = 0;
-        ErrorMsg("L3DS::LoadFile - error reading from file");
+        ErrorMsg("L3DS::LoadBuffer - empty buffer");
         return false;
     }
-    fclose(f);
     Clear();
+    m_buffer = (const unsigned char*)data;
+    m_bufferSize = size;
+    m_pos = 0;
+    m_eof = false;
     bool res = Read3DS();
-    free(m_buffer);
-    m_buffer = 0;
-    m_bufferSize = 0;
+    if (!res || !m_lazy)
+    {
+        m_buffer = 0;
+        m_bufferSize = 0;
+    }
     return res;
 }
 
+void L3DS::SetLazyLoading(bool value)
+{
+    m_lazy = value;
+}
+
+bool L3DS::GetLazyLoading()
+{
+    return m_lazy;
+}
+
+LMesh& L3DS::GetMesh(uint index)
+{
+    if (!m_meshLoaded[index])
+        LoadMesh(index);
+    return m_meshes[index];
+}
+
+bool L3DS::IsMeshLoaded(uint index)
+{
+    return m_meshLoaded[index];
+}
+
+void L3DS::EvictMesh(uint index)
+{
+    // without the file the mesh couldn't be read again
+    if (m_buffer == 0)
+        return;
+    m_meshes[index].Clear();
+    m_meshLoaded[index] = false;
+}
+
+uint L3DS::GetDirectorySize()
+{
+    return m_directory.size();
+}
+
+const LDirectoryEntry& L3DS::GetDirectoryEntry(uint index)
+{
+    return m_directory[index];
+}
+
+void L3DS::LoadMesh(uint index)
+{
+    const LDirectoryEntry &entry = m_directory[m_meshEntries[index]];
+    LChunk chunk;
+    chunk.id = OBJ_TRIMESH;
+    chunk.start = entry.start;
+    chunk.end = entry.end;
+    m_meshLoaded[index] = true;
+    if (m_buffer == 0)
+        return;
+    m_eof = false;
+    ReadMesh(chunk, m_meshes[index]);
+    m_meshes[index].Optimize(m_optLevel);
+}
+
 short L3DS::ReadShort()
 {
     if ((m_buffer!=0) && (m_bufferSize != 0) && ((m_pos+2)<m_bufferSize))
     {
-        short *w = (short*)(m_buffer+m_pos);
-        short s = *w;//(short)*(m_buffer+m_pos);
+        short s;
+        memcpy(&s, m_buffer+m_pos, sizeof(s));
         m_pos += 2;
         return s;
     }
@@ -1233,8 +2672,8 @@ int L3DS::ReadInt()
 {
     if ((m_buffer!=0) && (m_bufferSize != 0) && ((m_pos+4)<m_bufferSize))
     {
-        int *w = (int*)(m_buffer+m_pos);
-        int s = *w;//(int)*(m_buffer+m_pos);
+        int s;
+        memcpy(&s, m_buffer+m_pos, sizeof(s));
         m_pos += 4;
         return s;
     }
@@ -1258,8 +2697,8 @@ float L3DS::ReadFloat()
 {
     if ((m_buffer!=0) && (m_bufferSize != 0) && ((m_pos+4)<m_bufferSize))
     {
-        float *w = (float*)(m_buffer+m_pos);
-        float s = *w;//(float)*(m_buffer+m_pos);
+        float s;
+        memcpy(&s, m_buffer+m_pos, sizeof(s));
         m_pos += 4;
         return s;
     }
@@ -1300,6 +2739,18 @@ int L3DS::ReadASCIIZ(char *buf, int max_count)
     return count;
 }
 
+const byte* L3DS::ReadBlock(uint size)
+{
+    if ((m_buffer!=0) && (m_pos<=m_bufferSize) && (size<=m_bufferSize-m_pos))
+    {
+        const byte *p = m_buffer+m_pos;
+        m_pos += size;
+        return p;
+    }
+    m_eof = true;
+    return 0;
+}
+
 void L3DS::Seek(int offset, int origin)
 {
     if (origin == SEEK_START)
@@ -1431,23 +2882,64 @@ bool L3DS::Read3DS()
     }
     GotoChunk(edit);
 
+    // build the directory of the objects; lights and cameras are small and read right away,
+    // the meshes only get their names
     obj.id = EDIT_OBJECT;
     {
         while (FindChunk(obj, edit))
         {
             ReadASCIIZ(m_objName, 99);
             ml = ReadChunk();
+            LDirectoryEntry entry;
+            entry.name = m_objName;
+            entry.start = ml.start;
+            entry.end = ml.end;
             if (ml.id == OBJ_TRIMESH)
-                ReadMesh(ml);
+            {
+                entry.type = otMesh;
+                entry.index = m_meshes.size();
+                m_meshEntries.push_back(m_directory.size());
+                m_meshes.push_back(LMesh());
+                m_meshes.back().SetName(m_objName);
+                m_directory.push_back(entry);
+            }
 			else
             if (ml.id == OBJ_LIGHT)
+            {
                 ReadLight(ml);
+                entry.type = otLight;
+                entry.index = m_lights.size()-1;
+                m_directory.push_back(entry);
+            }
 			else
             if (ml.id == OBJ_CAMERA)
+            {
                 ReadCamera(ml);
+                entry.type = otCamera;
+                entry.index = m_cameras.size()-1;
+                m_directory.push_back(entry);
+            }
             SkipChunk(obj);
         }
     }
+    m_meshLoaded.assign(m_meshes.size(), false);
+    if (m_lazy)
+    {
+        // nothing else to do until a mesh is asked for; the keyframer data isn't used yet, and
+        // reading it would read every mesh
+        strcpy(m_objName, "");
+        return true;
+    }
+    for (uint i=0; i<m_meshes.size(); i++)
+    {
+        const LDirectoryEntry &entry = m_directory[m_meshEntries[i]];
+        LChunk chunk;
+        chunk.id = OBJ_TRIMESH;
+        chunk.start = entry.start;
+        chunk.end = entry.end;
+        ReadMesh(chunk, m_meshes[i]);
+        m_meshLoaded[i] = true;
+    }
     
     // read the keyframer data here to find out correct object orientation
 
@@ -1468,7 +2960,12 @@ bool L3DS::Read3DS()
         }
     }
 
-    for (uint i=0; i<m_meshes.size(); i++)
+    // the meshes are independent; with a single mesh its own loops use the cores instead
+    int meshCount = m_meshes.size();
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic) if (meshCount > 1)
+#endif
+    for (int i=0; i<meshCount; i++)
         m_meshes[i].Optimize(m_optLevel);
     m_pos = 0;
     strcpy(m_objName, "");
@@ -1560,15 +3057,12 @@ void L3DS::ReadCamera(const LChunk &parent)
     m_cameras.push_back(camera);
 }
 
-void L3DS::ReadMesh(const LChunk &parent)
+void L3DS::ReadMesh(const LChunk &parent, LMesh &mesh)
 {
-    unsigned short count, i;
-    LVector4 p;
+    unsigned short count;
+    const byte *data;
     LMatrix4 m;
-    LVector2 t;
-    p.w = 1.0f;
-    LMesh mesh;
-    mesh.SetName(m_objName);
+    mesh.Clear();
     GotoChunk(parent);
     LChunk chunk = ReadChunk();
     while (chunk.end <= parent.end)
@@ -1578,24 +3072,17 @@ void L3DS::ReadMesh(const LChunk &parent)
         case TRI_VERTEXLIST:
             count = ReadShort();
             mesh.SetVertexArraySize(count);
-            for (i=0; i < count; i++)
-            {
-                p.x = ReadFloat();
-                p.y = ReadFloat();
-                p.z = ReadFloat();
-                mesh.SetVertex(p, i);
-            }
+            data = ReadBlock(count*3*sizeof(float));
+            if (data != 0)
+                mesh.SetVertices(data, count);
             break;
         case TRI_FACEMAPPING:
             count = ReadShort();
             if (mesh.GetVertexCount() == 0)
                 mesh.SetVertexArraySize(count);
-            for (i=0; i < count; i++)
-            {
-                t.x = ReadFloat();
-                t.y = ReadFloat();
-                mesh.SetUV(t, i);
-            }
+            data = ReadBlock(count*2*sizeof(float));
+            if (data != 0)
+                mesh.SetUVs(data, count);
             break;
         case TRI_FACELIST:
             ReadFaceList(chunk, mesh);
@@ -1632,7 +3119,6 @@ void L3DS::ReadMesh(const LChunk &parent)
             break;
         chunk = ReadChunk();
     }
-    m_meshes.push_back(mesh);
 }
 
 void L3DS::ReadFaceList(const LChunk &chunk, LMesh &mesh)
@@ -1640,6 +3126,8 @@ void L3DS::ReadFaceList(const LChunk &chunk, LMesh &mesh)
     // variables 
     unsigned short count, t;    
     uint i;
+    const byte *data;
+    unsigned short face[4];
     LTri tri;
     LChunk ch;
     char str[20];
@@ -1656,12 +3144,14 @@ void L3DS::ReadFaceList(const LChunk &chunk, LMesh &mesh)
     // read the number of faces
     count = ReadShort();
     mesh.SetTriangleArraySize(count);
-    for (i=0; i<count; i++)
+    data = ReadBlock(count*sizeof(face));
+    for (i=0; (data != 0) && (i<count); i++)
     {
-        tri.a = ReadShort();
-        tri.b = ReadShort();
-        tri.c = ReadShort();
-        ReadShort();
+        // a, b, c and the face flags
+        memcpy(face, data+i*sizeof(face), sizeof(face));
+        tri.a = face[0];
+        tri.b = face[1];
+        tri.c = face[2];
         mesh.SetTri(tri, i);
     }
     // now read the optional chunks
@@ -1676,15 +3166,22 @@ void L3DS::ReadFaceList(const LChunk &chunk, LMesh &mesh)
             mat_id = FindMaterial(str)->GetID();
             mesh.AddMaterial(mat_id);
             count = ReadShort();
-            for (i=0; i<count; i++) 
+            data = ReadBlock(count*sizeof(t));
+            for (i=0; (data != 0) && (i<count); i++) 
             {
-                t = ReadShort();
+                memcpy(&t, data+i*sizeof(t), sizeof(t));
                 mesh.GetTri(t).materialId = mat_id;
             }                
             break;
         case TRI_SMOOTH_GROUP:
-            for (i=0; i<mesh.GetTriangleCount(); i++)
-                mesh.GetTri(i).smoothingGroups = (ulong) ReadInt();
+            count = mesh.GetTriangleCount();
+            data = ReadBlock(count*sizeof(int));
+            for (i=0; (data != 0) && (i<count); i++)
+            {
+                int sg;
+                memcpy(&sg, data+i*sizeof(sg), sizeof(sg));
+                mesh.GetTri(i).smoothingGroups = (ulong) sg;
+            }
             break;
         }
         SkipChunk(ch);
@@ -1974,3 +3471,192 @@ long L3DS::ReadKeyheader()
     }
     return frame;
 }
+
+//-------------------------------------------------------
+// LCookedScene implementation
+//-------------------------------------------------------
+
+// the cooked structures are written as they are in memory
+typedef char LCookedVertexSize[sizeof(LCookedVertex) == 64 ? 1 : -1];
+typedef char LCookedMeshSize[sizeof(LCookedMesh) == 112 ? 1 : -1];
+typedef char LCookedMaterialSize[sizeof(LCookedMaterial) == 496 ? 1 : -1];
+typedef char LCookedHeaderSize[sizeof(LCookedHeader) == 32 ? 1 : -1];
+
+// true if "count" elements of "size" bytes at "offset" are inside a buffer of "bufferSize" bytes
+static bool CookedArray(uint offset, uint count, uint size, uint bufferSize)
+{
+    return ((offset & 3) == 0) && (offset <= bufferSize) && (count <= (bufferSize-offset)/size);
+}
+
+LCookedScene::LCookedScene()
+{
+    m_map = 0;
+    m_mapSize = 0;
+    Clear();
+}
+
+LCookedScene::LCookedScene(const char *filename)
+{
+    m_map = 0;
+    m_mapSize = 0;
+    Clear();
+    LoadFile(filename);
+}
+
+LCookedScene::~LCookedScene()
+{
+    Clear();
+}
+
+void LCookedScene::Clear()
+{
+    if (m_map != 0)
+        UnmapFile(m_map, m_mapSize);
+    m_map = 0;
+    m_mapSize = 0;
+    m_cooked.clear();
+    m_data = 0;
+    m_size = 0;
+}
+
+bool LCookedScene::LoadFile(const char *filename)
+{
+    uint size;
+    Clear();
+    const void *data = MapFile(filename, size);
+    if (data == 0)
+    {
+        ErrorMsg("LCookedScene::LoadFile - cannot read file");
+        return false;
+    }
+    if (!SetBuffer(data, size))
+    {
+        UnmapFile(data, size);
+        return false;
+    }
+    m_map = data;
+    m_mapSize = size;
+    return true;
+}
+
+bool LCookedScene::LoadFile(const char *filename, const char *source)
+{
+    struct stat cooked, original;
+    if ((stat(filename, &cooked) == 0) &&
+        ((stat(source, &original) != 0) || (cooked.st_mtime >= original.st_mtime)) &&
+        LoadFile(filename))
+        return true;
+    Clear();
+    L3DS scene;
+    scene.SetOptimizationLevel(oCache);
+    if (!scene.LoadFile(source))
+        return false;
+    if (scene.SaveCooked(filename) && LoadFile(filename))
+        return true;
+    // keep it in memory then
+    if (!scene.Cook(m_cooked))
+        return false;
+    return SetBuffer(&m_cooked[0], m_cooked.size());
+}
+
+bool LCookedScene::LoadBuffer(const void *data, uint size)
+{
+    Clear();
+    return SetBuffer(data, size);
+}
+
+bool LCookedScene::SetBuffer(const void *data, uint size)
+{
+    uint i, j;
+    const LCookedHeader *header = (const LCookedHeader*)data;
+    if ((data == 0) || (size < sizeof(LCookedHeader)) || ((size_t)data & 3))
+    {
+        ErrorMsg("LCookedScene::SetBuffer - no cooked scene in the buffer");
+        return false;
+    }
+    if ((memcmp(header->magic, "L3DC", 4) != 0) || (header->byteOrder != 0x01020304) ||
+        (header->version != L3DC_VERSION))
+    {
+        ErrorMsg("LCookedScene::SetBuffer - wrong file format or version");
+        return false;
+    }
+    // check every table and array once here, so that the accessors can hand out pointers
+    if ((header->fileSize > size) ||
+        !CookedArray(header->meshOffset, header->meshCount, sizeof(LCookedMesh), header->fileSize) ||
+        !CookedArray(header->materialOffset, header->materialCount, sizeof(LCookedMaterial), header->fileSize))
+    {
+        ErrorMsg("LCookedScene::SetBuffer - the file is truncated or damaged");
+        return false;
+    }
+    size = header->fileSize;
+    const byte *base = (const byte*)data;
+    const LCookedMesh *meshes = (const LCookedMesh*)(base + header->meshOffset);
+    const LCookedMaterial *materials = (const LCookedMaterial*)(base + header->materialOffset);
+    bool ok = true;
+    for (i=0; ok && (i<header->materialCount); i++)
+        ok = (materials[i].name[sizeof(materials[i].name)-1] == 0);
+    for (i=0; ok && (i<header->meshCount); i++)
+    {
+        const LCookedMesh &mesh = meshes[i];
+        ok = (mesh.name[sizeof(mesh.name)-1] == 0) && (mesh.indexCount % 3 == 0) &&
+             CookedArray(mesh.vertexOffset, mesh.vertexCount, sizeof(LCookedVertex), size) &&
+             CookedArray(mesh.indexOffset, mesh.indexCount, sizeof(uint), size) &&
+             CookedArray(mesh.rangeOffset, mesh.rangeCount, sizeof(LCookedRange), size);
+        const uint *indices = (const uint*)(base + mesh.indexOffset);
+        for (j=0; ok && (j<mesh.indexCount); j++)
+            ok = (indices[j] < mesh.vertexCount);
+        const LCookedRange *ranges = (const LCookedRange*)(base + mesh.rangeOffset);
+        for (j=0; ok && (j<mesh.rangeCount); j++)
+            ok = (ranges[j].firstIndex <= mesh.indexCount) &&
+                 (ranges[j].indexCount <= mesh.indexCount - ranges[j].firstIndex) &&
+                 ((ranges[j].material < header->materialCount) || (ranges[j].material == L3DC_NO_MATERIAL));
+    }
+    if (!ok)
+    {
+        ErrorMsg("LCookedScene::SetBuffer - the file is truncated or damaged");
+        return false;
+    }
+    m_data = base;
+    m_size = size;
+    return true;
+}
+
+const void* LCookedScene::At(uint offset)
+{
+    return m_data + offset;
+}
+
+uint LCookedScene::GetMeshCount()
+{
+    return m_data ? ((const LCookedHeader*)m_data)->meshCount : 0;
+}
+
+const LCookedMesh& LCookedScene::GetMesh(uint index)
+{
+    return ((const LCookedMesh*)At(((const LCookedHeader*)m_data)->meshOffset))[index];
+}
+
+const LCookedVertex* LCookedScene::GetVertices(uint index)
+{
+    return (const LCookedVertex*)At(GetMesh(index).vertexOffset);
+}
+
+const uint* LCookedScene::GetIndices(uint index)
+{
+    return (const uint*)At(GetMesh(index).indexOffset);
+}
+
+const LCookedRange* LCookedScene::GetRanges(uint index)
+{
+    return (const LCookedRange*)At(GetMesh(index).rangeOffset);
+}
+
+uint LCookedScene::GetMaterialCount()
+{
+    return m_data ? ((const LCookedHeader*)m_data)->materialCount : 0;
+}
+
+const LCookedMaterial& LCookedScene::GetMaterial(uint index)
+{
+    return ((const LCookedMaterial*)At(((const LCookedHeader*)m_data)->materialOffset))[index];
+}
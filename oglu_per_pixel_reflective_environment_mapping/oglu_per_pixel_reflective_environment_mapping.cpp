@@ -78,8 +78,8 @@ GLfloat g_fEye[3] = { 0.0f,  0.0f, 5.0f };
 GLfloat g_fRot[3] = { 0.0f, 45.0f, 0.0f };
 
 // 3DS objects
-L3DS skull, teapot, sphere;
-L3DS *obj;
+LCookedScene skull, teapot, sphere;
+LCookedScene *obj;
 GLuint g_uiCurrentObj = 1;
 
 // Cg parameters
@@ -554,10 +554,10 @@ void init( void ) {
 	cgGLSetOptimalOptions( cgVertexProfile );
 	cgGLSetOptimalOptions( cgFragmentProfile );
 
-	// Load 3DS models
-	skull.LoadFile( "skull.3ds" );
-	teapot.LoadFile( "teapot.3ds" );
-	sphere.LoadFile( "sphere.3ds" );
+	// Load 3DS models, cooked on the first run so later runs only map them
+	skull.LoadFile( "skull.l3c", "skull.3ds" );
+	teapot.LoadFile( "teapot.l3c", "teapot.3ds" );
+	sphere.LoadFile( "sphere.l3c", "sphere.3ds" );
 
 	// Register error callback
     cgSetErrorCallback( cgErrorCallback );
@@ -835,20 +835,20 @@ void drawtext( void ) {
 	glCallLists( 29, GL_UNSIGNED_BYTE, strFrameRate );
 
 	// Get mesh
-	LMesh &mesh = obj->GetMesh( 0 );
+	const LCookedMesh &mesh = obj->GetMesh( 0 );
 
 	// Draw vertex count
 	x = ww-200; y = wh-30;
 	glRasterPos2i( x, y );
 	ZeroMemory( string, 80 );
-	sprintf( string, "Vertex count:         %d  ", mesh.GetVertexCount() );
+	sprintf( string, "Vertex count:         %d  ", mesh.vertexCount );
 	glCallLists( 26, GL_UNSIGNED_BYTE, string );
 
 	// Draw triangle count
 	x = ww-200; y = wh-45;
 	glRasterPos2i( x, y );
 	ZeroMemory( string, 80 );
-	sprintf( string, "Triangle count:      %d  ", mesh.GetTriangleCount() );
+	sprintf( string, "Triangle count:      %d  ", mesh.indexCount/3 );
 	glCallLists( 25, GL_UNSIGNED_BYTE, string );
 
 	// Reconfigure OpenGL matrix stacks
@@ -869,7 +869,7 @@ void draw3DSObject( void ) {
 
 	for ( GLuint z=0; z < obj->GetMeshCount(); z++ ) {
 
-		LMesh &mesh = obj->GetMesh( z );
+		const LCookedVertex *vertices = obj->GetVertices( z );
 
 		// Set vertex arrays as vertex shader inputs
 		cgGLEnableClientState( cgNormal );
@@ -877,12 +877,12 @@ void draw3DSObject( void ) {
 		cgGLEnableClientState( cgTexcoords );
 
 		// Point to corresponding vertex arrays
-		cgGLSetParameterPointer( cgNormal,		3, GL_FLOAT, 0, &mesh.GetNormal( 0 ) );
-		cgGLSetParameterPointer( cgPosition,	4, GL_FLOAT, 0, &mesh.GetVertex( 0 ) );
-		cgGLSetParameterPointer( cgTexcoords,	2, GL_FLOAT, 0, &mesh.GetUV( 0 ) );
+		cgGLSetParameterPointer( cgNormal,		3, GL_FLOAT, sizeof( LCookedVertex ), &vertices->normal );
+		cgGLSetParameterPointer( cgPosition,	4, GL_FLOAT, sizeof( LCookedVertex ), &vertices->position );
+		cgGLSetParameterPointer( cgTexcoords,	2, GL_FLOAT, sizeof( LCookedVertex ), &vertices->uv );
 
 		// Draw primitives
-		glDrawElements( GL_TRIANGLES, mesh.GetTriangleCount()*3, GL_UNSIGNED_SHORT, &mesh.GetTriangle( 0 ) );
+		glDrawElements( GL_TRIANGLES, obj->GetMesh( z ).indexCount, GL_UNSIGNED_INT, obj->GetIndices( z ) );
 
 		cgGLDisableClientState( cgNormal );
 		cgGLDisableClientState( cgPosition );
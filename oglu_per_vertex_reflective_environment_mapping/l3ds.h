@@ -15,7 +15,10 @@ typedef unsigned char byte;
 
 enum LShading {sWireframe, sFlat, sGouraud, sPhong, sMetal};
 
-enum LOptimizationLevel {oNone, oSimple, oFull};
+// oCache does what oFull does on welded vertices, then reorders the mesh for the vertex caches
+enum LOptimizationLevel {oNone, oSimple, oFull, oCache};
+
+enum LObjectType {otMesh, otLight, otCamera};
 
 // for internal use
 struct LChunk;
@@ -91,6 +94,29 @@ struct LMap
     float angle;
 };
 
+// vertex cache statistics of a mesh, see LMesh::OptimizeVertexCache
+struct LCacheStats
+{
+    // the number of vertices as read and after the optimization
+    uint vertexCountBefore;
+    uint vertexCountAfter;
+    // the average cache miss ratio (vertices transformed per triangle) before and after
+    float acmrBefore;
+    float acmrAfter;
+};
+
+// an object of a 3ds file, see L3DS::GetDirectoryEntry
+struct LDirectoryEntry
+{
+    std::string name;
+    LObjectType type;
+    // the index of the object in the meshes, lights or cameras of the importer
+    uint index;
+    // the offsets of the object's mesh, light or camera chunk in the file
+    uint start;
+    uint end;
+};
+
 //------------------------------------------------
 
 class LObject
@@ -236,6 +262,10 @@ public:
     void SetTangent(const LVector3 &vec, uint index);
     // sets the binormal at a given index to "vec" - for internal use    
     void SetBinormal(const LVector3 &vec, uint index);
+    // copies "count" packed x, y, z float triples to the vertex array (w is set to 1) - for internal use
+    void SetVertices(const void *xyz, uint count);
+    // copies "count" packed u, v float pairs to the texture coordinates array - for internal use
+    void SetUVs(const void *uv, uint count);
     // returns the triangle with a given index
     const LTriangle& GetTriangle(uint index);
     // returns the triangle with a given index, see LTriangle2 structure description
@@ -256,6 +286,28 @@ public:
     uint AddMaterial(uint id);
     // returns the number of materials used in the mesh
     uint GetMaterialCount();
+    // welds the vertices whose attributes all lie within "tolerance" of each other (0 welds only
+    // identical ones), returns the number of vertices removed
+    uint WeldVertices(float tolerance);
+    // reorders the triangles for a post-transform vertex cache of "cacheSize" entries, with
+    // Tom Forsyth's linear-speed vertex cache optimisation
+    void ReorderTriangles(uint cacheSize);
+    // renumbers the vertices in the order the triangles first use them, so that they're fetched
+    // sequentially, vertices no triangle uses are dropped
+    void ReorderVertices();
+    // returns the average cache miss ratio of the triangles for a FIFO cache of "cacheSize" entries
+    float GetACMR(uint cacheSize);
+    // returns the statistics of the oCache optimization
+    const LCacheStats& GetCacheStats();
+    // writes a copy of the mesh with about "targetCount" triangles to "lod", simplified with
+    // quadric error metrics; UV seams, material and smoothing group boundaries and open borders
+    // are kept as they are. The normals and texture space of "lod" are calculated anew. Returns
+    // the geometric error of "lod", roughly how far it strays from the mesh in object units
+    float Simplify(uint targetCount, LMesh &lod);
+    // as Simplify, for each of "targets" triangles in turn (largest first) in one pass, adding a
+    // copy to "levels" and its error to "errors" each time
+    void SimplifyLevels(const std::vector<uint> &targets, std::vector<LMesh> &levels,
+                        std::vector<float> &errors);
 protected:
     // the vertices, normals, etc.
     std::vector<LVector4> m_vertices;
@@ -276,12 +328,106 @@ protected:
     // the material ID array
     std::vector<uint> m_materials;
 
+    // the vertex cache statistics
+    LCacheStats m_cacheStats;
+
+    // builds the vertex to triangle corner adjacency in compressed rows: the corners (3*triangle+corner)
+    // using vertex i are corners[first[i]] .. corners[first[i+1]-1], in increasing order
+    void BuildAdjacency(std::vector<uint> &first, std::vector<uint> &corners);
+    // gives every smoothing group around a vertex but the first one its own copy of the vertex
+    void SplitSmoothingGroups(const std::vector<uint> &first, const std::vector<uint> &corners);
     // calculates the normals, either using the smoothing groups information or not
     void CalcNormals(bool useSmoothingGroups);
     // calculates the texture(tangent) space for each vertex
     void CalcTextureSpace();
     // transforms the vertices by the mesh matrix
     void TransformVertices();
+    // welds, calculates the normals and the texture space and reorders the mesh for the caches
+    void OptimizeVertexCache(uint cacheSize);
+    // copies m_tris to m_triangles
+    void CopyTriangles();
+};
+
+//------------------------------------------------
+
+class LMeshLOD
+{
+public:
+    // the default constructor
+    LMeshLOD();
+    // the destructor
+    virtual ~LMeshLOD();
+    // clears the levels
+    void Clear();
+    // builds up to "maxLevels" levels of detail of "mesh", each with about "ratio" (between 0 and 1)
+    // times the triangles of the one before. Level 0 is the mesh itself; it stops early when a mesh
+    // won't get smaller or its error would be more than "maxError" times the bounding radius
+    void Build(LMesh &mesh, uint maxLevels, float ratio, float maxError);
+    // returns the number of levels
+    uint GetLevelCount();
+    // returns a level, 0 is the most detailed
+    LMesh& GetLevel(uint index);
+    // returns the geometric error of a level in object units
+    float GetError(uint index);
+    // returns the radius of the bounding sphere of the mesh
+    float GetRadius();
+    // returns the radius in pixels of the bounding sphere at a given distance from the eye, for a
+    // perspective projection with a vertical field of view of "fovy" degrees
+    float GetProjectedRadius(float distance, float fovy, uint viewportHeight);
+    // returns the coarsest level whose error stays within "maxPixelError" pixels on screen, when
+    // the bounding sphere is "projectedRadius" pixels big
+    uint SelectLevel(float projectedRadius, float maxPixelError);
+protected:
+    std::vector<LMesh> m_levels;
+    std::vector<float> m_errors;
+    float m_radius;
+};
+
+//------------------------------------------------
+
+// a cluster of neighbouring triangles of a mesh
+struct LMeshlet
+{
+    // the triangles are indices[firstIndex] .. indices[firstIndex+3*triangleCount-1]
+    uint firstIndex;
+    uint triangleCount;
+    // the bounding sphere
+    LVector3 centre;
+    float radius;
+    // the cone around the face normals: the axis, and the cosine and sine of the largest angle
+    // to it. coneCos is 0 when the normals are too far apart for the cone to be of any use
+    LVector3 coneAxis;
+    float coneCos;
+    float coneSin;
+};
+
+//------------------------------------------------
+
+class LMeshlets
+{
+public:
+    // the default constructor
+    LMeshlets();
+    // the destructor
+    virtual ~LMeshlets();
+    // clears the meshlets
+    void Clear();
+    // splits the triangles of "mesh" into meshlets of at most "maxTriangles" triangles each,
+    // growing each one over neighbouring triangles that face the same way
+    void Build(LMesh &mesh, uint maxTriangles);
+    // returns the number of meshlets
+    uint GetMeshletCount();
+    // returns a meshlet
+    const LMeshlet& GetMeshlet(uint index);
+    // writes the indices of the meshlets that may be visible to "indices" and returns their
+    // triangle count. "planes" are the frustum planes (a, b, c, d with a unit normal pointing
+    // inwards) and "eye" the eye position, both in the space of the mesh. With "backfaces" set,
+    // meshlets whose triangles all face away from the eye are left out as well
+    uint Cull(const float planes[6][4], const LVector3 &eye, bool backfaces, std::vector<uint> &indices);
+protected:
+    std::vector<LMeshlet> m_meshlets;
+    // the triangle corners, meshlet after meshlet
+    std::vector<uint> m_indices;
 };
 
 //------------------------------------------------
@@ -402,7 +548,7 @@ public:
 	// returns the number of cameras in the scene
 	uint GetCameraCount();
     // returns a pointer to a mesh
-    LMesh& GetMesh(uint index);
+    virtual LMesh& GetMesh(uint index);
     // returns a pointer to a camera at a given index
     LCamera& GetCamera(uint index);
     // returns a pointer to a light at a given index
@@ -422,6 +568,11 @@ public:
     void SetOptimizationLevel(LOptimizationLevel value);
     // returns the current optimization level
     LOptimizationLevel GetOptimizationLevel();
+    // writes the scene in the cooked format (see LCookedScene) to "data", returns false on
+    // big-endian machines, where the structures cannot be written as they are
+    bool Cook(std::vector<byte> &data);
+    // writes the scene in the cooked format to a file
+    bool SaveCooked(const char *filename);
 protected:
     // the cameras found in the scene
     std::vector<LCamera> m_cameras;
@@ -447,19 +598,53 @@ public:
     L3DS(const char *filename);
     // destructor
     virtual ~L3DS();
-    // load 3ds file 
+    // load 3ds file, the file is mapped into memory and read in place
     virtual bool LoadFile(const char *filename);
+    // load 3ds file from a buffer in memory (e.g. from a pack file), the buffer is not copied
+    bool LoadBuffer(const void *data, uint size);
+    // with lazy loading on, LoadFile and LoadBuffer only read the materials, lights and cameras and
+    // the directory of the objects; a mesh is read when GetMesh or FindMesh first return it. The file
+    // stays mapped (a buffer has to outlive the object then), and reading isn't thread safe
+    void SetLazyLoading(bool value);
+    // returns true if lazy loading is on
+    bool GetLazyLoading();
+    // returns a pointer to a mesh, reading it first if needed
+    virtual LMesh& GetMesh(uint index);
+    // returns true if the data of the mesh is in memory
+    bool IsMeshLoaded(uint index);
+    // frees the data of a lazily loaded mesh, it's read again when next used
+    void EvictMesh(uint index);
+    // returns the number of objects in the file
+    uint GetDirectorySize();
+    // returns an object of the file, in file order
+    const LDirectoryEntry& GetDirectoryEntry(uint index);
 protected:
     // used internally for reading
     char m_objName[100];
     // true if end of file is reached
     bool m_eof;
-    // buffer for loading, used for speedup
-    unsigned char *m_buffer;
+    // the data being read, either the mapped file or the buffer passed to LoadBuffer
+    const unsigned char *m_buffer;
     // the size of the buffer
     uint m_bufferSize;
     // the current cursor position in the buffer
     uint m_pos;
+    // the objects of the file
+    std::vector<LDirectoryEntry> m_directory;
+    // the directory entry of each mesh
+    std::vector<uint> m_meshEntries;
+    // true for the meshes that have been read
+    std::vector<bool> m_meshLoaded;
+    // true if the meshes are read on demand
+    bool m_lazy;
+    // the file mapping kept for lazy loading
+    const void *m_map;
+    uint m_mapSize;
+
+    // clears all data and releases the file
+    virtual void Clear();
+    // reads a mesh of the directory
+    void LoadMesh(uint index);
 
     // reads a short value from the buffer
     short ReadShort();
@@ -473,6 +658,8 @@ protected:
     byte ReadByte();
     //reads an asciiz string 
     int ReadASCIIZ(char *buf, int max_count);
+    // returns a pointer to the next "size" bytes and skips them, or 0 if the buffer is too short
+    const byte* ReadBlock(uint size);
     // seek wihtin the buffer
     void Seek(int offset, int origin);
     // returns the position of the cursor
@@ -497,8 +684,8 @@ protected:
     void ReadLight(const LChunk &parent);
 	// read a camera chunk 
 	void ReadCamera(const LChunk &parent);
-    // read a trimesh chunk
-    void ReadMesh(const LChunk &parent);
+    // read a trimesh chunk into a mesh
+    void ReadMesh(const LChunk &parent, LMesh &mesh);
     // reads the face list, face materials, smoothing groups... and fill rthe information into the mesh
     void ReadFaceList(const LChunk &chunk, LMesh &mesh);
     // reads the material
@@ -509,6 +696,149 @@ protected:
     void ReadKeyframeData(const LChunk &parent);
     // reads the keyheader structure from the current offset and returns the frame number
     long ReadKeyheader();
+private:
+    // the object may own a file mapping, so it can't be copied
+    L3DS(const L3DS&);
+    L3DS& operator=(const L3DS&);
+};
+
+//---------------------------------------------------------
+// the cooked format holds a scene after LImporter is done with it, laid out the way the
+// renderer uses it, so it can be drawn straight from the mapped file. Everything is
+// little-endian, offsets are from the start of the file and every array starts at a
+// 16 byte boundary.
+
+#define L3DC_VERSION        2
+// the range material of triangles without a material
+#define L3DC_NO_MATERIAL    0xFFFFFFFF
+
+// an interleaved vertex, 64 bytes
+struct LCookedVertex
+{
+    LVector4 position;
+    LVector3 normal;
+    LVector3 tangent;
+    LVector3 binormal;
+    LVector2 uv;
+    float pad;
+};
+
+// the triangles of a mesh that use one material, they're sorted by material
+struct LCookedRange
+{
+    uint material;
+    uint firstIndex;
+    uint indexCount;
+    uint reserved;
+};
+
+struct LCookedMesh
+{
+    char name[64];
+    float boundsMin[3];
+    float boundsMax[3];
+    // LCookedVertex[vertexCount]
+    uint vertexCount;
+    uint vertexOffset;
+    // uint[indexCount], three per triangle
+    uint indexCount;
+    uint indexOffset;
+    // LCookedRange[rangeCount]
+    uint rangeCount;
+    uint rangeOffset;
+};
+
+struct LCookedMap
+{
+    char mapName[40];
+    float strength;
+    float uScale;
+    float vScale;
+    float uOffset;
+    float vOffset;
+    float angle;
+};
+
+struct LCookedMaterial
+{
+    char name[64];
+    LColor3 ambient;
+    LColor3 diffuse;
+    LColor3 specular;
+    float shininess;
+    float transparency;
+    uint shading;
+    // texture map 1, texture map 2, opacity, specular, bump and reflection maps
+    LCookedMap maps[6];
+};
+
+struct LCookedHeader
+{
+    // "L3DC"
+    char magic[4];
+    // 0x01020304, tells a file from a big-endian machine
+    uint byteOrder;
+    uint version;
+    uint fileSize;
+    // LCookedMesh[meshCount]
+    uint meshCount;
+    uint meshOffset;
+    // LCookedMaterial[materialCount]
+    uint materialCount;
+    uint materialOffset;
+};
+
+//------------------------------------------------
+
+class LCookedScene
+{
+public:
+    // the default constructor
+    LCookedScene();
+    // constructs the object and loads the file
+    LCookedScene(const char *filename);
+    // the destructor unmaps the file
+    virtual ~LCookedScene();
+    // releases the data
+    void Clear();
+    // maps a cooked file and checks it, the data is used in place
+    bool LoadFile(const char *filename);
+    // loads a cooked file, cooking it from the 3ds file "source" first if it is missing, older than
+    // the source or from another version. If it cannot be written the scene is cooked in memory
+    bool LoadFile(const char *filename, const char *source);
+    // uses a cooked scene in memory, the buffer is not copied and has to outlive the object
+    bool LoadBuffer(const void *data, uint size);
+    // returns the number of meshes in the scene
+    uint GetMeshCount();
+    // returns a mesh
+    const LCookedMesh& GetMesh(uint index);
+    // returns the vertices of a mesh
+    const LCookedVertex* GetVertices(uint index);
+    // returns the triangle indices of a mesh
+    const uint* GetIndices(uint index);
+    // returns the material ranges of a mesh
+    const LCookedRange* GetRanges(uint index);
+    // returns the number of materials in the scene
+    uint GetMaterialCount();
+    // returns a material
+    const LCookedMaterial& GetMaterial(uint index);
+protected:
+    // the scene data
+    const unsigned char *m_data;
+    uint m_size;
+    // the file mapping, if the scene came from LoadFile
+    const void *m_map;
+    uint m_mapSize;
+    // the scene, if it was cooked in memory
+    std::vector<byte> m_cooked;
+
+    // checks the data and makes it the current scene
+    bool SetBuffer(const void *data, uint size);
+    // returns a pointer to an array of the data
+    const void* At(uint offset);
+private:
+    LCookedScene(const LCookedScene&);
+    LCookedScene& operator=(const LCookedScene&);
 };
 
 //---------------------------------------------------------
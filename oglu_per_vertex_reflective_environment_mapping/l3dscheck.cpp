@@ -0,0 +1,384 @@
+// l3dscheck.cpp
+// checks the levels of detail (LMeshLOD) and the meshlets (LMeshlets) of l3ds.cpp on a UV sphere
+// split between two materials and on the given 3ds files. Build and run it with
+//   g++ -O2 l3dscheck.cpp l3ds.cpp -o l3dscheck && ./l3dscheck Teapot.3ds skull.3ds sphere.3ds
+// it prints what it finds wrong and returns 1 if anything is
+
+#include "l3ds.h"
+#include <algorithm>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+static int failures = 0;
+
+static void Fail(const char *name, const char *what, uint level, uint count)
+{
+    printf("%s: level %u: %u %s\n", name, level, count, what);
+    failures++;
+}
+
+//-------------------------------------------------------
+// a 3ds file in memory
+//-------------------------------------------------------
+
+struct LWriter
+{
+    std::vector<byte> data;
+    std::vector<uint> open;
+
+    void Bytes(const void *p, uint size)
+    {
+        data.insert(data.end(), (const byte*)p, (const byte*)p + size);
+    }
+    void Short(unsigned short v) { Bytes(&v, sizeof(v)); }
+    void Int(uint v) { Bytes(&v, sizeof(v)); }
+    void Float(float v) { Bytes(&v, sizeof(v)); }
+    void String(const char *s) { Bytes(s, strlen(s)+1); }
+    // chunks nest; the length is filled in when the chunk ends
+    void Begin(unsigned short id)
+    {
+        open.push_back(data.size());
+        Short(id);
+        Int(0);
+    }
+    void End()
+    {
+        uint start = open.back(), length = data.size() - start;
+        open.pop_back();
+        memcpy(&data[start+2], &length, sizeof(length));
+    }
+};
+
+// a sphere of radius 1 with "slices" x "stacks" quads, the poles made of triangles. The texture
+// wraps around, so there's a seam of vertices doubled for their texture coordinates, and the
+// slices of the -x half use the second material, so there's a material boundary as well
+static void MakeSphere(uint slices, uint stacks, std::vector<byte> &file)
+{
+    const float pi = 3.14159265f;
+    LWriter w;
+    uint i, j;
+    w.Begin(0x4D4D);            // MAIN3DS
+    w.Begin(0x3D3D);            // EDIT3DS
+    const char *names[2] = {"front", "back"};
+    for (i=0; i<2; i++)
+    {
+        w.Begin(0xAFFF);        // MAT_ENTRY
+        w.Begin(0xA000);        // MAT_NAME
+        w.String(names[i]);
+        w.End();
+        w.End();
+    }
+    w.Begin(0x4000);            // EDIT_OBJECT
+    w.String("sphere");
+    w.Begin(0x4100);            // OBJ_TRIMESH
+    w.Begin(0x4110);            // TRI_VERTEXLIST
+    w.Short((unsigned short)((slices+1)*(stacks+1)));
+    for (j=0; j<=stacks; j++)
+        for (i=0; i<=slices; i++)
+        {
+            float theta = pi*j/stacks, phi = 2*pi*i/slices;
+            // the seam gets exactly the positions of the first slice
+            if (i == slices)
+                phi = 0;
+            w.Float(sinf(theta)*cosf(phi));
+            w.Float(sinf(theta)*sinf(phi));
+            w.Float(cosf(theta));
+        }
+    w.End();
+    w.Begin(0x4140);            // TRI_FACEMAPPING
+    w.Short((unsigned short)((slices+1)*(stacks+1)));
+    for (j=0; j<=stacks; j++)
+        for (i=0; i<=slices; i++)
+        {
+            w.Float((float)i/slices);
+            w.Float(1 - (float)j/stacks);
+        }
+    w.End();
+    std::vector<unsigned short> faces, groups[2];
+    for (j=0; j<stacks; j++)
+        for (i=0; i<slices; i++)
+        {
+            unsigned short a = (unsigned short)(j*(slices+1) + i), b = a + 1;
+            unsigned short c = (unsigned short)(a + slices + 1), d = c + 1;
+            uint group = (i >= slices/4) && (i < 3*slices/4);
+            if (j > 0)
+            {
+                groups[group].push_back((unsigned short)(faces.size()/3));
+                faces.push_back(a); faces.push_back(c); faces.push_back(b);
+            }
+            if (j < stacks-1)
+            {
+                groups[group].push_back((unsigned short)(faces.size()/3));
+                faces.push_back(b); faces.push_back(c); faces.push_back(d);
+            }
+        }
+    w.Begin(0x4120);            // TRI_FACELIST
+    w.Short((unsigned short)(faces.size()/3));
+    for (i=0; i<faces.size(); i+=3)
+    {
+        w.Short(faces[i]);
+        w.Short(faces[i+1]);
+        w.Short(faces[i+2]);
+        w.Short(0);
+    }
+    for (i=0; i<2; i++)
+    {
+        w.Begin(0x4130);        // TRI_MAT_GROUP
+        w.String(names[i]);
+        w.Short((unsigned short)groups[i].size());
+        for (j=0; j<groups[i].size(); j++)
+            w.Short(groups[i][j]);
+        w.End();
+    }
+    w.Begin(0x4150);            // TRI_SMOOTH_GROUP
+    for (i=0; i<faces.size()/3; i++)
+        w.Int(1);
+    w.End();
+    w.End();
+    w.End();
+    w.End();
+    w.End();
+    w.End();
+    file.swap(w.data);
+}
+
+//-------------------------------------------------------
+// the checks
+//-------------------------------------------------------
+
+static LVector3 Sub(const LVector4 &a, const LVector4 &b)
+{
+    LVector3 r = {a.x-b.x, a.y-b.y, a.z-b.z};
+    return r;
+}
+
+static LVector3 Cross(const LVector3 &a, const LVector3 &b)
+{
+    LVector3 r = {a.y*b.z - a.z*b.y, a.z*b.x - a.x*b.z, a.x*b.y - a.y*b.x};
+    return r;
+}
+
+static float Dot(const LVector3 &a, const LVector3 &b)
+{
+    return a.x*b.x + a.y*b.y + a.z*b.z;
+}
+
+static bool Finite(const LVector3 &v)
+{
+    // false for NaNs as well
+    return (fabs(v.x) < 1e30f) && (fabs(v.y) < 1e30f) && (fabs(v.z) < 1e30f);
+}
+
+static LVector3 FaceNormal(LMesh &mesh, const LTriangle &t)
+{
+    return Cross(Sub(mesh.GetVertex(t.b), mesh.GetVertex(t.a)), Sub(mesh.GetVertex(t.c), mesh.GetVertex(t.a)));
+}
+
+static float UVArea(LMesh &mesh, const LTriangle &t)
+{
+    const LVector2 &a = mesh.GetUV(t.a), &b = mesh.GetUV(t.b), &c = mesh.GetUV(t.c);
+    return (b.x-a.x)*(c.y-a.y) - (b.y-a.y)*(c.x-a.x);
+}
+
+// "convex" says the mesh is convex around the origin, so every face has to point away from it.
+// The levels may not have more triangles without area (in space or in texture space) than the
+// mesh has
+static void CheckLevels(const char *name, LMesh &mesh, bool convex)
+{
+    LMeshLOD lod;
+    lod.Build(mesh, 6, 0.5f, 0.1f);
+    if (lod.GetLevelCount() == 0)
+        Fail(name, "levels", 0, 0);
+    uint flatBefore = 0, flatUVBefore = 0;
+    for (uint l=0; l<lod.GetLevelCount(); l++)
+    {
+        LMesh &level = lod.GetLevel(l);
+        uint i, nans = 0, flat = 0, flatUV = 0, flipped = 0;
+        for (i=0; i<level.GetVertexCount(); i++)
+            if (!Finite(level.GetNormal(i)) || !Finite(level.GetTangent(i)) || !Finite(level.GetBinormal(i)))
+                nans++;
+        for (i=0; i<level.GetTriangleCount(); i++)
+        {
+            const LTriangle &t = level.GetTriangle(i);
+            LVector3 n = FaceNormal(level, t);
+            const LVector4 &a = level.GetVertex(t.a);
+            LVector3 centre = {a.x, a.y, a.z};
+            if (!(Dot(n, n) > 0))
+                flat++;
+            else if (convex && !(Dot(n, centre) > 0))
+                flipped++;
+            if (UVArea(level, t) == 0)
+                flatUV++;
+        }
+        if (l == 0)
+        {
+            flatBefore = flat;
+            flatUVBefore = flatUV;
+        }
+        if (nans > 0)
+            Fail(name, "vertices with a NaN normal, tangent or binormal", l, nans);
+        if (flat > flatBefore)
+            Fail(name, "more triangles without area", l, flat - flatBefore);
+        if (flatUV > flatUVBefore)
+            Fail(name, "more triangles without area in texture space", l, flatUV - flatUVBefore);
+        if (flipped > 0)
+            Fail(name, "triangles facing inwards", l, flipped);
+        if ((l > 0) && (lod.GetError(l) < lod.GetError(l-1)))
+            Fail(name, "error smaller than the level before", l, 1);
+        if (lod.GetError(l) > lod.GetRadius())
+            Fail(name, "error larger than the mesh", l, 1);
+        printf("%s: level %u: %u triangles, error %g\n", name, l, level.GetTriangleCount(), lod.GetError(l));
+    }
+}
+
+struct LTriKey
+{
+    uint v[3];
+    bool operator<(const LTriKey &other) const
+    {
+        return std::lexicographical_compare(v, v+3, other.v, other.v+3);
+    }
+    bool operator==(const LTriKey &other) const
+    {
+        return (v[0] == other.v[0]) && (v[1] == other.v[1]) && (v[2] == other.v[2]);
+    }
+};
+
+static LTriKey Key(uint a, uint b, uint c)
+{
+    LTriKey k = {{a, b, c}};
+    return k;
+}
+
+static void CheckMeshlets(const char *name, LMesh &mesh)
+{
+    const uint maxTriangles = 64;
+    LMeshlets meshlets;
+    meshlets.Build(mesh, maxTriangles);
+    uint i, j, count = mesh.GetTriangleCount();
+
+    // every triangle, in exactly one meshlet
+    std::vector<LTriKey> all;
+    for (i=0; i<count; i++)
+    {
+        const LTriangle &t = mesh.GetTriangle(i);
+        all.push_back(Key(t.a, t.b, t.c));
+    }
+    std::sort(all.begin(), all.end());
+    std::vector<uint> indices;
+    float everything[6][4] = {{1, 0, 0, 1e6f}, {-1, 0, 0, 1e6f}, {0, 1, 0, 1e6f},
+                              {0, -1, 0, 1e6f}, {0, 0, 1, 1e6f}, {0, 0, -1, 1e6f}};
+    LVector3 origin = {0, 0, 0};
+    uint culled = meshlets.Cull(everything, origin, false, indices);
+    std::vector<LTriKey> got;
+    for (i=0; i<culled; i++)
+        got.push_back(Key(indices[3*i], indices[3*i+1], indices[3*i+2]));
+    std::sort(got.begin(), got.end());
+    if (!(got == all))
+        Fail(name, "triangles covered other than once", 0, count);
+    for (i=0; i<meshlets.GetMeshletCount(); i++)
+        if (meshlets.GetMeshlet(i).triangleCount > maxTriangles)
+            Fail(name, "triangles in an oversized meshlet", 0, meshlets.GetMeshlet(i).triangleCount);
+
+    // from all around, every triangle facing the eye has to stay, and every triangle inside the
+    // frustum of a view along -z
+    float radius = 0;
+    for (i=0; i<mesh.GetVertexCount(); i++)
+    {
+        const LVector4 &p = mesh.GetVertex(i);
+        radius = std::max(radius, sqrtf(p.x*p.x + p.y*p.y + p.z*p.z));
+    }
+    uint lost = 0;
+    srand(1);
+    for (int view=0; view<100; view++)
+    {
+        LVector3 eye;
+        do
+        {
+            eye.x = 2.0f*rand()/RAND_MAX - 1;
+            eye.y = 2.0f*rand()/RAND_MAX - 1;
+            eye.z = 2.0f*rand()/RAND_MAX - 1;
+        } while ((Dot(eye, eye) > 1) || (Dot(eye, eye) < 0.01f));
+        float scale = radius*(1.5f + 3.0f*rand()/RAND_MAX)/sqrtf(Dot(eye, eye));
+        eye.x *= scale;
+        eye.y *= scale;
+        eye.z *= scale;
+        // a 90 degree frustum looking along -z, moved to the eye, which leaves part of the mesh out
+        float planes[6][4] = {{1, 0, -1, 0}, {-1, 0, -1, 0}, {0, 1, -1, 0},
+                              {0, -1, -1, 0}, {0, 0, -1, 0}, {0, 0, 1, 1e6f}};
+        for (j=0; j<6; j++)
+        {
+            float len = sqrtf(planes[j][0]*planes[j][0] + planes[j][1]*planes[j][1] + planes[j][2]*planes[j][2]);
+            for (uint k=0; k<3; k++)
+                planes[j][k] /= len;
+            planes[j][3] = planes[j][3]/len - (planes[j][0]*eye.x + planes[j][1]*eye.y + planes[j][2]*eye.z);
+        }
+        for (int backfaces=0; backfaces<2; backfaces++)
+        {
+            float (*used)[4] = backfaces ? everything : planes;
+            culled = meshlets.Cull(used, eye, backfaces != 0, indices);
+            got.clear();
+            for (i=0; i<culled; i++)
+                got.push_back(Key(indices[3*i], indices[3*i+1], indices[3*i+2]));
+            std::sort(got.begin(), got.end());
+            for (i=0; i<count; i++)
+            {
+                const LTriangle &t = mesh.GetTriangle(i);
+                const LVector4 *p[3] = {&mesh.GetVertex(t.a), &mesh.GetVertex(t.b), &mesh.GetVertex(t.c)};
+                bool wanted = true;
+                if (backfaces)
+                {
+                    LVector4 e = {eye.x, eye.y, eye.z, 1};
+                    wanted = Dot(FaceNormal(mesh, t), Sub(e, *p[0])) > 0;
+                }
+                else
+                    for (j=0; wanted && (j<6); j++)
+                        for (uint k=0; wanted && (k<3); k++)
+                            wanted = planes[j][0]*p[k]->x + planes[j][1]*p[k]->y + planes[j][2]*p[k]->z + planes[j][3] > 0;
+                if (wanted && !std::binary_search(got.begin(), got.end(), Key(t.a, t.b, t.c)))
+                    lost++;
+            }
+        }
+    }
+    if (lost > 0)
+        Fail(name, "visible triangles culled", 0, lost);
+    printf("%s: %u meshlets\n", name, meshlets.GetMeshletCount());
+}
+
+int main(int argc, char **argv)
+{
+    std::vector<byte> sphere;
+    MakeSphere(64, 32, sphere);
+    L3DS scene;
+    if (!scene.LoadBuffer(&sphere[0], sphere.size()) || (scene.GetMeshCount() != 1))
+        Fail("uv sphere", "meshes", 0, 0);
+    else
+    {
+        CheckLevels("uv sphere", scene.GetMesh(0), true);
+        CheckMeshlets("uv sphere", scene.GetMesh(0));
+    }
+    for (int i=1; i<argc; i++)
+    {
+        L3DS file;
+        if (!file.LoadFile(argv[i]))
+        {
+            Fail(argv[i], "meshes", 0, 0);
+            continue;
+        }
+        for (uint m=0; m<file.GetMeshCount(); m++)
+        {
+            CheckLevels(argv[i], file.GetMesh(m), false);
+            CheckMeshlets(argv[i], file.GetMesh(m));
+        }
+    }
+    if (failures > 0)
+    {
+        printf("%d checks failed\n", failures);
+        return 1;
+    }
+    printf("all checks passed\n");
+    return 0;
+}
@@ -102,8 +102,8 @@ GLfloat g_fEye[3] = { 0.0f,  0.0f, 5.0f };
 GLfloat g_fRot[3] = { 0.0f, 45.0f, 0.0f };
 
 // 3DS objects
-L3DS quad, teapot, sphere;
-L3DS *obj;
+LCookedScene quad, teapot, sphere;
+LCookedScene *obj;
 GLuint g_uiCurrentObj = 1;
 
 // Cg parameters
@@ -676,10 +676,10 @@ void init( void ) {
 	cgGLSetOptimalOptions( cgVertexProfile );
 	cgGLSetOptimalOptions( cgFragmentProfile );
 
-	// Load 3DS models
-	quad.LoadFile( "quad.3ds" );
-	teapot.LoadFile( "teapot.3ds" );
-	sphere.LoadFile( "sphere.3ds" );
+	// Load 3DS models, cooked on the first run so later runs only map them
+	quad.LoadFile( "quad.l3c", "quad.3ds" );
+	teapot.LoadFile( "teapot.l3c", "teapot.3ds" );
+	sphere.LoadFile( "sphere.l3c", "sphere.3ds" );
 
 	// Register error callback
     cgSetErrorCallback( cgErrorCallback );
@@ -983,20 +983,20 @@ void drawtext( void ) {
 	glCallLists( 31, GL_UNSIGNED_BYTE, string );
 
 	// Get mesh
-	LMesh &mesh = obj->GetMesh( 0 );
+	const LCookedMesh &mesh = obj->GetMesh( 0 );
 	
 	// Draw vertex count
 	x = ww-200; y = wh-60;
 	glRasterPos2i( x, y );
 	ZeroMemory( string, 80 );
-	sprintf( string, "Vertex count:         %d  ", mesh.GetVertexCount() );
+	sprintf( string, "Vertex count:         %d  ", mesh.vertexCount );
 	glCallLists( 26, GL_UNSIGNED_BYTE, string );
 	
 	// Draw triangle count
 	x = ww-200; y = wh-75;
 	glRasterPos2i( x, y );
 	ZeroMemory( string, 80 );
-	sprintf( string, "Triangle count:      %d  ", mesh.GetTriangleCount() );
+	sprintf( string, "Triangle count:      %d  ", mesh.indexCount/3 );
 	glCallLists( 25, GL_UNSIGNED_BYTE, string );
 
 	// Draw fragment color mode
@@ -1027,7 +1027,7 @@ void draw3DSObject( void ) {
 
 	for ( GLuint z=0; z < obj->GetMeshCount(); z++ ) {
 
-		LMesh &mesh = obj->GetMesh( z );
+		const LCookedVertex *vertices = obj->GetVertices( z );
 
 		// Set vertex shader inputs:
 		// Model must supply tangent, binormal and normal data per vertex which
@@ -1040,14 +1040,14 @@ void draw3DSObject( void ) {
 		cgGLEnableClientState( cgTexcoords );
 
 		// Point to corresponding vertex arrays
-		cgGLSetParameterPointer( cgNormal,		3, GL_FLOAT, 0, &mesh.GetNormal( 0 ) );
-		cgGLSetParameterPointer( cgPosition,	4, GL_FLOAT, 0, &mesh.GetVertex( 0 ) );
-		cgGLSetParameterPointer( cgBinormal,	3, GL_FLOAT, 0, &mesh.GetBinormal( 0 ) );
-		cgGLSetParameterPointer( cgTangent,		3, GL_FLOAT, 0, &mesh.GetTangent( 0 ) );
-		cgGLSetParameterPointer( cgTexcoords,	2, GL_FLOAT, 0, &mesh.GetUV( 0 ) );
+		cgGLSetParameterPointer( cgNormal,		3, GL_FLOAT, sizeof( LCookedVertex ), &vertices->normal );
+		cgGLSetParameterPointer( cgPosition,	4, GL_FLOAT, sizeof( LCookedVertex ), &vertices->position );
+		cgGLSetParameterPointer( cgBinormal,	3, GL_FLOAT, sizeof( LCookedVertex ), &vertices->binormal );
+		cgGLSetParameterPointer( cgTangent,		3, GL_FLOAT, sizeof( LCookedVertex ), &vertices->tangent );
+		cgGLSetParameterPointer( cgTexcoords,	2, GL_FLOAT, sizeof( LCookedVertex ), &vertices->uv );
 
 		// Draw primitives
-		glDrawElements( GL_TRIANGLES, mesh.GetTriangleCount()*3, GL_UNSIGNED_SHORT, &mesh.GetTriangle( 0 ) );
+		glDrawElements( GL_TRIANGLES, obj->GetMesh( z ).indexCount, GL_UNSIGNED_INT, obj->GetIndices( z ) );
 
 		cgGLDisableClientState( cgNormal );
 		cgGLDisableClientState( cgPosition );